@@ -0,0 +1,42 @@
+#ifndef _AUDIO_INPUT_H_
+#define _AUDIO_INPUT_H_
+
+#include <midi_types.h>
+#include "PitchDetector.h"
+
+// I2S MEMS microphone (INMP441, SPH0645...), left channel
+#define AUDIO_I2S_PORT 0
+#define AUDIO_TASK_PRIORITY 1
+#define AUDIO_TASK_STACK_SIZE 4096
+// Notes waiting for loop(), the detector sends at most 2 packets per note and per block.
+// AUDIO_MAX_NOTES of them are kept for the note offs
+#define AUDIO_QUEUE_LENGTH (4 * AUDIO_MAX_NOTES)
+
+/**
+ * Notes played on an acoustic piano, heard through an I2S microphone.
+ * The I2S driver fills two DMA buffers of one block each: while the task analyzes a block,
+ * the next one is being received. Detected notes are queued by the task and sent to
+ * the callback from loop(), on the same task as the other MIDI inputs.
+ */
+class AudioInput {
+  public:
+    AudioInput();
+    ~AudioInput();
+    void setMidiInCallback(midi_in_callback_t *);
+    // Magnitude a note needs to start, see PitchDetector
+    void setThreshold(uint32_t magnitude);
+    // Use this in setup(), return false if the microphone can't be started
+    bool setup(int bck_pin, int ws_pin, int data_pin);
+    // Call this in loop(), sends the notes detected since the last call
+    void loop();
+    // Microseconds spent on the last block by the analysis
+    uint32_t getProcessTime();
+
+  private:
+    midi_in_callback_t *midiInCallback = NULL;
+    PitchDetector detector;
+    volatile uint32_t process_time_us = 0;
+    static void task(void*);
+};
+
+#endif /* _AUDIO_INPUT_H_ */
@@ -0,0 +1,32 @@
+#ifndef _BENCHMARK_WORKLOADS_H_
+#define _BENCHMARK_WORKLOADS_H_
+
+#include <cstddef>
+#include <midi_types.h>
+
+/**
+ * Synthetic MIDI streams shared by the host benchmarks and the on-device benchmark.
+ * Workloads are deterministic so results can be compared between commits.
+ */
+
+typedef enum {
+  BENCH_WORKLOAD_SCALES = 0,
+  BENCH_WORKLOAD_DENSE_CHORDS,
+  BENCH_WORKLOAD_GLISSANDI,
+  BENCH_WORKLOAD_PEDAL_STORM,
+  BENCH_WORKLOAD_MULTI_DEVICE,
+  BENCH_WORKLOAD_COUNT,
+} bench_workload_t;
+
+// Enough room for the biggest workload
+#define BENCH_WORKLOAD_MAX_EVENTS 4096
+
+const char* getBenchWorkloadName(bench_workload_t workload);
+
+/**
+ * Fill out with the events of a workload, sorted by time.
+ * @return number of events written, at most capacity
+ */
+size_t generateBenchWorkload(bench_workload_t workload, timed_midi_packet* out, size_t capacity);
+
+#endif /* _BENCHMARK_WORKLOADS_H_ */
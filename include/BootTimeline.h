@@ -0,0 +1,37 @@
+#ifndef _BOOT_TIMELINE_H_
+#define _BOOT_TIMELINE_H_
+
+#include <atomic>
+#include <cstdint>
+
+/// Types ///
+
+typedef enum : uint8_t {
+  BOOT_PHASE_SETUP = 0,   // setup() entered
+  BOOT_PHASE_LEDS_READY,  // The strip can light notes
+  BOOT_PHASE_USB_READY,   // The USB host waits for the keyboard
+  BOOT_PHASE_WIFI_READY,  // Connected, or access point started
+  BOOT_PHASE_SERVER_READY,
+  BOOT_PHASE_FIRST_NOTE,  // First note lit, whatever its input
+  BOOT_PHASE_COUNT,
+} boot_phase_t;
+
+/**
+ * Time each boot phase was reached, in us since the start of the firmware.
+ * Phases are marked from several tasks: the network comes up in the background.
+ */
+class BootTimeline {
+  public:
+    BootTimeline();
+    // Only the first mark of a phase is kept
+    void mark(boot_phase_t, uint32_t now_us);
+    bool isReached(boot_phase_t);
+    // 0 when the phase has not been reached
+    uint32_t getTime(boot_phase_t);
+    static const char* getPhaseName(boot_phase_t);
+
+  private:
+    std::atomic<uint32_t> times[BOOT_PHASE_COUNT];
+};
+
+#endif /* _BOOT_TIMELINE_H_ */
@@ -0,0 +1,59 @@
+#ifndef _COMPOSITOR_H_
+#define _COMPOSITOR_H_
+
+#include <cstdint>
+#include "MemoryArena.h"
+
+/// Types ///
+
+// Bottom to top
+typedef enum : uint8_t {
+  LAYER_BACKGROUND = 0, // Ambience under the notes
+  LAYER_GUIDE,          // Notes to play next in learning mode, see LearningSession
+  LAYER_NOTES,
+  LAYER_PARTICLES,
+  LAYER_SCRIPT,         // User effect script, see EffectVm
+  LAYER_OVERLAY,        // Sustain sides and indicators
+  LAYER_COUNT,
+} layer_id_t;
+
+typedef enum : uint8_t {
+  BLEND_ADD = 0,  // Saturating sum
+  BLEND_MAX,      // Brightest channel
+  BLEND_ALPHA,    // Lit pixels cover the layers below by the opacity, black pixels are transparent
+  BLEND_MULTIPLY, // Darken the layers below, white keeps them unchanged
+} blend_mode_t;
+
+/**
+ * Stack of packed RGB layers blended into the frame, bottom to top.
+ * Each layer is drawn on its own, so a layer going dark never erases what the others drew.
+ * Blending runs channel by channel over whole buffers, in loops the compiler can vectorize.
+ * Disabled layers are skipped.
+ */
+class Compositor {
+  public:
+    // Layers are allocated in memory when given
+    Compositor(uint16_t pixel_count, MemoryArena* memory = NULL);
+    ~Compositor();
+    uint8_t* getLayer(layer_id_t);
+    void clearLayer(layer_id_t);
+    void setBlendMode(layer_id_t, blend_mode_t);
+    blend_mode_t getBlendMode(layer_id_t);
+    // 255 is opaque
+    void setOpacity(layer_id_t, uint8_t);
+    uint8_t getOpacity(layer_id_t);
+    void setEnabled(layer_id_t, bool);
+    bool isEnabled(layer_id_t);
+    // Overwrite frame with the blend of the enabled layers
+    void compose(uint8_t* frame);
+
+  private:
+    uint16_t size;
+    MemoryArena* memory;
+    uint8_t* layers[LAYER_COUNT];
+    blend_mode_t modes[LAYER_COUNT];
+    uint8_t opacities[LAYER_COUNT];
+    bool enabled[LAYER_COUNT];
+};
+
+#endif /* _COMPOSITOR_H_ */
@@ -1,29 +1,100 @@
 #ifndef _CONFIG_SERVER_H_
 #define _CONFIG_SERVER_H_
 
+#include <atomic>
 #include <WebServer.h>
+#include <WebSocketsServer.h>
+#include "BootTimeline.h"
+#include "TraceRecorder.h"
+#include "MemoryArena.h"
 #include "LedController.h"
+#include "DeviceBenchmark.h"
+#include "MidiFilePlayer.h"
+#include "MidiRecorder.h"
+#include "UsbMidiHost.h"
+#include "settings_protocol.h"
+
+#define SETTINGS_WEBSOCKET_PORT 81
+// WiFi and the web server are started by this task, so that the keyboard doesn't wait for them
+#define NETWORK_TASK_STACK_SIZE 8192
+#define NETWORK_TASK_PRIORITY 1
 
 class ConfigServer {
   public:
     // @param webserver_mode 0: inactive, WIFI_MODE_STA or WIFI_MODE_AP
     ConfigServer(LedController* led, uint8_t webserver_mode = 0);
     ~ConfigServer();
+    // Connect and start the server in the background, returns right away
     void setup();
     void loop();
+    // True once WiFi is up and the server started
+    bool isReady();
+    void setBenchmark(DeviceBenchmark*);
+    void setFilePlayer(MidiFilePlayer*);
+    void setRecorder(MidiRecorder*);
+    void setBootTimeline(BootTimeline*);
+    void setTraceRecorder(TraceRecorder*);
+    void setUsbHost(UsbMidiHost*);
+    void setMemoryArenas(MemoryArena* internal, MemoryArena* psram);
+    // Free heap once everything is allocated, GET /memory reports the drift from it
+    void markSteadyState();
     
   private:
     WebServer* server;
+    // Binary settings updates, see settings_protocol.h
+    WebSocketsServer* websocket;
+    uint8_t settings_body[SETTINGS_MAX_MESSAGE_SIZE];
+    size_t settings_body_length = 0;
     LedController* led_controller;
+    DeviceBenchmark* benchmark = NULL;
+    MidiFilePlayer* file_player = NULL;
+    MidiRecorder* recorder = NULL;
+    BootTimeline* boot_timeline = NULL;
+    TraceRecorder* tracer = NULL;
+    UsbMidiHost* usb_host = NULL;
+    MemoryArena* internal_memory = NULL;
+    MemoryArena* psram_memory = NULL;
+    size_t steady_internal_free = 0;
+    size_t steady_psram_free = 0;
+    std::atomic<bool> ready{false};
     // 0: inactive, WIFI_MODE_STA or WIFI_MODE_AP
     uint8_t mode;
     void startApMode();
     void startStaMode();
     void startServer();
+    void markBootPhase(boot_phase_t);
+    static void networkTask(void*);
     void onConnect();
     void onPostColor();
     void onPostBrightness();
     void onPostShowSustain();
+    void onGetSettings();
+    void onGetPresets();
+    void onGetHarmony();
+    void onPostPreset();
+    void onPostSavePreset();
+    void onSettingsBody();
+    void onPostSettings();
+    void onWebSocketEvent(uint8_t client, WStype_t type, uint8_t* payload, size_t length);
+    settings_status_t applySettings(const uint8_t* message, size_t length);
+    void onPostBenchmark();
+    void onGetFiles();
+    void onPostPlay();
+    void onPostStop();
+    void onPostLearn();
+    void onGetLearn();
+    void onPostRecord();
+    void onGetRecording();
+    void onGetRecordingLog();
+    void onGetBoot();
+    void onGetEffect();
+    void onGetEffectScript();
+    void onPostEffect();
+    void onGetTrace();
+    void onPostTrace();
+    void onGetMemory();
+    void onGetUsb();
+    static void writeTrace(const char* data, size_t length, void* server);
 };
 
 #endif /* _CONFIG_SERVER_H_ */
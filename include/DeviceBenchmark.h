@@ -0,0 +1,40 @@
+#ifndef _DEVICE_BENCHMARK_H_
+#define _DEVICE_BENCHMARK_H_
+
+#include <Arduino.h>
+#include "LedController.h"
+#include "MemoryArena.h"
+#include "midi_types.h"
+
+// Target frame rate used to compute the remaining budget
+#define BENCHMARK_TARGET_FPS 120
+// Number of strip refreshes measured per workload, show() is slow so only a sample is timed
+#define BENCHMARK_SHOW_SAMPLES 32
+// Frames encoded by each pixel encoder, compared in the summary
+#define BENCHMARK_ENCODE_SAMPLES 64
+
+/**
+ * On-device benchmark of the whole pipeline.
+ * Replays the synthetic workloads shared with the host benchmark, measures every stage
+ * with the CPU cycle counter and reports the results as JSON.
+ */
+class DeviceBenchmark {
+  public:
+    // The buffers of the workloads and of the encoder output are allocated once, in memory when given
+    DeviceBenchmark(LedController* led, MemoryArena* memory = NULL);
+    ~DeviceBenchmark();
+    // Blocking, returns the JSON report
+    String run();
+    // True while run() is executing, MIDI input must be ignored meanwhile
+    bool isRunning();
+
+  private:
+    LedController* led_controller;
+    MemoryArena* memory;
+    timed_midi_packet* events;
+    uint8_t* encoded;
+    volatile bool running = false;
+    uint32_t measureEncoder(PixelEncoder*, uint8_t* output);
+};
+
+#endif /* _DEVICE_BENCHMARK_H_ */
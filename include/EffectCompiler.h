@@ -0,0 +1,66 @@
+#ifndef _EFFECT_COMPILER_H_
+#define _EFFECT_COMPILER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include "effect_bytecode.h"
+
+#define EFFECT_MAX_LABELS 32
+#define EFFECT_MAX_LABEL_LENGTH 16
+#define EFFECT_MAX_ERROR_LENGTH 64
+// Longest script, also the limit of an NVS string
+#define EFFECT_MAX_SOURCE_SIZE 4000
+
+/// Types ///
+
+typedef struct {
+  char name[EFFECT_MAX_LABEL_LENGTH + 1];
+  uint16_t target;
+} effect_label_t;
+
+typedef struct {
+  char name[EFFECT_MAX_LABEL_LENGTH + 1];
+  uint16_t instruction;
+  uint16_t line;
+} effect_fixup_t;
+
+/**
+ * Assembler of the effect scripts into the bytecode of effect_bytecode.h, one instruction per line:
+ *
+ *   mode pixel          ; or note, see effect_run_mode_t
+ *   loop:               ; label, target of jmp, jz and jnz
+ *     ldi r6, 360       ; immediates in decimal or 0x hexadecimal
+ *     mul r7, r0, r6
+ *     jnz r7, loop
+ *
+ * Mnemonics are the opcode names in lower case. ldi takes any 32 bits value, it becomes two
+ * instructions when it doesn't fit in 16 bits.
+ * Compiling never allocates, the first error stops it with its line number.
+ */
+class EffectCompiler {
+  public:
+    EffectCompiler();
+    // Return false on error, see getError()
+    bool compile(const char* source, size_t length);
+    const uint8_t* getBytecode();
+    size_t getBytecodeLength();
+    // Line of the error, starting at 1
+    uint16_t getErrorLine();
+    const char* getError();
+
+  private:
+    uint8_t bytecode[EFFECT_MAX_BYTECODE_SIZE];
+    size_t instruction_count = 0;
+    effect_label_t labels[EFFECT_MAX_LABELS];
+    size_t label_count = 0;
+    effect_fixup_t fixups[EFFECT_MAX_INSTRUCTIONS];
+    size_t fixup_count = 0;
+    uint16_t error_line = 0;
+    char error[EFFECT_MAX_ERROR_LENGTH];
+    bool compileLine(char* line, uint16_t line_number);
+    bool emit(uint8_t op, uint8_t a, uint8_t b, uint8_t c);
+    bool addLabel(const char* name);
+    bool fail(uint16_t line_number, const char* message);
+};
+
+#endif /* _EFFECT_COMPILER_H_ */
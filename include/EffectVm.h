@@ -0,0 +1,61 @@
+#ifndef _EFFECT_VM_H_
+#define _EFFECT_VM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include "effect_bytecode.h"
+#include "NoteState.h"
+
+// Instructions a script may run per frame, all runs of the frame included
+#define EFFECT_DEFAULT_BUDGET 20000
+
+/// Types ///
+
+// What a frame of the script can read and write
+typedef struct {
+  uint8_t* layer;             // Packed RGB, written by PX
+  const uint8_t* notes_layer; // Packed RGB, colors of the notes
+  uint16_t pixel_count;
+  uint32_t now_us;
+  NoteState* notes;
+  const uint32_t* note_colors;
+} effect_frame_t;
+
+/**
+ * Sandboxed interpreter of the user effect scripts, see effect_bytecode.h.
+ * A script only reaches its 16 registers and the pixels of its layer, through PX.
+ * Every frame has an instruction budget shared by all the runs of the frame: when it is spent,
+ * the frame stops where it is, so a looping script costs a bounded time and can't stall the LEDs.
+ */
+class EffectVm {
+  public:
+    EffectVm();
+    // Copy and validate the bytecode, return false if it is invalid
+    bool load(const uint8_t* bytecode, size_t length);
+    void unload();
+    bool isLoaded();
+    effect_run_mode_t getRunMode();
+    size_t getInstructionCount();
+    void setBudget(uint32_t instructions_per_frame);
+    // Run the script over the frame, return false if the budget ran out
+    bool runFrame(const effect_frame_t*);
+    // Instructions executed by the last frame
+    uint32_t getLastFrameCost();
+    // Frames stopped by the budget
+    uint32_t getOverrunCount();
+
+  private:
+    effect_instruction_t program[EFFECT_MAX_INSTRUCTIONS];
+    // Bytecode being loaded, validated after the copy
+    uint8_t staging[EFFECT_MAX_BYTECODE_SIZE];
+    size_t instruction_count = 0;
+    effect_run_mode_t run_mode = EFFECT_RUN_PER_PIXEL;
+    uint32_t budget = EFFECT_DEFAULT_BUDGET;
+    uint32_t last_frame_cost = 0;
+    uint32_t overrun_count = 0;
+    uint32_t random_state = 1;
+    // Return false if the budget ran out
+    bool run(int32_t* registers, const effect_frame_t*, uint32_t* remaining);
+};
+
+#endif /* _EFFECT_VM_H_ */
@@ -0,0 +1,92 @@
+#ifndef _EVENT_LOG_H_
+#define _EVENT_LOG_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <midi_types.h>
+#include "MemoryArena.h"
+
+/**
+ * Compact binary log of timestamped MIDI packets.
+ *
+ * Format:
+ *  - header: "PNLG", version byte, 3 reserved bytes
+ *  - records: delta time in us from the previous record as a MIDI variable length quantity,
+ *    followed by the 4 bytes of the USB MIDI packet
+ * Times are 32 bits, a log covers about 71 minutes.
+ */
+
+#define EVENT_LOG_VERSION 1
+#define EVENT_LOG_HEADER_SIZE 8
+#define EVENT_LOG_MAX_RECORD_SIZE 9
+// Size of each of the two RAM buffers
+#define EVENT_LOG_BUFFER_SIZE 2048
+// Resolution of exported MIDI files: 500 ticks per quarter at 120 bpm, one tick per ms
+#define EVENT_LOG_SMF_DIVISION 500
+#define EVENT_LOG_SMF_TEMPO 500000
+
+/**
+ * Records packets into two RAM buffers.
+ * record() is called by the MIDI thread and never touches the file system,
+ * full buffers are written by flush() from another task.
+ */
+class EventLogRecorder {
+  public:
+    // The buffers are allocated in memory when given, they can be in PSRAM
+    EventLogRecorder(MemoryArena* memory = NULL);
+    ~EventLogRecorder();
+    // Write the header and start recording
+    bool start(FILE* log, uint32_t now_us);
+    // Stop recording and write what is left in the buffers
+    void stop();
+    bool isRecording();
+    // MIDI thread side, drops the event if both buffers are full
+    void record(midi_usb_packet, uint32_t now_us);
+    // Writer side, write the buffers that are full, return the number of bytes written
+    size_t flush();
+    // True when a buffer waits for flush()
+    bool hasFullBuffer();
+    uint32_t getRecordedEvents();
+    uint32_t getDroppedEvents();
+
+  private:
+    FILE* file = NULL;
+    MemoryArena* memory;
+    uint8_t* buffers[2];
+    uint16_t lengths[2];
+    std::atomic<bool> full[2];
+    uint8_t active = 0;
+    uint32_t last_us = 0;
+    std::atomic<bool> recording;
+    // Number of record() calls in progress, stop() waits for them
+    std::atomic<uint8_t> writers;
+    uint32_t recorded_events = 0;
+    uint32_t dropped_events = 0;
+};
+
+/**
+ * Reads a log back, for replay and export.
+ */
+class EventLogReader {
+  public:
+    EventLogReader();
+    ~EventLogReader();
+    // Check the header, the file stays owned by the caller
+    bool open(FILE* log);
+    // Next packet with its time from the beginning of the recording
+    bool next(timed_midi_packet*);
+
+  private:
+    FILE* file = NULL;
+    uint32_t time_us = 0;
+};
+
+/**
+ * Convert a log into a type 0 Standard MIDI File.
+ * @return number of events exported, -1 on error
+ */
+int exportEventLogToSmf(FILE* log, FILE* smf);
+
+#endif /* _EVENT_LOG_H_ */
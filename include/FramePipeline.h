@@ -0,0 +1,47 @@
+#ifndef _FRAME_PIPELINE_H_
+#define _FRAME_PIPELINE_H_
+
+#include <cstdint>
+#include "NoteRenderer.h"
+#include "MatrixRenderer.h"
+#include "LearningSession.h"
+
+// Frames per second of the effects animation
+#define EFFECT_FRAME_RATE 120
+// Inputs whose program changes select a preset: the keyboard and the DAW,
+// the program changes of a MIDI file pick its instruments
+#define PRESET_PROGRAM_SOURCES ((1 << NOTE_SOURCE_USB) | (1 << NOTE_SOURCE_NETWORK))
+
+/**
+ * Hardware independent part of LedController: what the MIDI events and the clock do to the frame.
+ * LedController adds the strip, the network output and the persistence of the settings around it.
+ * Time is always given by the caller, the golden frame test replays captures on a virtual clock.
+ */
+class FramePipeline {
+  public:
+    FramePipeline(NoteRenderer*);
+    // A program change from PRESET_PROGRAM_SOURCES selects the preset of its number
+    // Return true if the frame may have changed, the caller then calls render()
+    bool handleEvent(midi_event_t, uint32_t now_us, note_source_t source = NOTE_SOURCE_USB);
+    // Call this in loop(), copies a new learning guide and paces the animation frames
+    // Return true if the frame may have changed
+    bool loop(uint32_t now_us);
+    // Compose the frame, return true if it has been recomposed
+    bool render(uint32_t now_us);
+    // Frame sent to the LEDs, from the matrix when there is one
+    const uint8_t* getFrame();
+    uint16_t getPixelCount();
+    NoteRenderer* getRenderer();
+    void setMatrix(MatrixRenderer*);
+    MatrixRenderer* getMatrix();
+    void setLearningSession(LearningSession*);
+
+  private:
+    NoteRenderer* renderer;
+    MatrixRenderer* matrix = NULL;
+    LearningSession* learning = NULL;
+    uint32_t guide_version = 0;
+    uint32_t last_frame_us = 0;
+};
+
+#endif /* _FRAME_PIPELINE_H_ */
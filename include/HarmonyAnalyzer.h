@@ -0,0 +1,50 @@
+#ifndef _HARMONY_ANALYZER_H_
+#define _HARMONY_ANALYZER_H_
+
+#include <cstdint>
+#include "chord_templates.h"
+
+// The key is estimated from the pitch classes of the last notes played
+#define KEY_WINDOW_SIZE 32
+// Notes needed before a key is reported
+#define KEY_MIN_NOTES 8
+// A new key must score this much more than the current one, so that a passing note doesn't flip it
+#define KEY_HYSTERESIS 2
+
+/**
+ * Incremental chord and key detection, fed with the presses and releases of NoteState.
+ * The held pitch classes are a 12 bits mask kept up to date with a count per pitch class. The chord is matched against the templates only when that mask changes.
+ * The key score of each major scale (shared with its relative minor) is updated with the notes
+ * entering and leaving the window, so every event has the same bounded cost however dense the playing.
+ */
+class HarmonyAnalyzer {
+  public:
+    HarmonyAnalyzer();
+    // Return true if the chord or the key changed
+    // @param held the key was already pressed, the note only counts again for the key
+    bool noteOn(uint8_t note, bool held = false);
+    // The key must have been pressed
+    bool noteOff(uint8_t note);
+    void clear();
+    uint16_t getPitchClasses();
+    chord_t getChord();
+    musical_key_t getKey();
+
+  private:
+    uint8_t pitch_class_count[12];
+    uint16_t pitch_classes = 0;
+    chord_t chord;
+    // Pitch classes of the last note ons, and how many times each one is in the window
+    uint8_t window[KEY_WINDOW_SIZE];
+    uint8_t window_position = 0;
+    uint8_t window_length = 0;
+    uint8_t window_count[12];
+    // Notes of the window in the major scale of each tonic
+    uint8_t scale_score[12];
+    musical_key_t key;
+    void addToWindow(uint8_t pitch_class);
+    bool updateChord();
+    bool updateKey();
+};
+
+#endif /* _HARMONY_ANALYZER_H_ */
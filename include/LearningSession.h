@@ -0,0 +1,101 @@
+#ifndef _LEARNING_SESSION_H_
+#define _LEARNING_SESSION_H_
+
+#include <atomic>
+#include <cstdint>
+#include "midi_decoder.h"
+#include "note_set.h"
+#include "SmfPlayer.h"
+
+// Steps read ahead of the current one, the file is only parsed to refill them
+#define LEARNING_WINDOW_STEPS 16
+// Note ons of the song closer than this are played together, as one step
+#define LEARNING_CHORD_US 40000
+// Steps lit after the current one, from its time
+#define LEARNING_LOOKAHEAD_US 2000000
+
+/// Types ///
+
+typedef enum : uint8_t {
+  LEARNING_MODE_WAIT = 0, // The song waits until the notes of the current step are played
+  LEARNING_MODE_FOLLOW,   // The song goes on in time, the steps not played are missed
+} learning_mode_t;
+
+// Notes to play together
+typedef struct {
+  // From the beginning of the song
+  uint32_t time_us;
+  note_set_t notes;
+} learning_step_t;
+
+typedef struct {
+  uint32_t steps;
+  uint32_t missed_steps;
+  uint32_t correct_notes;
+  uint32_t wrong_notes;
+} learning_stats_t;
+
+/**
+ * Teaches a Standard MIDI File: the notes of the next step are shown, then matched against the ones played.
+ * Note ons of the song are grouped into steps, kept in a ring refilled by update(): rendering only reads note sets.
+ * handleEvent() is called from the MIDI input task, it only sets the note in the struck bitset and
+ * compares it with the current step. update() runs in loop(), it advances once the struck notes cover the step.
+ */
+class LearningSession {
+  public:
+    LearningSession();
+    // The source must outlive the session
+    bool open(SmfSource*, learning_mode_t mode = LEARNING_MODE_WAIT);
+    void close();
+    bool isActive();
+    // True once every step of the song has been played or missed
+    bool isFinished();
+    learning_mode_t getMode();
+    // Follow mode: the first step is due at start_us
+    void start(uint32_t start_us);
+    // Note played on an input, return true if it belongs to the current step
+    bool handleEvent(midi_event_t);
+    // Advance the steps, refill the window, return true if the guide changed
+    bool update(uint32_t now_us);
+    // Notes of the current step, empty when the song is over
+    const note_set_t* getCurrentNotes();
+    // Notes of the next steps within LEARNING_LOOKAHEAD_US, without the current ones
+    const note_set_t* getUpcomingNotes();
+    // Incremented every time the guide changes, so that it is only copied when needed
+    uint32_t getGuideVersion();
+    // Steps read ahead, getStep(0) is the current one, NULL past the window
+    uint8_t getWindowSize();
+    const learning_step_t* getStep(uint8_t index);
+    learning_stats_t getStats();
+
+  private:
+    SmfPlayer player;
+    std::atomic<bool> active{false};
+    learning_mode_t mode = LEARNING_MODE_WAIT;
+    uint32_t start_us = 0;
+    // Ring of the steps read ahead, window[head] is the current step
+    learning_step_t window[LEARNING_WINDOW_STEPS];
+    uint8_t head = 0;
+    uint8_t count = 0;
+    // First note on of the step after the last one of the window
+    bool has_pending = false;
+    timed_midi_packet pending;
+    bool end_of_song = false;
+    // Notes struck since the current step began, set by the input task
+    std::atomic<uint32_t> struck[NOTE_SET_WORDS];
+    // Copy of the current step read by the input task
+    std::atomic<uint32_t> expected[NOTE_SET_WORDS];
+    note_set_t current;
+    note_set_t upcoming;
+    uint32_t guide_version = 0;
+    learning_stats_t stats;
+    std::atomic<uint32_t> correct_notes{0};
+    std::atomic<uint32_t> wrong_notes{0};
+    void fill();
+    bool readStep(learning_step_t*);
+    bool isStepPlayed();
+    void nextStep(bool played);
+    void updateGuide();
+};
+
+#endif /* _LEARNING_SESSION_H_ */
@@ -3,13 +3,27 @@
 
 #include <Adafruit_NeoPixel.h>
 #include <Preferences.h>
+#include "NoteRenderer.h"
+#include "FramePipeline.h"
+#include "PixelNetworkOutput.h"
+#include "SettingsStore.h"
+#include "MatrixRenderer.h"
+#include "EffectCompiler.h"
+#include "PixelEncoder.h"
+#include "LearningSession.h"
 
-#define DEFAULT_LED_COLOR 0xffffff
-#define DEFAULT_BRIGHTNESS 100
+// Settings are written to NVS once they stop changing for this long
+#define SETTINGS_SAVE_DELAY_MS 1000
+// Notes lit in turn by blinkLoop()
+#define BLINK_FIRST_NOTE 30
+#define BLINK_LAST_NOTE 34
+#define BLINK_PERIOD_MS 300
 
 class LedController {
   public:
-    LedController(int led_count, int led_strip_pin, bool use_preferences = true);
+    // The renderer and its buffers are allocated in memory when given, meant to be internal DRAM
+    // @param pixel_order color order of the strip, frames are encoded by a RuntimePixelEncoder until setPixelEncoder()
+    LedController(int led_count, int led_strip_pin, bool use_preferences = true, MemoryArena* memory = NULL, pixel_order_t pixel_order = PIXEL_ORDER_GRB);
     ~LedController();
     // Use this in setup()
     void setup();
@@ -20,23 +34,74 @@ class LedController {
     uint8_t getBrightness();
     void setShowSustain(bool);
     bool getShowSustain();
-    void lightOn(uint8_t note, uint8_t velocity);
+    // Replace every setting at once, see SettingsStore::getPreset() and SettingsStore::publish()
+    void setPreset(const led_preset_t&, int8_t selected = -1);
+    // Also selected by MIDI program changes, program n selects preset n
+    bool selectPreset(uint8_t index);
+    bool savePreset(uint8_t index, const char* name);
+    SettingsStore* getSettings();
+    void lightOn(uint8_t note, uint8_t velocity, note_source_t source = NOTE_SOURCE_DEMO);
     void lightOff(uint8_t note);
     void lightOnSides();
     void lightOffSides();
+    void handleEvent(midi_event_t, note_source_t source = NOTE_SOURCE_USB);
+    // Upcoming event of the song being played, for the falling notes of the matrix
+    void previewEvent(midi_event_t);
     void blinkLoop();
+    // Write the changed settings to NVS now instead of waiting for loop()
+    void saveSettings();
+    // Call this in loop(), saves the settings, animates the effects and refreshes the network output receivers
+    void loop();
+    // Also send the frames to remote controllers, local_strip false to only use the network
+    void setNetworkOutput(PixelNetworkOutput*, bool local_strip = true);
+    // The strip is a 2D matrix showing a waterfall of notes, the LED count must be its pixel count
+    void setMatrix(MatrixRenderer*);
+    MatrixRenderer* getMatrix();
+    // Keys of the song being learned, lit by loop() whenever the session moves to the next step
+    void setLearningSession(LearningSession*);
+    // Usually a StaticPixelEncoder matching the strip, return false if its order isn't the one of the strip
+    bool setPixelEncoder(PixelEncoder*);
+    PixelEncoder* getPixelEncoder();
+    // Compile and run an effect script, saved in NVS, an empty source removes it
+    // Return false if the script doesn't compile, see getEffectCompiler()
+    bool setEffectScript(const char* source, size_t length);
+    // Copy the saved script in buffer, return its length
+    size_t getEffectScript(char* buffer, size_t size);
+    EffectCompiler* getEffectCompiler();
+    // Push the composed frame to the strip if it changed
+    void show();
+    // Building blocks of show(), exposed for the benchmark
+    NoteRenderer* getRenderer();
+    void pushFrame();
+    void showStrip();
+    uint16_t getLedCount();
 
   private:
     Adafruit_NeoPixel* ws2812b;
+    pixel_order_t order;
+    PixelEncoder* encoder;
+    bool owns_encoder = true;
+    NoteRenderer* renderer;
+    // Events, animation and matrix, shared with the host tests
+    FramePipeline* pipeline;
+    MemoryArena* memory;
+    PixelNetworkOutput* network_output = NULL;
+    bool use_local_strip = true;
     Preferences nvs;
     uint16_t led_number;
     bool use_nvs;
-    uint32_t led_color_temp = DEFAULT_LED_COLOR;
-    uint8_t brightness_temp = DEFAULT_BRIGHTNESS;
-    bool show_sustain_temp = true;
-    int computePixelIndex(uint8_t note);
-    int blink_note = 30;
-    unsigned long last_blink_millis = 0;
+    // Current settings and presets, the current settings are persisted by loop() when use_nvs is set
+    SettingsStore settings;
+    bool settings_dirty = false;
+    unsigned long settings_changed_millis = 0;
+    void settingsApplied();
+    void loadSettings();
+    bool loadPreset(const char* key, led_preset_t*);
+    EffectCompiler effect_compiler;
+    void loadEffectScript();
+    // Frame sent to the LEDs, from the matrix when there is one
+    const uint8_t* getOutputFrame();
+    uint16_t getOutputPixelCount();
 };
 
 #endif /* _LED_CONTROLLER_H_ */
@@ -0,0 +1,49 @@
+#ifndef _LIGHT_GUIDE_H_
+#define _LIGHT_GUIDE_H_
+
+#include <cstdint>
+#include "note_set.h"
+#include "MidiOutQueue.h"
+#include "LearningSession.h"
+
+// Velocity of the keys lit for the current step, and for the next ones when they are shown
+#define LIGHT_GUIDE_CURRENT_VELOCITY 127
+#define LIGHT_GUIDE_UPCOMING_VELOCITY 1
+
+/**
+ * Lights the keys of keyboards having a LED under each key, from the steps of a LearningSession.
+ * These keyboards take a note on to light a key and a note off to turn it off, on a channel of their own.
+ * Only the keys that changed since the last update are sent: the new lit set is XORed with the one sent.
+ * A keyboard plugged again starts with its keys off, they are all sent again.
+ */
+class LightGuide {
+  public:
+    // @param channel 1 to 16, as shown on the keyboard
+    LightGuide(MidiOutQueue*, uint8_t channel, bool show_upcoming = false);
+    void setSession(LearningSession*);
+    // Call this in loop(), queues the changes of the guide, return the number of packets queued
+    size_t loop(uint32_t now_us);
+    // Light exactly these keys, return the number of packets queued
+    size_t show(const note_set_t* current, const note_set_t* upcoming, uint32_t now_us);
+    // Turn every lit key off, when the guide stops or the keyboard reconnects
+    size_t clear(uint32_t now_us);
+    // Forget the lit keys without sending anything, the keyboard turned them off itself
+    void reset();
+
+  private:
+    MidiOutQueue* queue;
+    uint8_t status_channel;
+    bool show_upcoming;
+    LearningSession* learning = NULL;
+    uint32_t guide_version = 0;
+    // Generation of the queue the lit keys were sent to
+    uint32_t generation = 0;
+    // Keys lit on the keyboard, upcoming ones are also in lit
+    note_set_t lit;
+    note_set_t lit_upcoming;
+    // False when the last show() found the queue full
+    bool synced = true;
+    bool send(uint8_t status, uint8_t note, uint8_t velocity, uint32_t now_us);
+};
+
+#endif /* _LIGHT_GUIDE_H_ */
@@ -0,0 +1,72 @@
+#ifndef _MATRIX_RENDERER_H_
+#define _MATRIX_RENDERER_H_
+
+#include <cstdint>
+#include "MemoryArena.h"
+
+#define MATRIX_DEFAULT_ROW_PERIOD_US 50000
+
+/// Types ///
+
+typedef enum : uint8_t {
+  MATRIX_WATERFALL_RISING = 0, // Played notes enter on the bottom row and scroll up
+  MATRIX_WATERFALL_FALLING,    // Upcoming notes enter on the top row and reach the bottom when played
+} matrix_mode_t;
+
+typedef struct {
+  uint16_t width;
+  uint16_t height;
+  bool serpentine; // Every other row is wired in the opposite direction
+  bool top_origin; // First LED in the top row, else in the bottom row
+} matrix_layout_t;
+
+/**
+ * Waterfall of notes on a 2D LED matrix placed above the keyboard, the 88 keys spread over the width.
+ * Rows are kept in a ring: scrolling moves the index of the newest row and writes that row only,
+ * the pixels are never moved. The frame is then composed in the wiring order of the matrix.
+ * Frames are packed RGB, like NoteRenderer.
+ */
+class MatrixRenderer {
+  public:
+    // Rows and frame are allocated in memory when given
+    MatrixRenderer(matrix_layout_t, MemoryArena* memory = NULL);
+    ~MatrixRenderer();
+    void setMode(matrix_mode_t);
+    matrix_mode_t getMode();
+    void setRowPeriod(uint32_t period_us);
+    // Time taken by a row to cross the matrix, the preview has to be that early
+    uint32_t getLookahead();
+    // Upcoming notes, drawn by the falling mode
+    void previewNoteOn(uint8_t note, uint32_t color);
+    void previewNoteOff(uint8_t note);
+    // Refresh the newest row and scroll when a row period elapsed
+    // @param note_colors color of each of the 128 notes, 0 when off, used by the rising mode
+    // Return true if the frame has to be recomposed
+    bool update(uint32_t now_us, const uint32_t* note_colors);
+    // Compose the frame if something changed, return true if it has been recomposed
+    bool render();
+    const uint8_t* getFrame();
+    uint16_t getPixelCount();
+    // Index in the strip of the pixel at column x, row y counted from the bottom
+    uint16_t mapPixel(uint16_t x, uint16_t y);
+    void clear();
+
+  private:
+    matrix_layout_t layout;
+    MemoryArena* memory;
+    matrix_mode_t mode = MATRIX_WATERFALL_RISING;
+    uint32_t row_period_us = MATRIX_DEFAULT_ROW_PERIOD_US;
+    uint16_t row_size;
+    // Ring of rows, newest_row is the last one that entered the matrix
+    uint8_t* rows;
+    uint16_t newest_row = 0;
+    uint8_t* frame;
+    uint32_t preview_colors[128];
+    uint32_t last_scroll_us = 0;
+    bool started = false;
+    bool dirty = true;
+    // Return true if the row changed
+    bool fillRow(uint8_t* row, const uint32_t* note_colors);
+};
+
+#endif /* _MATRIX_RENDERER_H_ */
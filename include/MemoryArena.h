@@ -0,0 +1,60 @@
+#ifndef _MEMORY_ARENA_H_
+#define _MEMORY_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#define MEMORY_ALIGNMENT 16
+
+/// Types ///
+
+typedef enum : uint8_t {
+  MEMORY_REGION_INTERNAL = 0, // Internal DRAM: hot data of the MIDI and render paths
+  MEMORY_REGION_PSRAM,        // Bulk data: recordings, traces, file buffers
+} memory_region_t;
+
+/**
+ * Block reserved once in a memory region, then handed out by bumping an offset.
+ * Without it, the heap decides alone where a buffer lands: with PSRAM enabled, large allocations
+ * go to PSRAM, and allocating after setup fragments the internal heap over a long session.
+ * Everything allocated in an arena lives as long as the arena, nothing is freed one by one.
+ * Allocations are expected from setup only, they are not thread safe.
+ */
+class MemoryArena {
+  public:
+    // The block is empty when the region can't hold it, allocations then fall back to the heap
+    MemoryArena(const char* name, memory_region_t, size_t size);
+    ~MemoryArena();
+    // NULL when the arena is full
+    void* allocate(size_t size, size_t alignment = MEMORY_ALIGNMENT);
+    // Object built in the arena, or on the heap when the arena is full, never destroyed
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+      void* memory = this->allocate(sizeof(T), alignof(T) > MEMORY_ALIGNMENT ? alignof(T) : MEMORY_ALIGNMENT);
+      if (memory == NULL) return new T(std::forward<Args>(args)...);
+      return new (memory) T(std::forward<Args>(args)...);
+    }
+    bool contains(const void*);
+    const char* getName();
+    memory_region_t getRegion();
+    size_t getSize();
+    size_t getUsed();
+    // Allocations the arena could not hold
+    uint32_t getOverflowCount();
+    // Zeroed buffer from the arena when there is one and it has room, else from the heap
+    static uint8_t* allocateBuffer(MemoryArena*, size_t size);
+    // Only frees the buffers that came from the heap
+    static void releaseBuffer(MemoryArena*, uint8_t*);
+
+  private:
+    const char* name;
+    memory_region_t region;
+    uint8_t* block;
+    size_t size;
+    size_t used = 0;
+    uint32_t overflow_count = 0;
+};
+
+#endif /* _MEMORY_ARENA_H_ */
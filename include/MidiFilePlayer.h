@@ -0,0 +1,56 @@
+#ifndef _MIDI_FILE_PLAYER_H_
+#define _MIDI_FILE_PLAYER_H_
+
+#include <Arduino.h>
+#include <midi_types.h>
+#include "SmfPlayer.h"
+#include "LearningSession.h"
+
+// LittleFS mount point in the VFS, files are opened with stdio
+#define MIDI_FILES_MOUNT_POINT "/littlefs"
+
+/**
+ * Plays Standard MIDI Files stored on the flash file system.
+ * Events are sent to the same callback as the USB MIDI input.
+ * A file can also be learned instead of played, its notes are then read ahead by a LearningSession.
+ */
+class MidiFilePlayer {
+  public:
+    MidiFilePlayer();
+    ~MidiFilePlayer();
+    void setMidiInCallback(midi_in_callback_t *);
+    // The same file is also played lookahead_us ahead of time to the preview callback, 0 disables it
+    void setPreview(midi_in_callback_t *, uint32_t lookahead_us);
+    // Session learn() uses, fed with the notes played by the caller
+    void setLearningSession(LearningSession*);
+    LearningSession* getLearningSession();
+    // Use this in setup()
+    void setup();
+    // Call this in loop(), sends the events that are due
+    void loop();
+    // @param file_name name of the file at the root of the file system
+    bool play(const char* file_name);
+    // Light the notes of the file step by step instead of playing it, stopped by stop() or play()
+    bool learn(const char* file_name, learning_mode_t mode);
+    void stop();
+    bool isPlaying();
+    // Tracks of the file played, and the ones past SMF_MAX_TRACKS left out
+    uint16_t getTrackCount();
+    uint16_t getSkippedTrackCount();
+    // JSON array with the names of the .mid files available
+    String listFiles();
+
+  private:
+    midi_in_callback_t *midiInCallback = NULL;
+    SmfFileSource file;
+    SmfPlayer player;
+    midi_in_callback_t *previewCallback = NULL;
+    uint32_t preview_lookahead_us = 0;
+    SmfFileSource preview_file;
+    SmfPlayer preview_player;
+    LearningSession* learning = NULL;
+    SmfFileSource learning_file;
+    bool fs_mounted = false;
+};
+
+#endif /* _MIDI_FILE_PLAYER_H_ */
@@ -0,0 +1,54 @@
+#ifndef _MIDI_JITTER_BUFFER_H_
+#define _MIDI_JITTER_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <midi_types.h>
+
+#define JITTER_BUFFER_CAPACITY 256
+
+/**
+ * Adaptive jitter buffer for MIDI received over the network.
+ * Events are played at their sender time plus the smallest transit time seen plus a latency
+ * that follows the measured jitter. The latency never exceeds the configured maximum:
+ * that maximum is what is traded for smooth timing.
+ */
+class MidiJitterBuffer {
+  public:
+    MidiJitterBuffer(uint32_t max_latency_us);
+    ~MidiJitterBuffer();
+    void setMaxLatency(uint32_t max_latency_us);
+    void reset();
+    // Call this once per received packet before pushing its events, measures the transit time and the jitter
+    // sender_time_us is the timestamp of the packet on the sender clock, arrival_us is on the local one
+    void receive(uint32_t sender_time_us, uint32_t arrival_us);
+    // Queue an event of the last packet received, played delta_us after the packet timestamp
+    bool push(midi_usb_packet, uint32_t delta_us = 0);
+    // Send the events due at now_us to the callback, return the number of events sent
+    size_t pop(uint32_t now_us, midi_in_callback_t*);
+    // Send all the queued events to the callback, whatever their time
+    size_t flush(midi_in_callback_t*);
+    size_t getCount();
+    uint32_t getLatency();
+    uint32_t getJitter();
+    uint32_t getLateEvents();
+    uint32_t getDroppedEvents();
+
+  private:
+    timed_midi_packet events[JITTER_BUFFER_CAPACITY];
+    size_t head = 0;
+    size_t count = 0;
+    uint32_t max_latency_us;
+    bool has_transit = false;
+    // Smallest transit time seen, slowly raised to follow the clock drift
+    int32_t min_transit_us = 0;
+    int32_t last_transit_us = 0;
+    // Last packet received
+    uint32_t sender_time_us = 0;
+    uint32_t arrival_us = 0;
+    uint32_t jitter_us = 0;
+    uint32_t late_events = 0;
+    uint32_t dropped_events = 0;
+};
+
+#endif /* _MIDI_JITTER_BUFFER_H_ */
@@ -0,0 +1,82 @@
+#ifndef _MIDI_OUT_QUEUE_H_
+#define _MIDI_OUT_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <midi_types.h>
+
+// Power of 2, about 10 bulk transfers of a full speed endpoint
+#define MIDI_OUT_QUEUE_CAPACITY 128
+
+/// Types ///
+
+typedef struct {
+  // Packets accepted by push()
+  uint32_t queued;
+  // Packets refused because the queue was full
+  uint32_t dropped;
+  // Packets handed to a transfer by pop()
+  uint32_t sent;
+  // Batches popped, one per bulk OUT transfer
+  uint32_t transfers;
+  uint32_t failed_transfers;
+  // Packets waiting now, and the most ever waiting
+  uint16_t depth;
+  uint16_t max_depth;
+  // From push() to pop(), moving average over about 16 packets
+  uint32_t average_latency_us;
+  uint32_t max_latency_us;
+} midi_out_stats_t;
+
+/**
+ * Bounded queue of the USB MIDI packets to send, shared by every task producing MIDI out.
+ * push() never blocks and never allocates: each slot has a sequence number, producers reserve
+ * a slot with a compare and swap on the tail, so the file player, the network and the USB input can
+ * all send. A single consumer, the USB class driver task, pops whole batches to fill a bulk OUT transfer.
+ */
+class MidiOutQueue {
+  public:
+    MidiOutQueue();
+    // Called after each push, to wake the consumer up
+    void setReadyCallback(void (*)(void));
+    // Any task, return false when the queue is closed, or full: the packet is then counted as dropped
+    bool push(midi_usb_packet, uint32_t now_us);
+    // Consumer only, copy up to max_count packets in order, return the number copied
+    size_t pop(midi_usb_packet* packets, size_t max_count, uint32_t now_us);
+    // Consumer only, forget the waiting packets, when the device they were for went away
+    size_t discard();
+    // Consumer only, accept packets for a new device, the ones waiting for the previous one are discarded
+    void open();
+    // Consumer only, refuse packets until the next open()
+    void close();
+    bool isOpen();
+    // Incremented by open(), senders keeping a state of the device start over when it changes
+    uint32_t getGeneration();
+    void countFailedTransfer();
+    size_t getDepth();
+    midi_out_stats_t getStats();
+
+  private:
+    typedef struct {
+      std::atomic<uint32_t> sequence;
+      midi_usb_packet packet;
+      uint32_t queued_us;
+    } slot_t;
+    slot_t slots[MIDI_OUT_QUEUE_CAPACITY];
+    void (*ready_callback)(void) = NULL;
+    std::atomic<bool> opened{false};
+    std::atomic<uint32_t> generation{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> queued{0};
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<uint32_t> sent{0};
+    std::atomic<uint32_t> transfers{0};
+    std::atomic<uint32_t> failed_transfers{0};
+    std::atomic<uint16_t> max_depth{0};
+    std::atomic<uint32_t> average_latency_us{0};
+    std::atomic<uint32_t> max_latency_us{0};
+};
+
+#endif /* _MIDI_OUT_QUEUE_H_ */
@@ -0,0 +1,48 @@
+#ifndef _MIDI_RECORDER_H_
+#define _MIDI_RECORDER_H_
+
+#include <Arduino.h>
+#include <midi_types.h>
+#include "EventLog.h"
+
+#define RECORDING_LOG_FILE "/recording.pnl"
+#define RECORDING_SMF_FILE "/recording.mid"
+#define RECORDER_TASK_PRIORITY 1
+#define RECORDER_TASK_STACK_SIZE 4096
+
+/**
+ * Records the MIDI input to the flash file system.
+ * record() only copies the packet in RAM. A writer task on core 0 is woken when a buffer is full
+ * and writes it to the flash, a page write or erase never stalls the notes and the strip on loop().
+ */
+class MidiRecorder {
+  public:
+    // The buffers are allocated in memory when given
+    MidiRecorder(MemoryArena* memory = NULL);
+    ~MidiRecorder();
+    // Use this in setup(), starts the writer task
+    void setup();
+    // Call this in loop(), writes the full buffers only when the writer task couldn't be started
+    void loop();
+    // Call this from the MIDI thread
+    void record(midi_usb_packet);
+    bool start();
+    // Writes what is left in the buffers from the caller, once per recording
+    void stop();
+    bool isRecording();
+    // Convert the last recording into RECORDING_SMF_FILE
+    bool exportSmf();
+    // JSON status
+    String getStatus();
+
+  private:
+    EventLogRecorder recorder;
+    FILE* log_file = NULL;
+    bool fs_mounted = false;
+    TaskHandle_t writer_task = NULL;
+    // Held by the writer task while it writes, and by start() and stop() that open and close the file
+    SemaphoreHandle_t file_lock = NULL;
+    static void writerTask(void*);
+};
+
+#endif /* _MIDI_RECORDER_H_ */
@@ -0,0 +1,98 @@
+#ifndef _NOTE_RENDERER_H_
+#define _NOTE_RENDERER_H_
+
+#include <atomic>
+#include <cstdint>
+#include "midi_decoder.h"
+#include "SettingsStore.h"
+#include "HarmonyAnalyzer.h"
+#include "ParticleSystem.h"
+#include "NoteState.h"
+#include "Compositor.h"
+#include "EffectVm.h"
+#include "MemoryArena.h"
+
+/**
+ * Hardware independent part of the LED pipeline.
+ * Keeps the state of the notes and composes the frame pushed to the strip.
+ * Colors are 0x00RRGGBB, as returned by Adafruit_NeoPixel::Color().
+ * Settings are read from the current snapshot of a SettingsStore, once per call.
+ * Notes, particles and sustain sides are drawn on their own layers, blended into the frame.
+ * The keys to play next in learning mode are lit under the notes.
+ * The frame is stored as packed RGB bytes, the layout sent on the network outputs.
+ * A user effect script can draw on its own layer, it is run by every render while it is loaded.
+ */
+class NoteRenderer {
+  public:
+    // Uses its own store with the default settings when settings is NULL
+    // The frame and the layers are allocated in memory when given
+    NoteRenderer(uint16_t led_count, SettingsStore* settings = NULL, MemoryArena* memory = NULL);
+    ~NoteRenderer();
+    SettingsStore* getSettings();
+    // @param now_us time of the event, recorded as the onset of the notes
+    void handleEvent(midi_event_t, uint32_t now_us = 0, note_source_t source = NOTE_SOURCE_USB);
+    void noteOn(uint8_t note, uint8_t velocity, uint32_t now_us = 0, note_source_t source = NOTE_SOURCE_USB);
+    void noteOff(uint8_t note);
+    void sustainOn();
+    void sustainOff();
+    void clear();
+    // Advance the effects, return true if the frame has to be recomposed
+    bool animate(uint32_t now_us);
+    // Compose the frame if something changed, return true if it has been recomposed
+    bool render();
+    // 3 bytes per pixel: red, green, blue
+    const uint8_t* getFrame();
+    uint32_t getPixel(uint16_t index);
+    // Color of each of the 128 notes, 0 when the note is off
+    const uint32_t* getNoteColors();
+    uint16_t getLedCount();
+    NoteState* getNoteState();
+    // Chord and key of the notes played
+    HarmonyAnalyzer* getHarmony();
+    ParticleSystem* getParticles();
+    Compositor* getCompositor();
+    // Ambient color under the notes, 0 disables the background layer
+    void setBackground(uint32_t color);
+    // Validate the bytecode of an effect script, it is loaded by the next render
+    // NULL or an empty bytecode removes the script, return false if the bytecode is invalid
+    bool setEffect(const uint8_t* bytecode, size_t length);
+    EffectVm* getEffect();
+    // Keys to light under the notes in learning mode, brighter for the current step, NULL sets remove the guide
+    void setGuide(const note_set_t* current, const note_set_t* upcoming);
+    static int computePixelIndex(uint8_t note);
+
+  private:
+    uint8_t* frame;
+    MemoryArena* memory;
+    uint16_t led_number;
+    SettingsStore* settings;
+    bool owns_settings;
+    // Settings of the last render, a new publication recomposes the frame
+    uint32_t rendered_sequence = 0;
+    bool dirty = true;
+    // Time of the last animate(), the clock of the effect script
+    uint32_t frame_us = 0;
+    uint32_t getNoteColor(uint8_t note, const led_settings_t*);
+    // Recolor the held notes when the chord or the key changed, for the palettes that follow them
+    void recolorHeldNotes(const led_settings_t*);
+    void spawnParticles(uint8_t note, uint8_t velocity, uint32_t color, effect_mode_t effect);
+    NoteState state;
+    // Color given to each note when it was pressed, 0 when the note is off
+    uint32_t note_color[NOTE_COUNT];
+    HarmonyAnalyzer harmony;
+    ParticleSystem particles;
+    Compositor compositor;
+    EffectVm effect;
+    // Handed over to render(), which loads a copy of it: a script written meanwhile
+    // is never run unvalidated, and its new length makes the next render load it whole
+    uint8_t pending_effect[EFFECT_MAX_BYTECODE_SIZE];
+    // -1 when there is nothing to load, 0 to remove the script
+    std::atomic<int> pending_effect_length{-1};
+    uint32_t random_state = 1;
+    note_set_t guide_current;
+    note_set_t guide_upcoming;
+    void drawGuide(const led_settings_t*);
+    void runEffect(uint32_t now_us);
+};
+
+#endif /* _NOTE_RENDERER_H_ */
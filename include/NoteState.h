@@ -0,0 +1,60 @@
+#ifndef _NOTE_STATE_H_
+#define _NOTE_STATE_H_
+
+#include <cstdint>
+#include "note_set.h"
+
+/// Types ///
+
+// Input a note came from
+typedef enum : uint8_t {
+  NOTE_SOURCE_USB = 0,
+  NOTE_SOURCE_NETWORK, // RTP-MIDI
+  NOTE_SOURCE_FILE,
+  NOTE_SOURCE_AUDIO,
+  NOTE_SOURCE_DEMO,    // Notes lit by the firmware itself, like blinkLoop()
+} note_source_t;
+
+/**
+ * State of the 128 notes, read by the renderer, the effects and the analysis stages.
+ * Per note values are parallel arrays, the pressed and sustained notes are bitsets:
+ * walking the active notes visits the set bits only.
+ * A key released while the pedal is down moves from pressed to sustained until the pedal is up.
+ * Values of a note are kept after its release, until it is pressed again.
+ */
+class NoteState {
+  public:
+    NoteState();
+    // Return false if the key was already pressed, its velocity, onset and source are still updated
+    bool press(uint8_t note, uint8_t velocity, uint32_t now_us, note_source_t source);
+    // Return false if the key was not pressed
+    bool release(uint8_t note);
+    void pedalDown();
+    // Sustained notes stop
+    void pedalUp();
+    void clear();
+    bool isPressed(uint8_t note);
+    bool isSustained(uint8_t note);
+    bool isPedalDown();
+    // Next pressed note from note included, -1 if none
+    int nextPressed(int note);
+    int nextSustained(int note);
+    uint8_t getPressedCount();
+    const note_set_t* getPressed();
+    const note_set_t* getSustained();
+    uint8_t getVelocity(uint8_t note);
+    // Time of the last press
+    uint32_t getOnset(uint8_t note);
+    note_source_t getSource(uint8_t note);
+
+  private:
+    note_set_t pressed;
+    note_set_t sustained;
+    uint8_t pressed_count = 0;
+    bool pedal_down = false;
+    uint8_t velocity[NOTE_COUNT];
+    uint32_t onset_us[NOTE_COUNT];
+    note_source_t source[NOTE_COUNT];
+};
+
+#endif /* _NOTE_STATE_H_ */
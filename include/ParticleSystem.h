@@ -0,0 +1,49 @@
+#ifndef _PARTICLE_SYSTEM_H_
+#define _PARTICLE_SYSTEM_H_
+
+#include <cstdint>
+
+#define PARTICLE_CAPACITY 64
+// Spawns past this count are dropped until the next update, so a glissando can't churn the whole pool
+#define PARTICLE_MAX_SPAWNS_PER_FRAME 16
+
+/**
+ * Fixed pool of particles moving along the strip, drawn additively over the frame.
+ * Storage is a struct of arrays with the alive particles packed at the start, so updating
+ * and drawing touch only the live data and a frame costs at most PARTICLE_CAPACITY particles.
+ * When the pool is full, a new particle replaces the one with the least remaining life.
+ */
+class ParticleSystem {
+  public:
+    ParticleSystem();
+    // @param position pixel, 16.16 fixed point
+    // @param velocity pixels per second, 16.16 fixed point
+    // Return false when the spawn budget of the frame is spent
+    bool spawn(int32_t position, int32_t velocity, uint32_t color, uint32_t life_us);
+    // Move and fade the particles, return true if the frame has to be redrawn
+    bool update(uint32_t now_us);
+    // Add the particles to a packed RGB frame, saturating
+    void draw(uint8_t* frame, uint16_t led_count);
+    void clear();
+    uint8_t getCount();
+    // Particles replaced before the end of their life because the pool was full
+    uint32_t getReusedCount();
+    // Spawns refused by the per frame budget
+    uint32_t getDroppedCount();
+
+  private:
+    int32_t position[PARTICLE_CAPACITY];
+    int32_t velocity[PARTICLE_CAPACITY];
+    uint32_t color[PARTICLE_CAPACITY];
+    uint32_t age_us[PARTICLE_CAPACITY];
+    uint32_t life_us[PARTICLE_CAPACITY];
+    uint8_t count = 0;
+    uint8_t frame_spawns = 0;
+    uint32_t last_update_us = 0;
+    bool updated = false;
+    uint32_t reused_count = 0;
+    uint32_t dropped_count = 0;
+    void remove(uint8_t index);
+};
+
+#endif /* _PARTICLE_SYSTEM_H_ */
@@ -0,0 +1,55 @@
+#ifndef _PITCH_DETECTOR_H_
+#define _PITCH_DETECTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <midi_types.h>
+
+#define AUDIO_SAMPLE_RATE 16000
+// Samples per block, a new analysis runs every block (32 ms)
+#define AUDIO_BLOCK_SIZE 512
+// Analysis window, 7.8 Hz per bin: notes below A2 share bins with their neighbours
+#define AUDIO_FFT_SIZE 2048
+#define AUDIO_MAX_NOTES 10
+// Magnitude a note needs to start, it stops below a quarter of it
+#define AUDIO_DEFAULT_THRESHOLD 64
+
+/**
+ * Turns blocks of microphone samples into MIDI notes, for pianos without a MIDI port.
+ * Each block slides a Hann window over the last AUDIO_FFT_SIZE samples, runs a fixed point FFT
+ * and keeps the strongest bin of each piano key. Keys peaking above the threshold and the noise floor
+ * for two blocks become notes, unless they are a partial (octave, twelfth...) of a lower note.
+ * Notes are sent as MIDI packets, the same way as a USB keyboard.
+ * On the ESP32-S3 the FFT uses the vectorized ESP-DSP routines when available.
+ */
+class PitchDetector {
+  public:
+    PitchDetector(uint32_t sample_rate = AUDIO_SAMPLE_RATE);
+    void setMidiInCallback(midi_in_callback_t *);
+    void setThreshold(uint32_t magnitude);
+    uint32_t getThreshold();
+    // @param samples AUDIO_BLOCK_SIZE mono samples
+    // Return the number of MIDI packets sent
+    size_t process(const int16_t* samples);
+    // Release the notes still on
+    void stop();
+    bool isNoteOn(uint8_t note);
+    // Strongest bin magnitude of the note in the last block
+    uint32_t getMagnitude(uint8_t note);
+
+  private:
+    midi_in_callback_t *midiInCallback = NULL;
+    uint32_t threshold = AUDIO_DEFAULT_THRESHOLD;
+    int16_t history[AUDIO_FFT_SIZE];
+    // Interleaved real and imaginary parts
+    int16_t spectrum[2 * AUDIO_FFT_SIZE];
+    // Key of each bin, 0 when out of the piano range
+    uint8_t bin_note[AUDIO_FFT_SIZE / 2];
+    uint32_t magnitude[128];
+    uint32_t previous_magnitude[128];
+    uint32_t notes_on[4];
+    size_t sendNote(uint8_t note, uint8_t velocity);
+    size_t analyze();
+};
+
+#endif /* _PITCH_DETECTOR_H_ */
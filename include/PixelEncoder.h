@@ -0,0 +1,116 @@
+#ifndef _PIXEL_ENCODER_H_
+#define _PIXEL_ENCODER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/// Types ///
+
+// Order of the color bytes on the wire
+typedef enum : uint8_t {
+  PIXEL_ORDER_RGB = 0,
+  PIXEL_ORDER_GRB,  // WS2812B
+  PIXEL_ORDER_RGBW,
+  PIXEL_ORDER_GRBW, // SK6812 RGBW
+} pixel_order_t;
+
+// Position on the strip of the pixels of the frame
+typedef enum : uint8_t {
+  PIXEL_MAPPING_FORWARD = 0, // First pixel of the frame on the first LED
+  PIXEL_MAPPING_REVERSED,    // Strip wired from the highest key
+} pixel_mapping_t;
+
+/// Functions definition ///
+
+constexpr uint8_t getPixelSize(pixel_order_t order) {
+  return order == PIXEL_ORDER_RGBW || order == PIXEL_ORDER_GRBW ? 4 : 3;
+}
+
+constexpr uint8_t getRedOffset(pixel_order_t order) {
+  return order == PIXEL_ORDER_GRB || order == PIXEL_ORDER_GRBW ? 1 : 0;
+}
+
+constexpr uint8_t getGreenOffset(pixel_order_t order) {
+  return order == PIXEL_ORDER_GRB || order == PIXEL_ORDER_GRBW ? 0 : 1;
+}
+
+/**
+ * Scale the RGB frame by brightness and write it in the wire format of the strip.
+ * White LEDs take the part shared by the 3 colors, it is removed from them.
+ * @param scale brightness from 1 to 256, 256 unchanged
+ */
+template <pixel_order_t Order, pixel_mapping_t Mapping>
+static inline void encodePixels(const uint8_t* frame, uint16_t pixel_count, uint8_t* output, uint16_t scale) {
+  constexpr uint8_t size = getPixelSize(Order);
+  constexpr uint8_t red_offset = getRedOffset(Order);
+  constexpr uint8_t green_offset = getGreenOffset(Order);
+  #pragma GCC unroll 4
+  for (uint16_t i = 0; i < pixel_count; i++) {
+    const uint16_t position = Mapping == PIXEL_MAPPING_REVERSED ? pixel_count - 1 - i : i;
+    uint8_t* pixel = output + position * size;
+    uint8_t red = frame[3 * i] * scale >> 8;
+    uint8_t green = frame[3 * i + 1] * scale >> 8;
+    uint8_t blue = frame[3 * i + 2] * scale >> 8;
+    if (size == 4) {
+      uint8_t white = red < green ? red : green;
+      if (blue < white) white = blue;
+      red -= white;
+      green -= white;
+      blue -= white;
+      pixel[3] = white;
+    }
+    pixel[red_offset] = red;
+    pixel[green_offset] = green;
+    pixel[2] = blue;
+  }
+}
+
+/**
+ * Writes the composed frames into the buffer sent to the strip.
+ * It is called once per frame: the order and the mapping are resolved inside, never per pixel by the caller.
+ */
+class PixelEncoder {
+  public:
+    virtual ~PixelEncoder() {}
+    // @param frame 3 bytes per pixel: red, green, blue
+    // @param output getPixelSize(getOrder()) bytes per pixel
+    virtual void encode(const uint8_t* frame, uint16_t pixel_count, uint8_t* output, uint16_t scale) = 0;
+    virtual pixel_order_t getOrder() = 0;
+};
+
+/**
+ * Order and mapping chosen at runtime, looked up for every pixel like Adafruit_NeoPixel::setPixelColor.
+ */
+class RuntimePixelEncoder : public PixelEncoder {
+  public:
+    RuntimePixelEncoder(pixel_order_t, pixel_mapping_t mapping = PIXEL_MAPPING_FORWARD);
+    void encode(const uint8_t* frame, uint16_t pixel_count, uint8_t* output, uint16_t scale) override;
+    pixel_order_t getOrder() override;
+
+  private:
+    pixel_order_t order;
+    pixel_mapping_t mapping;
+    uint8_t size;
+    uint8_t red_offset;
+    uint8_t green_offset;
+};
+
+/**
+ * Strip fixed at compile time: offsets, pixel size and the loop bound are constants,
+ * so the encoding loop is unrolled without a single branch on the format.
+ * Frames of another size, like a smaller matrix, take the same code with a runtime bound.
+ */
+template <uint16_t PixelCount, pixel_order_t Order, pixel_mapping_t Mapping = PIXEL_MAPPING_FORWARD>
+class StaticPixelEncoder : public PixelEncoder {
+  public:
+    void encode(const uint8_t* frame, uint16_t pixel_count, uint8_t* output, uint16_t scale) override {
+      if (pixel_count == PixelCount) encodePixels<Order, Mapping>(frame, PixelCount, output, scale);
+      else encodePixels<Order, Mapping>(frame, pixel_count, output, scale);
+    }
+
+    pixel_order_t getOrder() override {
+      return Order;
+    }
+};
+
+#endif /* _PIXEL_ENCODER_H_ */
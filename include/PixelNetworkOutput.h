@@ -0,0 +1,62 @@
+#ifndef _PIXEL_NETWORK_OUTPUT_H_
+#define _PIXEL_NETWORK_OUTPUT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#define PIXEL_UNIVERSE_SIZE 170 // RGB pixels in a 512 channels DMX universe, pixels are never split
+#define PIXEL_MAX_UNIVERSES 32
+#define E131_PORT 5568
+#define ARTNET_PORT 6454
+#define E131_HEADER_SIZE 126
+#define ARTNET_HEADER_SIZE 18
+#define PIXEL_MAX_HEADER_SIZE E131_HEADER_SIZE
+// Unchanged universes are still sent at this period so that receivers don't time out
+#define PIXEL_KEEP_ALIVE_US 1000000
+#define PIXEL_SOURCE_NAME_SIZE 64
+
+typedef enum : uint8_t {
+  PIXEL_PROTOCOL_NONE = 0,
+  PIXEL_PROTOCOL_E131,   // sACN, multicast by default
+  PIXEL_PROTOCOL_ARTNET, // ArtDmx, broadcast by default
+} pixel_protocol_t;
+
+/**
+ * Sends RGB frames to remote LED controllers as E1.31 or Art-Net DMX universes.
+ * Packets are sent with a header buffer and a pointer into the frame (scatter/gather),
+ * pixel data is never copied. Only universes whose content changed are sent.
+ * Based on BSD sockets, provided by lwIP on the ESP32, so it also runs on the host.
+ */
+class PixelNetworkOutput {
+  public:
+    PixelNetworkOutput(pixel_protocol_t protocol, uint16_t first_universe = 1);
+    ~PixelNetworkOutput();
+    void setSourceName(const char*);
+    // @param address IPv4 address in host order, 0 for multicast (E1.31) or broadcast (Art-Net)
+    bool begin(uint32_t address = 0, uint16_t port = 0);
+    void end();
+    // Send the universes that changed, frame is packed RGB, return the number of packets sent
+    size_t send(const uint8_t* frame, uint16_t pixel_count, uint32_t now_us);
+    // Write the protocol header of a universe, return its size
+    size_t buildHeader(uint16_t universe_index, uint16_t channel_count, uint8_t* header);
+    uint16_t getUniverseCount(uint16_t pixel_count);
+    uint32_t getSentPackets();
+    uint32_t getSkippedPackets();
+
+  private:
+    pixel_protocol_t protocol;
+    uint16_t first_universe;
+    char source_name[PIXEL_SOURCE_NAME_SIZE];
+    uint8_t cid[16];
+    int output_socket = -1;
+    uint32_t destination_address = 0;
+    uint16_t destination_port = 0;
+    uint8_t sequences[PIXEL_MAX_UNIVERSES];
+    uint32_t hashes[PIXEL_MAX_UNIVERSES];
+    uint32_t last_sent_us[PIXEL_MAX_UNIVERSES];
+    bool has_sent[PIXEL_MAX_UNIVERSES];
+    uint32_t sent_packets = 0;
+    uint32_t skipped_packets = 0;
+};
+
+#endif /* _PIXEL_NETWORK_OUTPUT_H_ */
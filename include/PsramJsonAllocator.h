@@ -0,0 +1,24 @@
+#ifndef _PSRAM_JSON_ALLOCATOR_H_
+#define _PSRAM_JSON_ALLOCATOR_H_
+
+#include <ArduinoJson.h>
+#include <esp_heap_caps.h>
+
+/**
+ * JSON documents of the requests go to PSRAM when there is some: they come and go all session long
+ * and would fragment the internal heap used by WiFi and the USB host.
+ */
+class PsramJsonAllocator : public ArduinoJson::Allocator {
+  public:
+    void* allocate(size_t size) override {
+      return heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+    }
+    void deallocate(void* pointer) override {
+      heap_caps_free(pointer);
+    }
+    void* reallocate(void* pointer, size_t new_size) override {
+      return heap_caps_realloc_prefer(pointer, new_size, 2, MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT);
+    }
+};
+
+#endif /* _PSRAM_JSON_ALLOCATOR_H_ */
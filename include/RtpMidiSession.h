@@ -0,0 +1,83 @@
+#ifndef _RTP_MIDI_SESSION_H_
+#define _RTP_MIDI_SESSION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <midi_types.h>
+#include "MidiJitterBuffer.h"
+
+#define RTP_MIDI_DEFAULT_PORT 5004 // Control port, the data port is the next one
+#define RTP_MIDI_DEFAULT_MAX_LATENCY_MS 10
+#define RTP_MIDI_MAX_PACKET_SIZE 1500
+#define RTP_MIDI_NAME_SIZE 32
+// Cable number given to the packets received from the network
+#define RTP_MIDI_CABLE_NUMBER 1
+// Session is closed when the peer stays silent longer than this (it syncs every 10s)
+#define RTP_MIDI_TIMEOUT_US 60000000UL
+
+/**
+ * RTP-MIDI (AppleMIDI) session listener, as used by macOS, rtpMIDI on Windows and most DAWs.
+ * Accepts one peer at a time. Lost packets are recovered from the recovery journal (RFC 6295)
+ * for the note on/off (chapter N) and sustain (chapter C) states.
+ * Based on BSD sockets, provided by lwIP on the ESP32, so it also runs on the host.
+ */
+class RtpMidiSession {
+  public:
+    RtpMidiSession(const char* name, uint16_t port = RTP_MIDI_DEFAULT_PORT);
+    ~RtpMidiSession();
+    void setMidiInCallback(midi_in_callback_t *);
+    void setMaxLatency(uint32_t max_latency_ms);
+    // Open the sockets
+    bool begin();
+    void end();
+    // Call this often, handles the received packets and sends the events that are due
+    void loop(uint32_t now_us);
+    bool isConnected();
+    uint32_t getLostPackets();
+    uint32_t getRecoveredEvents();
+    MidiJitterBuffer* getJitterBuffer();
+
+  private:
+    midi_in_callback_t *midiInCallback = NULL;
+    char name[RTP_MIDI_NAME_SIZE];
+    uint16_t port;
+    int control_socket = -1;
+    int data_socket = -1;
+    uint32_t ssrc;
+    // Peer
+    bool connected = false;
+    uint32_t peer_ssrc = 0;
+    uint32_t peer_address = 0;
+    uint16_t peer_data_port = 0;
+    uint32_t last_packet_us = 0;
+    // Sequence tracking
+    bool has_sequence = false;
+    uint16_t last_sequence = 0;
+    uint32_t last_feedback_us = 0;
+    bool feedback_pending = false;
+    uint32_t lost_packets = 0;
+    uint32_t recovered_events = 0;
+    // Local clock on 64 bits, for the clock synchronization
+    uint64_t clock_us = 0;
+    uint32_t last_clock_us = 0;
+    // State known from the stream, used to apply the journal
+    uint32_t notes_on[16][4];
+    bool sustain_on[16];
+    MidiJitterBuffer jitter_buffer;
+    uint8_t buffer[RTP_MIDI_MAX_PACKET_SIZE];
+
+    int openSocket(uint16_t socket_port);
+    void receive(int socket, bool is_data, uint32_t now_us);
+    void handleSessionPacket(int socket, bool is_data, const uint8_t* packet, size_t length, uint32_t address, uint16_t from_port, uint32_t now_us);
+    void handleRtpPacket(const uint8_t* packet, size_t length, uint32_t now_us);
+    // Journal events are played at the time of the packet
+    void handleJournal(const uint8_t* journal, size_t length);
+    size_t handleChannelJournal(const uint8_t* journal, size_t length);
+    void sendFeedback();
+    void sendTo(int socket, const uint8_t* packet, size_t length, uint32_t address, uint16_t to_port);
+    // Queue an event delta_us after the timestamp of the packet being handled
+    void emit(uint8_t status, uint8_t data_1, uint8_t data_2, uint32_t delta_us = 0);
+    void disconnect();
+};
+
+#endif /* _RTP_MIDI_SESSION_H_ */
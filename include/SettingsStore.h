@@ -0,0 +1,131 @@
+#ifndef _SETTINGS_STORE_H_
+#define _SETTINGS_STORE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "chord_templates.h"
+
+#define LED_PRESET_VERSION 2
+#define PRESET_COUNT 8
+#define PRESET_NAME_SIZE 16
+// Snapshots published, current and being read included, a writer waits when none is free
+#define SETTINGS_SNAPSHOT_COUNT 4
+#define DEFAULT_LED_COLOR 0xffffff
+#define DEFAULT_BRIGHTNESS 100
+#define DEFAULT_SECONDARY_COLOR 0x0080ff
+#define DEFAULT_SPLIT_KEY 60 // Middle C
+
+/// Types ///
+
+typedef enum : uint8_t {
+  VELOCITY_CURVE_NONE = 0, // Every note at full color
+  VELOCITY_CURVE_LINEAR,
+  VELOCITY_CURVE_SOFT,     // Light touches are already bright
+  VELOCITY_CURVE_HARD,     // Only strong notes are bright
+  VELOCITY_CURVE_COUNT,
+} velocity_curve_t;
+
+typedef enum : uint8_t {
+  PALETTE_SINGLE_COLOR = 0,
+  PALETTE_PITCH_CLASS,   // Color wheel on the circle of fifths
+  PALETTE_RAINBOW,       // Hue from the lowest to the highest key
+  PALETTE_GRADIENT,      // From the secondary color on the lowest key to the color on the highest one
+  PALETTE_HAND_SPLIT,    // Secondary color below the split key
+  PALETTE_CHORD_QUALITY, // Held notes take the color of the chord they form
+  PALETTE_CHORD_ROOT,    // Held notes take the pitch class color of the chord root
+  PALETTE_KEY,           // Pitch class color of the detected key, secondary color for the notes out of the key
+  PALETTE_COUNT,
+} palette_mode_t;
+
+typedef enum : uint8_t {
+  EFFECT_NONE = 0,
+  EFFECT_RIPPLE, // Two waves leave the key in both directions
+  EFFECT_SPARKS, // Short lived sparks scattered around the key
+  EFFECT_COUNT,
+} effect_mode_t;
+
+typedef enum : uint8_t {
+  KEY_MAPPING_TWO_LEDS_PER_KEY = 0, // NoteRenderer::computePixelIndex()
+  KEY_MAPPING_COUNT,
+} key_mapping_t;
+
+/**
+ * Persisted settings, stored as one blob per preset.
+ * The layout is part of the stored data: add fields in the reserved bytes or bump the version.
+ */
+typedef struct {
+  uint8_t version;
+  uint8_t brightness;
+  uint8_t show_sustain;
+  palette_mode_t palette;
+  velocity_curve_t velocity_curve;
+  effect_mode_t effect;
+  key_mapping_t mapping;
+  uint8_t split_key;
+  uint32_t color; // 0x00RRGGBB
+  uint32_t secondary_color;
+  char name[PRESET_NAME_SIZE];
+} led_preset_t;
+
+static_assert(sizeof(led_preset_t) == 32, "led_preset_t is stored as is, its layout must not change");
+
+/**
+ * Settings seen by the render path: the preset and the tables derived from it.
+ * A published snapshot is never modified.
+ */
+typedef struct {
+  // Publication number, a recycled snapshot gets a new one
+  uint32_t sequence;
+  led_preset_t preset;
+  uint8_t velocity_scale[128];
+  // Palette color of each note, and of each chord quality for PALETTE_CHORD_QUALITY
+  uint32_t note_colors[128];
+  uint32_t chord_colors[CHORD_QUALITY_COUNT];
+  // Color wheel used by the chord root and key palettes
+  uint32_t pitch_class_colors[12];
+} led_settings_t;
+
+/**
+ * Holds the current settings snapshot and the presets.
+ * Readers acquire the current snapshot once per operation and get a consistent view of every field.
+ * Writers fill a snapshot that is neither current nor acquired and swap the current pointer,
+ * so a preset switch is a copy of a few hundred bytes and never blocks the render path.
+ */
+class SettingsStore {
+  public:
+    SettingsStore();
+    // Current snapshot, not recycled until it is released
+    const led_settings_t* acquire();
+    void release(const led_settings_t*);
+    // Sequence of the last snapshot published, tells a new publication without acquiring it
+    uint32_t getSequence();
+    // Copy of the current preset, to modify and publish
+    led_preset_t getPreset();
+    // @param selected stored preset the settings come from, it becomes the selected one, -1 if none
+    void publish(const led_preset_t&, int8_t selected = -1);
+    // Publish a stored preset, return false if the slot is empty
+    bool selectPreset(uint8_t index);
+    // Store the current settings in a slot, under name
+    bool savePreset(uint8_t index, const char* name);
+    // Fill a slot, used when loading the presets from the flash
+    bool setStoredPreset(uint8_t index, const led_preset_t&);
+    // NULL if the slot is empty
+    const led_preset_t* getStoredPreset(uint8_t index);
+    // Last selected preset, -1 if none
+    int8_t getSelectedPreset();
+    static led_preset_t defaultPreset();
+    // Check the version and the values of a stored blob and copy it to preset, older versions are upgraded
+    static bool decodePreset(const void* blob, size_t length, led_preset_t* preset);
+
+  private:
+    led_settings_t snapshots[SETTINGS_SNAPSHOT_COUNT];
+    // Readers of each snapshot, SNAPSHOT_WRITING is added while a writer fills it
+    std::atomic<int> readers[SETTINGS_SNAPSHOT_COUNT];
+    std::atomic<const led_settings_t*> current;
+    std::atomic<uint32_t> sequence;
+    led_preset_t presets[PRESET_COUNT];
+    int8_t selected_preset = -1;
+};
+
+#endif /* _SETTINGS_STORE_H_ */
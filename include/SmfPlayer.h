@@ -0,0 +1,120 @@
+#ifndef _SMF_PLAYER_H_
+#define _SMF_PLAYER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <midi_types.h>
+
+#define SMF_MAX_TRACKS 16
+// Bytes cached per track, the file is never loaded whole
+#define SMF_TRACK_BUFFER_SIZE 32
+#define SMF_DEFAULT_TEMPO 500000 // us per quarter note, 120 bpm
+
+/**
+ * Random access byte source the Standard MIDI File is streamed from.
+ */
+class SmfSource {
+  public:
+    virtual ~SmfSource() {}
+    // @return number of bytes actually read
+    virtual size_t read(uint32_t offset, uint8_t* buffer, size_t length) = 0;
+};
+
+/**
+ * File source based on stdio.
+ * On the ESP32, LittleFS is mounted in the VFS so the same code reads from flash and from the host disk.
+ */
+class SmfFileSource : public SmfSource {
+  public:
+    SmfFileSource();
+    ~SmfFileSource();
+    bool open(const char* path);
+    void close();
+    size_t read(uint32_t offset, uint8_t* buffer, size_t length) override;
+  private:
+    FILE* file = NULL;
+};
+
+/**
+ * Source over a buffer already in memory.
+ */
+class SmfMemorySource : public SmfSource {
+  public:
+    SmfMemorySource(const uint8_t* data, size_t size);
+    size_t read(uint32_t offset, uint8_t* buffer, size_t length) override;
+  private:
+    const uint8_t* data;
+    size_t size;
+};
+
+typedef struct {
+  uint32_t start_offset;  // Offset of the first event of the track
+  uint32_t offset;        // Offset of the next byte to parse
+  uint32_t end_offset;    // Offset of the end of the track chunk
+  uint32_t buffer_offset; // Offset of buffer[0] in the file
+  uint8_t buffer_length;
+  uint8_t running_status;
+  uint32_t tick;          // Absolute tick of the pending event
+  uint8_t buffer[SMF_TRACK_BUFFER_SIZE];
+} smf_track_cursor_t;
+
+/**
+ * Standard MIDI File type 0 and 1 player.
+ * Tracks are read incrementally through small per-track cursors, merged in time order with a min heap.
+ * Channel events are returned as USB MIDI packets, so they can go through the USB input path.
+ */
+class SmfPlayer {
+  public:
+    SmfPlayer();
+    ~SmfPlayer();
+    // Parse the header and locate the tracks, the source must outlive the player
+    bool open(SmfSource*);
+    void close();
+    void rewind();
+    // Next channel event with its time from the beginning of the song
+    bool nextEvent(timed_midi_packet*);
+    uint16_t getTrackCount();
+    // Tracks of the file past SMF_MAX_TRACKS, not played
+    uint16_t getSkippedTrackCount();
+    uint32_t getTempo();
+
+    // Real time playback, times are in us from any monotonic clock
+    // start_us can be in the future to delay the song
+    void start(uint32_t start_us);
+    // Stop playing and release the notes still on
+    void stop(midi_in_callback_t*);
+    bool isPlaying();
+    // Send every event due at now_us to the callback, return the number of events sent
+    size_t update(uint32_t now_us, midi_in_callback_t*);
+
+  private:
+    SmfSource* source = NULL;
+    uint16_t track_count = 0;
+    uint16_t skipped_track_count = 0;
+    int16_t division = 0;
+    smf_track_cursor_t tracks[SMF_MAX_TRACKS];
+    // Min heap of track indexes, ordered by pending event tick
+    uint8_t heap[SMF_MAX_TRACKS];
+    uint8_t heap_size = 0;
+    uint32_t tempo = SMF_DEFAULT_TEMPO;
+    uint32_t tempo_tick = 0;
+    uint32_t tempo_time_us = 0;
+    // Playback state
+    bool playing = false;
+    uint32_t start_us = 0;
+    bool has_pending = false;
+    timed_midi_packet pending;
+    uint32_t notes_on[4];
+
+    int readByte(smf_track_cursor_t*);
+    bool readVarLen(smf_track_cursor_t*, uint32_t*);
+    bool readDeltaTime(smf_track_cursor_t*);
+    uint32_t tickToTime(uint32_t tick);
+    void heapPush(uint8_t track);
+    uint8_t heapPop();
+    void heapSiftDown(uint8_t index);
+    bool heapLess(uint8_t a, uint8_t b);
+};
+
+#endif /* _SMF_PLAYER_H_ */
@@ -0,0 +1,129 @@
+#ifndef _TRACE_RECORDER_H_
+#define _TRACE_RECORDER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "MemoryArena.h"
+
+// Events kept by the ring, 8 bytes each
+#define TRACE_DEFAULT_CAPACITY 16384
+// Ring used when the arena has no room
+#define TRACE_FALLBACK_CAPACITY 1024
+// Tasks told apart in the trace, the next ones share the last slot
+#define TRACE_MAX_THREADS 16
+#define TRACE_THREAD_NAME_LENGTH 16
+
+/// Types ///
+
+typedef enum : uint8_t {
+  TRACE_SPAN_LOOP = 0,       // Arduino loop()
+  TRACE_SPAN_SERVER,         // Web server and WebSocket clients
+  TRACE_SPAN_MIDI_EVENT,     // A MIDI event handled by the LEDs, whatever its input
+  TRACE_SPAN_SHOW,           // LedController::show()
+  TRACE_SPAN_RENDER,         // Frame composition
+  TRACE_SPAN_PIXEL_OUTPUT,   // Frame sent to the network controllers
+  TRACE_SPAN_PUSH,           // Frame copied to the strip buffer
+  TRACE_SPAN_STRIP,          // Frame sent to the strip
+  TRACE_SPAN_USB_TRANSFER,   // MIDI IN transfer completed, in classDriverTask
+  TRACE_SPAN_AUDIO_BLOCK,    // Pitch detection of a microphone block
+  TRACE_SPAN_FRAME_LATE,     // Instant: an animation frame came a period late
+  TRACE_SPAN_COUNT,
+} trace_span_t;
+
+typedef enum : uint8_t {
+  TRACE_PHASE_BEGIN = 0,
+  TRACE_PHASE_END,
+  TRACE_PHASE_INSTANT,
+} trace_phase_t;
+
+typedef struct {
+  uint32_t time_us;
+  trace_span_t span;
+  trace_phase_t phase;
+  uint8_t thread;
+  uint8_t core;
+} trace_event_t;
+
+// Receives the exported trace piece by piece
+typedef void trace_writer_t(const char* data, size_t length, void* context);
+
+/**
+ * Begin and end events of the pipeline stages, recorded from every task and both cores into a ring,
+ * the oldest events are overwritten. Recording an event is a few instructions and never locks:
+ * a slot is reserved with an atomic increment.
+ * The trace is exported as Chrome trace JSON, to be opened in Perfetto or chrome://tracing,
+ * with a track per task and the core of each event in its arguments.
+ */
+class TraceRecorder {
+  public:
+    // @param capacity rounded down to a power of 2
+    // @param memory arena of the ring, meant to be in PSRAM
+    TraceRecorder(size_t capacity = TRACE_DEFAULT_CAPACITY, MemoryArena* memory = NULL);
+    ~TraceRecorder();
+    void begin(trace_span_t);
+    void end(trace_span_t);
+    void instant(trace_span_t);
+    void setRecording(bool);
+    bool isRecording();
+    // Forget the recorded events
+    void clear();
+    // Events in the ring
+    size_t getEventCount();
+    size_t getCapacity();
+    // Events overwritten since the last clear
+    uint32_t getOverwrittenCount();
+    // Write the events as Chrome trace JSON, the recording is paused meanwhile
+    // Return the number of bytes written
+    size_t exportChromeJson(trace_writer_t* writer, void* context);
+    static const char* getSpanName(trace_span_t);
+
+  private:
+    trace_event_t* events;
+    bool owns_events;
+    size_t capacity;
+    std::atomic<uint32_t> next_event{0};
+    std::atomic<bool> recording{true};
+    std::atomic<uint8_t> thread_count{0};
+    char thread_names[TRACE_MAX_THREADS][TRACE_THREAD_NAME_LENGTH];
+    void record(trace_span_t, trace_phase_t);
+    uint8_t getThread();
+};
+
+/// Functions declaration ///
+
+// Recorder used by the trace functions below, NULL disables them
+void setTraceRecorder(TraceRecorder*);
+TraceRecorder* getTraceRecorder();
+
+/// Variables ///
+
+extern TraceRecorder* active_trace_recorder;
+
+/// Functions definition ///
+
+static inline void traceBegin(trace_span_t span) {
+  if (active_trace_recorder != NULL) active_trace_recorder->begin(span);
+}
+
+static inline void traceEnd(trace_span_t span) {
+  if (active_trace_recorder != NULL) active_trace_recorder->end(span);
+}
+
+static inline void traceInstant(trace_span_t span) {
+  if (active_trace_recorder != NULL) active_trace_recorder->instant(span);
+}
+
+/**
+ * Span of a block of code.
+ */
+class TraceScope {
+  public:
+    TraceScope(trace_span_t trace_span) : span(trace_span) { traceBegin(span); }
+    ~TraceScope() { traceEnd(span); }
+
+  private:
+    trace_span_t span;
+};
+
+#endif /* _TRACE_RECORDER_H_ */
@@ -0,0 +1,63 @@
+#ifndef _USB_DEVICE_CACHE_H_
+#define _USB_DEVICE_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Keyboards remembered, the least recently connected one is forgotten first
+#define USB_DEVICE_CACHE_SIZE 8
+#define USB_DEVICE_CACHE_VERSION 1
+#define USB_DEVICE_CACHE_DATA_SIZE (2 + USB_DEVICE_CACHE_SIZE * sizeof(usb_device_profile_t))
+
+/// Types ///
+
+// MIDI layout of a device, found once by walking its configuration descriptor
+typedef struct {
+  uint16_t vendor_id;
+  uint16_t product_id;
+  // Hash of the serial number string, 0 when the device has none
+  uint32_t serial_hash;
+  uint8_t configuration;
+  uint8_t interface_number;
+  uint8_t alternate_setting;
+  uint8_t in_endpoint;
+  uint16_t in_max_packet_size;
+  // 0 when the device has no MIDI OUT endpoint
+  uint8_t out_endpoint;
+  uint8_t reserved;
+  uint16_t out_max_packet_size;
+  // Order of the connections, the oldest entry is replaced
+  uint16_t last_used;
+} usb_device_profile_t;
+
+/**
+ * MIDI layouts of the devices already seen, so that a keyboard plugged back in is claimed
+ * without walking its descriptors again. Saved as a blob in NVS by UsbMidiHost.
+ * Used by the USB class driver task only, besides loading at setup.
+ */
+class UsbDeviceCache {
+  public:
+    UsbDeviceCache();
+    // NULL when the device is unknown
+    const usb_device_profile_t* find(uint16_t vendor_id, uint16_t product_id, uint32_t serial_hash);
+    // Add or update the profile of a device, marks it as the most recent
+    void store(usb_device_profile_t);
+    // Forget a device whose profile no longer works
+    void remove(uint16_t vendor_id, uint16_t product_id, uint32_t serial_hash);
+    void clear();
+    uint8_t getCount();
+    // Return the size written, 0 if size is too small
+    size_t save(uint8_t* data, size_t size);
+    // Return false if the data is from another version, the cache is then empty
+    bool load(const uint8_t* data, size_t length);
+    // FNV-1a of a string descriptor
+    static uint32_t hashSerial(const uint8_t* data, size_t length);
+
+  private:
+    usb_device_profile_t profiles[USB_DEVICE_CACHE_SIZE];
+    uint8_t count = 0;
+    uint16_t use_counter = 0;
+    int indexOf(uint16_t vendor_id, uint16_t product_id, uint32_t serial_hash);
+};
+
+#endif /* _USB_DEVICE_CACHE_H_ */
@@ -0,0 +1,77 @@
+#ifndef _USB_MIDI_DESCRIPTOR_H_
+#define _USB_MIDI_DESCRIPTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#define USB_MIDI_MAX_INTERFACES 4
+#define USB_MIDI_MAX_ENDPOINTS 4
+#define USB_MIDI_MAX_JACKS 32
+// A USB MIDI endpoint carries at most 16 virtual cables
+#define USB_MIDI_MAX_CABLES 16
+
+/// Types ///
+
+typedef enum : uint8_t {
+  USB_DESCRIPTOR_OK = 0,
+  // Not a configuration descriptor, or shorter than its header
+  USB_DESCRIPTOR_INVALID_HEADER,
+  // A descriptor is shorter than 2 bytes or goes past the end, the walk stops there
+  // and the topology holds what was found before
+  USB_DESCRIPTOR_INVALID_LENGTH,
+  // Well formed, but without a MIDI streaming interface having a bulk IN endpoint
+  USB_DESCRIPTOR_NO_MIDI,
+} usb_descriptor_status_t;
+
+typedef struct {
+  uint8_t number;
+  uint8_t alternate_setting;
+} usb_midi_interface_t;
+
+typedef struct {
+  uint8_t address;
+  uint16_t max_packet_size;
+  // Index in usb_midi_topology_t::interfaces
+  uint8_t interface_index;
+  // Embedded jacks of the endpoint, one per virtual cable
+  uint8_t cable_count;
+} usb_midi_endpoint_t;
+
+typedef struct {
+  uint8_t id;
+  // true for a MIDI IN jack, false for a MIDI OUT jack
+  bool input;
+  // true for an embedded jack (USB side), false for an external one (DIN side)
+  bool embedded;
+} usb_midi_jack_t;
+
+// MIDI part of a configuration descriptor, anything past the limits is counted in dropped_count but not kept
+typedef struct {
+  usb_midi_interface_t interfaces[USB_MIDI_MAX_INTERFACES];
+  uint8_t interface_count;
+  usb_midi_endpoint_t in_endpoints[USB_MIDI_MAX_ENDPOINTS];
+  uint8_t in_endpoint_count;
+  usb_midi_endpoint_t out_endpoints[USB_MIDI_MAX_ENDPOINTS];
+  uint8_t out_endpoint_count;
+  usb_midi_jack_t jacks[USB_MIDI_MAX_JACKS];
+  uint8_t jack_count;
+  // Largest number of cables of an IN endpoint
+  uint8_t cable_count;
+  // Descriptors walked, bounded by the length: every descriptor is at least 2 bytes
+  uint16_t descriptor_count;
+  // MIDI interfaces, bulk endpoints and jacks past the limits. Those of an interface not kept are not counted
+  uint16_t dropped_count;
+} usb_midi_topology_t;
+
+/// Functions declaration ///
+
+/**
+ * Find the MIDI streaming interfaces of a configuration descriptor, their bulk endpoints and jacks.
+ * Pure function: nothing is claimed, the device is not touched, so it runs on the host.
+ * Every descriptor advances the walk by at least 2 bytes, the cost is linear in the length.
+ * @param data whole configuration descriptor, wTotalLength is only trusted within length
+ */
+usb_descriptor_status_t parseUsbMidiTopology(const uint8_t* data, size_t length, usb_midi_topology_t* topology);
+const char* getUsbDescriptorStatusName(usb_descriptor_status_t);
+
+#endif /* _USB_MIDI_DESCRIPTOR_H_ */
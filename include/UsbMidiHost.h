@@ -3,15 +3,68 @@
 
 #include <midi_types.h>
 #include <cstddef>
+#include "UsbDeviceCache.h"
+#include "MidiOutQueue.h"
+
+// Packets received between two loop(), a bulk transfer brings 16 at most
+#define USB_MIDI_IN_QUEUE_LENGTH 256
+
+/// Types ///
+
+// Last connection of a keyboard, written by the USB class driver task, read with UsbMidiHost::getStats()
+typedef struct {
+  uint32_t connections;
+  // Connections claimed from a cached profile
+  uint32_t cache_hits;
+  bool connected;
+  bool cached;
+  // Time of the last connection, from esp_timer
+  int64_t connect_us;
+  // From the connection to the MIDI IN transfer submitted
+  uint32_t setup_us;
+  // From the connection to the first note played, 0 until then
+  uint32_t first_note_us;
+  // The device has a MIDI OUT endpoint, packets can be sent to it
+  bool midi_out;
+} usb_connection_stats_t;
+
+// Shared with the class driver task
+typedef struct {
+  // Called by the class driver task for each packet received
+  midi_in_callback_t* midi_in_callback;
+  UsbDeviceCache* device_cache;
+  usb_connection_stats_t* stats;
+  // Emptied into the MIDI OUT endpoint by the class driver task
+  MidiOutQueue* midi_out;
+  // Called by the class driver task when a new profile has been cached
+  void (*device_cache_changed)(UsbDeviceCache*);
+} usb_class_driver_config_t;
 
 class UsbMidiHost {
   public:
     UsbMidiHost();
     ~UsbMidiHost();
+    // The callback runs in loop(), the task of the other inputs, never in the USB tasks
     void setMidiInCallback(midi_in_callback_t *);
+    // Loads the device profiles saved in NVS, then starts the USB tasks
     void setup();
+    // Call this in loop(), sends the packets received since the last call to the callback
+    void loop();
+    // Packets lost because loop() didn't empty the queue in time
+    uint32_t getDroppedPackets();
+    usb_connection_stats_t getStats();
+    uint8_t getCachedDeviceCount();
+    // Queue a packet for the MIDI OUT endpoint of the keyboard, from any task, never blocks
+    // Return false when no device takes MIDI in, or the queue is full
+    bool send(midi_usb_packet);
+    // Packets are batched into bulk OUT transfers by the class driver task
+    MidiOutQueue* getMidiOut();
   private:
     midi_in_callback_t *midiInCallback = NULL;
+    UsbDeviceCache device_cache;
+    usb_connection_stats_t stats = {};
+    MidiOutQueue midi_out;
+    usb_class_driver_config_t driver_config;
 };
 
 #endif /* _USB_MIDI_HOST_H_ */
@@ -0,0 +1,32 @@
+#ifndef _WAV_FILE_H_
+#define _WAV_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+/**
+ * Reader of 16 bit PCM WAV files, used to feed recorded audio to the pitch detection on the host.
+ * Stereo files are mixed down to mono.
+ */
+class WavFile {
+  public:
+    WavFile();
+    ~WavFile();
+    // Return false if the file is not a 16 bit PCM WAV file
+    bool open(const char* path);
+    void close();
+    uint32_t getSampleRate();
+    uint16_t getChannelCount();
+    // Read up to count mono samples, return the number of samples read
+    size_t read(int16_t* samples, size_t count);
+
+  private:
+    FILE* file = NULL;
+    uint32_t sample_rate = 0;
+    uint16_t channel_count = 0;
+    // Bytes of sample data left in the data chunk
+    uint32_t data_left = 0;
+};
+
+#endif /* _WAV_FILE_H_ */
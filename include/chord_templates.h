@@ -0,0 +1,107 @@
+#ifndef _CHORD_TEMPLATES_H_
+#define _CHORD_TEMPLATES_H_
+
+#include <cstdint>
+
+// Pitch class sets are 12 bits masks, bit 0 is C
+#define PITCH_CLASS_MASK 0x0fff
+// Pitch classes of the C major scale, also the A minor natural scale
+#define MAJOR_SCALE_TEMPLATE 0x0ab5
+
+/// Types ///
+
+typedef enum : uint8_t {
+  CHORD_QUALITY_NONE = 0, // Less than 3 pitch classes or no template matched
+  CHORD_QUALITY_MAJOR,
+  CHORD_QUALITY_MINOR,
+  CHORD_QUALITY_DIMINISHED,
+  CHORD_QUALITY_AUGMENTED,
+  CHORD_QUALITY_SUSPENDED,
+  CHORD_QUALITY_DOMINANT_7,
+  CHORD_QUALITY_MAJOR_7,
+  CHORD_QUALITY_MINOR_7,
+  CHORD_QUALITY_COUNT,
+} chord_quality_t;
+
+typedef struct {
+  chord_quality_t quality;
+  uint8_t root; // Pitch class, 0 is C
+} chord_t;
+
+typedef struct {
+  uint8_t tonic; // Pitch class, 0 is C
+  bool minor;
+  bool valid;    // False until enough notes have been played
+} musical_key_t;
+
+/// Functions definition ///
+
+/**
+ * Pitch classes of each quality with the root on C, indexed by chord_quality_t.
+ */
+static inline uint16_t getChordTemplate(chord_quality_t quality) {
+  static const uint16_t templates[CHORD_QUALITY_COUNT] = {
+    0,
+    (1 << 0) | (1 << 4) | (1 << 7),
+    (1 << 0) | (1 << 3) | (1 << 7),
+    (1 << 0) | (1 << 3) | (1 << 6),
+    (1 << 0) | (1 << 4) | (1 << 8),
+    (1 << 0) | (1 << 5) | (1 << 7),
+    (1 << 0) | (1 << 4) | (1 << 7) | (1 << 10),
+    (1 << 0) | (1 << 4) | (1 << 7) | (1 << 11),
+    (1 << 0) | (1 << 3) | (1 << 7) | (1 << 10),
+  };
+  return templates[quality];
+}
+
+static inline uint16_t rotatePitchClasses(uint16_t pitch_classes, uint8_t semitones) {
+  return ((pitch_classes << semitones) | (pitch_classes >> (12 - semitones))) & PITCH_CLASS_MASK;
+}
+
+/**
+ * Find the chord formed by a set of pitch classes.
+ * Every note of a template must be held, the template covering the most held notes wins,
+ * so C E G B is a major 7th and not a C major or an E minor.
+ */
+static inline chord_t matchChord(uint16_t pitch_classes) {
+  chord_t chord = { CHORD_QUALITY_NONE, 0 };
+  const int held = __builtin_popcount(pitch_classes);
+  if (held < 3) return chord;
+  int best_score = 0;
+  for (uint8_t root = 0; root < 12; root++) {
+    if (!(pitch_classes & (1 << root))) continue;
+    for (uint8_t quality = CHORD_QUALITY_MAJOR; quality < CHORD_QUALITY_COUNT; quality++) {
+      const uint16_t chord_template = rotatePitchClasses(getChordTemplate((chord_quality_t)quality), root);
+      if (chord_template & ~pitch_classes) continue;
+      // Extra held notes lower the score
+      const int score = 2 * __builtin_popcount(chord_template) - held;
+      if (score > best_score) {
+        best_score = score;
+        chord.quality = (chord_quality_t)quality;
+        chord.root = root;
+      }
+    }
+  }
+  return chord;
+}
+
+/**
+ * Pitch classes of the scale of a key, a minor key uses the natural minor scale.
+ */
+static inline uint16_t getScaleTemplate(musical_key_t key) {
+  // A minor has the notes of C major, 3 semitones up
+  const uint8_t major_tonic = key.minor ? (key.tonic + 3) % 12 : key.tonic;
+  return rotatePitchClasses(MAJOR_SCALE_TEMPLATE, major_tonic);
+}
+
+static inline const char* getPitchClassName(uint8_t pitch_class) {
+  static const char* names[12] = { "C", "C#", "D", "Eb", "E", "F", "F#", "G", "Ab", "A", "Bb", "B" };
+  return names[pitch_class % 12];
+}
+
+static inline const char* getChordQualityName(chord_quality_t quality) {
+  static const char* names[CHORD_QUALITY_COUNT] = { "", "major", "minor", "dim", "aug", "sus", "7", "maj7", "m7" };
+  return quality < CHORD_QUALITY_COUNT ? names[quality] : "";
+}
+
+#endif /* _CHORD_TEMPLATES_H_ */
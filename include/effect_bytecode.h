@@ -0,0 +1,136 @@
+#ifndef _EFFECT_BYTECODE_H_
+#define _EFFECT_BYTECODE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bytecode of the user effect scripts, run by EffectVm and produced by EffectCompiler.
+ *
+ *   bytes 0-1   magic "PX"
+ *   byte 2      bytecode version
+ *   byte 3      run mode, see effect_run_mode_t
+ *   byte 4...   instructions of 4 bytes: opcode, a, b, c
+ *
+ * a, b and c are register numbers, or b and c form a big endian 16 bits immediate.
+ * Programs are validated once when loaded (opcodes, registers, jump targets), so the
+ * interpreter doesn't check them again.
+ */
+
+#define EFFECT_BYTECODE_VERSION 1
+#define EFFECT_HEADER_SIZE 4
+#define EFFECT_INSTRUCTION_SIZE 4
+#define EFFECT_MAX_INSTRUCTIONS 256
+#define EFFECT_MAX_BYTECODE_SIZE (EFFECT_HEADER_SIZE + EFFECT_MAX_INSTRUCTIONS * EFFECT_INSTRUCTION_SIZE)
+#define EFFECT_REGISTER_COUNT 16
+
+/// Types ///
+
+// How many times a program runs per frame, and what it gets in its registers
+typedef enum : uint8_t {
+  // Once per pixel: r0 pixel, r1 pixel count, r2 time in ms, r3 color of the notes under the pixel
+  EFFECT_RUN_PER_PIXEL = 0,
+  // Once per pressed note: r0 note, r1 velocity, r2 time in ms, r3 ms since the press,
+  // r4 pixel of the note, r5 color of the note
+  EFFECT_RUN_PER_NOTE,
+  EFFECT_RUN_MODE_COUNT,
+} effect_run_mode_t;
+
+typedef enum : uint8_t {
+  EFFECT_OP_HALT = 0, // End of this run
+  EFFECT_OP_LDI,      // ra = signed imm16
+  EFFECT_OP_LDH,      // High half of ra = imm16
+  EFFECT_OP_MOV,      // ra = rb
+  EFFECT_OP_ADD,      // ra = rb + rc
+  EFFECT_OP_SUB,
+  EFFECT_OP_MUL,
+  EFFECT_OP_DIV,      // 0 when rc is 0
+  EFFECT_OP_MOD,      // 0 when rc is 0
+  EFFECT_OP_AND,
+  EFFECT_OP_OR,
+  EFFECT_OP_XOR,
+  EFFECT_OP_SHL,      // Shift by rc & 31
+  EFFECT_OP_SHR,      // Arithmetic
+  EFFECT_OP_MIN,
+  EFFECT_OP_MAX,
+  EFFECT_OP_SLT,      // ra = rb < rc
+  EFFECT_OP_SEQ,      // ra = rb == rc
+  EFFECT_OP_ADDI,     // ra = rb + signed c
+  EFFECT_OP_JMP,      // Jump to imm16
+  EFFECT_OP_JZ,       // Jump to imm16 if ra is 0
+  EFFECT_OP_JNZ,
+  EFFECT_OP_HUE,      // ra = color of hue rb in degrees
+  EFFECT_OP_SCALE,    // ra = color rb scaled by rc, 255 unchanged
+  EFFECT_OP_BLEND,    // ra = blend from color ra to color rb at position rc, 0 to 255
+  EFFECT_OP_SIN,      // ra = sine of rb, 256 per turn, from -127 to 127
+  EFFECT_OP_RND,      // ra = random from 0 to 65535
+  EFFECT_OP_PX,       // Pixel ra = color rb, ignored out of the strip
+  EFFECT_OP_COUNT,
+} effect_opcode_t;
+
+typedef struct {
+  uint8_t op;
+  uint8_t a;
+  uint8_t b;
+  uint8_t c;
+} effect_instruction_t;
+
+/// Functions definition ///
+
+static inline int16_t getEffectImmediate(effect_instruction_t instruction) {
+  return (int16_t)((instruction.b << 8) | instruction.c);
+}
+
+/**
+ * Registers used by an instruction: bit 0 for a, bit 1 for b, bit 2 for c.
+ */
+static inline uint8_t getEffectRegisterOperands(uint8_t op) {
+  switch (op) {
+    case EFFECT_OP_HALT:
+    case EFFECT_OP_JMP:
+      return 0;
+    case EFFECT_OP_LDI:
+    case EFFECT_OP_LDH:
+    case EFFECT_OP_JZ:
+    case EFFECT_OP_JNZ:
+    case EFFECT_OP_RND:
+      return 0x1;
+    case EFFECT_OP_MOV:
+    case EFFECT_OP_ADDI:
+    case EFFECT_OP_HUE:
+    case EFFECT_OP_SIN:
+    case EFFECT_OP_PX:
+      return 0x3;
+    default:
+      return 0x7;
+  }
+}
+
+static inline bool isEffectJump(uint8_t op) {
+  return op == EFFECT_OP_JMP || op == EFFECT_OP_JZ || op == EFFECT_OP_JNZ;
+}
+
+/**
+ * Check a whole program before it is run.
+ * @return number of instructions, 0 if the program is invalid
+ */
+static inline size_t validateEffectBytecode(const uint8_t* bytecode, size_t length) {
+  if (length <= EFFECT_HEADER_SIZE || length > EFFECT_MAX_BYTECODE_SIZE) return 0;
+  if ((length - EFFECT_HEADER_SIZE) % EFFECT_INSTRUCTION_SIZE != 0) return 0;
+  if (bytecode[0] != 'P' || bytecode[1] != 'X' || bytecode[2] != EFFECT_BYTECODE_VERSION) return 0;
+  if (bytecode[3] >= EFFECT_RUN_MODE_COUNT) return 0;
+  const size_t count = (length - EFFECT_HEADER_SIZE) / EFFECT_INSTRUCTION_SIZE;
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t* instruction = bytecode + EFFECT_HEADER_SIZE + i * EFFECT_INSTRUCTION_SIZE;
+    const uint8_t op = instruction[0];
+    if (op >= EFFECT_OP_COUNT) return 0;
+    const uint8_t operands = getEffectRegisterOperands(op);
+    for (uint8_t j = 0; j < 3; j++) {
+      if ((operands & (1 << j)) && instruction[1 + j] >= EFFECT_REGISTER_COUNT) return 0;
+    }
+    if (isEffectJump(op) && (size_t)((instruction[2] << 8) | instruction[3]) >= count) return 0;
+  }
+  return count;
+}
+
+#endif /* _EFFECT_BYTECODE_H_ */
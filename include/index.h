@@ -1,15 +1,11 @@
 #ifndef INDEX_H
 #define INDEX_H
 
-#include <string>
-// #include <iostream>
-#include <sstream>
+// The page stays in flash and is sent part by part, with the current settings between the parts:
+// red, green, blue, brightness, then sustain ("true" or "false")
+#define HTML_PAGE_VALUE_COUNT 5
 
-std::string getHtmlPage(char* brightness, char* red, char* green, char* blue, bool showSustain) {
-  std::stringstream htmlStream;
-  const char* sustainCheckedProp = showSustain ? "true" : "false";
-  
-  htmlStream << R"__(
+static const char html_page_start[] = R"__(
 <!DOCTYPE html>
 <html>
 <head>
@@ -99,6 +95,10 @@ std::string getHtmlPage(char* brightness, char* red, char* green, char* blue, bo
       width: 1rem;
       height: 1rem;
     }
+    #benchmark-result {
+      font-size: 0.6rem;
+      white-space: pre-wrap;
+    }
   </style>
 </head>
 
@@ -137,7 +137,7 @@ std::string getHtmlPage(char* brightness, char* red, char* green, char* blue, bo
         <p id="brightness-value" ></p>
       </div>
       <div class="brightness-container">
-        <input type="range" min="0" max="255" id="brightness-slider" oninput="updateBrightness()" onchange="postBrightness()" />
+        <input type="range" min="0" max="255" id="brightness-slider" oninput="postBrightness()" />
       </div>
     </div>
 
@@ -148,6 +148,79 @@ std::string getHtmlPage(char* brightness, char* red, char* green, char* blue, bo
         <label for="sustain">Show sustain on sides</label>
     </div>
 
+    <div>
+      <h2>Palette:</h2>
+      <select id="palette-mode" onchange="postPalette()">
+        <option value="0">Single color</option>
+        <option value="1">Pitch class wheel</option>
+        <option value="2">Rainbow</option>
+        <option value="3">Gradient</option>
+        <option value="4">Hand split</option>
+        <option value="5">Chord quality</option>
+        <option value="6">Chord root</option>
+        <option value="7">Key</option>
+      </select>
+      <p>
+        <label for="secondary-color">Second color</label>
+        <input type="color" id="secondary-color" onchange="postPalette()" />
+      </p>
+      <p>
+        <label for="split-key">Split key</label>
+        <input type="number" id="split-key" min="0" max="127" onchange="postPalette()" />
+      </p>
+    </div>
+
+    <div>
+      <h2>Effect:</h2>
+      <select id="effect" onchange="postEffect()">
+        <option value="0">None</option>
+        <option value="1">Ripples</option>
+        <option value="2">Sparks</option>
+      </select>
+    </div>
+
+    <div>
+      <h2>Velocity:</h2>
+      <select id="velocity-curve" onchange="postVelocityCurve()">
+        <option value="0">Ignored</option>
+        <option value="1">Linear</option>
+        <option value="2">Soft</option>
+        <option value="3">Hard</option>
+      </select>
+    </div>
+
+    <div>
+      <h2>Presets:</h2>
+      <select id="preset-select" onchange="selectPreset()"></select>
+      <input type="text" id="preset-name" placeholder="Name" maxlength="15" />
+      <button onclick="savePreset()">Save</button>
+    </div>
+
+    <div>
+      <h2>MIDI files:</h2>
+      <select id="file-select"></select>
+      <button onclick="postPlay()">Play</button>
+      <button onclick="postLearn('wait')">Learn</button>
+      <button onclick="postLearn('follow')">Learn in time</button>
+      <button onclick="postStop()">Stop</button>
+    </div>
+
+    <div>
+      <h2>Recording:</h2>
+      <button onclick="postRecord(true)">Record</button>
+      <button onclick="postRecord(false)">Stop</button>
+      <a href="recording.mid" download>Download</a>
+      <p id="record-status"></p>
+    </div>
+
+    <div>
+      <h2>Benchmark:</h2>
+      <button id="benchmark-button" onclick="postBenchmark()">
+        Run benchmark
+      </button>
+      <pre id="benchmark-result"></pre>
+    </div>
+
   </div>
 </body>
 
@@ -158,10 +231,57 @@ std::string getHtmlPage(char* brightness, char* red, char* green, char* blue, bo
   const blueInput = document.getElementById("blue-input");
   const currentColorIndicator = document.getElementById("current-color");
 
+  // Binary settings messages, see settings_protocol.h
+  const SETTINGS_PROTOCOL_VERSION = 1;
+  const SETTINGS_FIELD_COLOR = 1;
+  const SETTINGS_FIELD_BRIGHTNESS = 2;
+  const SETTINGS_FIELD_SHOW_SUSTAIN = 3;
+  const SETTINGS_FIELD_PRESET = 4;
+  const SETTINGS_FIELD_VELOCITY_CURVE = 5;
+  const SETTINGS_FIELD_PALETTE = 6;
+  const SETTINGS_FIELD_SECONDARY_COLOR = 7;
+  const SETTINGS_FIELD_SPLIT_KEY = 8;
+  const SETTINGS_FIELD_EFFECT = 9;
+
+  var settingsSocket = null;
+
+  const openSettingsSocket = () => {
+    settingsSocket = new WebSocket(`ws://${location.hostname}:81/`);
+    settingsSocket.binaryType = "arraybuffer";
+    settingsSocket.onclose = () => setTimeout(openSettingsSocket, 2000);
+  }
+
+  openSettingsSocket();
+
+  // fields: list of [field id, value], useHttp to wait until they are applied
+  const sendSettings = async (fields, useHttp = false) => {
+    const message = new DataView(new ArrayBuffer(1 + 5 * fields.length));
+    message.setUint8(0, SETTINGS_PROTOCOL_VERSION);
+    fields.forEach(([field, value], i) => {
+      message.setUint8(1 + 5 * i, field);
+      message.setUint32(2 + 5 * i, value);
+    });
+    if (!useHttp && settingsSocket.readyState == WebSocket.OPEN) {
+      settingsSocket.send(message.buffer);
+      return;
+    }
+    await fetch("settings", {
+      method: "POST",
+      headers: { "Content-Type": "application/octet-stream" },
+      body: message.buffer,
+    });
+  }
+
   var currentColor = {
-    red: )__" << red << R"__(,
-    green: )__" << green << R"__(,
-    blue: )__" << blue << R"__(,
+    red: )__";
+
+static const char html_page_after_red[] = R"__(,
+    green: )__";
+
+static const char html_page_after_green[] = R"__(,
+    blue: )__";
+
+static const char html_page_after_blue[] = R"__(,
   };
 
   const updateColorValues = () => {
@@ -257,12 +377,8 @@ std::string getHtmlPage(char* brightness, char* red, char* green, char* blue, bo
   }
 
   const postColor = async (red, green, blue) => {
-    const body = { red, green, blue };
-    console.log("New color: ", JSON.stringify(body));
-    await fetch("color", {
-      method: "POST",
-      body: JSON.stringify(body),
-    });
+    console.log("New color: ", red, green, blue);
+    await sendSettings([[SETTINGS_FIELD_COLOR, (red << 16) | (green << 8) | blue]]);
     currentColor = { red, green, blue };
     updateColorValues();
   }
@@ -279,38 +395,198 @@ std::string getHtmlPage(char* brightness, char* red, char* green, char* blue, bo
   const brightnessInput = document.getElementById("brightness-slider");
   const brightnessValue = document.getElementById("brightness-value");
 
-  brightnessValue.innerHTML = )__" << brightness << R"__(;
-  brightnessInput.value = brightnessValue.innerHTML;
+  brightnessValue.innerHTML = )__";
 
-  const updateBrightness = () => {
-    brightnessValue.innerHTML = brightnessInput.value;
-  }
+static const char html_page_after_brightness[] = R"__(;
+  brightnessInput.value = brightnessValue.innerHTML;
 
+  // Sent on every slider move, the firmware only writes the last value to flash
   const postBrightness = async () => {
-    const brightness = brightnessInput.value;
-    console.log("New brightness: ", brightness);
-    await fetch("brightness", {
-      method: "POST",
-      body: JSON.stringify({ brightness }),
-    });
+    brightnessValue.innerHTML = brightnessInput.value;
+    await sendSettings([[SETTINGS_FIELD_BRIGHTNESS, Number(brightnessInput.value)]]);
   }
 
   const sustainInput = document.getElementById("sustain");
-  sustainInput.checked = )__" << sustainCheckedProp << R"__(;
+  sustainInput.checked = )__";
+
+static const char html_page_after_sustain[] = R"__(;
 
   const postSustain = async () => {
     const sustain = sustainInput.checked;
     console.log("Request show sustain", sustain);
-    await fetch("sustain", {
+    await sendSettings([[SETTINGS_FIELD_SHOW_SUSTAIN, sustain ? 1 : 0]]);
+  }
+
+  const velocityCurveSelect = document.getElementById("velocity-curve");
+
+  const postVelocityCurve = async () => {
+    await sendSettings([[SETTINGS_FIELD_VELOCITY_CURVE, Number(velocityCurveSelect.value)]]);
+  }
+
+  const paletteSelect = document.getElementById("palette-mode");
+  const secondaryColorInput = document.getElementById("secondary-color");
+  const splitKeyInput = document.getElementById("split-key");
+
+  const postPalette = async () => {
+    await sendSettings([
+      [SETTINGS_FIELD_PALETTE, Number(paletteSelect.value)],
+      [SETTINGS_FIELD_SECONDARY_COLOR, parseInt(secondaryColorInput.value.substring(1), 16)],
+      [SETTINGS_FIELD_SPLIT_KEY, Number(splitKeyInput.value)],
+    ]);
+  }
+
+  const effectSelect = document.getElementById("effect");
+
+  const postEffect = async () => {
+    await sendSettings([[SETTINGS_FIELD_EFFECT, Number(effectSelect.value)]]);
+  }
+
+  // Refresh the page from the device, after a preset changed everything
+  const loadSettings = async () => {
+    const response = await fetch("settings");
+    const message = new DataView(await response.arrayBuffer());
+    for (let offset = 1; offset + 5 <= message.byteLength; offset += 5) {
+      const value = message.getUint32(offset + 1);
+      switch (message.getUint8(offset)) {
+        case SETTINGS_FIELD_COLOR:
+          currentColor = { red: value >> 16, green: (value >> 8) & 0xff, blue: value & 0xff };
+          updateColorValues();
+          break;
+        case SETTINGS_FIELD_BRIGHTNESS:
+          brightnessInput.value = value;
+          brightnessValue.innerHTML = value;
+          break;
+        case SETTINGS_FIELD_SHOW_SUSTAIN:
+          sustainInput.checked = value == 1;
+          break;
+        case SETTINGS_FIELD_VELOCITY_CURVE:
+          velocityCurveSelect.value = value;
+          break;
+        case SETTINGS_FIELD_PALETTE:
+          paletteSelect.value = value;
+          break;
+        case SETTINGS_FIELD_SECONDARY_COLOR:
+          secondaryColorInput.value = "#" + value.toString(16).padStart(6, "0");
+          break;
+        case SETTINGS_FIELD_SPLIT_KEY:
+          splitKeyInput.value = value;
+          break;
+        case SETTINGS_FIELD_EFFECT:
+          effectSelect.value = value;
+          break;
+      }
+    }
+  }
+
+  const presetSelect = document.getElementById("preset-select");
+  const presetName = document.getElementById("preset-name");
+
+  const loadPresets = async () => {
+    const response = await fetch("presets");
+    const { selected, presets } = await response.json();
+    presetSelect.innerHTML = "";
+    for (const preset of presets) {
+      const option = document.createElement("option");
+      option.value = preset.index;
+      option.innerHTML = `${preset.index + 1}. ${preset.name || "(empty)"}`;
+      option.dataset.empty = !preset.name;
+      presetSelect.appendChild(option);
+    }
+    presetSelect.value = selected >= 0 ? selected : 0;
+  }
+
+  // Empty slots are only selected to save in them
+  const selectPreset = async () => {
+    if (presetSelect.selectedOptions[0].dataset.empty == "true") return;
+    await sendSettings([[SETTINGS_FIELD_PRESET, Number(presetSelect.value)]], true);
+    await loadSettings();
+  }
+
+  const savePreset = async () => {
+    const name = presetName.value.trim();
+    if (!name) return;
+    const index = Number(presetSelect.value);
+    await fetch("preset/save", {
+      method: "POST",
+      body: JSON.stringify({ index, name }),
+    });
+    presetName.value = "";
+    await loadPresets();
+  }
+
+  loadSettings();
+  loadPresets();
+
+  const fileSelect = document.getElementById("file-select");
+
+  const loadFiles = async () => {
+    const response = await fetch("files");
+    const files = await response.json();
+    for (const file of files) {
+      const option = document.createElement("option");
+      option.value = file;
+      option.innerHTML = file;
+      fileSelect.appendChild(option);
+    }
+  }
+
+  loadFiles();
+
+  const postPlay = async () => {
+    if (!fileSelect.value) return;
+    console.log("Play file", fileSelect.value);
+    await fetch("play", {
       method: "POST",
-      body: JSON.stringify({ sustain }),
+      body: JSON.stringify({ file: fileSelect.value }),
     });
   }
+
+  const postLearn = async (mode) => {
+    if (!fileSelect.value) return;
+    console.log("Learn file", fileSelect.value, mode);
+    await fetch("learn", {
+      method: "POST",
+      body: JSON.stringify({ file: fileSelect.value, mode: mode }),
+    });
+  }
+
+  const postStop = async () => {
+    await fetch("stop", { method: "POST" });
+  }
+
+  const recordStatus = document.getElementById("record-status");
+
+  const postRecord = async (recording) => {
+    const response = await fetch("record", {
+      method: "POST",
+      body: JSON.stringify({ recording }),
+    });
+    const status = await response.json();
+    recordStatus.innerHTML = status.recording ? "Recording..." : `${status.events} events recorded`;
+  }
+
+  const benchmarkButton = document.getElementById("benchmark-button");
+  const benchmarkResult = document.getElementById("benchmark-result");
+
+  const postBenchmark = async () => {
+    benchmarkButton.disabled = true;
+    benchmarkResult.innerHTML = "Running...";
+    const response = await fetch("benchmark", { method: "POST" });
+    const report = await response.json();
+    benchmarkResult.innerHTML = JSON.stringify(report, null, 2);
+    benchmarkButton.disabled = false;
+  }
 </script>
 </html>
 )__";
 
-  return htmlStream.str();
-}
+static const char* const html_page_parts[HTML_PAGE_VALUE_COUNT + 1] = {
+  html_page_start,
+  html_page_after_red,
+  html_page_after_green,
+  html_page_after_blue,
+  html_page_after_brightness,
+  html_page_after_sustain,
+};
 
 #endif
\ No newline at end of file
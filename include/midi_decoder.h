@@ -0,0 +1,61 @@
+#ifndef _MIDI_DECODER_H_
+#define _MIDI_DECODER_H_
+
+#include <midi_types.h>
+
+/// Types ///
+
+typedef enum : uint8_t {
+  MIDI_EVENT_NONE = 0,
+  MIDI_EVENT_NOTE_ON,
+  MIDI_EVENT_NOTE_OFF,
+  MIDI_EVENT_SUSTAIN_ON,
+  MIDI_EVENT_SUSTAIN_OFF,
+  MIDI_EVENT_PROGRAM_CHANGE, // Program number in note
+} midi_event_type_t;
+
+typedef struct {
+  midi_event_type_t type;
+  uint8_t note;
+  uint8_t velocity;
+  uint8_t cable;
+} midi_event_t;
+
+/// Functions definition ///
+
+/**
+ * Translate a raw USB MIDI packet into the events the lighting pipeline cares about.
+ * A note on with a null velocity is a note off.
+ */
+static inline midi_event_t decodeMidiPacket(midi_usb_packet packet) {
+  midi_event_t event = { MIDI_EVENT_NONE, packet.midi_data_1, packet.midi_data_2, packet.usb_cable_number };
+  if ( // Note Off
+    packet.midi_type == MIDI_NOTE_OFF
+    || (packet.midi_type == MIDI_NOTE_ON && packet.midi_data_2 == 0)
+  ) {
+    event.type = MIDI_EVENT_NOTE_OFF;
+  } else if (packet.midi_type == MIDI_NOTE_ON) { // Note On
+    event.type = MIDI_EVENT_NOTE_ON;
+  } else if (packet.midi_type == MIDI_CONTROL_CHANGE && packet.midi_data_1 == MIDI_CC_SUSTAIN) { // Sustain
+    event.type = packet.midi_data_2 < 64 ? MIDI_EVENT_SUSTAIN_OFF : MIDI_EVENT_SUSTAIN_ON;
+  } else if (packet.midi_type == MIDI_PROGRAM_CHANGE) { // Program Change
+    event.type = MIDI_EVENT_PROGRAM_CHANGE;
+  }
+  return event;
+}
+
+/**
+ * Build a USB MIDI packet from a MIDI status byte and its two data bytes.
+ */
+static inline midi_usb_packet makeMidiPacket(uint8_t status, uint8_t data_1, uint8_t data_2, uint8_t cable = 0) {
+  midi_usb_packet packet;
+  packet.usb_cable_number = cable;
+  packet.code_index_number = status >> 4;
+  packet.midi_type = status >> 4;
+  packet.midi_channel = status & 0x0f;
+  packet.midi_data_1 = data_1;
+  packet.midi_data_2 = data_2;
+  return packet;
+}
+
+#endif /* _MIDI_DECODER_H_ */
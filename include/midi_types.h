@@ -5,6 +5,10 @@
 
 #define MIDI_NOTE_OFF 0x08
 #define MIDI_NOTE_ON 0x09
+#define MIDI_CONTROL_CHANGE 0x0b
+#define MIDI_PROGRAM_CHANGE 0x0c
+
+#define MIDI_CC_SUSTAIN 0x40
 
 typedef struct __attribute__((__packed__)) {
   uint8_t code_index_number : 4;
@@ -17,4 +21,10 @@ typedef struct __attribute__((__packed__)) {
 
 typedef void midi_in_callback_t(midi_usb_packet);
 
-#endif /* _MIDI_TYPES_H */ 
+// MIDI packet with its arrival time, used by replay and benchmark workloads
+typedef struct {
+  uint32_t time_us;
+  midi_usb_packet packet;
+} timed_midi_packet;
+
+#endif /* _MIDI_TYPES_H */
@@ -0,0 +1,54 @@
+#ifndef _NOTE_SET_H_
+#define _NOTE_SET_H_
+
+#include <cstdint>
+
+#define NOTE_COUNT 128
+#define NOTE_SET_WORDS (NOTE_COUNT / 32)
+
+/// Types ///
+
+// One bit per MIDI note, bit n of word n / 32
+typedef struct {
+  uint32_t words[NOTE_SET_WORDS];
+} note_set_t;
+
+/// Functions definition ///
+
+static inline void clearNoteSet(note_set_t* set) {
+  for (int i = 0; i < NOTE_SET_WORDS; i++) set->words[i] = 0;
+}
+
+static inline bool hasNote(const note_set_t* set, uint8_t note) {
+  return note < NOTE_COUNT && (set->words[note >> 5] & (1UL << (note & 31)));
+}
+
+static inline void addNote(note_set_t* set, uint8_t note) {
+  if (note < NOTE_COUNT) set->words[note >> 5] |= 1UL << (note & 31);
+}
+
+static inline void removeNote(note_set_t* set, uint8_t note) {
+  if (note < NOTE_COUNT) set->words[note >> 5] &= ~(1UL << (note & 31));
+}
+
+/**
+ * Next note of the set from note included, -1 if none.
+ * Walks the set bits: iterating costs the number of notes in the set, not 128.
+ */
+static inline int nextNote(const note_set_t* set, int note) {
+  if (note < 0) note = 0;
+  for (int word = note >> 5; word < NOTE_SET_WORDS; word++) {
+    uint32_t bits = set->words[word];
+    if (word == note >> 5) bits &= ~0UL << (note & 31);
+    if (bits) return (word << 5) + __builtin_ctz(bits);
+  }
+  return -1;
+}
+
+static inline uint8_t countNotes(const note_set_t* set) {
+  uint8_t count = 0;
+  for (int i = 0; i < NOTE_SET_WORDS; i++) count += __builtin_popcount(set->words[i]);
+  return count;
+}
+
+#endif /* _NOTE_SET_H_ */
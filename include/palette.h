@@ -0,0 +1,77 @@
+#ifndef _PALETTE_H_
+#define _PALETTE_H_
+
+#include <cstdint>
+#include "chord_templates.h"
+
+// Piano keyboard range, used to spread the keyboard wide palettes
+#define PIANO_FIRST_NOTE 21
+#define PIANO_LAST_NOTE 108
+
+/// Functions definition ///
+
+/**
+ * Full saturation and value color, hue in degrees.
+ */
+static inline uint32_t hueToColor(uint16_t hue) {
+  hue %= 360;
+  const uint8_t sector = hue / 60;
+  const uint8_t rising = (hue % 60) * 255 / 60;
+  const uint8_t falling = 255 - rising;
+  switch (sector) {
+    case 0: return 0xff0000 | (rising << 8);
+    case 1: return (falling << 16) | 0x00ff00;
+    case 2: return 0x00ff00 | rising;
+    case 3: return (falling << 8) | 0x0000ff;
+    case 4: return (rising << 16) | 0x0000ff;
+    default: return 0xff0000 | falling;
+  }
+}
+
+/**
+ * Linear interpolation between two colors, position from 0 (from) to 255 (to).
+ */
+static inline uint32_t blendColors(uint32_t from, uint32_t to, uint8_t position) {
+  uint32_t color = 0;
+  for (int shift = 0; shift <= 16; shift += 8) {
+    const int a = (from >> shift) & 0xff;
+    const int b = (to >> shift) & 0xff;
+    color |= (uint32_t)(a + (b - a) * position / 255) << shift;
+  }
+  return color;
+}
+
+/**
+ * Position of a note on the keyboard, 0 on the lowest key and 255 on the highest one.
+ */
+static inline uint8_t getKeyboardPosition(uint8_t note) {
+  if (note <= PIANO_FIRST_NOTE) return 0;
+  if (note >= PIANO_LAST_NOTE) return 255;
+  return (note - PIANO_FIRST_NOTE) * 255 / (PIANO_LAST_NOTE - PIANO_FIRST_NOTE);
+}
+
+/**
+ * Color of each pitch class around the circle of fifths, so that close keys get close colors.
+ */
+static inline uint32_t getPitchClassColor(uint8_t pitch_class) {
+  return hueToColor((pitch_class * 7 % 12) * 30);
+}
+
+/**
+ * Color of each chord quality, CHORD_QUALITY_NONE keeps the base color.
+ */
+static inline uint32_t getChordQualityColor(chord_quality_t quality, uint32_t base_color) {
+  switch (quality) {
+    case CHORD_QUALITY_MAJOR: return 0xffc000;
+    case CHORD_QUALITY_MINOR: return 0x0040ff;
+    case CHORD_QUALITY_DIMINISHED: return 0x8000ff;
+    case CHORD_QUALITY_AUGMENTED: return 0xff0020;
+    case CHORD_QUALITY_SUSPENDED: return 0x00ffc0;
+    case CHORD_QUALITY_DOMINANT_7: return 0xff6000;
+    case CHORD_QUALITY_MAJOR_7: return 0xffff60;
+    case CHORD_QUALITY_MINOR_7: return 0x00a0ff;
+    default: return base_color;
+  }
+}
+
+#endif /* _PALETTE_H_ */
@@ -0,0 +1,152 @@
+#ifndef _SETTINGS_PROTOCOL_H_
+#define _SETTINGS_PROTOCOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include "SettingsStore.h"
+
+/**
+ * Binary settings messages, sent by the web UI over HTTP POST /settings or the WebSocket.
+ *
+ *   byte 0      protocol version
+ *   byte 1...   records of 5 bytes: field id, then the value as a big endian uint32
+ *
+ * A message updates only the fields it contains. Unknown field ids are skipped so that
+ * a newer UI can talk to an older firmware. The reply is 2 bytes: version and status.
+ */
+
+#define SETTINGS_PROTOCOL_VERSION 1
+#define SETTINGS_RECORD_SIZE 5
+#define SETTINGS_MAX_RECORDS 16
+#define SETTINGS_MAX_MESSAGE_SIZE (1 + SETTINGS_MAX_RECORDS * SETTINGS_RECORD_SIZE)
+#define SETTINGS_REPLY_SIZE 2
+
+/// Types ///
+
+// Persisted fields, ids are part of the protocol and must never be reused
+typedef enum : uint8_t {
+  SETTINGS_FIELD_COLOR = 1,        // 0x00RRGGBB
+  SETTINGS_FIELD_BRIGHTNESS = 2,   // 0 to 255
+  SETTINGS_FIELD_SHOW_SUSTAIN = 3, // 0 or 1
+  SETTINGS_FIELD_PRESET = 4,       // Select a stored preset, not persisted itself
+  SETTINGS_FIELD_VELOCITY_CURVE = 5,
+  SETTINGS_FIELD_PALETTE = 6,
+  SETTINGS_FIELD_SECONDARY_COLOR = 7, // 0x00RRGGBB
+  SETTINGS_FIELD_SPLIT_KEY = 8,       // MIDI note
+  SETTINGS_FIELD_EFFECT = 9,
+  SETTINGS_FIELD_COUNT,
+} settings_field_t;
+
+typedef enum : uint8_t {
+  SETTINGS_STATUS_OK = 0,
+  SETTINGS_STATUS_TOO_SHORT,
+  SETTINGS_STATUS_TOO_LONG,
+  SETTINGS_STATUS_BAD_VERSION,
+  SETTINGS_STATUS_BAD_LENGTH,
+  SETTINGS_STATUS_BAD_VALUE,
+} settings_status_t;
+
+typedef struct {
+  // Bit n is set when field n is present
+  uint32_t fields;
+  uint32_t values[SETTINGS_FIELD_COUNT];
+} settings_update_t;
+
+/// Functions definition ///
+
+static inline bool hasSettingsField(const settings_update_t* update, settings_field_t field) {
+  return update->fields & (1UL << field);
+}
+
+static inline void setSettingsField(settings_update_t* update, settings_field_t field, uint32_t value) {
+  update->fields |= 1UL << field;
+  update->values[field] = value;
+}
+
+static inline bool isValidSettingsValue(uint8_t field, uint32_t value) {
+  switch (field) {
+    case SETTINGS_FIELD_COLOR: return value <= 0xffffff;
+    case SETTINGS_FIELD_BRIGHTNESS: return value <= 0xff;
+    case SETTINGS_FIELD_SHOW_SUSTAIN: return value <= 1;
+    case SETTINGS_FIELD_PRESET: return value < PRESET_COUNT;
+    case SETTINGS_FIELD_VELOCITY_CURVE: return value < VELOCITY_CURVE_COUNT;
+    case SETTINGS_FIELD_PALETTE: return value < PALETTE_COUNT;
+    case SETTINGS_FIELD_SECONDARY_COLOR: return value <= 0xffffff;
+    case SETTINGS_FIELD_SPLIT_KEY: return value <= 127;
+    case SETTINGS_FIELD_EFFECT: return value < EFFECT_COUNT;
+    default: return true;
+  }
+}
+
+/**
+ * Decode a settings message into update. Nothing is written to update unless the whole
+ * message is valid, so a bad message never applies half of its fields.
+ */
+static inline settings_status_t decodeSettings(const uint8_t* message, size_t length, settings_update_t* update) {
+  if (length < 1) return SETTINGS_STATUS_TOO_SHORT;
+  if (message[0] != SETTINGS_PROTOCOL_VERSION) return SETTINGS_STATUS_BAD_VERSION;
+  if (length > SETTINGS_MAX_MESSAGE_SIZE) return SETTINGS_STATUS_TOO_LONG;
+  if ((length - 1) % SETTINGS_RECORD_SIZE) return SETTINGS_STATUS_BAD_LENGTH;
+
+  settings_update_t decoded = { 0, { 0 } };
+  for (size_t offset = 1; offset < length; offset += SETTINGS_RECORD_SIZE) {
+    const uint8_t field = message[offset];
+    const uint32_t value = ((uint32_t)message[offset + 1] << 24) | ((uint32_t)message[offset + 2] << 16)
+      | ((uint32_t)message[offset + 3] << 8) | message[offset + 4];
+    if (field == 0 || field >= SETTINGS_FIELD_COUNT) continue;
+    if (!isValidSettingsValue(field, value)) return SETTINGS_STATUS_BAD_VALUE;
+    decoded.fields |= 1UL << field;
+    decoded.values[field] = value;
+  }
+  *update = decoded;
+  return SETTINGS_STATUS_OK;
+}
+
+/**
+ * Settings resulting from an update, for the caller to publish at once: the stored preset it selects,
+ * or the current settings, modified by the other fields of the message.
+ * Return the index of the stored preset the settings come from, -1 if none or if its slot is empty.
+ */
+static inline int8_t applySettingsUpdate(const settings_update_t* update, SettingsStore* store, led_preset_t* preset) {
+  int8_t selected = -1;
+  const led_preset_t* stored = NULL;
+  if (hasSettingsField(update, SETTINGS_FIELD_PRESET)) {
+    stored = store->getStoredPreset(update->values[SETTINGS_FIELD_PRESET]);
+    if (stored != NULL) selected = update->values[SETTINGS_FIELD_PRESET];
+  }
+  *preset = stored != NULL ? *stored : store->getPreset();
+  if (hasSettingsField(update, SETTINGS_FIELD_COLOR)) preset->color = update->values[SETTINGS_FIELD_COLOR];
+  if (hasSettingsField(update, SETTINGS_FIELD_BRIGHTNESS)) preset->brightness = update->values[SETTINGS_FIELD_BRIGHTNESS];
+  if (hasSettingsField(update, SETTINGS_FIELD_SHOW_SUSTAIN)) preset->show_sustain = update->values[SETTINGS_FIELD_SHOW_SUSTAIN];
+  if (hasSettingsField(update, SETTINGS_FIELD_VELOCITY_CURVE)) {
+    preset->velocity_curve = (velocity_curve_t)update->values[SETTINGS_FIELD_VELOCITY_CURVE];
+  }
+  if (hasSettingsField(update, SETTINGS_FIELD_PALETTE)) preset->palette = (palette_mode_t)update->values[SETTINGS_FIELD_PALETTE];
+  if (hasSettingsField(update, SETTINGS_FIELD_SECONDARY_COLOR)) {
+    preset->secondary_color = update->values[SETTINGS_FIELD_SECONDARY_COLOR];
+  }
+  if (hasSettingsField(update, SETTINGS_FIELD_SPLIT_KEY)) preset->split_key = update->values[SETTINGS_FIELD_SPLIT_KEY];
+  if (hasSettingsField(update, SETTINGS_FIELD_EFFECT)) preset->effect = (effect_mode_t)update->values[SETTINGS_FIELD_EFFECT];
+  return selected;
+}
+
+/**
+ * Encode the fields present in update, message must hold SETTINGS_MAX_MESSAGE_SIZE bytes.
+ * Return the message length.
+ */
+static inline size_t encodeSettings(const settings_update_t* update, uint8_t* message) {
+  size_t length = 0;
+  message[length++] = SETTINGS_PROTOCOL_VERSION;
+  for (uint8_t field = 1; field < SETTINGS_FIELD_COUNT; field++) {
+    if (!hasSettingsField(update, (settings_field_t)field)) continue;
+    const uint32_t value = update->values[field];
+    message[length++] = field;
+    message[length++] = value >> 24;
+    message[length++] = value >> 16;
+    message[length++] = value >> 8;
+    message[length++] = value;
+  }
+  return length;
+}
+
+#endif /* _SETTINGS_PROTOCOL_H_ */
@@ -8,11 +8,17 @@
 #define _USB_MIDI_CLASS_H_
 
 #include <stdlib.h>
+#include <string.h>
+#include <atomic>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "usb/usb_host.h"
 #include <midi_types.h>
+#include <TraceRecorder.h>
+#include <UsbMidiHost.h>
+#include <UsbMidiDescriptor.h>
 
 #define CLIENT_NUM_EVENT_MSG        5
 #define DEV_MAX_COUNT               8
@@ -27,6 +33,7 @@ typedef enum {
   ACTION_GET_CONFIG_DESC  = (1 << 4),
   ACTION_GET_STR_DESC     = (1 << 5),
   ACTION_CLOSE_DEV        = (1 << 6),
+  ACTION_CLAIM_CACHED     = (1 << 7),
 } action_t;
 
 typedef struct {
@@ -35,7 +42,10 @@ typedef struct {
   usb_device_handle_t dev_hdl;
   uint8_t actions;
   usb_transfer_t *midi_in_transfer = NULL;
+  usb_transfer_t *midi_out_transfer = NULL;
   uint8_t midi_interface_number;
+  // Identity and MIDI layout, looked up in the device cache
+  usb_device_profile_t profile;
 } usb_device_t;
 
 typedef struct {
@@ -62,19 +72,37 @@ typedef struct {
 static const char *TAG_MIDI_CLASS = "MIDI CLASS";
 static class_driver_t *s_driver_obj;
 static midi_in_callback_t *midiInCallbackPtr = NULL;
+static UsbDeviceCache *device_cache = NULL;
+static usb_connection_stats_t *connection_stats = NULL;
+// Held while the stats are written, UsbMidiHost::getStats() copies them under it
+static portMUX_TYPE connection_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static void (*deviceCacheChanged)(UsbDeviceCache*) = NULL;
+static MidiOutQueue *midi_out_queue = NULL;
+// OUT transfer of the device packets are sent to, a single device takes MIDI out.
+// Atomic: the sending tasks test it in classDriverMidiOutReady() while this task clears it on disconnection
+static std::atomic<usb_transfer_t*> midi_out_transfer{NULL};
+// True while the OUT transfer is submitted, its callback sends the packets queued meanwhile
+static std::atomic<bool> midi_out_busy{false};
 
 /// Functions declaration ///
 
 static void clientEventCallback(const usb_host_client_event_msg_t*, void*);
 static void classDriverDeviceHandle(usb_device_t*);
 static void actionOpenDev(usb_device_t*);
+static void identifyDevice(usb_device_t*);
+static void actionClaimCached(usb_device_t*);
 static void actionSetupMidi(usb_device_t*);
+static esp_err_t startMidiIn(usb_device_t*, uint8_t endpoint_address, uint16_t max_packet_size);
+static void startMidiOut(usb_device_t*, uint8_t endpoint_address, uint16_t max_packet_size);
+static void flushMidiOut(void);
+static void midiOutTransferCallback(usb_transfer_t*);
 static void actionGetInfo(usb_device_t*);
 static void actionGetDevDesc(usb_device_t*);
 static void actionGetConfigDesc(usb_device_t*);
 static void actionGetStrDesc(usb_device_t*);
 static void actionCloseDev(usb_device_t*);
 static void transferCallback(usb_transfer_t*);
+void classDriverMidiOutReady(void);
 void classDriverTask(void*);
 void classDriverClientUnregister(void);
 
@@ -87,6 +115,16 @@ static void clientEventCallback(const usb_host_client_event_msg_t *event_msg, vo
       ESP_LOGI(TAG_MIDI_CLASS, "New device connected");
       // Save the device address
       xSemaphoreTake(driver_obj->constant.mux_lock, portMAX_DELAY);
+      if (connection_stats != NULL) {
+        // The host library has enumerated the device, the rest of the setup is ours
+        portENTER_CRITICAL(&connection_stats_lock);
+        connection_stats->connect_us = esp_timer_get_time();
+        connection_stats->setup_us = 0;
+        connection_stats->first_note_us = 0;
+        connection_stats->cached = false;
+        connection_stats->connections++;
+        portEXIT_CRITICAL(&connection_stats_lock);
+      }
       driver_obj->mux_protected.device[event_msg->new_dev.address].dev_addr = event_msg->new_dev.address;
       driver_obj->mux_protected.device[event_msg->new_dev.address].dev_hdl = NULL;
       // Open the device next
@@ -121,6 +159,9 @@ static void classDriverDeviceHandle(usb_device_t *device_obj) {
     if (actions & ACTION_OPEN_DEV) {
       actionOpenDev(device_obj);
     }
+    if (actions & ACTION_CLAIM_CACHED) {
+      actionClaimCached(device_obj);
+    }
     if (actions & ACTION_SETUP_MIDI) {
       actionSetupMidi(device_obj);
     }
@@ -149,94 +190,207 @@ static void actionOpenDev(usb_device_t *device_obj) {
   assert(device_obj->dev_addr != 0);
   ESP_LOGI(TAG_MIDI_CLASS, "Opening device at address %d", device_obj->dev_addr);
   ESP_ERROR_CHECK(usb_host_device_open(device_obj->client_hdl, device_obj->dev_addr, &device_obj->dev_hdl));
-  // Get the device's information next
-  device_obj->actions |= ACTION_SETUP_MIDI;
+  identifyDevice(device_obj);
+  // A known device is claimed right away, others have their descriptors walked
+  const usb_device_profile_t *profile = NULL;
+  if (device_cache != NULL) {
+    profile = device_cache->find(device_obj->profile.vendor_id, device_obj->profile.product_id, device_obj->profile.serial_hash);
+  }
+  if (profile != NULL && profile->configuration == device_obj->profile.configuration) {
+    device_obj->profile = *profile;
+    device_obj->actions |= ACTION_CLAIM_CACHED;
+  } else {
+    device_obj->actions |= ACTION_SETUP_MIDI;
+  }
+}
+
+/**
+ * VID, PID and serial number of the device, from the descriptors read by the host library during the enumeration:
+ * no control transfer is needed.
+ */
+static void identifyDevice(usb_device_t *device_obj) {
+  memset(&device_obj->profile, 0, sizeof(device_obj->profile));
+  const usb_device_desc_t *dev_desc;
+  if (usb_host_get_device_descriptor(device_obj->dev_hdl, &dev_desc) == ESP_OK) {
+    device_obj->profile.vendor_id = dev_desc->idVendor;
+    device_obj->profile.product_id = dev_desc->idProduct;
+  }
+  usb_device_info_t dev_info;
+  if (usb_host_device_info(device_obj->dev_hdl, &dev_info) != ESP_OK) return;
+  device_obj->profile.configuration = dev_info.bConfigurationValue;
+  const usb_str_desc_t *serial = dev_info.str_desc_serial_num;
+  if (serial != NULL && serial->bLength > 2) {
+    device_obj->profile.serial_hash = UsbDeviceCache::hashSerial((const uint8_t *)serial->wData, serial->bLength - 2);
+  }
+}
+
+/**
+ * Claim the interface and the endpoint saved for this device.
+ * If the device no longer matches its profile, it is forgotten and set up from its descriptors.
+ */
+static void actionClaimCached(usb_device_t *device_obj) {
+  const usb_device_profile_t *profile = &device_obj->profile;
+  ESP_LOGD(TAG_MIDI_CLASS, "Claiming cached MIDI device %04x:%04x", profile->vendor_id, profile->product_id);
+  esp_err_t err = usb_host_interface_claim(
+    device_obj->client_hdl,
+    device_obj->dev_hdl,
+    profile->interface_number,
+    profile->alternate_setting
+  );
+  if (err == ESP_OK) {
+    device_obj->midi_interface_number = profile->interface_number;
+    err = startMidiIn(device_obj, profile->in_endpoint, profile->in_max_packet_size);
+    if (err != ESP_OK) usb_host_interface_release(device_obj->client_hdl, device_obj->dev_hdl, profile->interface_number);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG_MIDI_CLASS, "Cached profile of %04x:%04x failed, reading its descriptors", profile->vendor_id, profile->product_id);
+    device_cache->remove(profile->vendor_id, profile->product_id, profile->serial_hash);
+    if (deviceCacheChanged != NULL) deviceCacheChanged(device_cache);
+    identifyDevice(device_obj);
+    device_obj->actions |= ACTION_SETUP_MIDI;
+    return;
+  }
+  if (connection_stats != NULL) {
+    portENTER_CRITICAL(&connection_stats_lock);
+    connection_stats->cached = true;
+    connection_stats->cache_hits++;
+    portEXIT_CRITICAL(&connection_stats_lock);
+  }
+  startMidiOut(device_obj, profile->out_endpoint, profile->out_max_packet_size);
+  log_printf("MIDI device connected\n");
+}
+
+/**
+ * Allocate the transfer of the MIDI IN endpoint and start listening to it.
+ */
+static esp_err_t startMidiIn(usb_device_t *device_obj, uint8_t endpoint_address, uint16_t max_packet_size) {
+  esp_err_t err = usb_host_transfer_alloc(max_packet_size, 0, &device_obj->midi_in_transfer);
+  if (err != ESP_OK) return err;
+  device_obj->midi_in_transfer->device_handle = device_obj->dev_hdl;
+  device_obj->midi_in_transfer->bEndpointAddress = endpoint_address;
+  device_obj->midi_in_transfer->num_bytes = max_packet_size;
+  device_obj->midi_in_transfer->callback = transferCallback;
+  err = usb_host_transfer_submit(device_obj->midi_in_transfer);
+  if (err != ESP_OK) {
+    usb_host_transfer_free(device_obj->midi_in_transfer);
+    device_obj->midi_in_transfer = NULL;
+    return err;
+  }
+  if (connection_stats != NULL) {
+    portENTER_CRITICAL(&connection_stats_lock);
+    connection_stats->connected = true;
+    connection_stats->setup_us = esp_timer_get_time() - connection_stats->connect_us;
+    portEXIT_CRITICAL(&connection_stats_lock);
+  }
+  return ESP_OK;
+}
+
+/**
+ * Allocate the transfer of the MIDI OUT endpoint, the queue takes packets from now on.
+ * Only the first device having an OUT endpoint gets MIDI out, a device without one just has no output.
+ */
+static void startMidiOut(usb_device_t *device_obj, uint8_t endpoint_address, uint16_t max_packet_size) {
+  if (endpoint_address == 0 || midi_out_queue == NULL || midi_out_transfer.load() != NULL) return;
+  // One packet of the endpoint per transfer, 16 MIDI packets at full speed
+  const esp_err_t err = usb_host_transfer_alloc(max_packet_size, 0, &device_obj->midi_out_transfer);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG_MIDI_CLASS, "Unable to allocate the MIDI OUT transfer: %s", esp_err_to_name(err));
+    return;
+  }
+  device_obj->midi_out_transfer->device_handle = device_obj->dev_hdl;
+  device_obj->midi_out_transfer->bEndpointAddress = endpoint_address;
+  device_obj->midi_out_transfer->callback = midiOutTransferCallback;
+  midi_out_busy.store(false);
+  midi_out_transfer.store(device_obj->midi_out_transfer);
+  midi_out_queue->open();
+  if (connection_stats != NULL) {
+    portENTER_CRITICAL(&connection_stats_lock);
+    connection_stats->midi_out = true;
+    portEXIT_CRITICAL(&connection_stats_lock);
+  }
+}
+
+/**
+ * Send the packets waiting in the queue, up to a packet of the endpoint, if no transfer is in flight.
+ * Only called by the class driver task: from its loop, and from the callback of the previous transfer.
+ */
+static void flushMidiOut(void) {
+  usb_transfer_t *transfer = midi_out_transfer.load();
+  if (transfer == NULL || midi_out_busy.load()) return;
+  // Pairs with the fence of classDriverMidiOutReady(): either this pop sees the packet, or the sender sees the task idle
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  const size_t count = midi_out_queue->pop(
+    (midi_usb_packet*)transfer->data_buffer,
+    transfer->data_buffer_size / sizeof(midi_usb_packet),
+    esp_timer_get_time()
+  );
+  if (count == 0) return;
+  transfer->num_bytes = count * sizeof(midi_usb_packet);
+  midi_out_busy.store(true);
+  if (usb_host_transfer_submit(transfer) != ESP_OK) {
+    midi_out_queue->countFailedTransfer();
+    midi_out_busy.store(false);
+  }
+}
+
+/**
+ * MIDI OUT endpoint transfer callback, the next batch goes right away.
+ */
+static void midiOutTransferCallback(usb_transfer_t *transfer) {
+  if (transfer->status != USB_TRANSFER_STATUS_COMPLETED) midi_out_queue->countFailedTransfer();
+  midi_out_busy.store(false);
+  if (transfer == midi_out_transfer.load()) flushMidiOut();
 }
 
 /**
- * Look for a MIDI interface and claim it.
- * Then look for its IN endpoint and attach it a callback.
+ * Parse the MIDI topology of the configuration descriptor, claim the interface of its first IN endpoint
+ * and attach it a callback.
  */
 static void actionSetupMidi(usb_device_t *device_obj) {
   const usb_config_desc_t *config_desc;
   ESP_ERROR_CHECK(usb_host_get_active_config_descriptor(device_obj->dev_hdl, &config_desc));
-  
-  const uint8_t *p = &config_desc->val[0];
-  uint8_t bLength;
-  bool is_midi_desc = false; // Indicates that we are reading a MIDI interface descriptor
-  bool is_midi_in_endpoint_ready = false; // True if a MIDI IN endpoint has been found
-
-  // Iterate over config desc
-  for (int i = 0; i < config_desc->wTotalLength; i+=bLength, p+=bLength) {
-    bLength = *p;
-    if ((i + bLength) <= config_desc->wTotalLength) {
-      const uint8_t bDescriptorType = *(p + 1);
-      switch (bDescriptorType) {
-        case USB_B_DESCRIPTOR_TYPE_INTERFACE: {
-          // Cast as interface descriptor type
-          const usb_intf_desc_t *intf = (const usb_intf_desc_t *)p;
-
-          // Check if interface is MIDI and update is_midi_desc accordingly
-          if ((intf->bInterfaceClass == USB_CLASS_AUDIO) &&
-              (intf->bInterfaceSubClass == 3) &&
-              (intf->bInterfaceProtocol == 0))
-          {
-            is_midi_desc = true;
-            ESP_LOGD(TAG_MIDI_CLASS, "Claiming a MIDI device! number: %d, alt: %d", intf->bInterfaceNumber, intf->bAlternateSetting);
-            // Claim MIDI interface
-            ESP_ERROR_CHECK(usb_host_interface_claim(
-              device_obj->client_hdl,
-              device_obj->dev_hdl,
-              intf->bInterfaceNumber,
-              intf->bAlternateSetting
-            ));
-            device_obj->midi_interface_number = intf->bInterfaceNumber; // Used later to release interface on disconnection
-          } else {
-            is_midi_desc = false;
-          }
-          break;
-        }
-          
-        case USB_B_DESCRIPTOR_TYPE_ENDPOINT: {
-          if (!is_midi_desc) break;
-
-          // Cast as endpoint descriptor
-          const usb_ep_desc_t *endpoint = (const usb_ep_desc_t *)p;
-
-          // Must be bulk for MIDI
-          if ((endpoint->bmAttributes & USB_BM_ATTRIBUTES_XFERTYPE_MASK) != USB_BM_ATTRIBUTES_XFER_BULK) {
-            ESP_LOGD(TAG_MIDI_CLASS, "Not bulk endpoint: 0x%02x", endpoint->bmAttributes);
-            break;
-          }
-
-          if (endpoint->bEndpointAddress & USB_B_ENDPOINT_ADDRESS_EP_DIR_MASK) {
-            if (is_midi_in_endpoint_ready) break;
-            // MIDI IN endpoint
-            ESP_LOGD(TAG_MIDI_CLASS, "Setting up MIDI IN endpoint from address 0x%02x", endpoint->bEndpointAddress);
-            ESP_ERROR_CHECK(usb_host_transfer_alloc(endpoint->wMaxPacketSize, 0, &device_obj->midi_in_transfer));
-            device_obj->midi_in_transfer->device_handle = device_obj->dev_hdl;
-            device_obj->midi_in_transfer->bEndpointAddress = endpoint->bEndpointAddress;
-            device_obj->midi_in_transfer->num_bytes = endpoint->wMaxPacketSize;
-            device_obj->midi_in_transfer->callback = transferCallback;
-            ESP_ERROR_CHECK(usb_host_transfer_submit(device_obj->midi_in_transfer));
-            is_midi_in_endpoint_ready = true;
-            // Log to the serial port regardless of the log level to have the serial LED give a visual feedback
-            log_printf("MIDI device connected\n");
-          } else {
-            // MIDI OUT endpoint
-            ESP_LOGD(TAG_MIDI_CLASS, "Found MIDI OUT endpoint at address 0x%02x", endpoint->bEndpointAddress);
-          }
-          break;
-        }
-          
-        default:
-          break;
-      }
-    }
-    else {
-      ESP_LOGD(TAG_MIDI_CLASS, "USB Descriptor invalid");
-      return;
-    }
+
+  usb_midi_topology_t topology;
+  const usb_descriptor_status_t status = parseUsbMidiTopology(&config_desc->val[0], config_desc->wTotalLength, &topology);
+  if (status != USB_DESCRIPTOR_OK) {
+    ESP_LOGD(TAG_MIDI_CLASS, "USB Descriptor: %s", getUsbDescriptorStatusName(status));
+  }
+  if (topology.dropped_count > 0) {
+    ESP_LOGW(TAG_MIDI_CLASS, "USB Descriptor: %d interfaces, endpoints or jacks past the limits", topology.dropped_count);
+  }
+  // A descriptor broken after the MIDI interface still gives its endpoints
+  if (topology.in_endpoint_count == 0) return;
+
+  const usb_midi_endpoint_t *in_endpoint = &topology.in_endpoints[0];
+  const usb_midi_interface_t *intf = &topology.interfaces[in_endpoint->interface_index];
+  ESP_LOGD(TAG_MIDI_CLASS, "Claiming a MIDI device! number: %d, alt: %d, cables: %d", intf->number, intf->alternate_setting, topology.cable_count);
+  ESP_ERROR_CHECK(usb_host_interface_claim(device_obj->client_hdl, device_obj->dev_hdl, intf->number, intf->alternate_setting));
+  device_obj->midi_interface_number = intf->number; // Used later to release interface on disconnection
+  device_obj->profile.interface_number = intf->number;
+  device_obj->profile.alternate_setting = intf->alternate_setting;
+
+  ESP_LOGD(TAG_MIDI_CLASS, "Setting up MIDI IN endpoint from address 0x%02x", in_endpoint->address);
+  ESP_ERROR_CHECK(startMidiIn(device_obj, in_endpoint->address, in_endpoint->max_packet_size));
+  device_obj->profile.in_endpoint = in_endpoint->address;
+  device_obj->profile.in_max_packet_size = in_endpoint->max_packet_size;
+  // Log to the serial port regardless of the log level to have the serial LED give a visual feedback
+  log_printf("MIDI device connected\n");
+
+  // Only an OUT endpoint of the claimed interface can be used
+  for (uint8_t i = 0; i < topology.out_endpoint_count; i++) {
+    const usb_midi_endpoint_t *out_endpoint = &topology.out_endpoints[i];
+    if (topology.interfaces[out_endpoint->interface_index].number != intf->number) continue;
+    ESP_LOGD(TAG_MIDI_CLASS, "Setting up MIDI OUT endpoint to address 0x%02x", out_endpoint->address);
+    device_obj->profile.out_endpoint = out_endpoint->address;
+    device_obj->profile.out_max_packet_size = out_endpoint->max_packet_size;
+    startMidiOut(device_obj, out_endpoint->address, out_endpoint->max_packet_size);
+    break;
+  }
+
+  // Next connections of this device skip the parsing
+  if (device_cache != NULL) {
+    device_cache->store(device_obj->profile);
+    if (deviceCacheChanged != NULL) deviceCacheChanged(device_cache);
   }
 
   // Log device infos only if log level is info or above
@@ -307,7 +461,25 @@ static void actionCloseDev(usb_device_t *device_obj) {
     );
     device_obj->midi_in_transfer = NULL;
   }
+  if (device_obj->midi_out_transfer != NULL) {
+    if (device_obj->midi_out_transfer == midi_out_transfer.load()) {
+      midi_out_queue->close();
+      midi_out_transfer.store(NULL);
+      if (connection_stats != NULL) {
+        portENTER_CRITICAL(&connection_stats_lock);
+        connection_stats->midi_out = false;
+        portEXIT_CRITICAL(&connection_stats_lock);
+      }
+    }
+    ESP_ERROR_CHECK_WITHOUT_ABORT(usb_host_transfer_free(device_obj->midi_out_transfer));
+    device_obj->midi_out_transfer = NULL;
+  }
   ESP_ERROR_CHECK(usb_host_device_close(device_obj->client_hdl, device_obj->dev_hdl));
+  if (connection_stats != NULL) {
+    portENTER_CRITICAL(&connection_stats_lock);
+    connection_stats->connected = false;
+    portEXIT_CRITICAL(&connection_stats_lock);
+  }
   device_obj->dev_hdl = NULL;
   device_obj->dev_addr = 0;
 }
@@ -319,26 +491,50 @@ static void actionCloseDev(usb_device_t *device_obj) {
 static void transferCallback(usb_transfer_t *transfer) {
   int in_xfer = transfer->bEndpointAddress & USB_B_ENDPOINT_ADDRESS_EP_DIR_MASK;
   if ((transfer->status == USB_TRANSFER_STATUS_COMPLETED) && in_xfer) {
+    traceBegin(TRACE_SPAN_USB_TRANSFER);
     const midi_usb_packet *packets = (midi_usb_packet*)transfer->data_buffer;
     for (int i = 0; i < transfer->actual_num_bytes / 4; i += 1) {
       const midi_usb_packet packet = packets[i];
       if ((packet.usb_cable_number | packet.code_index_number | packet.midi_channel | packet.midi_type | packet.midi_data_1 | packet.midi_data_2) == 0) {
         break;
       }
+      if (connection_stats != NULL && packet.code_index_number == MIDI_NOTE_ON && packet.midi_data_2 > 0) {
+        portENTER_CRITICAL(&connection_stats_lock);
+        if (connection_stats->first_note_us == 0) {
+          connection_stats->first_note_us = esp_timer_get_time() - connection_stats->connect_us;
+        }
+        portEXIT_CRITICAL(&connection_stats_lock);
+      }
       if (midiInCallbackPtr != NULL) {
         (*midiInCallbackPtr)(packet);
       }
     }
 
+    traceEnd(TRACE_SPAN_USB_TRANSFER);
     ESP_ERROR_CHECK_WITHOUT_ABORT(usb_host_transfer_submit(transfer));
   }
 }
 
 /**
- * @param[in] arg  Midi in callback
+ * Called by the tasks sending MIDI after each packet queued.
+ * Wakes the class driver task up when no OUT transfer is in flight, otherwise the transfer callback sends the packet.
+ */
+void classDriverMidiOutReady(void) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (midi_out_busy.load() || midi_out_transfer.load() == NULL || s_driver_obj == NULL) return;
+  usb_host_client_unblock(s_driver_obj->constant.client_hdl);
+}
+
+/**
+ * @param[in] arg  usb_class_driver_config_t
  */
 void classDriverTask(void *arg) {
-  midiInCallbackPtr = (midi_in_callback_t*)arg;
+  const usb_class_driver_config_t *config = (const usb_class_driver_config_t*)arg;
+  midiInCallbackPtr = config->midi_in_callback;
+  device_cache = config->device_cache;
+  connection_stats = config->stats;
+  deviceCacheChanged = config->device_cache_changed;
+  midi_out_queue = config->midi_out;
   class_driver_t driver_obj = {0};
   usb_host_client_handle_t class_driver_client_hdl = NULL;
   
@@ -381,6 +577,8 @@ void classDriverTask(void *arg) {
       // Driver is active, handle client events
       if (driver_obj.mux_protected.flags.shutdown == 0) {
         usb_host_client_handle_events(class_driver_client_hdl, portMAX_DELAY);
+        // Also returns when classDriverMidiOutReady() unblocked it
+        flushMidiOut();
       } else {
         // Shutdown the driver
         break;
@@ -0,0 +1,145 @@
+#include "AudioInput.h"
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/i2s.h"
+#include "TraceRecorder.h"
+#include "midi_decoder.h"
+
+// Microphones send 24 bit samples left aligned in 32 bits, keep 16 bits with a gain of 4
+#define AUDIO_SAMPLE_SHIFT 14
+// One DMA buffer is received while the other one is read
+#define AUDIO_DMA_BUFFER_COUNT 2
+
+/// Variables ///
+
+static QueueHandle_t note_queue = NULL;
+// Notes whose note on was dropped, their note off is dropped too. Only used by the audio task
+static uint32_t dropped_notes[4];
+static int32_t raw_block[AUDIO_BLOCK_SIZE];
+static int16_t block[AUDIO_BLOCK_SIZE];
+
+/// Functions declaration ///
+
+static void queueNote(midi_usb_packet packet);
+
+/// Class members definition ///
+
+AudioInput::AudioInput() {
+
+}
+
+AudioInput::~AudioInput() {
+
+}
+
+void AudioInput::setMidiInCallback(midi_in_callback_t *callback) {
+  this->midiInCallback = callback;
+}
+
+void AudioInput::setThreshold(uint32_t magnitude) {
+  detector.setThreshold(magnitude);
+}
+
+bool AudioInput::setup(int bck_pin, int ws_pin, int data_pin) {
+  i2s_config_t config = {};
+  config.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX);
+  config.sample_rate = AUDIO_SAMPLE_RATE;
+  config.bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT;
+  config.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
+  config.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+  config.intr_alloc_flags = ESP_INTR_FLAG_LEVEL1;
+  config.dma_buf_count = AUDIO_DMA_BUFFER_COUNT;
+  config.dma_buf_len = AUDIO_BLOCK_SIZE;
+  if (i2s_driver_install((i2s_port_t)AUDIO_I2S_PORT, &config, 0, NULL) != ESP_OK) {
+    log_e("Unable to install the I2S driver");
+    return false;
+  }
+  i2s_pin_config_t pins = {};
+  pins.mck_io_num = I2S_PIN_NO_CHANGE;
+  pins.bck_io_num = bck_pin;
+  pins.ws_io_num = ws_pin;
+  pins.data_out_num = I2S_PIN_NO_CHANGE;
+  pins.data_in_num = data_pin;
+  if (i2s_set_pin((i2s_port_t)AUDIO_I2S_PORT, &pins) != ESP_OK) {
+    log_e("Unable to set the I2S pins");
+    i2s_driver_uninstall((i2s_port_t)AUDIO_I2S_PORT);
+    return false;
+  }
+
+  note_queue = xQueueCreate(AUDIO_QUEUE_LENGTH, sizeof(midi_usb_packet));
+  detector.setMidiInCallback(&queueNote);
+  // Core 1 runs loop(), the analysis shares core 0 with the USB host at a lower priority
+  const BaseType_t task_created = xTaskCreatePinnedToCore(
+    task,
+    "audio_input",
+    AUDIO_TASK_STACK_SIZE,
+    this,
+    AUDIO_TASK_PRIORITY,
+    NULL,
+    0
+  );
+  if (task_created != pdTRUE) {
+    log_e("Unable to create the audio task");
+    return false;
+  }
+  log_i("Audio input started, %d Hz", AUDIO_SAMPLE_RATE);
+  return true;
+}
+
+void AudioInput::loop() {
+  if (note_queue == NULL) return;
+  midi_usb_packet packet;
+  while (xQueueReceive(note_queue, &packet, 0)) {
+    if (this->midiInCallback != NULL) (*this->midiInCallback)(packet);
+  }
+}
+
+uint32_t AudioInput::getProcessTime() {
+  return process_time_us;
+}
+
+/**
+ * Wait for each block of the DMA and analyze it.
+ */
+void AudioInput::task(void* arg) {
+  AudioInput* input = (AudioInput*)arg;
+  for (;;) {
+    size_t bytes_read = 0;
+    if (i2s_read((i2s_port_t)AUDIO_I2S_PORT, raw_block, sizeof(raw_block), &bytes_read, portMAX_DELAY) != ESP_OK) continue;
+    if (bytes_read != sizeof(raw_block)) continue;
+    const uint32_t start_us = micros();
+    for (uint16_t i = 0; i < AUDIO_BLOCK_SIZE; i++) {
+      const int32_t sample = raw_block[i] >> AUDIO_SAMPLE_SHIFT;
+      block[i] = sample > INT16_MAX ? INT16_MAX : sample < INT16_MIN ? INT16_MIN : sample;
+    }
+    traceBegin(TRACE_SPAN_AUDIO_BLOCK);
+    input->detector.process(block);
+    traceEnd(TRACE_SPAN_AUDIO_BLOCK);
+    input->process_time_us = micros() - start_us;
+  }
+}
+
+/// Functions definition ///
+
+/**
+ * Called from the audio task, never blocks it. When loop() is late the note ons are dropped first:
+ * the last AUDIO_MAX_NOTES places are kept for the note offs, so a note lit is always released.
+ */
+static void queueNote(midi_usb_packet packet) {
+  const midi_event_t event = decodeMidiPacket(packet);
+  const uint32_t mask = 1UL << (event.note & 31);
+  if (event.type == MIDI_EVENT_NOTE_ON) {
+    if (uxQueueSpacesAvailable(note_queue) <= AUDIO_MAX_NOTES) {
+      dropped_notes[event.note >> 5] |= mask;
+      return;
+    }
+    dropped_notes[event.note >> 5] &= ~mask;
+  } else if (event.type == MIDI_EVENT_NOTE_OFF && (dropped_notes[event.note >> 5] & mask)) {
+    dropped_notes[event.note >> 5] &= ~mask;
+    return;
+  }
+  xQueueSend(note_queue, &packet, 0);
+}
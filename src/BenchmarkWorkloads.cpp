@@ -0,0 +1,163 @@
+#include "BenchmarkWorkloads.h"
+
+#include <algorithm>
+#include "midi_decoder.h"
+
+#define FIRST_PIANO_NOTE 21
+#define LAST_PIANO_NOTE 108
+
+/// Types ///
+
+typedef struct {
+  timed_midi_packet* out;
+  size_t capacity;
+  size_t count;
+} workload_writer_t;
+
+/// Functions declaration ///
+
+static void pushEvent(workload_writer_t*, uint32_t time_us, uint8_t status, uint8_t data_1, uint8_t data_2, uint8_t cable);
+static void pushNote(workload_writer_t*, uint32_t time_us, uint32_t duration_us, uint8_t note, uint8_t velocity, uint8_t cable);
+static void writeScales(workload_writer_t*, uint8_t cable);
+static void writeDenseChords(workload_writer_t*, uint8_t cable, int chord_count);
+static void writeGlissandi(workload_writer_t*, uint8_t cable, int glissando_count);
+static void writePedalStorm(workload_writer_t*, uint8_t cable);
+static bool isWhiteKey(uint8_t note);
+
+/// Functions definition ///
+
+const char* getBenchWorkloadName(bench_workload_t workload) {
+  switch (workload) {
+    case BENCH_WORKLOAD_SCALES: return "scales";
+    case BENCH_WORKLOAD_DENSE_CHORDS: return "dense_chords";
+    case BENCH_WORKLOAD_GLISSANDI: return "glissandi";
+    case BENCH_WORKLOAD_PEDAL_STORM: return "pedal_storm";
+    case BENCH_WORKLOAD_MULTI_DEVICE: return "multi_device";
+    default: return "unknown";
+  }
+}
+
+size_t generateBenchWorkload(bench_workload_t workload, timed_midi_packet* out, size_t capacity) {
+  workload_writer_t writer = { out, capacity, 0 };
+  switch (workload) {
+    case BENCH_WORKLOAD_SCALES:
+      writeScales(&writer, 0);
+      break;
+    case BENCH_WORKLOAD_DENSE_CHORDS:
+      writeDenseChords(&writer, 0, 100);
+      break;
+    case BENCH_WORKLOAD_GLISSANDI:
+      writeGlissandi(&writer, 0, 8);
+      break;
+    case BENCH_WORKLOAD_PEDAL_STORM:
+      writePedalStorm(&writer, 0);
+      break;
+    case BENCH_WORKLOAD_MULTI_DEVICE:
+      // Three keyboards playing at the same time, merged on their cable number
+      writeScales(&writer, 0);
+      writeDenseChords(&writer, 1, 60);
+      writeGlissandi(&writer, 2, 4);
+      break;
+    default:
+      break;
+  }
+  std::stable_sort(out, out + writer.count, [](const timed_midi_packet& a, const timed_midi_packet& b) {
+    return a.time_us < b.time_us;
+  });
+  return writer.count;
+}
+
+static void pushEvent(workload_writer_t* writer, uint32_t time_us, uint8_t status, uint8_t data_1, uint8_t data_2, uint8_t cable) {
+  if (writer->count >= writer->capacity) return;
+  writer->out[writer->count].time_us = time_us;
+  writer->out[writer->count].packet = makeMidiPacket(status, data_1, data_2, cable);
+  writer->count++;
+}
+
+static void pushNote(workload_writer_t* writer, uint32_t time_us, uint32_t duration_us, uint8_t note, uint8_t velocity, uint8_t cable) {
+  pushEvent(writer, time_us, 0x90, note, velocity, cable);
+  // Use the note on with null velocity form half of the time, as many keyboards do
+  if (note & 1) {
+    pushEvent(writer, time_us + duration_us, 0x80, note, 64, cable);
+  } else {
+    pushEvent(writer, time_us + duration_us, 0x90, note, 0, cable);
+  }
+}
+
+/**
+ * Major scales, up and down, starting on every C of the keyboard.
+ */
+static void writeScales(workload_writer_t* writer, uint8_t cable) {
+  static const uint8_t major_steps[] = { 0, 2, 4, 5, 7, 9, 11, 12 };
+  uint32_t time_us = 0;
+  for (int pass = 0; pass < 4; pass++) {
+    for (uint8_t root = 24; root + 12 <= LAST_PIANO_NOTE; root += 12) {
+      for (int i = 0; i < 8; i++) {
+        pushNote(writer, time_us, 120000, root + major_steps[i], 70 + 5 * i, cable);
+        time_us += 125000;
+      }
+      for (int i = 6; i >= 0; i--) {
+        pushNote(writer, time_us, 120000, root + major_steps[i], 70 + 5 * i, cable);
+        time_us += 125000;
+      }
+    }
+  }
+}
+
+/**
+ * Ten note chords, both hands, with a slight strum between fingers.
+ */
+static void writeDenseChords(workload_writer_t* writer, uint8_t cable, int chord_count) {
+  static const uint8_t left_hand[] = { 0, 7, 12, 16, 19 };
+  static const uint8_t right_hand[] = { 24, 28, 31, 36, 40 };
+  uint32_t time_us = 0;
+  for (int chord = 0; chord < chord_count; chord++) {
+    const uint8_t root = 28 + (chord * 5) % 24;
+    for (int i = 0; i < 5; i++) {
+      pushNote(writer, time_us + i * 800, 200000, root + left_hand[i], 90, cable);
+      pushNote(writer, time_us + i * 800, 200000, root + right_hand[i], 100, cable);
+    }
+    time_us += 250000;
+  }
+}
+
+/**
+ * White key glissandi across the whole keyboard, notes overlap while the hand slides.
+ */
+static void writeGlissandi(workload_writer_t* writer, uint8_t cable, int glissando_count) {
+  uint32_t time_us = 0;
+  for (int glissando = 0; glissando < glissando_count; glissando++) {
+    const bool up = glissando % 2 == 0;
+    for (int i = 0; i <= LAST_PIANO_NOTE - FIRST_PIANO_NOTE; i++) {
+      const uint8_t note = up ? FIRST_PIANO_NOTE + i : LAST_PIANO_NOTE - i;
+      if (!isWhiteKey(note)) continue;
+      pushNote(writer, time_us, 60000, note, 110, cable);
+      time_us += 8000;
+    }
+    time_us += 200000;
+  }
+}
+
+/**
+ * Half pedaling with a continuous sustain controller over a slow melody.
+ */
+static void writePedalStorm(workload_writer_t* writer, uint8_t cable) {
+  uint32_t time_us = 0;
+  for (int bar = 0; bar < 40; bar++) {
+    pushNote(writer, time_us, 400000, 60 + (bar * 7) % 24, 80, cable);
+    // Pedal goes down then up with every intermediate position
+    for (int value = 0; value <= 127; value += 4) {
+      pushEvent(writer, time_us, MIDI_CONTROL_CHANGE << 4, MIDI_CC_SUSTAIN, value, cable);
+      time_us += 3000;
+    }
+    for (int value = 127; value >= 0; value -= 4) {
+      pushEvent(writer, time_us, MIDI_CONTROL_CHANGE << 4, MIDI_CC_SUSTAIN, value, cable);
+      time_us += 3000;
+    }
+  }
+}
+
+static bool isWhiteKey(uint8_t note) {
+  static const bool white_keys[12] = { true, false, true, false, true, true, false, true, false, true, false, true };
+  return white_keys[note % 12];
+}
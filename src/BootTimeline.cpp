@@ -0,0 +1,38 @@
+#include "BootTimeline.h"
+
+/// Variables ///
+
+static const char* phase_names[BOOT_PHASE_COUNT] = {
+  "setup",
+  "leds_ready",
+  "usb_ready",
+  "wifi_ready",
+  "server_ready",
+  "first_note",
+};
+
+/// Class members definition ///
+
+BootTimeline::BootTimeline() {
+  for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) times[i].store(0);
+}
+
+void BootTimeline::mark(boot_phase_t phase, uint32_t now_us) {
+  if (phase >= BOOT_PHASE_COUNT) return;
+  // 0 means not reached
+  if (now_us == 0) now_us = 1;
+  uint32_t unset = 0;
+  times[phase].compare_exchange_strong(unset, now_us);
+}
+
+bool BootTimeline::isReached(boot_phase_t phase) {
+  return this->getTime(phase) != 0;
+}
+
+uint32_t BootTimeline::getTime(boot_phase_t phase) {
+  return phase < BOOT_PHASE_COUNT ? times[phase].load() : 0;
+}
+
+const char* BootTimeline::getPhaseName(boot_phase_t phase) {
+  return phase < BOOT_PHASE_COUNT ? phase_names[phase] : "unknown";
+}
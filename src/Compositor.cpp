@@ -0,0 +1,136 @@
+#include "Compositor.h"
+
+#include <cstring>
+
+/// Functions declaration ///
+
+static void blendAdd(uint8_t* __restrict frame, const uint8_t* __restrict layer, uint16_t size, uint8_t opacity);
+static void blendMax(uint8_t* __restrict frame, const uint8_t* __restrict layer, uint16_t size, uint8_t opacity);
+static void blendAlpha(uint8_t* __restrict frame, const uint8_t* __restrict layer, uint16_t size, uint8_t opacity);
+static void blendMultiply(uint8_t* __restrict frame, const uint8_t* __restrict layer, uint16_t size, uint8_t opacity);
+
+/// Class members definition ///
+
+Compositor::Compositor(uint16_t pixel_count, MemoryArena* arena) {
+  size = 3 * pixel_count;
+  memory = arena;
+  for (uint8_t i = 0; i < LAYER_COUNT; i++) {
+    layers[i] = MemoryArena::allocateBuffer(memory, size);
+    modes[i] = BLEND_ALPHA;
+    opacities[i] = 255;
+    enabled[i] = true;
+  }
+  modes[LAYER_PARTICLES] = BLEND_ADD;
+  modes[LAYER_SCRIPT] = BLEND_ADD;
+}
+
+Compositor::~Compositor() {
+  for (uint8_t i = 0; i < LAYER_COUNT; i++) MemoryArena::releaseBuffer(memory, layers[i]);
+}
+
+uint8_t* Compositor::getLayer(layer_id_t layer) {
+  return layers[layer];
+}
+
+void Compositor::clearLayer(layer_id_t layer) {
+  memset(layers[layer], 0, size);
+}
+
+void Compositor::setBlendMode(layer_id_t layer, blend_mode_t mode) {
+  modes[layer] = mode;
+}
+
+blend_mode_t Compositor::getBlendMode(layer_id_t layer) {
+  return modes[layer];
+}
+
+void Compositor::setOpacity(layer_id_t layer, uint8_t opacity) {
+  opacities[layer] = opacity;
+}
+
+uint8_t Compositor::getOpacity(layer_id_t layer) {
+  return opacities[layer];
+}
+
+void Compositor::setEnabled(layer_id_t layer, bool layer_enabled) {
+  enabled[layer] = layer_enabled;
+}
+
+bool Compositor::isEnabled(layer_id_t layer) {
+  return enabled[layer];
+}
+
+void Compositor::compose(uint8_t* frame) {
+  bool blank = true;
+  for (uint8_t i = 0; i < LAYER_COUNT; i++) {
+    if (!enabled[i] || opacities[i] == 0) continue;
+    if (blank) {
+      // Multiplying black stays black, the other modes copy an opaque layer
+      if (modes[i] == BLEND_MULTIPLY) continue;
+      blank = false;
+      if (opacities[i] == 255) {
+        memcpy(frame, layers[i], size);
+        continue;
+      }
+      memset(frame, 0, size);
+    }
+    switch (modes[i]) {
+      case BLEND_ADD:
+        blendAdd(frame, layers[i], size, opacities[i]);
+        break;
+      case BLEND_MAX:
+        blendMax(frame, layers[i], size, opacities[i]);
+        break;
+      case BLEND_ALPHA:
+        blendAlpha(frame, layers[i], size, opacities[i]);
+        break;
+      case BLEND_MULTIPLY:
+        blendMultiply(frame, layers[i], size, opacities[i]);
+        break;
+    }
+  }
+  if (blank) memset(frame, 0, size);
+}
+
+/// Functions definition ///
+
+// The kernels work on bytes with 16 bits intermediates and no branch in the loop, so that
+// GCC vectorizes them (SSE/NEON on the host). Opacity scaling is x * (opacity + 1) >> 8, like scaleColor.
+
+static void blendAdd(uint8_t* __restrict frame, const uint8_t* __restrict layer, uint16_t size, uint8_t opacity) {
+  const uint16_t factor = opacity + 1;
+  for (uint16_t i = 0; i < size; i++) {
+    const uint16_t sum = frame[i] + (layer[i] * factor >> 8);
+    frame[i] = sum > 255 ? 255 : sum;
+  }
+}
+
+static void blendMax(uint8_t* __restrict frame, const uint8_t* __restrict layer, uint16_t size, uint8_t opacity) {
+  const uint16_t factor = opacity + 1;
+  for (uint16_t i = 0; i < size; i++) {
+    const uint8_t value = layer[i] * factor >> 8;
+    frame[i] = value > frame[i] ? value : frame[i];
+  }
+}
+
+/**
+ * Per pixel coverage: a pixel with any channel lit covers the three channels below.
+ */
+static void blendAlpha(uint8_t* __restrict frame, const uint8_t* __restrict layer, uint16_t size, uint8_t opacity) {
+  const int16_t factor = opacity + 1;
+  for (uint16_t i = 0; i < size; i += 3) {
+    const int16_t coverage = (layer[i] | layer[i + 1] | layer[i + 2]) ? factor : 0;
+    for (uint8_t channel = 0; channel < 3; channel++) {
+      frame[i + channel] += (layer[i + channel] - frame[i + channel]) * coverage >> 8;
+    }
+  }
+}
+
+static void blendMultiply(uint8_t* __restrict frame, const uint8_t* __restrict layer, uint16_t size, uint8_t opacity) {
+  const uint16_t factor = opacity + 1;
+  for (uint16_t i = 0; i < size; i++) {
+    // White, or a transparent layer, keeps the frame
+    const uint16_t scale = 256 - ((255 - layer[i]) * factor >> 8);
+    frame[i] = frame[i] * scale >> 8;
+  }
+}
@@ -3,29 +3,113 @@
 #include <WiFi.h>
 #include <WebServer.h>
 #include <ArduinoJson.h>
-#include <string>
+#include <LittleFS.h>
+#include <esp_heap_caps.h>
 
 #include "LedController.h"
+#include "PsramJsonAllocator.h"
 #include "secrets.h"
 #include "index.h"
 
+/// Functions declaration ///
+
+static void addHeapReport(JsonObject report, uint32_t caps, size_t steady_free);
+
+/// Variables ///
+
+static PsramJsonAllocator json_allocator;
+
+/// Class members definition ///
+
 ConfigServer::ConfigServer(LedController* led, uint8_t webserver_mode) {
   mode = webserver_mode;
   led_controller = led;
   server = new WebServer(80);
+  websocket = new WebSocketsServer(SETTINGS_WEBSOCKET_PORT);
 }
 
 ConfigServer::~ConfigServer() {
   delete server;
+  delete websocket;
 }
 
 void ConfigServer::setup() {
-  if (mode == WIFI_MODE_STA) this->startStaMode();
-  else if (mode == WIFI_MODE_AP) this->startApMode();
+  if (!mode) return;
+  // Core 1 runs loop(), it keeps handling the keyboard while WiFi connects
+  const BaseType_t task_created = xTaskCreatePinnedToCore(
+    networkTask,
+    "network",
+    NETWORK_TASK_STACK_SIZE,
+    this,
+    NETWORK_TASK_PRIORITY,
+    NULL,
+    0
+  );
+  if (task_created != pdTRUE) {
+    log_e("Unable to create the network task, starting the network in setup");
+    if (mode == WIFI_MODE_STA) this->startStaMode();
+    else this->startApMode();
+    ready.store(true, std::memory_order_release);
+  }
 }
 
 void ConfigServer::loop() {
-  if (mode) server->handleClient();
+  if (!mode || !ready.load(std::memory_order_acquire)) return;
+  server->handleClient();
+  websocket->loop();
+}
+
+void ConfigServer::setBenchmark(DeviceBenchmark* device_benchmark) {
+  benchmark = device_benchmark;
+}
+
+void ConfigServer::setFilePlayer(MidiFilePlayer* player) {
+  file_player = player;
+}
+
+void ConfigServer::setRecorder(MidiRecorder* midi_recorder) {
+  recorder = midi_recorder;
+}
+
+void ConfigServer::setBootTimeline(BootTimeline* timeline) {
+  boot_timeline = timeline;
+}
+
+void ConfigServer::setTraceRecorder(TraceRecorder* trace_recorder) {
+  tracer = trace_recorder;
+}
+
+void ConfigServer::setUsbHost(UsbMidiHost* usb_midi_host) {
+  usb_host = usb_midi_host;
+}
+
+void ConfigServer::setMemoryArenas(MemoryArena* internal, MemoryArena* psram) {
+  internal_memory = internal;
+  psram_memory = psram;
+}
+
+void ConfigServer::markSteadyState() {
+  steady_internal_free = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  steady_psram_free = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+}
+
+bool ConfigServer::isReady() {
+  return ready.load(std::memory_order_acquire);
+}
+
+void ConfigServer::networkTask(void* arg) {
+  ConfigServer* config_server = (ConfigServer*)arg;
+  if (config_server->mode == WIFI_MODE_STA) config_server->startStaMode();
+  else config_server->startApMode();
+  // The server is only used by loop() from now on
+  config_server->ready.store(true, std::memory_order_release);
+  vTaskDelete(NULL);
+}
+
+void ConfigServer::markBootPhase(boot_phase_t phase) {
+  if (boot_timeline == NULL) return;
+  boot_timeline->mark(phase, micros());
+  log_i("Boot phase %s at %lu ms", BootTimeline::getPhaseName(phase), (unsigned long)boot_timeline->getTime(phase) / 1000);
 }
 
 void ConfigServer::startApMode() {
@@ -37,6 +121,7 @@ void ConfigServer::startApMode() {
   WiFi.softAPConfig(local_ip, gateway, subnet);
   WiFi.softAP(AP_SSID, NULL);
   delay(100);
+  this->markBootPhase(BOOT_PHASE_WIFI_READY);
 
   this->startServer();
 }
@@ -49,6 +134,7 @@ void ConfigServer::startStaMode() {
   WiFi.waitForConnectResult(10000);
   if (WiFi.status() == WL_CONNECTED) {
     log_i("Connected with IP %s", WiFi.localIP().toString().c_str());
+    this->markBootPhase(BOOT_PHASE_WIFI_READY);
     this->startServer();
   } else {
     log_e("Connection failed with status %d", WiFi.status());
@@ -62,19 +148,57 @@ void ConfigServer::startServer() {
   server->on("/color", HTTP_POST, [this](){ this->onPostColor(); });
   server->on("/brightness", HTTP_POST, [this](){ this->onPostBrightness(); });
   server->on("/sustain", HTTP_POST, [this](){ this->onPostShowSustain(); });
+  server->on("/settings", HTTP_GET, [this](){ this->onGetSettings(); });
+  server->on("/presets", HTTP_GET, [this](){ this->onGetPresets(); });
+  server->on("/harmony", HTTP_GET, [this](){ this->onGetHarmony(); });
+  server->on("/preset", HTTP_POST, [this](){ this->onPostPreset(); });
+  server->on("/preset/save", HTTP_POST, [this](){ this->onPostSavePreset(); });
+  // The second handler receives the raw body, kept out of the String based "plain" argument
+  server->on("/settings", HTTP_POST, [this](){ this->onPostSettings(); }, [this](){ this->onSettingsBody(); });
+  server->on("/benchmark", HTTP_POST, [this](){ this->onPostBenchmark(); });
+  server->on("/files", HTTP_GET, [this](){ this->onGetFiles(); });
+  server->on("/play", HTTP_POST, [this](){ this->onPostPlay(); });
+  server->on("/stop", HTTP_POST, [this](){ this->onPostStop(); });
+  server->on("/learn", HTTP_POST, [this](){ this->onPostLearn(); });
+  server->on("/learn", HTTP_GET, [this](){ this->onGetLearn(); });
+  server->on("/record", HTTP_POST, [this](){ this->onPostRecord(); });
+  server->on("/recording.mid", HTTP_GET, [this](){ this->onGetRecording(); });
+  server->on("/recording.pnl", HTTP_GET, [this](){ this->onGetRecordingLog(); });
+  server->on("/boot", HTTP_GET, [this](){ this->onGetBoot(); });
+  server->on("/effect", HTTP_GET, [this](){ this->onGetEffect(); });
+  server->on("/effect/script", HTTP_GET, [this](){ this->onGetEffectScript(); });
+  server->on("/effect", HTTP_POST, [this](){ this->onPostEffect(); });
+  server->on("/trace.json", HTTP_GET, [this](){ this->onGetTrace(); });
+  server->on("/trace", HTTP_POST, [this](){ this->onPostTrace(); });
+  server->on("/memory", HTTP_GET, [this](){ this->onGetMemory(); });
+  server->on("/usb", HTTP_GET, [this](){ this->onGetUsb(); });
   server->begin();
+  websocket->onEvent([this](uint8_t client, WStype_t type, uint8_t* payload, size_t length) {
+    this->onWebSocketEvent(client, type, payload, length);
+  });
+  websocket->begin();
+  this->markBootPhase(BOOT_PHASE_SERVER_READY);
 }
 
 void ConfigServer::onConnect() {
   uint8_t brightness = led_controller->getBrightness();
   uint32_t led_color = led_controller->getColor();
   bool sustain = led_controller->getShowSustain();
-  char brightnessString[4], redString[4], greenString[4], blueString[4];
-  sprintf(brightnessString, "%d", brightness);
-  sprintf(redString, "%d", ((uint8_t*)&led_color)[2]);
-  sprintf(greenString, "%d", ((uint8_t*)&led_color)[1]);
-  sprintf(blueString, "%d", ((uint8_t*)&led_color)[0]);
-  server->send(200, "text/html", getHtmlPage(brightnessString, redString, greenString, blueString, sustain).c_str());
+  char values[HTML_PAGE_VALUE_COUNT][6];
+  sprintf(values[0], "%d", ((uint8_t*)&led_color)[2]);
+  sprintf(values[1], "%d", ((uint8_t*)&led_color)[1]);
+  sprintf(values[2], "%d", ((uint8_t*)&led_color)[0]);
+  sprintf(values[3], "%d", brightness);
+  strcpy(values[4], sustain ? "true" : "false");
+  // The page is sent from flash, it is never copied to the heap
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server->send(200, "text/html", "");
+  for (uint8_t i = 0; i < HTML_PAGE_VALUE_COUNT; i++) {
+    server->sendContent_P(html_page_parts[i]);
+    server->sendContent(values[i], strlen(values[i]));
+  }
+  server->sendContent_P(html_page_parts[HTML_PAGE_VALUE_COUNT]);
+  server->sendContent("");
 }
 
 void ConfigServer::onPostColor() {
@@ -82,8 +206,14 @@ void ConfigServer::onPostColor() {
     server->send(400, "application/json", R"({ "error": "missing body" })");
     return;
   }
-  JsonDocument json;
-  deserializeJson(json, server->arg("plain"));
+  JsonDocument json(&json_allocator);
+  if (
+    deserializeJson(json, server->arg("plain"))
+    || !json["red"].is<uint8_t>() || !json["green"].is<uint8_t>() || !json["blue"].is<uint8_t>()
+  ) {
+    server->send(400, "application/json", R"({ "error": "invalid body" })");
+    return;
+  }
 
   led_controller->setColor(json["red"], json["green"], json["blue"]);
   server->send(200, "application/json", R"({ "status": "ok" })");
@@ -94,8 +224,11 @@ void ConfigServer::onPostBrightness() {
     server->send(400, "application/json", R"({ "error": "missing body" })");
     return;
   }
-  JsonDocument json;
-  deserializeJson(json, server->arg("plain"));
+  JsonDocument json(&json_allocator);
+  if (deserializeJson(json, server->arg("plain")) || !json["brightness"].is<uint8_t>()) {
+    server->send(400, "application/json", R"({ "error": "invalid body" })");
+    return;
+  }
 
   led_controller->setBrightness(json["brightness"]);
   server->send(200, "application/json", R"({ "status": "ok" })");
@@ -106,9 +239,468 @@ void ConfigServer::onPostShowSustain() {
     server->send(400, "application/json", R"({ "error": "missing body" })");
     return;
   }
-  JsonDocument json;
-  deserializeJson(json, server->arg("plain"));
+  JsonDocument json(&json_allocator);
+  if (deserializeJson(json, server->arg("plain")) || !json["sustain"].is<bool>()) {
+    server->send(400, "application/json", R"({ "error": "invalid body" })");
+    return;
+  }
 
   led_controller->setShowSustain(json["sustain"] == true);
   server->send(200, "application/json", R"({ "status": "ok" })");
 }
+
+void ConfigServer::onGetSettings() {
+  SettingsStore* store = led_controller->getSettings();
+  const led_preset_t preset = store->getPreset();
+  settings_update_t settings = { 0, { 0 } };
+  setSettingsField(&settings, SETTINGS_FIELD_COLOR, preset.color);
+  setSettingsField(&settings, SETTINGS_FIELD_BRIGHTNESS, preset.brightness);
+  setSettingsField(&settings, SETTINGS_FIELD_SHOW_SUSTAIN, preset.show_sustain);
+  setSettingsField(&settings, SETTINGS_FIELD_VELOCITY_CURVE, preset.velocity_curve);
+  setSettingsField(&settings, SETTINGS_FIELD_PALETTE, preset.palette);
+  setSettingsField(&settings, SETTINGS_FIELD_SECONDARY_COLOR, preset.secondary_color);
+  setSettingsField(&settings, SETTINGS_FIELD_SPLIT_KEY, preset.split_key);
+  setSettingsField(&settings, SETTINGS_FIELD_EFFECT, preset.effect);
+  if (store->getSelectedPreset() >= 0) setSettingsField(&settings, SETTINGS_FIELD_PRESET, store->getSelectedPreset());
+  uint8_t message[SETTINGS_MAX_MESSAGE_SIZE];
+  const size_t length = encodeSettings(&settings, message);
+  server->send_P(200, "application/octet-stream", (const char*)message, length);
+}
+
+void ConfigServer::onSettingsBody() {
+  HTTPRaw& raw = server->raw();
+  if (raw.status == RAW_START) {
+    settings_body_length = 0;
+  } else if (raw.status == RAW_WRITE) {
+    if (settings_body_length + raw.currentSize > sizeof(settings_body)) {
+      // Only the length is kept, the decoder rejects messages over the maximum size
+      settings_body_length = sizeof(settings_body) + 1;
+      return;
+    }
+    memcpy(settings_body + settings_body_length, raw.buf, raw.currentSize);
+    settings_body_length += raw.currentSize;
+  }
+}
+
+void ConfigServer::onPostSettings() {
+  const uint8_t reply[SETTINGS_REPLY_SIZE] = {
+    SETTINGS_PROTOCOL_VERSION,
+    this->applySettings(settings_body, settings_body_length),
+  };
+  settings_body_length = 0;
+  server->send_P(reply[1] == SETTINGS_STATUS_OK ? 200 : 400, "application/octet-stream", (const char*)reply, sizeof(reply));
+}
+
+void ConfigServer::onWebSocketEvent(uint8_t client, WStype_t type, uint8_t* payload, size_t length) {
+  if (type != WStype_BIN) return;
+  const uint8_t reply[SETTINGS_REPLY_SIZE] = {
+    SETTINGS_PROTOCOL_VERSION,
+    this->applySettings(payload, length),
+  };
+  websocket->sendBIN(client, reply, sizeof(reply));
+}
+
+/**
+ * Apply a binary settings message as a single new snapshot, the stored preset it selects included.
+ */
+settings_status_t ConfigServer::applySettings(const uint8_t* message, size_t length) {
+  settings_update_t update;
+  const settings_status_t status = decodeSettings(message, length, &update);
+  if (status != SETTINGS_STATUS_OK) {
+    log_e("Invalid settings message, status %d", status);
+    return status;
+  }
+  led_preset_t preset;
+  const int8_t selected = applySettingsUpdate(&update, led_controller->getSettings(), &preset);
+  led_controller->setPreset(preset, selected);
+  return status;
+}
+
+void ConfigServer::onGetPresets() {
+  SettingsStore* settings = led_controller->getSettings();
+  JsonDocument json(&json_allocator);
+  json["selected"] = settings->getSelectedPreset();
+  JsonArray presets = json["presets"].to<JsonArray>();
+  for (uint8_t index = 0; index < PRESET_COUNT; index++) {
+    const led_preset_t* preset = settings->getStoredPreset(index);
+    JsonObject entry = presets.add<JsonObject>();
+    entry["index"] = index;
+    if (preset != NULL) entry["name"] = preset->name;
+  }
+  String body;
+  serializeJson(json, body);
+  server->send(200, "application/json", body);
+}
+
+void ConfigServer::onGetHarmony() {
+  HarmonyAnalyzer* harmony = led_controller->getRenderer()->getHarmony();
+  const chord_t chord = harmony->getChord();
+  const musical_key_t key = harmony->getKey();
+  JsonDocument json(&json_allocator);
+  json["held"] = led_controller->getRenderer()->getNoteState()->getPressedCount();
+  if (chord.quality != CHORD_QUALITY_NONE) {
+    json["chord"] = String(getPitchClassName(chord.root)) + " " + getChordQualityName(chord.quality);
+  }
+  if (key.valid) {
+    json["key"] = String(getPitchClassName(key.tonic)) + (key.minor ? " minor" : " major");
+  }
+  String body;
+  serializeJson(json, body);
+  server->send(200, "application/json", body);
+}
+
+void ConfigServer::onPostPreset() {
+  if (!server->hasArg("plain")) {
+    server->send(400, "application/json", R"({ "error": "missing body" })");
+    return;
+  }
+  JsonDocument json(&json_allocator);
+  if (deserializeJson(json, server->arg("plain")) || !json["index"].is<uint8_t>()) {
+    server->send(400, "application/json", R"({ "error": "invalid body" })");
+    return;
+  }
+  if (!led_controller->selectPreset(json["index"])) {
+    server->send(404, "application/json", R"({ "error": "empty preset" })");
+    return;
+  }
+  server->send(200, "application/json", R"({ "status": "ok" })");
+}
+
+void ConfigServer::onPostSavePreset() {
+  if (!server->hasArg("plain")) {
+    server->send(400, "application/json", R"({ "error": "missing body" })");
+    return;
+  }
+  JsonDocument json(&json_allocator);
+  if (
+    deserializeJson(json, server->arg("plain"))
+    || !json["index"].is<uint8_t>() || !json["name"].is<const char*>()
+    || !led_controller->savePreset(json["index"], json["name"])
+  ) {
+    server->send(400, "application/json", R"({ "error": "invalid body" })");
+    return;
+  }
+  server->send(200, "application/json", R"({ "status": "ok" })");
+}
+
+void ConfigServer::onPostBenchmark() {
+  if (benchmark == NULL) {
+    server->send(404, "application/json", R"({ "error": "benchmark unavailable" })");
+    return;
+  }
+  server->send(200, "application/json", benchmark->run());
+}
+
+void ConfigServer::onGetFiles() {
+  if (file_player == NULL) {
+    server->send(200, "application/json", "[]");
+    return;
+  }
+  server->send(200, "application/json", file_player->listFiles());
+}
+
+void ConfigServer::onPostPlay() {
+  if (!server->hasArg("plain")) {
+    server->send(400, "application/json", R"({ "error": "missing body" })");
+    return;
+  }
+  JsonDocument json(&json_allocator);
+  if (deserializeJson(json, server->arg("plain")) || !json["file"].is<const char*>()) {
+    server->send(400, "application/json", R"({ "error": "invalid body" })");
+    return;
+  }
+  if (file_player == NULL || !file_player->play(json["file"])) {
+    server->send(404, "application/json", R"({ "error": "unable to play file" })");
+    return;
+  }
+  JsonDocument status(&json_allocator);
+  status["status"] = "ok";
+  status["tracks"] = file_player->getTrackCount();
+  status["skipped_tracks"] = file_player->getSkippedTrackCount();
+  String body;
+  serializeJson(status, body);
+  server->send(200, "application/json", body);
+}
+
+void ConfigServer::onPostStop() {
+  if (file_player != NULL) file_player->stop();
+  server->send(200, "application/json", R"({ "status": "ok" })");
+}
+
+void ConfigServer::onPostLearn() {
+  if (!server->hasArg("plain")) {
+    server->send(400, "application/json", R"({ "error": "missing body" })");
+    return;
+  }
+  JsonDocument json(&json_allocator);
+  if (deserializeJson(json, server->arg("plain")) || !json["file"].is<const char*>()) {
+    server->send(400, "application/json", R"({ "error": "invalid body" })");
+    return;
+  }
+  // The song waits for the right keys unless it is asked to follow its own tempo
+  const learning_mode_t mode = json["mode"] == "follow" ? LEARNING_MODE_FOLLOW : LEARNING_MODE_WAIT;
+  if (file_player == NULL || !file_player->learn(json["file"], mode)) {
+    server->send(404, "application/json", R"({ "error": "unable to learn file" })");
+    return;
+  }
+  server->send(200, "application/json", R"({ "status": "ok" })");
+}
+
+void ConfigServer::onGetLearn() {
+  LearningSession* learning = file_player != NULL ? file_player->getLearningSession() : NULL;
+  if (learning == NULL) {
+    server->send(404, "application/json", R"({ "error": "learning unavailable" })");
+    return;
+  }
+  const learning_stats_t stats = learning->getStats();
+  JsonDocument json(&json_allocator);
+  json["active"] = learning->isActive();
+  json["mode"] = learning->getMode() == LEARNING_MODE_FOLLOW ? "follow" : "wait";
+  json["steps"] = stats.steps;
+  json["missed_steps"] = stats.missed_steps;
+  json["correct_notes"] = stats.correct_notes;
+  json["wrong_notes"] = stats.wrong_notes;
+  json["window"] = learning->getWindowSize();
+  String body;
+  serializeJson(json, body);
+  server->send(200, "application/json", body);
+}
+
+void ConfigServer::onPostRecord() {
+  if (!server->hasArg("plain")) {
+    server->send(400, "application/json", R"({ "error": "missing body" })");
+    return;
+  }
+  JsonDocument json(&json_allocator);
+  if (deserializeJson(json, server->arg("plain")) || !json["recording"].is<bool>()) {
+    server->send(400, "application/json", R"({ "error": "invalid body" })");
+    return;
+  }
+  if (recorder == NULL) {
+    server->send(404, "application/json", R"({ "error": "recorder unavailable" })");
+    return;
+  }
+  if (json["recording"] == true) {
+    if (!recorder->start()) {
+      server->send(500, "application/json", R"({ "error": "unable to start recording" })");
+      return;
+    }
+  } else {
+    recorder->stop();
+  }
+  server->send(200, "application/json", recorder->getStatus());
+}
+
+void ConfigServer::onGetRecording() {
+  if (recorder == NULL || !recorder->exportSmf()) {
+    server->send(404, "application/json", R"({ "error": "no recording" })");
+    return;
+  }
+  File smf = LittleFS.open(RECORDING_SMF_FILE, "r");
+  server->streamFile(smf, "audio/midi");
+  smf.close();
+}
+
+/**
+ * The log as recorded, a capture for the golden frame test.
+ */
+void ConfigServer::onGetRecordingLog() {
+  if (recorder == NULL || recorder->isRecording() || !LittleFS.exists(RECORDING_LOG_FILE)) {
+    server->send(404, "application/json", R"({ "error": "no recording" })");
+    return;
+  }
+  File log = LittleFS.open(RECORDING_LOG_FILE, "r");
+  server->streamFile(log, "application/octet-stream");
+  log.close();
+}
+
+/**
+ * Time of each boot phase in ms, null for the phases not reached yet.
+ */
+void ConfigServer::onGetBoot() {
+  if (boot_timeline == NULL) {
+    server->send(404, "application/json", R"({ "error": "boot timeline not available" })");
+    return;
+  }
+  JsonDocument json(&json_allocator);
+  for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+    const boot_phase_t phase = (boot_phase_t)i;
+    if (boot_timeline->isReached(phase)) {
+      json[BootTimeline::getPhaseName(phase)] = boot_timeline->getTime(phase) / 1000.0;
+    } else {
+      json[BootTimeline::getPhaseName(phase)] = nullptr;
+    }
+  }
+  String body;
+  serializeJson(json, body);
+  server->send(200, "application/json", body);
+}
+
+/**
+ * State and cost of the effect script, the cost is the number of instructions run by the last frame.
+ */
+void ConfigServer::onGetEffect() {
+  EffectVm* effect = led_controller->getRenderer()->getEffect();
+  JsonDocument json(&json_allocator);
+  json["loaded"] = effect->isLoaded();
+  if (effect->isLoaded()) {
+    json["mode"] = effect->getRunMode() == EFFECT_RUN_PER_NOTE ? "note" : "pixel";
+    json["instructions"] = effect->getInstructionCount();
+    json["cost"] = effect->getLastFrameCost();
+    json["budget"] = EFFECT_DEFAULT_BUDGET;
+    json["overruns"] = effect->getOverrunCount();
+  }
+  String body;
+  serializeJson(json, body);
+  server->send(200, "application/json", body);
+}
+
+void ConfigServer::onGetEffectScript() {
+  char* source = new char[EFFECT_MAX_SOURCE_SIZE];
+  const size_t length = led_controller->getEffectScript(source, EFFECT_MAX_SOURCE_SIZE);
+  server->send_P(200, "text/plain", source, length);
+  delete[] source;
+}
+
+/**
+ * The body is the source of the script, an empty body removes it.
+ */
+void ConfigServer::onPostEffect() {
+  const String source = server->hasArg("plain") ? server->arg("plain") : String();
+  if (source.length() > EFFECT_MAX_SOURCE_SIZE) {
+    server->send(400, "application/json", R"({ "error": "script too long" })");
+    return;
+  }
+  if (!led_controller->setEffectScript(source.c_str(), source.length())) {
+    EffectCompiler* compiler = led_controller->getEffectCompiler();
+    JsonDocument json(&json_allocator);
+    json["error"] = compiler->getError();
+    json["line"] = compiler->getErrorLine();
+    String body;
+    serializeJson(json, body);
+    server->send(400, "application/json", body);
+    return;
+  }
+  server->send(200, "application/json", R"({ "status": "ok" })");
+}
+
+/**
+ * Chrome trace JSON of the last pipeline events, streamed in chunks: the trace is larger than the free DRAM.
+ */
+void ConfigServer::onGetTrace() {
+  if (tracer == NULL) {
+    server->send(404, "application/json", R"({ "error": "trace disabled" })");
+    return;
+  }
+  server->sendHeader("Content-Disposition", "attachment; filename=\"trace.json\"");
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server->send(200, "application/json", "");
+  tracer->exportChromeJson(&ConfigServer::writeTrace, server);
+  server->sendContent("");
+}
+
+void ConfigServer::writeTrace(const char* data, size_t length, void* web_server) {
+  ((WebServer*)web_server)->sendContent(data, length);
+}
+
+/**
+ * Starting a recording forgets the previous events.
+ */
+void ConfigServer::onPostTrace() {
+  if (!server->hasArg("plain")) {
+    server->send(400, "application/json", R"({ "error": "missing body" })");
+    return;
+  }
+  JsonDocument json(&json_allocator);
+  if (deserializeJson(json, server->arg("plain")) || !json["recording"].is<bool>()) {
+    server->send(400, "application/json", R"({ "error": "invalid body" })");
+    return;
+  }
+  if (tracer == NULL) {
+    server->send(404, "application/json", R"({ "error": "trace disabled" })");
+    return;
+  }
+  if (json["recording"] == true) tracer->clear();
+  tracer->setRecording(json["recording"] == true);
+  json.clear();
+  json["recording"] = tracer->isRecording();
+  json["events"] = tracer->getEventCount();
+  json["capacity"] = tracer->getCapacity();
+  json["overwritten"] = tracer->getOverwrittenCount();
+  String body;
+  serializeJson(json, body);
+  server->send(200, "application/json", body);
+}
+
+/**
+ * Heap of each region and usage of the arenas.
+ * Fragmentation is the share of the free memory out of the largest block, drift the free memory lost since the steady state.
+ */
+void ConfigServer::onGetMemory() {
+  JsonDocument json(&json_allocator);
+  addHeapReport(json["internal"].to<JsonObject>(), MALLOC_CAP_INTERNAL, steady_internal_free);
+  addHeapReport(json["psram"].to<JsonObject>(), MALLOC_CAP_SPIRAM, steady_psram_free);
+  JsonArray arenas = json["arenas"].to<JsonArray>();
+  for (MemoryArena* arena : { internal_memory, psram_memory }) {
+    if (arena == NULL) continue;
+    JsonObject item = arenas.add<JsonObject>();
+    item["name"] = arena->getName();
+    item["region"] = arena->getRegion() == MEMORY_REGION_PSRAM ? "psram" : "internal";
+    item["size"] = arena->getSize();
+    item["used"] = arena->getUsed();
+    item["overflows"] = arena->getOverflowCount();
+  }
+  String body;
+  serializeJson(json, body);
+  server->send(200, "application/json", body);
+}
+
+/**
+ * Last keyboard connection: whether its cached profile was used, and the times from the connection
+ * to the MIDI input ready and to the first note.
+ */
+void ConfigServer::onGetUsb() {
+  if (usb_host == NULL) {
+    server->send(404, "application/json", R"({ "error": "usb host not available" })");
+    return;
+  }
+  const usb_connection_stats_t stats = usb_host->getStats();
+  JsonDocument json(&json_allocator);
+  json["connected"] = stats.connected;
+  json["cached"] = stats.cached;
+  json["connections"] = stats.connections;
+  json["cache_hits"] = stats.cache_hits;
+  json["cached_devices"] = usb_host->getCachedDeviceCount();
+  json["dropped_in_packets"] = usb_host->getDroppedPackets();
+  json["setup_ms"] = stats.setup_us / 1000.0;
+  if (stats.first_note_us > 0) json["first_note_ms"] = stats.first_note_us / 1000.0;
+  else json["first_note_ms"] = nullptr;
+  const midi_out_stats_t out_stats = usb_host->getMidiOut()->getStats();
+  JsonObject midi_out = json["midi_out"].to<JsonObject>();
+  midi_out["available"] = stats.midi_out;
+  midi_out["queued"] = out_stats.queued;
+  midi_out["sent"] = out_stats.sent;
+  midi_out["dropped"] = out_stats.dropped;
+  midi_out["transfers"] = out_stats.transfers;
+  midi_out["failed_transfers"] = out_stats.failed_transfers;
+  midi_out["depth"] = out_stats.depth;
+  midi_out["max_depth"] = out_stats.max_depth;
+  midi_out["average_latency_ms"] = out_stats.average_latency_us / 1000.0;
+  midi_out["max_latency_ms"] = out_stats.max_latency_us / 1000.0;
+  String body;
+  serializeJson(json, body);
+  server->send(200, "application/json", body);
+}
+
+/// Functions definition ///
+
+static void addHeapReport(JsonObject report, uint32_t caps, size_t steady_free) {
+  const size_t free_size = heap_caps_get_free_size(caps);
+  const size_t largest_block = heap_caps_get_largest_free_block(caps);
+  report["free"] = free_size;
+  report["largest_block"] = largest_block;
+  report["minimum_free"] = heap_caps_get_minimum_free_size(caps);
+  report["fragmentation"] = free_size > 0 ? 100 - 100 * largest_block / free_size : 0;
+  if (steady_free > 0) report["drift"] = (int32_t)steady_free - (int32_t)free_size;
+  else report["drift"] = nullptr;
+}
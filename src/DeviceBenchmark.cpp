@@ -0,0 +1,165 @@
+#include "DeviceBenchmark.h"
+
+#include <ArduinoJson.h>
+
+#include "BenchmarkWorkloads.h"
+#include "PsramJsonAllocator.h"
+#include "midi_decoder.h"
+
+/// Types ///
+
+typedef struct {
+  uint64_t decode;
+  uint64_t update;
+  uint64_t compose;
+  uint64_t push;
+  uint64_t show;
+  uint32_t events;
+  uint32_t frames;
+  uint32_t shows;
+} benchmark_cycles_t;
+
+/// Variables ///
+
+// Keeps the compiler from optimizing the measured decoding away
+static volatile uint8_t benchmark_sink;
+static PsramJsonAllocator json_allocator;
+
+/// Class members definition ///
+
+DeviceBenchmark::DeviceBenchmark(LedController* led, MemoryArena* arena) {
+  led_controller = led;
+  memory = arena;
+  events = (timed_midi_packet*)MemoryArena::allocateBuffer(memory, BENCH_WORKLOAD_MAX_EVENTS * sizeof(timed_midi_packet));
+  // The encoder is only known at setup, room for the widest pixels
+  encoded = MemoryArena::allocateBuffer(memory, led->getLedCount() * getPixelSize(PIXEL_ORDER_RGBW));
+}
+
+DeviceBenchmark::~DeviceBenchmark() {
+  MemoryArena::releaseBuffer(memory, (uint8_t*)events);
+  MemoryArena::releaseBuffer(memory, encoded);
+}
+
+bool DeviceBenchmark::isRunning() {
+  return running;
+}
+
+String DeviceBenchmark::run() {
+  NoteRenderer* renderer = led_controller->getRenderer();
+  const uint16_t led_count = led_controller->getLedCount();
+  const uint32_t cpu_mhz = getCpuFrequencyMhz();
+  running = true;
+  log_i("Starting benchmark on core %d at %d MHz", xPortGetCoreID(), cpu_mhz);
+
+  JsonDocument report(&json_allocator);
+  report["led_count"] = led_count;
+  report["cpu_mhz"] = cpu_mhz;
+  report["target_fps"] = BENCHMARK_TARGET_FPS;
+  JsonArray workloads = report["workloads"].to<JsonArray>();
+  benchmark_cycles_t total = {};
+
+  for (int workload = 0; workload < BENCH_WORKLOAD_COUNT; workload++) {
+    const size_t event_count = generateBenchWorkload((bench_workload_t)workload, events, BENCH_WORKLOAD_MAX_EVENTS);
+    benchmark_cycles_t cycles = {};
+    renderer->clear();
+
+    for (size_t i = 0; i < event_count; i++) {
+      uint32_t start = ESP.getCycleCount();
+      const midi_event_t event = decodeMidiPacket(events[i].packet);
+      cycles.decode += ESP.getCycleCount() - start;
+      benchmark_sink = event.type;
+
+      start = ESP.getCycleCount();
+      renderer->handleEvent(event);
+      cycles.update += ESP.getCycleCount() - start;
+
+      start = ESP.getCycleCount();
+      if (renderer->render()) {
+        cycles.compose += ESP.getCycleCount() - start;
+        cycles.frames++;
+
+        // Only a sample of the frames is sent to the strip, a refresh takes milliseconds
+        if (cycles.shows < BENCHMARK_SHOW_SAMPLES) {
+          start = ESP.getCycleCount();
+          led_controller->pushFrame();
+          cycles.push += ESP.getCycleCount() - start;
+          start = ESP.getCycleCount();
+          led_controller->showStrip();
+          cycles.show += ESP.getCycleCount() - start;
+          cycles.shows++;
+        }
+      }
+      cycles.events++;
+    }
+
+    JsonObject result = workloads.add<JsonObject>();
+    result["name"] = getBenchWorkloadName((bench_workload_t)workload);
+    result["events"] = cycles.events;
+    result["decode_ns"] = cycles.decode * 1000 / cpu_mhz / cycles.events;
+    result["update_ns"] = cycles.update * 1000 / cpu_mhz / cycles.events;
+    result["compose_ns"] = cycles.frames ? cycles.compose * 1000 / cpu_mhz / cycles.frames : 0;
+
+    total.decode += cycles.decode;
+    total.update += cycles.update;
+    total.compose += cycles.compose;
+    total.push += cycles.push;
+    total.show += cycles.show;
+    total.events += cycles.events;
+    total.frames += cycles.frames;
+    total.shows += cycles.shows;
+    // Let the other tasks of this core run between workloads
+    delay(1);
+  }
+
+  // Frame cost: composition, copy into the strip buffer and refresh
+  const uint32_t compose_ns = total.compose * 1000 / cpu_mhz / total.frames;
+  const uint32_t push_ns = total.push * 1000 / cpu_mhz / total.shows;
+  const uint32_t show_ns = total.show * 1000 / cpu_mhz / total.shows;
+  const uint32_t frame_ns = compose_ns + push_ns + show_ns;
+  const uint32_t budget_ns = 1000000000UL / BENCHMARK_TARGET_FPS;
+  const uint32_t event_ns = (total.decode + total.update) * 1000 / cpu_mhz / total.events;
+
+  // Pushing the frame is mostly its encoding, compared with the encoder looking up the format per pixel
+  RuntimePixelEncoder runtime_encoder(led_controller->getPixelEncoder()->getOrder());
+  const uint32_t encode_ns = this->measureEncoder(led_controller->getPixelEncoder(), encoded);
+  const uint32_t runtime_encode_ns = this->measureEncoder(&runtime_encoder, encoded);
+
+  JsonObject summary = report["summary"].to<JsonObject>();
+  summary["decode_ns"] = total.decode * 1000 / cpu_mhz / total.events;
+  summary["update_ns"] = total.update * 1000 / cpu_mhz / total.events;
+  summary["compose_ns"] = compose_ns;
+  summary["push_ns"] = push_ns;
+  summary["encode_ns"] = encode_ns;
+  summary["runtime_encode_ns"] = runtime_encode_ns;
+  summary["show_ns"] = show_ns;
+  summary["frame_ns"] = frame_ns;
+  summary["frame_budget_ns"] = budget_ns;
+  summary["max_fps"] = 1000000000UL / frame_ns;
+  // Time left in each frame for effects, and how many events fit in it
+  summary["effects_budget_ns"] = frame_ns < budget_ns ? budget_ns - frame_ns : 0;
+  summary["events_per_frame_budget"] = frame_ns < budget_ns ? (budget_ns - frame_ns) / (event_ns ? event_ns : 1) : 0;
+  // Every stage of a frame is linear in the number of pixels
+  summary["max_leds_at_target_fps"] = (uint64_t)budget_ns * led_count / frame_ns;
+
+  renderer->clear();
+  led_controller->show();
+  running = false;
+
+  String output;
+  serializeJson(report, output);
+  log_i("Benchmark done: %s", output.c_str());
+  return output;
+}
+
+/**
+ * Average time to encode the frame of the renderer, at full brightness.
+ */
+uint32_t DeviceBenchmark::measureEncoder(PixelEncoder* encoder, uint8_t* output) {
+  const uint8_t* frame = led_controller->getRenderer()->getFrame();
+  const uint16_t led_count = led_controller->getLedCount();
+  const uint32_t start = ESP.getCycleCount();
+  for (int i = 0; i < BENCHMARK_ENCODE_SAMPLES; i++) encoder->encode(frame, led_count, output, 256);
+  const uint32_t cycles = ESP.getCycleCount() - start;
+  benchmark_sink = output[0];
+  return (uint64_t)cycles * 1000 / getCpuFrequencyMhz() / BENCHMARK_ENCODE_SAMPLES;
+}
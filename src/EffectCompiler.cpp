@@ -0,0 +1,291 @@
+#include "EffectCompiler.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define MAX_LINE_LENGTH 96
+#define MAX_OPERANDS 3
+
+/// Types ///
+
+// Operands of each instruction: r for a register, i for an immediate, l for a label
+typedef struct {
+  const char* mnemonic;
+  const char* operands;
+} op_syntax_t;
+
+/// Variables ///
+
+static const op_syntax_t op_syntax[EFFECT_OP_COUNT] = {
+  { "halt", "" },
+  { "ldi", "ri" },
+  { "ldh", "ri" },
+  { "mov", "rr" },
+  { "add", "rrr" },
+  { "sub", "rrr" },
+  { "mul", "rrr" },
+  { "div", "rrr" },
+  { "mod", "rrr" },
+  { "and", "rrr" },
+  { "or", "rrr" },
+  { "xor", "rrr" },
+  { "shl", "rrr" },
+  { "shr", "rrr" },
+  { "min", "rrr" },
+  { "max", "rrr" },
+  { "slt", "rrr" },
+  { "seq", "rrr" },
+  { "addi", "rri" },
+  { "jmp", "l" },
+  { "jz", "rl" },
+  { "jnz", "rl" },
+  { "hue", "rr" },
+  { "scale", "rrr" },
+  { "blend", "rrr" },
+  { "sin", "rr" },
+  { "rnd", "r" },
+  { "px", "rr" },
+};
+
+/// Functions declaration ///
+
+static bool parseRegister(const char* token, uint8_t* index);
+static bool parseNumber(const char* token, int64_t* value);
+static bool isValidLabel(const char* name);
+static int findOp(const char* mnemonic);
+
+/// Class members definition ///
+
+EffectCompiler::EffectCompiler() {
+  memset(bytecode, 0, sizeof(bytecode));
+  error[0] = '\0';
+}
+
+bool EffectCompiler::compile(const char* source, size_t length) {
+  instruction_count = 0;
+  label_count = 0;
+  fixup_count = 0;
+  error_line = 0;
+  error[0] = '\0';
+  bytecode[0] = 'P';
+  bytecode[1] = 'X';
+  bytecode[2] = EFFECT_BYTECODE_VERSION;
+  bytecode[3] = EFFECT_RUN_PER_PIXEL;
+
+  char line[MAX_LINE_LENGTH + 1];
+  uint16_t line_number = 1;
+  size_t start = 0;
+  while (start < length) {
+    size_t end = start;
+    while (end < length && source[end] != '\n') end++;
+    if (end - start > MAX_LINE_LENGTH) return this->fail(line_number, "line too long");
+    memcpy(line, source + start, end - start);
+    line[end - start] = '\0';
+    if (!this->compileLine(line, line_number)) return false;
+    start = end + 1;
+    line_number++;
+  }
+  if (instruction_count == 0) return this->fail(line_number, "no instruction");
+
+  // Jumps forward are resolved once all the labels are known
+  for (size_t i = 0; i < fixup_count; i++) {
+    const effect_fixup_t* fixup = &fixups[i];
+    size_t label = 0;
+    while (label < label_count && strcmp(labels[label].name, fixup->name) != 0) label++;
+    if (label == label_count) return this->fail(fixup->line, "unknown label");
+    // A label after the last instruction ends the run
+    uint16_t target = labels[label].target;
+    if (target >= instruction_count) {
+      if (!this->emit(EFFECT_OP_HALT, 0, 0, 0)) return this->fail(fixup->line, "too many instructions");
+      target = instruction_count - 1;
+    }
+    uint8_t* instruction = bytecode + EFFECT_HEADER_SIZE + fixup->instruction * EFFECT_INSTRUCTION_SIZE;
+    instruction[2] = target >> 8;
+    instruction[3] = target;
+  }
+  return true;
+}
+
+const uint8_t* EffectCompiler::getBytecode() {
+  return bytecode;
+}
+
+size_t EffectCompiler::getBytecodeLength() {
+  return EFFECT_HEADER_SIZE + instruction_count * EFFECT_INSTRUCTION_SIZE;
+}
+
+uint16_t EffectCompiler::getErrorLine() {
+  return error_line;
+}
+
+const char* EffectCompiler::getError() {
+  return error;
+}
+
+bool EffectCompiler::compileLine(char* line, uint16_t line_number) {
+  char* comment = strchr(line, ';');
+  if (comment != NULL) *comment = '\0';
+  for (char* c = line; *c; c++) {
+    if (*c == ',' || *c == '\t' || *c == '\r') *c = ' ';
+    else *c = tolower((unsigned char)*c);
+  }
+
+  char* tokens[1 + MAX_OPERANDS];
+  size_t token_count = 0;
+  char* save = NULL;
+  for (char* token = strtok_r(line, " ", &save); token != NULL; token = strtok_r(NULL, " ", &save)) {
+    if (token_count == 1 + MAX_OPERANDS) return this->fail(line_number, "too many operands");
+    tokens[token_count++] = token;
+  }
+  if (token_count == 0) return true;
+
+  const size_t first_length = strlen(tokens[0]);
+  if (tokens[0][first_length - 1] == ':') {
+    if (token_count > 1) return this->fail(line_number, "label must be alone on its line");
+    tokens[0][first_length - 1] = '\0';
+    if (!isValidLabel(tokens[0])) return this->fail(line_number, "invalid label");
+    if (!this->addLabel(tokens[0])) return this->fail(line_number, "duplicate label or too many labels");
+    return true;
+  }
+
+  if (strcmp(tokens[0], "mode") == 0) {
+    if (token_count != 2) return this->fail(line_number, "mode takes pixel or note");
+    if (instruction_count > 0) return this->fail(line_number, "mode must come before the instructions");
+    if (strcmp(tokens[1], "pixel") == 0) bytecode[3] = EFFECT_RUN_PER_PIXEL;
+    else if (strcmp(tokens[1], "note") == 0) bytecode[3] = EFFECT_RUN_PER_NOTE;
+    else return this->fail(line_number, "mode takes pixel or note");
+    return true;
+  }
+
+  const int op = findOp(tokens[0]);
+  if (op < 0) return this->fail(line_number, "unknown instruction");
+  const char* syntax = op_syntax[op].operands;
+  if (token_count - 1 != strlen(syntax)) return this->fail(line_number, "wrong number of operands");
+
+  uint8_t fields[MAX_OPERANDS] = { 0, 0, 0 };
+  int64_t immediate = 0;
+  const char* label = NULL;
+  for (size_t i = 0; syntax[i]; i++) {
+    const char* token = tokens[1 + i];
+    switch (syntax[i]) {
+      case 'r':
+        if (!parseRegister(token, &fields[i])) return this->fail(line_number, "invalid register, r0 to r15");
+        break;
+      case 'i':
+        if (!parseNumber(token, &immediate)) return this->fail(line_number, "invalid number");
+        break;
+      case 'l':
+        if (!isValidLabel(token)) return this->fail(line_number, "invalid label");
+        label = token;
+        break;
+    }
+  }
+
+  bool emitted;
+  switch (op) {
+    case EFFECT_OP_LDI: {
+      if (immediate < INT32_MIN || immediate > UINT32_MAX) return this->fail(line_number, "number out of 32 bits");
+      const uint32_t value = (uint32_t)immediate;
+      emitted = this->emit(op, fields[0], value >> 8, value);
+      // Sign extension of the low half gives the wrong high half, fix it
+      if (emitted && (int32_t)value != (int16_t)value) emitted = this->emit(EFFECT_OP_LDH, fields[0], value >> 24, value >> 16);
+      break;
+    }
+    case EFFECT_OP_LDH:
+      if (immediate < INT16_MIN || immediate > UINT16_MAX) return this->fail(line_number, "number out of 16 bits");
+      emitted = this->emit(op, fields[0], immediate >> 8, immediate);
+      break;
+    case EFFECT_OP_ADDI:
+      if (immediate < INT8_MIN || immediate > INT8_MAX) return this->fail(line_number, "number out of -128 to 127");
+      emitted = this->emit(op, fields[0], fields[1], immediate);
+      break;
+    case EFFECT_OP_JMP:
+    case EFFECT_OP_JZ:
+    case EFFECT_OP_JNZ: {
+      effect_fixup_t* fixup = &fixups[fixup_count];
+      strcpy(fixup->name, label);
+      fixup->instruction = instruction_count;
+      fixup->line = line_number;
+      emitted = this->emit(op, fields[0], 0, 0);
+      if (emitted) fixup_count++;
+      break;
+    }
+    default:
+      emitted = this->emit(op, fields[0], fields[1], fields[2]);
+      break;
+  }
+  if (!emitted) return this->fail(line_number, "too many instructions");
+  return true;
+}
+
+bool EffectCompiler::emit(uint8_t op, uint8_t a, uint8_t b, uint8_t c) {
+  if (instruction_count == EFFECT_MAX_INSTRUCTIONS) return false;
+  uint8_t* instruction = bytecode + EFFECT_HEADER_SIZE + instruction_count * EFFECT_INSTRUCTION_SIZE;
+  instruction[0] = op;
+  instruction[1] = a;
+  instruction[2] = b;
+  instruction[3] = c;
+  instruction_count++;
+  return true;
+}
+
+bool EffectCompiler::addLabel(const char* name) {
+  if (label_count == EFFECT_MAX_LABELS) return false;
+  for (size_t i = 0; i < label_count; i++) {
+    if (strcmp(labels[i].name, name) == 0) return false;
+  }
+  strcpy(labels[label_count].name, name);
+  labels[label_count].target = instruction_count;
+  label_count++;
+  return true;
+}
+
+bool EffectCompiler::fail(uint16_t line_number, const char* message) {
+  error_line = line_number;
+  snprintf(error, sizeof(error), "%s", message);
+  instruction_count = 0;
+  return false;
+}
+
+/// Functions definition ///
+
+static bool parseRegister(const char* token, uint8_t* index) {
+  if (token[0] != 'r' || !isdigit((unsigned char)token[1])) return false;
+  char* end;
+  const long value = strtol(token + 1, &end, 10);
+  if (*end != '\0' || value >= EFFECT_REGISTER_COUNT) return false;
+  *index = value;
+  return true;
+}
+
+static bool parseNumber(const char* token, int64_t* value) {
+  char* end;
+  const bool negative = token[0] == '-';
+  // Base 0 would read a leading 0 as octal
+  const char* digits = negative ? token + 1 : token;
+  const int base = digits[0] == '0' && digits[1] == 'x' ? 16 : 10;
+  if (base == 16) digits += 2;
+  if (!isxdigit((unsigned char)digits[0])) return false;
+  const long long number = strtoll(digits, &end, base);
+  if (*end != '\0' || number > UINT32_MAX) return false;
+  *value = negative ? -number : number;
+  return true;
+}
+
+static bool isValidLabel(const char* name) {
+  const size_t length = strlen(name);
+  if (length == 0 || length > EFFECT_MAX_LABEL_LENGTH || isdigit((unsigned char)name[0])) return false;
+  for (size_t i = 0; i < length; i++) {
+    if (!isalnum((unsigned char)name[i]) && name[i] != '_') return false;
+  }
+  return true;
+}
+
+static int findOp(const char* mnemonic) {
+  for (int op = 0; op < EFFECT_OP_COUNT; op++) {
+    if (strcmp(op_syntax[op].mnemonic, mnemonic) == 0) return op;
+  }
+  return -1;
+}
@@ -0,0 +1,186 @@
+#include "EffectVm.h"
+
+#include <cstring>
+#include "palette.h"
+#include "NoteRenderer.h"
+
+/// Variables ///
+
+// sin(2 * pi * i / 256) * 127
+static const int8_t sine_table[256] = {
+  0, 3, 6, 9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46,
+  49, 51, 54, 57, 60, 63, 65, 68, 71, 73, 76, 78, 81, 83, 85, 88,
+  90, 92, 94, 96, 98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116,
+  117, 118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127,
+  127, 127, 127, 127, 126, 126, 126, 125, 125, 124, 123, 122, 122, 121, 120, 118,
+  117, 116, 115, 113, 112, 111, 109, 107, 106, 104, 102, 100, 98, 96, 94, 92,
+  90, 88, 85, 83, 81, 78, 76, 73, 71, 68, 65, 63, 60, 57, 54, 51,
+  49, 46, 43, 40, 37, 34, 31, 28, 25, 22, 19, 16, 12, 9, 6, 3,
+  0, -3, -6, -9, -12, -16, -19, -22, -25, -28, -31, -34, -37, -40, -43, -46,
+  -49, -51, -54, -57, -60, -63, -65, -68, -71, -73, -76, -78, -81, -83, -85, -88,
+  -90, -92, -94, -96, -98, -100, -102, -104, -106, -107, -109, -111, -112, -113, -115, -116,
+  -117, -118, -120, -121, -122, -122, -123, -124, -125, -125, -126, -126, -126, -127, -127, -127,
+  -127, -127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -122, -122, -121, -120, -118,
+  -117, -116, -115, -113, -112, -111, -109, -107, -106, -104, -102, -100, -98, -96, -94, -92,
+  -90, -88, -85, -83, -81, -78, -76, -73, -71, -68, -65, -63, -60, -57, -54, -51,
+  -49, -46, -43, -40, -37, -34, -31, -28, -25, -22, -19, -16, -12, -9, -6, -3,
+};
+
+/// Functions declaration ///
+
+static void setPixel(uint8_t* layer, uint16_t pixel_count, int32_t index, int32_t color);
+
+/// Class members definition ///
+
+EffectVm::EffectVm() {
+
+}
+
+bool EffectVm::load(const uint8_t* bytecode, size_t length) {
+  if (length > EFFECT_MAX_BYTECODE_SIZE) return false;
+  // The bytecode may be written by another task meanwhile, only the copy validated is run
+  memcpy(staging, bytecode, length);
+  const size_t count = validateEffectBytecode(staging, length);
+  if (count == 0) return false;
+  run_mode = (effect_run_mode_t)staging[3];
+  memcpy(program, staging + EFFECT_HEADER_SIZE, count * EFFECT_INSTRUCTION_SIZE);
+  instruction_count = count;
+  overrun_count = 0;
+  last_frame_cost = 0;
+  random_state = 1;
+  return true;
+}
+
+void EffectVm::unload() {
+  instruction_count = 0;
+}
+
+bool EffectVm::isLoaded() {
+  return instruction_count > 0;
+}
+
+effect_run_mode_t EffectVm::getRunMode() {
+  return run_mode;
+}
+
+size_t EffectVm::getInstructionCount() {
+  return instruction_count;
+}
+
+void EffectVm::setBudget(uint32_t instructions_per_frame) {
+  budget = instructions_per_frame;
+}
+
+bool EffectVm::runFrame(const effect_frame_t* frame) {
+  if (instruction_count == 0) return true;
+  uint32_t remaining = budget;
+  int32_t registers[EFFECT_REGISTER_COUNT];
+  const int32_t time_ms = frame->now_us / 1000;
+  bool completed = true;
+  if (run_mode == EFFECT_RUN_PER_PIXEL) {
+    for (uint16_t pixel = 0; pixel < frame->pixel_count && completed; pixel++) {
+      memset(registers, 0, sizeof(registers));
+      const uint8_t* under = frame->notes_layer + 3 * pixel;
+      registers[0] = pixel;
+      registers[1] = frame->pixel_count;
+      registers[2] = time_ms;
+      registers[3] = (under[0] << 16) | (under[1] << 8) | under[2];
+      completed = this->run(registers, frame, &remaining);
+    }
+  } else {
+    NoteState* notes = frame->notes;
+    for (int note = notes->nextPressed(0); note >= 0 && completed; note = notes->nextPressed(note + 1)) {
+      memset(registers, 0, sizeof(registers));
+      registers[0] = note;
+      registers[1] = notes->getVelocity(note);
+      registers[2] = time_ms;
+      registers[3] = (frame->now_us - notes->getOnset(note)) / 1000;
+      registers[4] = NoteRenderer::computePixelIndex(note);
+      registers[5] = frame->note_colors[note];
+      completed = this->run(registers, frame, &remaining);
+    }
+  }
+  last_frame_cost = budget - remaining;
+  if (!completed) overrun_count++;
+  return completed;
+}
+
+uint32_t EffectVm::getLastFrameCost() {
+  return last_frame_cost;
+}
+
+uint32_t EffectVm::getOverrunCount() {
+  return overrun_count;
+}
+
+/**
+ * Registers and jump targets were checked by load(), only the budget is checked here.
+ */
+bool EffectVm::run(int32_t* r, const effect_frame_t* frame, uint32_t* remaining) {
+  size_t pc = 0;
+  uint32_t left = *remaining;
+  while (pc < instruction_count) {
+    if (left == 0) {
+      *remaining = 0;
+      return false;
+    }
+    left--;
+    const effect_instruction_t instruction = program[pc++];
+    const uint8_t a = instruction.a, b = instruction.b, c = instruction.c;
+    switch (instruction.op) {
+      case EFFECT_OP_HALT: pc = instruction_count; break;
+      case EFFECT_OP_LDI: r[a] = getEffectImmediate(instruction); break;
+      case EFFECT_OP_LDH: r[a] = (r[a] & 0xffff) | ((uint32_t)(uint16_t)getEffectImmediate(instruction) << 16); break;
+      case EFFECT_OP_MOV: r[a] = r[b]; break;
+      // Wrapping arithmetic, signed overflow is undefined in C++
+      case EFFECT_OP_ADD: r[a] = (uint32_t)r[b] + (uint32_t)r[c]; break;
+      case EFFECT_OP_SUB: r[a] = (uint32_t)r[b] - (uint32_t)r[c]; break;
+      case EFFECT_OP_MUL: r[a] = (uint32_t)r[b] * (uint32_t)r[c]; break;
+      case EFFECT_OP_DIV: r[a] = r[c] == 0 || (r[b] == INT32_MIN && r[c] == -1) ? 0 : r[b] / r[c]; break;
+      case EFFECT_OP_MOD: r[a] = r[c] == 0 || r[c] == -1 ? 0 : r[b] % r[c]; break;
+      case EFFECT_OP_AND: r[a] = r[b] & r[c]; break;
+      case EFFECT_OP_OR: r[a] = r[b] | r[c]; break;
+      case EFFECT_OP_XOR: r[a] = r[b] ^ r[c]; break;
+      case EFFECT_OP_SHL: r[a] = (uint32_t)r[b] << (r[c] & 31); break;
+      case EFFECT_OP_SHR: r[a] = r[b] >> (r[c] & 31); break;
+      case EFFECT_OP_MIN: r[a] = r[b] < r[c] ? r[b] : r[c]; break;
+      case EFFECT_OP_MAX: r[a] = r[b] > r[c] ? r[b] : r[c]; break;
+      case EFFECT_OP_SLT: r[a] = r[b] < r[c]; break;
+      case EFFECT_OP_SEQ: r[a] = r[b] == r[c]; break;
+      case EFFECT_OP_ADDI: r[a] = (uint32_t)r[b] + (uint32_t)(int8_t)c; break;
+      case EFFECT_OP_JMP: pc = (uint16_t)getEffectImmediate(instruction); break;
+      case EFFECT_OP_JZ: if (r[a] == 0) pc = (uint16_t)getEffectImmediate(instruction); break;
+      case EFFECT_OP_JNZ: if (r[a] != 0) pc = (uint16_t)getEffectImmediate(instruction); break;
+      case EFFECT_OP_HUE: r[a] = hueToColor((uint32_t)r[b] % 360); break;
+      case EFFECT_OP_SCALE: {
+        const uint32_t factor = (r[c] < 0 ? 0 : r[c] > 255 ? 255 : r[c]) + 1;
+        const uint32_t color = r[b];
+        r[a] = ((((color >> 16) & 0xff) * factor >> 8) << 16)
+          | ((((color >> 8) & 0xff) * factor >> 8) << 8)
+          | ((color & 0xff) * factor >> 8);
+        break;
+      }
+      case EFFECT_OP_BLEND:
+        r[a] = blendColors(r[a] & 0xffffff, r[b] & 0xffffff, r[c] < 0 ? 0 : r[c] > 255 ? 255 : r[c]);
+        break;
+      case EFFECT_OP_SIN: r[a] = sine_table[r[b] & 0xff]; break;
+      case EFFECT_OP_RND:
+        random_state = random_state * 1103515245 + 12345;
+        r[a] = (random_state >> 8) & 0xffff;
+        break;
+      case EFFECT_OP_PX: setPixel(frame->layer, frame->pixel_count, r[a], r[b]); break;
+    }
+  }
+  *remaining = left;
+  return true;
+}
+
+/// Functions definition ///
+
+static void setPixel(uint8_t* layer, uint16_t pixel_count, int32_t index, int32_t color) {
+  if (index < 0 || index >= pixel_count) return;
+  uint8_t* pixel = layer + 3 * index;
+  pixel[0] = color >> 16;
+  pixel[1] = color >> 8;
+  pixel[2] = color;
+}
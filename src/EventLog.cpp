@@ -0,0 +1,220 @@
+#include "EventLog.h"
+
+#include <cstring>
+
+static const char EVENT_LOG_MAGIC[4] = { 'P', 'N', 'L', 'G' };
+
+/// Functions declaration ///
+
+static size_t encodeVarLen(uint32_t value, uint8_t* out);
+static void writeVarLen(FILE*, uint32_t value);
+static void writeBigEndian(FILE*, uint32_t value, int length);
+
+/// EventLogRecorder ///
+
+EventLogRecorder::EventLogRecorder(MemoryArena* arena) {
+  memory = arena;
+  buffers[0] = MemoryArena::allocateBuffer(memory, EVENT_LOG_BUFFER_SIZE);
+  buffers[1] = MemoryArena::allocateBuffer(memory, EVENT_LOG_BUFFER_SIZE);
+  full[0] = false;
+  full[1] = false;
+  recording = false;
+  writers = 0;
+}
+
+EventLogRecorder::~EventLogRecorder() {
+  this->stop();
+  MemoryArena::releaseBuffer(memory, buffers[0]);
+  MemoryArena::releaseBuffer(memory, buffers[1]);
+}
+
+bool EventLogRecorder::start(FILE* log, uint32_t now_us) {
+  this->stop();
+  const uint8_t header[EVENT_LOG_HEADER_SIZE] = {
+    (uint8_t)EVENT_LOG_MAGIC[0], (uint8_t)EVENT_LOG_MAGIC[1], (uint8_t)EVENT_LOG_MAGIC[2], (uint8_t)EVENT_LOG_MAGIC[3],
+    EVENT_LOG_VERSION, 0, 0, 0
+  };
+  if (log == NULL || fwrite(header, 1, sizeof(header), log) != sizeof(header)) return false;
+  file = log;
+  lengths[0] = 0;
+  lengths[1] = 0;
+  full[0] = false;
+  full[1] = false;
+  active = 0;
+  last_us = now_us;
+  recorded_events = 0;
+  dropped_events = 0;
+  recording = true;
+  return true;
+}
+
+void EventLogRecorder::stop() {
+  if (!recording) return;
+  recording = false;
+  // A record() may have seen recording still true, let it finish
+  while (writers > 0) {}
+  this->flush();
+  if (lengths[active] > 0) fwrite(buffers[active], 1, lengths[active], file);
+  lengths[active] = 0;
+  fflush(file);
+  file = NULL;
+}
+
+bool EventLogRecorder::isRecording() {
+  return recording;
+}
+
+void EventLogRecorder::record(midi_usb_packet packet, uint32_t now_us) {
+  writers++;
+  if (!recording) {
+    writers--;
+    return;
+  }
+  if (lengths[active] + EVENT_LOG_MAX_RECORD_SIZE > EVENT_LOG_BUFFER_SIZE) {
+    // Hand the active buffer to the writer and continue in the other one
+    const uint8_t other = active ^ 1;
+    if (full[other]) {
+      dropped_events++;
+      writers--;
+      return;
+    }
+    full[active] = true;
+    active = other;
+    lengths[active] = 0;
+  }
+  uint8_t* out = buffers[active] + lengths[active];
+  const size_t delta_size = encodeVarLen(now_us - last_us, out);
+  memcpy(out + delta_size, &packet, sizeof(packet));
+  lengths[active] += delta_size + sizeof(packet);
+  last_us = now_us;
+  recorded_events++;
+  writers--;
+}
+
+size_t EventLogRecorder::flush() {
+  size_t written = 0;
+  if (file == NULL) return 0;
+  for (int i = 0; i < 2; i++) {
+    if (!full[i]) continue;
+    written += fwrite(buffers[i], 1, lengths[i], file);
+    full[i] = false;
+  }
+  return written;
+}
+
+bool EventLogRecorder::hasFullBuffer() {
+  return full[0] || full[1];
+}
+
+uint32_t EventLogRecorder::getRecordedEvents() {
+  return recorded_events;
+}
+
+uint32_t EventLogRecorder::getDroppedEvents() {
+  return dropped_events;
+}
+
+/// EventLogReader ///
+
+EventLogReader::EventLogReader() {
+
+}
+
+EventLogReader::~EventLogReader() {
+
+}
+
+bool EventLogReader::open(FILE* log) {
+  uint8_t header[EVENT_LOG_HEADER_SIZE];
+  file = NULL;
+  time_us = 0;
+  if (log == NULL || fread(header, 1, sizeof(header), log) != sizeof(header)) return false;
+  if (memcmp(header, EVENT_LOG_MAGIC, sizeof(EVENT_LOG_MAGIC)) != 0 || header[4] != EVENT_LOG_VERSION) return false;
+  file = log;
+  return true;
+}
+
+bool EventLogReader::next(timed_midi_packet* event) {
+  if (file == NULL) return false;
+  uint32_t delta = 0;
+  for (int i = 0; ; i++) {
+    const int byte = fgetc(file);
+    if (byte == EOF || i == 5) return false;
+    delta = (delta << 7) | (byte & 0x7f);
+    if (!(byte & 0x80)) break;
+  }
+  if (fread(&event->packet, 1, sizeof(event->packet), file) != sizeof(event->packet)) return false;
+  time_us += delta;
+  event->time_us = time_us;
+  return true;
+}
+
+/// Functions definition ///
+
+int exportEventLogToSmf(FILE* log, FILE* smf) {
+  EventLogReader reader;
+  if (!reader.open(log)) return -1;
+
+  fwrite("MThd", 1, 4, smf);
+  writeBigEndian(smf, 6, 4);
+  writeBigEndian(smf, 0, 2); // Format 0
+  writeBigEndian(smf, 1, 2); // One track
+  writeBigEndian(smf, EVENT_LOG_SMF_DIVISION, 2);
+  fwrite("MTrk", 1, 4, smf);
+  const long length_offset = ftell(smf);
+  writeBigEndian(smf, 0, 4); // Patched once the track is written
+  const long track_start = ftell(smf);
+
+  const uint8_t tempo_event[] = { 0x00, 0xff, 0x51, 0x03 };
+  fwrite(tempo_event, 1, sizeof(tempo_event), smf);
+  writeBigEndian(smf, EVENT_LOG_SMF_TEMPO, 3);
+
+  int exported = 0;
+  uint32_t last_tick = 0;
+  timed_midi_packet event;
+  while (reader.next(&event)) {
+    // Only channel messages have a meaning in a MIDI file
+    if (event.packet.midi_type < MIDI_NOTE_OFF || event.packet.midi_type == 0x0f) continue;
+    const uint32_t tick = event.time_us / (EVENT_LOG_SMF_TEMPO / EVENT_LOG_SMF_DIVISION);
+    writeVarLen(smf, tick - last_tick);
+    last_tick = tick;
+    fputc((event.packet.midi_type << 4) | event.packet.midi_channel, smf);
+    fputc(event.packet.midi_data_1 & 0x7f, smf);
+    // Program change and channel pressure only have one data byte
+    if (event.packet.midi_type != 0x0c && event.packet.midi_type != 0x0d) {
+      fputc(event.packet.midi_data_2 & 0x7f, smf);
+    }
+    exported++;
+  }
+
+  const uint8_t end_of_track[] = { 0x00, 0xff, 0x2f, 0x00 };
+  fwrite(end_of_track, 1, sizeof(end_of_track), smf);
+  const long track_end = ftell(smf);
+  fseek(smf, length_offset, SEEK_SET);
+  writeBigEndian(smf, track_end - track_start, 4);
+  fseek(smf, track_end, SEEK_SET);
+  return ferror(smf) ? -1 : exported;
+}
+
+static size_t encodeVarLen(uint32_t value, uint8_t* out) {
+  uint8_t bytes[5];
+  size_t count = 0;
+  do {
+    bytes[count++] = value & 0x7f;
+    value >>= 7;
+  } while (value > 0);
+  // Most significant group first, with the continuation bit on all but the last byte
+  for (size_t i = 0; i < count; i++) {
+    out[i] = bytes[count - 1 - i] | (i + 1 < count ? 0x80 : 0);
+  }
+  return count;
+}
+
+static void writeVarLen(FILE* file, uint32_t value) {
+  uint8_t bytes[5];
+  fwrite(bytes, 1, encodeVarLen(value, bytes), file);
+}
+
+static void writeBigEndian(FILE* file, uint32_t value, int length) {
+  for (int i = length - 1; i >= 0; i--) fputc((value >> (8 * i)) & 0xff, file);
+}
@@ -0,0 +1,71 @@
+#include "FramePipeline.h"
+
+#include "TraceRecorder.h"
+
+/// Class members definition ///
+
+FramePipeline::FramePipeline(NoteRenderer* note_renderer) {
+  renderer = note_renderer;
+}
+
+bool FramePipeline::handleEvent(midi_event_t event, uint32_t now_us, note_source_t source) {
+  if (event.type == MIDI_EVENT_PROGRAM_CHANGE) {
+    if (!(PRESET_PROGRAM_SOURCES & (1 << source))) return false;
+    return renderer->getSettings()->selectPreset(event.note);
+  }
+  renderer->handleEvent(event, now_us, source);
+  return true;
+}
+
+bool FramePipeline::loop(uint32_t now_us) {
+  bool changed = false;
+  // The guide only changes when a step is played or missed
+  if (learning != NULL && learning->getGuideVersion() != guide_version) {
+    guide_version = learning->getGuideVersion();
+    renderer->setGuide(learning->getCurrentNotes(), learning->getUpcomingNotes());
+    changed = true;
+  }
+  // Effects move on their own, between the MIDI events
+  if (now_us - last_frame_us >= 1000000 / EFFECT_FRAME_RATE) {
+    // A whole frame was missed, the trace shows what held loop() meanwhile
+    if (last_frame_us != 0 && now_us - last_frame_us >= 2 * 1000000 / EFFECT_FRAME_RATE) traceInstant(TRACE_SPAN_FRAME_LATE);
+    last_frame_us = now_us;
+    // The matrix scrolls even without notes
+    if (renderer->animate(now_us) || matrix != NULL) changed = true;
+  }
+  return changed;
+}
+
+bool FramePipeline::render(uint32_t now_us) {
+  if (matrix == NULL) return renderer->render();
+  matrix->update(now_us, renderer->getNoteColors());
+  return matrix->render();
+}
+
+const uint8_t* FramePipeline::getFrame() {
+  return matrix != NULL ? matrix->getFrame() : renderer->getFrame();
+}
+
+uint16_t FramePipeline::getPixelCount() {
+  const uint16_t led_count = renderer->getLedCount();
+  if (matrix == NULL) return led_count;
+  return matrix->getPixelCount() < led_count ? matrix->getPixelCount() : led_count;
+}
+
+NoteRenderer* FramePipeline::getRenderer() {
+  return renderer;
+}
+
+void FramePipeline::setMatrix(MatrixRenderer* matrix_renderer) {
+  matrix = matrix_renderer;
+}
+
+MatrixRenderer* FramePipeline::getMatrix() {
+  return matrix;
+}
+
+void FramePipeline::setLearningSession(LearningSession* session) {
+  learning = session;
+  guide_version = session != NULL ? session->getGuideVersion() - 1 : 0;
+  if (session == NULL) renderer->setGuide(NULL, NULL);
+}
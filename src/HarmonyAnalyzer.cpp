@@ -0,0 +1,111 @@
+#include "HarmonyAnalyzer.h"
+
+#include <cstring>
+
+HarmonyAnalyzer::HarmonyAnalyzer() {
+  this->clear();
+}
+
+bool HarmonyAnalyzer::noteOn(uint8_t note, bool held) {
+  if (note >= 128) return false;
+  bool changed = false;
+  if (!held) {
+    const uint8_t pitch_class = note % 12;
+    if (pitch_class_count[pitch_class]++ == 0) {
+      pitch_classes |= 1 << pitch_class;
+      changed = this->updateChord();
+    }
+  }
+  // Repeated notes weigh more in the key
+  this->addToWindow(note % 12);
+  return this->updateKey() || changed;
+}
+
+bool HarmonyAnalyzer::noteOff(uint8_t note) {
+  if (note >= 128) return false;
+  const uint8_t pitch_class = note % 12;
+  if (pitch_class_count[pitch_class] == 0 || --pitch_class_count[pitch_class] > 0) return false;
+  pitch_classes &= ~(1 << pitch_class);
+  return this->updateChord();
+}
+
+void HarmonyAnalyzer::clear() {
+  memset(pitch_class_count, 0, sizeof(pitch_class_count));
+  pitch_classes = 0;
+  chord = { CHORD_QUALITY_NONE, 0 };
+  window_position = 0;
+  window_length = 0;
+  memset(window_count, 0, sizeof(window_count));
+  memset(scale_score, 0, sizeof(scale_score));
+  key = { 0, false, false };
+}
+
+uint16_t HarmonyAnalyzer::getPitchClasses() {
+  return pitch_classes;
+}
+
+chord_t HarmonyAnalyzer::getChord() {
+  return chord;
+}
+
+musical_key_t HarmonyAnalyzer::getKey() {
+  return key;
+}
+
+void HarmonyAnalyzer::addToWindow(uint8_t pitch_class) {
+  if (window_length == KEY_WINDOW_SIZE) {
+    const uint8_t oldest = window[window_position];
+    window_count[oldest]--;
+    for (uint8_t tonic = 0; tonic < 12; tonic++) {
+      if ((MAJOR_SCALE_TEMPLATE >> ((oldest + 12 - tonic) % 12)) & 1) scale_score[tonic]--;
+    }
+  } else {
+    window_length++;
+  }
+  window[window_position] = pitch_class;
+  window_position = (window_position + 1) % KEY_WINDOW_SIZE;
+  window_count[pitch_class]++;
+  for (uint8_t tonic = 0; tonic < 12; tonic++) {
+    if ((MAJOR_SCALE_TEMPLATE >> ((pitch_class + 12 - tonic) % 12)) & 1) scale_score[tonic]++;
+  }
+}
+
+bool HarmonyAnalyzer::updateChord() {
+  const chord_t matched = matchChord(pitch_classes);
+  if (matched.quality == chord.quality && matched.root == chord.root) return false;
+  chord = matched;
+  return true;
+}
+
+/**
+ * Pick the major scale holding the most notes of the window, then decide between the major key
+ * and its relative minor from the weight of their tonic and dominant. The raised leading tone of
+ * the harmonic minor also counts for the minor key.
+ */
+bool HarmonyAnalyzer::updateKey() {
+  if (window_length < KEY_MIN_NOTES) return false;
+  uint8_t scale = 0;
+  for (uint8_t tonic = 1; tonic < 12; tonic++) {
+    if (scale_score[tonic] > scale_score[scale]) scale = tonic;
+  }
+  if (key.valid) {
+    const uint8_t current_scale = key.minor ? (key.tonic + 3) % 12 : key.tonic;
+    if (scale_score[scale] < scale_score[current_scale] + KEY_HYSTERESIS) scale = current_scale;
+  }
+
+  const uint8_t minor_tonic = (scale + 9) % 12;
+  const int major_weight = window_count[scale] + window_count[(scale + 7) % 12];
+  const int minor_weight = window_count[minor_tonic] + window_count[(minor_tonic + 7) % 12]
+    + window_count[(minor_tonic + 11) % 12];
+  bool minor = minor_weight > major_weight;
+  // Same scale as the current key, only switch mode on a clear difference
+  if (key.valid && scale == (key.minor ? (key.tonic + 3) % 12 : key.tonic) && minor != key.minor) {
+    const int difference = minor ? minor_weight - major_weight : major_weight - minor_weight;
+    if (difference < KEY_HYSTERESIS) minor = key.minor;
+  }
+
+  const musical_key_t detected = { minor ? minor_tonic : scale, minor, true };
+  if (key.valid && detected.tonic == key.tonic && detected.minor == key.minor) return false;
+  key = detected;
+  return true;
+}
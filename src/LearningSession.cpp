@@ -0,0 +1,183 @@
+#include "LearningSession.h"
+
+/// Class members definition ///
+
+LearningSession::LearningSession() {
+  for (int i = 0; i < NOTE_SET_WORDS; i++) {
+    struck[i].store(0, std::memory_order_relaxed);
+    expected[i].store(0, std::memory_order_relaxed);
+  }
+  clearNoteSet(&current);
+  clearNoteSet(&upcoming);
+  stats = {};
+}
+
+bool LearningSession::open(SmfSource* source, learning_mode_t learning_mode) {
+  this->close();
+  if (!player.open(source)) return false;
+  mode = learning_mode;
+  head = 0;
+  count = 0;
+  has_pending = false;
+  end_of_song = false;
+  stats = {};
+  correct_notes.store(0, std::memory_order_relaxed);
+  wrong_notes.store(0, std::memory_order_relaxed);
+  for (int i = 0; i < NOTE_SET_WORDS; i++) struck[i].store(0, std::memory_order_relaxed);
+  this->fill();
+  this->updateGuide();
+  active.store(true, std::memory_order_release);
+  return true;
+}
+
+void LearningSession::close() {
+  if (!active.exchange(false, std::memory_order_acq_rel)) return;
+  player.close();
+  count = 0;
+  this->updateGuide();
+}
+
+bool LearningSession::isActive() {
+  return active.load(std::memory_order_acquire);
+}
+
+bool LearningSession::isFinished() {
+  return this->isActive() && count == 0 && end_of_song;
+}
+
+learning_mode_t LearningSession::getMode() {
+  return mode;
+}
+
+void LearningSession::start(uint32_t start_time_us) {
+  start_us = start_time_us;
+}
+
+/**
+ * One bit set and one bit tested, the whole step is compared by update().
+ */
+bool LearningSession::handleEvent(midi_event_t event) {
+  if (event.type != MIDI_EVENT_NOTE_ON || event.note >= NOTE_COUNT || !this->isActive()) return false;
+  const uint32_t bit = 1UL << (event.note & 31);
+  struck[event.note >> 5].fetch_or(bit, std::memory_order_relaxed);
+  const bool correct = expected[event.note >> 5].load(std::memory_order_relaxed) & bit;
+  (correct ? correct_notes : wrong_notes).fetch_add(1, std::memory_order_relaxed);
+  return correct;
+}
+
+bool LearningSession::update(uint32_t now_us) {
+  if (!this->isActive()) return false;
+  const uint32_t version = guide_version;
+  while (count > 0) {
+    if (this->isStepPlayed()) {
+      this->nextStep(true);
+      continue;
+    }
+    if (mode != LEARNING_MODE_FOLLOW) break;
+    // The step is missed once the next one is due, the last one is left the look-ahead time
+    const learning_step_t* step = &window[head];
+    const uint32_t next_us = count > 1 ? window[(head + 1) % LEARNING_WINDOW_STEPS].time_us : step->time_us + LEARNING_LOOKAHEAD_US;
+    if ((int32_t)(now_us - start_us - next_us) < 0) break;
+    this->nextStep(false);
+  }
+  return guide_version != version;
+}
+
+const note_set_t* LearningSession::getCurrentNotes() {
+  return &current;
+}
+
+const note_set_t* LearningSession::getUpcomingNotes() {
+  return &upcoming;
+}
+
+uint32_t LearningSession::getGuideVersion() {
+  return guide_version;
+}
+
+uint8_t LearningSession::getWindowSize() {
+  return count;
+}
+
+const learning_step_t* LearningSession::getStep(uint8_t index) {
+  if (index >= count) return NULL;
+  return &window[(head + index) % LEARNING_WINDOW_STEPS];
+}
+
+learning_stats_t LearningSession::getStats() {
+  learning_stats_t current_stats = stats;
+  current_stats.correct_notes = correct_notes.load(std::memory_order_relaxed);
+  current_stats.wrong_notes = wrong_notes.load(std::memory_order_relaxed);
+  return current_stats;
+}
+
+/**
+ * Read the steps up to a full window, the only place the file is parsed.
+ */
+void LearningSession::fill() {
+  while (count < LEARNING_WINDOW_STEPS && !end_of_song) {
+    if (this->readStep(&window[(head + count) % LEARNING_WINDOW_STEPS])) count++;
+    else end_of_song = true;
+  }
+}
+
+/**
+ * Gather the note ons starting within LEARNING_CHORD_US of the first one.
+ * The note on ending the step is kept pending, it begins the next one.
+ */
+bool LearningSession::readStep(learning_step_t* step) {
+  clearNoteSet(&step->notes);
+  bool started = false;
+  while (true) {
+    if (!has_pending) {
+      if (!player.nextEvent(&pending)) return started;
+      has_pending = true;
+    }
+    const midi_event_t event = decodeMidiPacket(pending.packet);
+    if (event.type == MIDI_EVENT_NOTE_ON) {
+      if (!started) {
+        step->time_us = pending.time_us;
+        started = true;
+      } else if (pending.time_us - step->time_us > LEARNING_CHORD_US) {
+        return true;
+      }
+      addNote(&step->notes, event.note);
+    }
+    has_pending = false;
+  }
+}
+
+bool LearningSession::isStepPlayed() {
+  for (int i = 0; i < NOTE_SET_WORDS; i++) {
+    if (current.words[i] & ~struck[i].load(std::memory_order_relaxed)) return false;
+  }
+  return true;
+}
+
+void LearningSession::nextStep(bool played) {
+  if (played) stats.steps++;
+  else stats.missed_steps++;
+  // Notes struck for this step don't count for the next one
+  for (int i = 0; i < NOTE_SET_WORDS; i++) struck[i].store(0, std::memory_order_relaxed);
+  head = (head + 1) % LEARNING_WINDOW_STEPS;
+  count--;
+  this->fill();
+  this->updateGuide();
+}
+
+void LearningSession::updateGuide() {
+  clearNoteSet(&current);
+  clearNoteSet(&upcoming);
+  if (count > 0) {
+    const learning_step_t* step = &window[head];
+    current = step->notes;
+    for (uint8_t i = 1; i < count; i++) {
+      const learning_step_t* next = &window[(head + i) % LEARNING_WINDOW_STEPS];
+      if (next->time_us - step->time_us >= LEARNING_LOOKAHEAD_US) break;
+      for (int j = 0; j < NOTE_SET_WORDS; j++) upcoming.words[j] |= next->notes.words[j];
+    }
+    for (int j = 0; j < NOTE_SET_WORDS; j++) upcoming.words[j] &= ~current.words[j];
+  }
+  for (int i = 0; i < NOTE_SET_WORDS; i++) expected[i].store(current.words[i], std::memory_order_relaxed);
+  guide_version++;
+}
@@ -1,125 +1,363 @@
 #include "LedController.h"
 
 #include <Adafruit_NeoPixel.h>
+#include "TraceRecorder.h"
 
-LedController::LedController(int led_count, int led_strip_pin, bool use_preferences) {
-  ws2812b = new Adafruit_NeoPixel(led_count, led_strip_pin, NEO_GRB + NEO_KHZ800);
+/// Functions declaration ///
+
+static neoPixelType getNeoPixelType(pixel_order_t);
+
+/// Class members definition ///
+
+LedController::LedController(int led_count, int led_strip_pin, bool use_preferences, MemoryArena* arena, pixel_order_t pixel_order) {
+  order = pixel_order;
+  ws2812b = new Adafruit_NeoPixel(led_count, led_strip_pin, getNeoPixelType(order) + NEO_KHZ800);
+  encoder = new RuntimePixelEncoder(order);
+  memory = arena;
+  // Objects of an arena are never destroyed
+  renderer = memory != NULL ? memory->create<NoteRenderer>(led_count, &settings, memory) : new NoteRenderer(led_count, &settings);
+  pipeline = memory != NULL ? memory->create<FramePipeline>(renderer) : new FramePipeline(renderer);
   led_number = led_count;
   use_nvs = use_preferences;
 }
 
 LedController::~LedController() {
   delete ws2812b;
+  if (owns_encoder) delete encoder;
+  if (memory == NULL) {
+    delete pipeline;
+    delete renderer;
+  }
   if (use_nvs) nvs.end();
 }
 
 void LedController::setup() {
-  if (use_nvs) nvs.begin("Pianeon", false);
-  log_i("color %06x, brigthness %d", this->getColor(), this->getBrightness());
+  if (use_nvs) {
+    nvs.begin("Pianeon", false);
+    this->loadSettings();
+    this->loadEffectScript();
+  }
+  const led_preset_t preset = settings.getPreset();
+  log_i("color %06x, brigthness %d", preset.color, preset.brightness);
   ws2812b->begin();
-  ws2812b->setBrightness(this->getBrightness());
+  ws2812b->setBrightness(preset.brightness);
   ws2812b->clear();
   ws2812b->show();
 }
 
 void LedController::setColor(uint32_t color) {
-  if (use_nvs) {
-    nvs.putUInt("led_color", color);
-  } else {
-    led_color_temp = color;
-  }
-  log_i("led_color set to: %04x", color);
+  led_preset_t preset = settings.getPreset();
+  preset.color = color;
+  this->setPreset(preset);
+  log_d("led_color set to: %04x", color);
 }
 
 void LedController::setColor(uint8_t red, uint8_t green, uint8_t blue) {
-  uint32_t color = ws2812b->Color(red, green, blue);
-  if (use_nvs) {
-    nvs.putUInt("led_color", color);
-  } else {
-    led_color_temp = color;
-  }
-  log_i("led_color set to: %04x", color);
+  this->setColor(ws2812b->Color(red, green, blue));
 }
 
 uint32_t LedController::getColor() {
-  return use_nvs
-    ? nvs.getUInt("led_color", DEFAULT_LED_COLOR)
-    : led_color_temp;
+  return settings.getPreset().color;
 }
 
 void LedController::setBrightness(uint8_t brightness) {
-  if (use_nvs) {
-    nvs.putUChar("brightness", brightness);
-  } else {
-    brightness_temp = brightness;
-  }
-  ws2812b->setBrightness(brightness);
-  log_i("brightness set to: %d", brightness);
+  led_preset_t preset = settings.getPreset();
+  preset.brightness = brightness;
+  this->setPreset(preset);
+  log_d("brightness set to: %d", brightness);
 }
 
 uint8_t LedController::getBrightness() {
-  return use_nvs
-    ? nvs.getUChar("brightness", DEFAULT_BRIGHTNESS)
-    : brightness_temp;
+  return settings.getPreset().brightness;
 }
 
 void LedController::setShowSustain(bool showSustain) {
-  if (!showSustain) this->lightOffSides();
+  led_preset_t preset = settings.getPreset();
+  preset.show_sustain = showSustain;
+  this->setPreset(preset);
+  log_d("show_sustain set to: %d", showSustain);
+}
+
+bool LedController::getShowSustain() {
+  return settings.getPreset().show_sustain;
+}
+
+bool LedController::selectPreset(uint8_t index) {
+  if (!settings.selectPreset(index)) return false;
+  this->settingsApplied();
+  log_d("preset %d selected", index);
+  return true;
+}
+
+bool LedController::savePreset(uint8_t index, const char* name) {
+  if (!settings.savePreset(index, name)) return false;
   if (use_nvs) {
-    nvs.putBool("sustain", showSustain);
+    char key[8];
+    snprintf(key, sizeof(key), "preset%d", index);
+    nvs.putBytes(key, settings.getStoredPreset(index), sizeof(led_preset_t));
+  }
+  log_i("preset %d saved as %s", index, name);
+  return true;
+}
+
+SettingsStore* LedController::getSettings() {
+  return &settings;
+}
+
+void LedController::setPreset(const led_preset_t& preset, int8_t selected) {
+  settings.publish(preset, selected);
+  this->settingsApplied();
+}
+
+/**
+ * Apply what the renderer doesn't read from the snapshot and schedule the save.
+ */
+void LedController::settingsApplied() {
+  const uint8_t brightness = settings.getPreset().brightness;
+  if (brightness != ws2812b->getBrightness()) ws2812b->setBrightness(brightness);
+  this->show();
+  settings_dirty = use_nvs;
+  settings_changed_millis = millis();
+}
+
+void LedController::loadSettings() {
+  led_preset_t preset;
+  if (this->loadPreset("settings", &preset)) {
+    settings.publish(preset);
+  } else if (nvs.isKey("led_color")) {
+    // Settings saved as separate keys by the previous firmwares
+    preset = SettingsStore::defaultPreset();
+    preset.color = nvs.getUInt("led_color", DEFAULT_LED_COLOR);
+    preset.brightness = nvs.getUChar("brightness", DEFAULT_BRIGHTNESS);
+    preset.show_sustain = nvs.getBool("sustain", false);
+    settings.publish(preset);
+    nvs.putBytes("settings", &preset, sizeof(preset));
+    nvs.remove("led_color");
+    nvs.remove("brightness");
+    nvs.remove("sustain");
+  }
+
+  for (uint8_t index = 0; index < PRESET_COUNT; index++) {
+    char key[8];
+    snprintf(key, sizeof(key), "preset%d", index);
+    if (this->loadPreset(key, &preset)) settings.setStoredPreset(index, preset);
+  }
+}
+
+bool LedController::loadPreset(const char* key, led_preset_t* preset) {
+  uint8_t blob[sizeof(led_preset_t)];
+  // Blobs of older versions are shorter
+  const size_t length = nvs.getBytesLength(key);
+  if (length == 0 || length > sizeof(blob)) return false;
+  nvs.getBytes(key, blob, length);
+  return SettingsStore::decodePreset(blob, length, preset);
+}
+
+void LedController::loadEffectScript() {
+  const size_t length = nvs.getBytesLength("effect");
+  if (length == 0 || length > EFFECT_MAX_SOURCE_SIZE) return;
+  char* source = new char[length];
+  nvs.getBytes("effect", source, length);
+  if (effect_compiler.compile(source, length)) {
+    renderer->setEffect(effect_compiler.getBytecode(), effect_compiler.getBytecodeLength());
+    log_i("Effect script loaded, %u instructions", (unsigned)renderer->getEffect()->getInstructionCount());
   } else {
-    show_sustain_temp = showSustain;
+    log_e("Saved effect script line %d: %s", effect_compiler.getErrorLine(), effect_compiler.getError());
   }
-  log_i("show_sustain set to: %d", showSustain);
+  delete[] source;
 }
 
-bool LedController::getShowSustain() {
-  return use_nvs
-    ? nvs.getBool("sustain", false)
-    : show_sustain_temp;
+bool LedController::setEffectScript(const char* source, size_t length) {
+  if (length > EFFECT_MAX_SOURCE_SIZE) return false;
+  if (length == 0) {
+    renderer->setEffect(NULL, 0);
+    if (use_nvs) nvs.remove("effect");
+    log_i("Effect script removed");
+    return true;
+  }
+  if (!effect_compiler.compile(source, length)) return false;
+  renderer->setEffect(effect_compiler.getBytecode(), effect_compiler.getBytecodeLength());
+  if (use_nvs) nvs.putBytes("effect", source, length);
+  log_i("Effect script set, %u bytes of bytecode", (unsigned)effect_compiler.getBytecodeLength());
+  return true;
 }
 
-void LedController::lightOn(uint8_t note, uint8_t velocity) {
-  ws2812b->setPixelColor(this->computePixelIndex(note), this->getColor());
-  // changes_to_show = true;
-  ws2812b->show();
+size_t LedController::getEffectScript(char* buffer, size_t size) {
+  if (!use_nvs) return 0;
+  const size_t length = nvs.getBytesLength("effect");
+  if (length == 0 || length > size) return 0;
+  return nvs.getBytes("effect", buffer, length);
+}
+
+EffectCompiler* LedController::getEffectCompiler() {
+  return &effect_compiler;
+}
+
+void LedController::saveSettings() {
+  if (!settings_dirty) return;
+  settings_dirty = false;
+  const led_preset_t preset = settings.getPreset();
+  nvs.putBytes("settings", &preset, sizeof(preset));
+  log_i("Settings saved: color %06x, brightness %d, sustain %d", preset.color, preset.brightness, preset.show_sustain);
+}
+
+void LedController::lightOn(uint8_t note, uint8_t velocity, note_source_t source) {
+  renderer->noteOn(note, velocity, micros(), source);
+  this->show();
 }
 
 void LedController::lightOff(uint8_t note) {
-  ws2812b->setPixelColor(this->computePixelIndex(note), 0);
-  // changes_to_show = true;
-  ws2812b->show();
+  renderer->noteOff(note);
+  this->show();
 }
 
 void LedController::lightOnSides() {
-  if (!this->getShowSustain()) return;
-  uint32_t color = this->getColor();
-  ws2812b->setPixelColor(0, color);
-  ws2812b->setPixelColor(led_number - 1, color);
-  // changes_to_show = true;
-  ws2812b->show();
+  renderer->sustainOn();
+  this->show();
 }
 
 void LedController::lightOffSides() {
-  if (!this->getShowSustain()) return;
-  ws2812b->setPixelColor(0, 0);
-  ws2812b->setPixelColor(led_number - 1, 0);
-  // changes_to_show = true;
-  ws2812b->show();
+  renderer->sustainOff();
+  this->show();
 }
 
+void LedController::handleEvent(midi_event_t event, note_source_t source) {
+  if (!pipeline->handleEvent(event, micros(), source)) return;
+  if (event.type == MIDI_EVENT_PROGRAM_CHANGE) {
+    // The brightness of the preset is applied by the strip, not the frame
+    this->settingsApplied();
+    log_d("preset %d selected", event.note);
+    return;
+  }
+  this->show();
+}
+
+/**
+ * Light the blink notes one after the other, the lit one is found in the note state.
+ */
 void LedController::blinkLoop() {
-  unsigned long current_millis = millis();
-  if (current_millis - last_blink_millis < 300) return;
+  NoteState* state = renderer->getNoteState();
+  int note = state->nextPressed(BLINK_FIRST_NOTE);
+  while (note >= 0 && note <= BLINK_LAST_NOTE && state->getSource(note) != NOTE_SOURCE_DEMO) {
+    note = state->nextPressed(note + 1);
+  }
+  if (note > BLINK_LAST_NOTE) note = -1;
+  if (note >= 0) {
+    if (micros() - state->getOnset(note) < BLINK_PERIOD_MS * 1000) return;
+    this->lightOff(note);
+  }
+  this->lightOn(note >= 0 && note < BLINK_LAST_NOTE ? note + 1 : BLINK_FIRST_NOTE, 100);
+}
+
+void LedController::previewEvent(midi_event_t event) {
+  MatrixRenderer* matrix = pipeline->getMatrix();
+  if (matrix == NULL) return;
+  if (event.type == MIDI_EVENT_NOTE_ON) {
+    const led_settings_t* current = settings.acquire();
+    matrix->previewNoteOn(event.note, current->note_colors[event.note & 0x7f]);
+    settings.release(current);
+  } else if (event.type == MIDI_EVENT_NOTE_OFF) {
+    matrix->previewNoteOff(event.note);
+  }
+}
+
+void LedController::show() {
+  TraceScope show_trace(TRACE_SPAN_SHOW);
+  const uint32_t now_us = micros();
+  traceBegin(TRACE_SPAN_RENDER);
+  const bool rendered = pipeline->render(now_us);
+  traceEnd(TRACE_SPAN_RENDER);
+  if (!rendered) return;
+  if (network_output != NULL) {
+    TraceScope output_trace(TRACE_SPAN_PIXEL_OUTPUT);
+    network_output->send(this->getOutputFrame(), this->getOutputPixelCount(), now_us);
+  }
+  if (!use_local_strip) return;
+  traceBegin(TRACE_SPAN_PUSH);
+  this->pushFrame();
+  traceEnd(TRACE_SPAN_PUSH);
+  traceBegin(TRACE_SPAN_STRIP);
+  this->showStrip();
+  traceEnd(TRACE_SPAN_STRIP);
+}
+
+void LedController::loop() {
+  // A slider drag sends many updates, only the last one is written to flash
+  if (settings_dirty && millis() - settings_changed_millis >= SETTINGS_SAVE_DELAY_MS) this->saveSettings();
+  // New learning guide and animation frames
+  if (pipeline->loop(micros())) this->show();
+  // Unchanged universes are only sent when their keep alive period is over. Rendering runs on this
+  // task too, the frame sent without a copy is always the last one committed
+  if (network_output != NULL) network_output->send(this->getOutputFrame(), this->getOutputPixelCount(), micros());
+}
+
+void LedController::setNetworkOutput(PixelNetworkOutput* output, bool local_strip) {
+  network_output = output;
+  use_local_strip = local_strip;
+}
+
+void LedController::setMatrix(MatrixRenderer* matrix_renderer) {
+  pipeline->setMatrix(matrix_renderer);
+}
+
+void LedController::setLearningSession(LearningSession* session) {
+  pipeline->setLearningSession(session);
+}
 
-  last_blink_millis = current_millis;
-  this->lightOff(blink_note++);
-  if (blink_note >= 35) {
-    blink_note = 30;
+MatrixRenderer* LedController::getMatrix() {
+  return pipeline->getMatrix();
+}
+
+bool LedController::setPixelEncoder(PixelEncoder* pixel_encoder) {
+  if (pixel_encoder == NULL || pixel_encoder->getOrder() != order) {
+    log_e("Pixel encoder not matching the strip");
+    return false;
   }
-  this->lightOn(blink_note, 100);
+  if (owns_encoder) delete encoder;
+  encoder = pixel_encoder;
+  owns_encoder = false;
+  return true;
+}
+
+PixelEncoder* LedController::getPixelEncoder() {
+  return encoder;
+}
+
+const uint8_t* LedController::getOutputFrame() {
+  return pipeline->getFrame();
+}
+
+uint16_t LedController::getOutputPixelCount() {
+  return pipeline->getPixelCount();
 }
 
-int LedController::computePixelIndex(uint8_t note) {
-  return (note - 21) * 2;
+NoteRenderer* LedController::getRenderer() {
+  return renderer;
+}
+
+/**
+ * The frame is encoded straight into the buffer of the strip, Adafruit_NeoPixel only sends it.
+ * Its brightness is applied the same way as setPixelColor() does.
+ */
+void LedController::pushFrame() {
+  encoder->encode(this->getOutputFrame(), this->getOutputPixelCount(), ws2812b->getPixels(), ws2812b->getBrightness() + 1);
+}
+
+void LedController::showStrip() {
+  ws2812b->show();
+}
+
+uint16_t LedController::getLedCount() {
+  return led_number;
+}
+
+/// Functions definition ///
+
+static neoPixelType getNeoPixelType(pixel_order_t order) {
+  switch (order) {
+    case PIXEL_ORDER_RGB: return NEO_RGB;
+    case PIXEL_ORDER_RGBW: return NEO_RGBW;
+    case PIXEL_ORDER_GRBW: return NEO_GRBW;
+    default: return NEO_GRB;
+  }
 }
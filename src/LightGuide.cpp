@@ -0,0 +1,85 @@
+#include "LightGuide.h"
+
+#include "midi_decoder.h"
+
+/// Class members definition ///
+
+LightGuide::LightGuide(MidiOutQueue* out_queue, uint8_t channel, bool upcoming) {
+  queue = out_queue;
+  generation = queue->getGeneration();
+  status_channel = (channel - 1) & 0x0f;
+  show_upcoming = upcoming;
+  clearNoteSet(&lit);
+  clearNoteSet(&lit_upcoming);
+}
+
+void LightGuide::setSession(LearningSession* session) {
+  learning = session;
+  guide_version = session != NULL ? session->getGuideVersion() - 1 : 0;
+}
+
+size_t LightGuide::loop(uint32_t now_us) {
+  if (queue->getGeneration() != generation) {
+    generation = queue->getGeneration();
+    this->reset();
+  }
+  if (learning == NULL || learning->getGuideVersion() == guide_version) return 0;
+  const uint32_t version = learning->getGuideVersion();
+  const size_t sent = this->show(learning->getCurrentNotes(), learning->getUpcomingNotes(), now_us);
+  // Keys left unchanged by a full queue are sent again by the next loop
+  if (synced) guide_version = version;
+  return sent;
+}
+
+size_t LightGuide::show(const note_set_t* current, const note_set_t* upcoming, uint32_t now_us) {
+  note_set_t target;
+  note_set_t target_upcoming;
+  note_set_t changed;
+  for (int i = 0; i < NOTE_SET_WORDS; i++) {
+    target_upcoming.words[i] = show_upcoming ? upcoming->words[i] & ~current->words[i] : 0;
+    target.words[i] = current->words[i] | target_upcoming.words[i];
+    // Keys turned on or off, and lit keys moving between upcoming and current
+    changed.words[i] = (lit.words[i] ^ target.words[i]) | ((lit_upcoming.words[i] ^ target_upcoming.words[i]) & target.words[i]);
+  }
+  size_t sent = 0;
+  synced = true;
+  for (int note = nextNote(&changed, 0); note >= 0; note = nextNote(&changed, note + 1)) {
+    if (hasNote(&target, note)) {
+      const bool next = hasNote(&target_upcoming, note);
+      const bool queued = this->send(0x90, note, next ? LIGHT_GUIDE_UPCOMING_VELOCITY : LIGHT_GUIDE_CURRENT_VELOCITY, now_us);
+      if (!queued) {
+        synced = false;
+        continue;
+      }
+      addNote(&lit, note);
+      if (next) addNote(&lit_upcoming, note);
+      else removeNote(&lit_upcoming, note);
+    } else {
+      const bool queued = this->send(0x80, note, 0, now_us);
+      if (!queued) {
+        synced = false;
+        continue;
+      }
+      removeNote(&lit, note);
+      removeNote(&lit_upcoming, note);
+    }
+    sent++;
+  }
+  return sent;
+}
+
+size_t LightGuide::clear(uint32_t now_us) {
+  note_set_t none;
+  clearNoteSet(&none);
+  return this->show(&none, &none, now_us);
+}
+
+void LightGuide::reset() {
+  clearNoteSet(&lit);
+  clearNoteSet(&lit_upcoming);
+  if (learning != NULL) guide_version = learning->getGuideVersion() - 1;
+}
+
+bool LightGuide::send(uint8_t status, uint8_t note, uint8_t velocity, uint32_t now_us) {
+  return queue->push(makeMidiPacket(status | status_channel, note, velocity), now_us);
+}
@@ -0,0 +1,136 @@
+#include "MatrixRenderer.h"
+
+#include <cstring>
+#include "palette.h"
+
+#define PIANO_KEY_COUNT (PIANO_LAST_NOTE - PIANO_FIRST_NOTE + 1)
+
+MatrixRenderer::MatrixRenderer(matrix_layout_t matrix_layout, MemoryArena* arena) {
+  layout = matrix_layout;
+  memory = arena;
+  row_size = 3 * layout.width;
+  rows = MemoryArena::allocateBuffer(memory, row_size * layout.height);
+  frame = MemoryArena::allocateBuffer(memory, row_size * layout.height);
+  this->clear();
+}
+
+MatrixRenderer::~MatrixRenderer() {
+  MemoryArena::releaseBuffer(memory, rows);
+  MemoryArena::releaseBuffer(memory, frame);
+}
+
+void MatrixRenderer::setMode(matrix_mode_t matrix_mode) {
+  mode = matrix_mode;
+  dirty = true;
+}
+
+matrix_mode_t MatrixRenderer::getMode() {
+  return mode;
+}
+
+void MatrixRenderer::setRowPeriod(uint32_t period_us) {
+  if (period_us > 0) row_period_us = period_us;
+}
+
+uint32_t MatrixRenderer::getLookahead() {
+  return row_period_us * layout.height;
+}
+
+void MatrixRenderer::previewNoteOn(uint8_t note, uint32_t color) {
+  if (note < 128) preview_colors[note] = color;
+}
+
+void MatrixRenderer::previewNoteOff(uint8_t note) {
+  if (note < 128) preview_colors[note] = 0;
+}
+
+bool MatrixRenderer::update(uint32_t now_us, const uint32_t* note_colors) {
+  if (layout.height == 0) return false;
+  const uint32_t* source = mode == MATRIX_WATERFALL_FALLING ? preview_colors : note_colors;
+  if (!started) {
+    started = true;
+    last_scroll_us = now_us;
+  }
+  // After a long pause, scroll the whole matrix at most once
+  uint32_t scrolls = (now_us - last_scroll_us) / row_period_us;
+  last_scroll_us += scrolls * row_period_us;
+  if (scrolls > layout.height) scrolls = layout.height;
+  for (uint32_t i = 0; i < scrolls; i++) {
+    newest_row = (newest_row + 1) % layout.height;
+    // The row leaving the matrix is reused, it must not keep its old notes
+    memset(rows + newest_row * row_size, 0, row_size);
+    this->fillRow(rows + newest_row * row_size, source);
+    dirty = true;
+  }
+  // Notes starting within the period show up right away in the newest row
+  if (this->fillRow(rows + newest_row * row_size, source)) dirty = true;
+  return dirty;
+}
+
+bool MatrixRenderer::render() {
+  if (!dirty) return false;
+  dirty = false;
+  for (uint16_t age = 0; age < layout.height; age++) {
+    const uint8_t* row = rows + ((newest_row + layout.height - age) % layout.height) * row_size;
+    const uint16_t y = mode == MATRIX_WATERFALL_RISING ? age : layout.height - 1 - age;
+    const uint16_t strip_row = layout.top_origin ? layout.height - 1 - y : y;
+    uint8_t* output = frame + strip_row * row_size;
+    if (!layout.serpentine || !(strip_row & 1)) {
+      memcpy(output, row, row_size);
+      continue;
+    }
+    // Row wired from right to left
+    for (uint16_t x = 0; x < layout.width; x++) {
+      memcpy(output + 3 * (layout.width - 1 - x), row + 3 * x, 3);
+    }
+  }
+  return true;
+}
+
+const uint8_t* MatrixRenderer::getFrame() {
+  return frame;
+}
+
+uint16_t MatrixRenderer::getPixelCount() {
+  return layout.width * layout.height;
+}
+
+uint16_t MatrixRenderer::mapPixel(uint16_t x, uint16_t y) {
+  const uint16_t strip_row = layout.top_origin ? layout.height - 1 - y : y;
+  const bool reversed = layout.serpentine && (strip_row & 1);
+  return strip_row * layout.width + (reversed ? layout.width - 1 - x : x);
+}
+
+void MatrixRenderer::clear() {
+  memset(rows, 0, row_size * layout.height);
+  memset(frame, 0, row_size * layout.height);
+  memset(preview_colors, 0, sizeof(preview_colors));
+  started = false;
+  dirty = true;
+}
+
+/**
+ * Draw the notes of the keyboard over the width of the row.
+ * Notes are only added: a note released during the period stays until the row scrolls.
+ */
+bool MatrixRenderer::fillRow(uint8_t* row, const uint32_t* note_colors) {
+  if (note_colors == NULL) return false;
+  bool changed = false;
+  for (uint8_t note = PIANO_FIRST_NOTE; note <= PIANO_LAST_NOTE; note++) {
+    const uint32_t color = note_colors[note];
+    if (color == 0) continue;
+    const uint8_t key = note - PIANO_FIRST_NOTE;
+    const uint16_t first = key * layout.width / PIANO_KEY_COUNT;
+    uint16_t last = (key + 1) * layout.width / PIANO_KEY_COUNT;
+    if (last <= first) last = first + 1;
+    for (uint16_t x = first; x < last && x < layout.width; x++) {
+      uint8_t* pixel = row + 3 * x;
+      if (pixel[0] == (uint8_t)(color >> 16) && pixel[1] == (uint8_t)(color >> 8) && pixel[2] == (uint8_t)color) continue;
+      pixel[0] = color >> 16;
+      pixel[1] = color >> 8;
+      pixel[2] = color;
+      changed = true;
+    }
+  }
+  return changed;
+}
@@ -0,0 +1,76 @@
+#include "MemoryArena.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if __has_include("esp_heap_caps.h")
+#include "esp_heap_caps.h"
+#define USE_HEAP_CAPS 1
+#endif
+
+/// Class members definition ///
+
+MemoryArena::MemoryArena(const char* arena_name, memory_region_t memory_region, size_t arena_size) {
+  name = arena_name;
+  region = memory_region;
+#ifdef USE_HEAP_CAPS
+  const uint32_t caps = region == MEMORY_REGION_PSRAM ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+  block = (uint8_t*)heap_caps_malloc(arena_size, caps);
+#else
+  block = (uint8_t*)malloc(arena_size);
+#endif
+  size = block != NULL ? arena_size : 0;
+  if (block != NULL) memset(block, 0, size);
+}
+
+MemoryArena::~MemoryArena() {
+  free(block);
+}
+
+void* MemoryArena::allocate(size_t length, size_t alignment) {
+  const size_t start = (used + alignment - 1) & ~(alignment - 1);
+  if (block == NULL || start + length > size) {
+    overflow_count++;
+    return NULL;
+  }
+  used = start + length;
+  return block + start;
+}
+
+bool MemoryArena::contains(const void* pointer) {
+  return block != NULL && pointer >= block && pointer < block + size;
+}
+
+const char* MemoryArena::getName() {
+  return name;
+}
+
+memory_region_t MemoryArena::getRegion() {
+  return region;
+}
+
+size_t MemoryArena::getSize() {
+  return size;
+}
+
+size_t MemoryArena::getUsed() {
+  return used;
+}
+
+uint32_t MemoryArena::getOverflowCount() {
+  return overflow_count;
+}
+
+uint8_t* MemoryArena::allocateBuffer(MemoryArena* arena, size_t length) {
+  // Arena blocks are zeroed when reserved
+  uint8_t* buffer = arena != NULL ? (uint8_t*)arena->allocate(length) : NULL;
+  if (buffer != NULL) return buffer;
+  buffer = new uint8_t[length];
+  memset(buffer, 0, length);
+  return buffer;
+}
+
+void MemoryArena::releaseBuffer(MemoryArena* arena, uint8_t* buffer) {
+  if (arena != NULL && arena->contains(buffer)) return;
+  delete[] buffer;
+}
@@ -0,0 +1,143 @@
+#include "MidiFilePlayer.h"
+
+#include <LittleFS.h>
+
+MidiFilePlayer::MidiFilePlayer() {
+
+}
+
+MidiFilePlayer::~MidiFilePlayer() {
+  file.close();
+  preview_file.close();
+  learning_file.close();
+}
+
+void MidiFilePlayer::setMidiInCallback(midi_in_callback_t *callback) {
+  this->midiInCallback = callback;
+}
+
+void MidiFilePlayer::setPreview(midi_in_callback_t *callback, uint32_t lookahead_us) {
+  this->stop();
+  this->previewCallback = callback;
+  preview_lookahead_us = callback != NULL ? lookahead_us : 0;
+}
+
+void MidiFilePlayer::setLearningSession(LearningSession* session) {
+  this->stop();
+  learning = session;
+}
+
+LearningSession* MidiFilePlayer::getLearningSession() {
+  return learning;
+}
+
+void MidiFilePlayer::setup() {
+  fs_mounted = LittleFS.begin(false, MIDI_FILES_MOUNT_POINT);
+  if (!fs_mounted) log_e("Unable to mount LittleFS, MIDI files won't be available");
+}
+
+void MidiFilePlayer::loop() {
+  if (learning != NULL && learning->isActive()) {
+    learning->update(micros());
+    if (learning->isFinished()) {
+      log_i("End of learned MIDI file");
+      learning->close();
+      learning_file.close();
+    }
+  }
+  if (!player.isPlaying()) return;
+  const uint32_t now_us = micros();
+  if (preview_player.isPlaying()) {
+    preview_player.update(now_us, this->previewCallback);
+    if (!preview_player.isPlaying()) preview_file.close();
+  }
+  player.update(now_us, this->midiInCallback);
+  if (!player.isPlaying()) {
+    log_i("End of MIDI file");
+    file.close();
+  }
+}
+
+bool MidiFilePlayer::play(const char* file_name) {
+  if (!fs_mounted) return false;
+  this->stop();
+  String path = String(MIDI_FILES_MOUNT_POINT) + "/" + file_name;
+  if (!file.open(path.c_str()) || !player.open(&file)) {
+    log_e("Unable to open MIDI file %s", path.c_str());
+    file.close();
+    return false;
+  }
+  log_i("Playing %s, %d tracks", path.c_str(), player.getTrackCount());
+  if (player.getSkippedTrackCount() > 0) {
+    log_w("%d tracks past the first %d won't be played", player.getSkippedTrackCount(), SMF_MAX_TRACKS);
+  }
+  const uint32_t now_us = micros();
+  if (preview_lookahead_us > 0) {
+    // The song itself starts once the preview is lookahead_us ahead
+    if (preview_file.open(path.c_str()) && preview_player.open(&preview_file)) {
+      preview_player.start(now_us);
+    } else {
+      log_w("Unable to preview MIDI file %s", path.c_str());
+      preview_file.close();
+    }
+  }
+  player.start(preview_player.isPlaying() ? now_us + preview_lookahead_us : now_us);
+  return true;
+}
+
+bool MidiFilePlayer::learn(const char* file_name, learning_mode_t mode) {
+  if (!fs_mounted || learning == NULL) return false;
+  this->stop();
+  String path = String(MIDI_FILES_MOUNT_POINT) + "/" + file_name;
+  if (!learning_file.open(path.c_str()) || !learning->open(&learning_file, mode)) {
+    log_e("Unable to open MIDI file %s", path.c_str());
+    learning_file.close();
+    return false;
+  }
+  log_i("Learning %s", path.c_str());
+  learning->start(micros());
+  return true;
+}
+
+void MidiFilePlayer::stop() {
+  if (learning != NULL) learning->close();
+  learning_file.close();
+  if (preview_player.isPlaying()) {
+    preview_player.stop(this->previewCallback);
+    preview_player.close();
+  }
+  preview_file.close();
+  if (!player.isPlaying()) return;
+  player.stop(this->midiInCallback);
+  player.close();
+  file.close();
+}
+
+bool MidiFilePlayer::isPlaying() {
+  return player.isPlaying();
+}
+
+uint16_t MidiFilePlayer::getTrackCount() {
+  return player.getTrackCount();
+}
+
+uint16_t MidiFilePlayer::getSkippedTrackCount() {
+  return player.getSkippedTrackCount();
+}
+
+String MidiFilePlayer::listFiles() {
+  String list = "[";
+  if (fs_mounted) {
+    File root = LittleFS.open("/");
+    File entry = root.openNextFile();
+    while (entry) {
+      String name = entry.name();
+      if (!entry.isDirectory() && (name.endsWith(".mid") || name.endsWith(".midi"))) {
+        if (list.length() > 1) list += ",";
+        list += "\"" + name + "\"";
+      }
+      entry = root.openNextFile();
+    }
+  }
+  return list + "]";
+}
@@ -0,0 +1,119 @@
+#include "MidiJitterBuffer.h"
+
+// Latency given to the buffer for each us of jitter
+#define JITTER_FACTOR 3
+
+MidiJitterBuffer::MidiJitterBuffer(uint32_t max_latency_us) {
+  this->max_latency_us = max_latency_us;
+}
+
+MidiJitterBuffer::~MidiJitterBuffer() {
+
+}
+
+void MidiJitterBuffer::setMaxLatency(uint32_t max_latency_us) {
+  this->max_latency_us = max_latency_us;
+}
+
+void MidiJitterBuffer::reset() {
+  head = 0;
+  count = 0;
+  has_transit = false;
+  jitter_us = 0;
+}
+
+/**
+ * The transit time is measured on the packet timestamp, not on the events: the deltas of the events
+ * in a packet are the spacing to keep, not a transit time.
+ */
+void MidiJitterBuffer::receive(uint32_t packet_sender_time_us, uint32_t packet_arrival_us) {
+  sender_time_us = packet_sender_time_us;
+  arrival_us = packet_arrival_us;
+  // Clocks are not synchronized, the transit time includes their offset
+  const int32_t transit = (int32_t)(arrival_us - sender_time_us);
+  if (!has_transit) {
+    min_transit_us = transit;
+    last_transit_us = transit;
+    has_transit = true;
+  }
+  if (transit < min_transit_us) {
+    min_transit_us = transit;
+  } else if (transit > min_transit_us) {
+    // Raised by 1 us per packet to follow a sender clock slower than ours
+    min_transit_us++;
+  }
+  // Interarrival jitter estimate from RFC 3550
+  const int32_t variation = transit - last_transit_us;
+  const uint32_t abs_variation = variation < 0 ? -variation : variation;
+  jitter_us += ((int32_t)abs_variation - (int32_t)jitter_us) / 16;
+  last_transit_us = transit;
+}
+
+bool MidiJitterBuffer::push(midi_usb_packet packet, uint32_t delta_us) {
+  if (count == JITTER_BUFFER_CAPACITY) {
+    dropped_events++;
+    return false;
+  }
+
+  uint32_t play_us = sender_time_us + delta_us + min_transit_us + this->getLatency();
+  if ((int32_t)(play_us - arrival_us) < 0) {
+    late_events++;
+    play_us = arrival_us;
+  }
+
+  // Insertion from the back, events mostly arrive in order
+  size_t position = count;
+  while (position > 0) {
+    const timed_midi_packet* previous = &events[(head + position - 1) % JITTER_BUFFER_CAPACITY];
+    if ((int32_t)(previous->time_us - play_us) <= 0) break;
+    events[(head + position) % JITTER_BUFFER_CAPACITY] = *previous;
+    position--;
+  }
+  timed_midi_packet* event = &events[(head + position) % JITTER_BUFFER_CAPACITY];
+  event->time_us = play_us;
+  event->packet = packet;
+  count++;
+  return true;
+}
+
+size_t MidiJitterBuffer::pop(uint32_t now_us, midi_in_callback_t* callback) {
+  size_t sent = 0;
+  while (count > 0 && (int32_t)(events[head].time_us - now_us) <= 0) {
+    if (callback != NULL) (*callback)(events[head].packet);
+    head = (head + 1) % JITTER_BUFFER_CAPACITY;
+    count--;
+    sent++;
+  }
+  return sent;
+}
+
+size_t MidiJitterBuffer::flush(midi_in_callback_t* callback) {
+  const size_t sent = count;
+  while (count > 0) {
+    if (callback != NULL) (*callback)(events[head].packet);
+    head = (head + 1) % JITTER_BUFFER_CAPACITY;
+    count--;
+  }
+  return sent;
+}
+
+size_t MidiJitterBuffer::getCount() {
+  return count;
+}
+
+uint32_t MidiJitterBuffer::getLatency() {
+  const uint32_t latency = JITTER_FACTOR * jitter_us;
+  return latency < max_latency_us ? latency : max_latency_us;
+}
+
+uint32_t MidiJitterBuffer::getJitter() {
+  return jitter_us;
+}
+
+uint32_t MidiJitterBuffer::getLateEvents() {
+  return late_events;
+}
+
+uint32_t MidiJitterBuffer::getDroppedEvents() {
+  return dropped_events;
+}
@@ -0,0 +1,127 @@
+#include "MidiOutQueue.h"
+
+#define SLOT_MASK (MIDI_OUT_QUEUE_CAPACITY - 1)
+// The average moves by 1/16 of the difference with each packet
+#define LATENCY_AVERAGE_SHIFT 4
+
+static_assert((MIDI_OUT_QUEUE_CAPACITY & SLOT_MASK) == 0, "MIDI_OUT_QUEUE_CAPACITY must be a power of 2");
+
+/// Class members definition ///
+
+MidiOutQueue::MidiOutQueue() {
+  // A slot is free for the push of its position, and ready for the pop of position + 1
+  for (uint32_t i = 0; i < MIDI_OUT_QUEUE_CAPACITY; i++) slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+void MidiOutQueue::setReadyCallback(void (*callback)(void)) {
+  ready_callback = callback;
+}
+
+bool MidiOutQueue::push(midi_usb_packet packet, uint32_t now_us) {
+  if (!opened.load(std::memory_order_acquire)) return false;
+  uint32_t position = tail.load(std::memory_order_relaxed);
+  slot_t* slot;
+  while (true) {
+    slot = &slots[position & SLOT_MASK];
+    const int32_t difference = (int32_t)(slot->sequence.load(std::memory_order_acquire) - position);
+    if (difference == 0) {
+      if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+    } else if (difference < 0) {
+      // Not popped yet since the last turn of the ring
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      // Another producer took this slot
+      position = tail.load(std::memory_order_relaxed);
+    }
+  }
+  slot->packet = packet;
+  slot->queued_us = now_us;
+  slot->sequence.store(position + 1, std::memory_order_release);
+  queued.fetch_add(1, std::memory_order_relaxed);
+
+  const uint16_t depth = position + 1 - head.load(std::memory_order_relaxed);
+  uint16_t deepest = max_depth.load(std::memory_order_relaxed);
+  while (depth > deepest && !max_depth.compare_exchange_weak(deepest, depth, std::memory_order_relaxed)) {}
+  if (ready_callback != NULL) ready_callback();
+  return true;
+}
+
+size_t MidiOutQueue::pop(midi_usb_packet* packets, size_t max_count, uint32_t now_us) {
+  uint32_t position = head.load(std::memory_order_relaxed);
+  uint32_t average = average_latency_us.load(std::memory_order_relaxed);
+  uint32_t longest = max_latency_us.load(std::memory_order_relaxed);
+  size_t count = 0;
+  while (count < max_count) {
+    slot_t* slot = &slots[position & SLOT_MASK];
+    // The slot is reserved but not written yet, the next pop takes it
+    if (slot->sequence.load(std::memory_order_acquire) != position + 1) break;
+    packets[count++] = slot->packet;
+    const uint32_t latency = now_us - slot->queued_us;
+    average = average + ((int32_t)(latency - average) >> LATENCY_AVERAGE_SHIFT);
+    if (latency > longest) longest = latency;
+    slot->sequence.store(position + MIDI_OUT_QUEUE_CAPACITY, std::memory_order_release);
+    position++;
+  }
+  if (count == 0) return 0;
+  head.store(position, std::memory_order_relaxed);
+  average_latency_us.store(average, std::memory_order_relaxed);
+  max_latency_us.store(longest, std::memory_order_relaxed);
+  sent.fetch_add(count, std::memory_order_relaxed);
+  transfers.fetch_add(1, std::memory_order_relaxed);
+  return count;
+}
+
+size_t MidiOutQueue::discard() {
+  uint32_t position = head.load(std::memory_order_relaxed);
+  size_t count = 0;
+  while (slots[position & SLOT_MASK].sequence.load(std::memory_order_acquire) == position + 1) {
+    slots[position & SLOT_MASK].sequence.store(position + MIDI_OUT_QUEUE_CAPACITY, std::memory_order_release);
+    position++;
+    count++;
+  }
+  head.store(position, std::memory_order_relaxed);
+  dropped.fetch_add(count, std::memory_order_relaxed);
+  return count;
+}
+
+void MidiOutQueue::open() {
+  this->discard();
+  generation.fetch_add(1, std::memory_order_relaxed);
+  opened.store(true, std::memory_order_release);
+}
+
+void MidiOutQueue::close() {
+  opened.store(false, std::memory_order_release);
+  this->discard();
+}
+
+bool MidiOutQueue::isOpen() {
+  return opened.load(std::memory_order_acquire);
+}
+
+uint32_t MidiOutQueue::getGeneration() {
+  return generation.load(std::memory_order_relaxed);
+}
+
+void MidiOutQueue::countFailedTransfer() {
+  failed_transfers.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t MidiOutQueue::getDepth() {
+  return (uint32_t)(tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed));
+}
+
+midi_out_stats_t MidiOutQueue::getStats() {
+  midi_out_stats_t stats;
+  stats.queued = queued.load(std::memory_order_relaxed);
+  stats.dropped = dropped.load(std::memory_order_relaxed);
+  stats.sent = sent.load(std::memory_order_relaxed);
+  stats.transfers = transfers.load(std::memory_order_relaxed);
+  stats.failed_transfers = failed_transfers.load(std::memory_order_relaxed);
+  stats.depth = this->getDepth();
+  stats.max_depth = max_depth.load(std::memory_order_relaxed);
+  stats.average_latency_us = average_latency_us.load(std::memory_order_relaxed);
+  stats.max_latency_us = max_latency_us.load(std::memory_order_relaxed);
+  return stats;
+}
@@ -0,0 +1,114 @@
+#include "MidiRecorder.h"
+
+#include <LittleFS.h>
+#include "MidiFilePlayer.h"
+
+MidiRecorder::MidiRecorder(MemoryArena* memory) : recorder(memory) {
+
+}
+
+MidiRecorder::~MidiRecorder() {
+  this->stop();
+}
+
+void MidiRecorder::setup() {
+  fs_mounted = LittleFS.begin(false, MIDI_FILES_MOUNT_POINT);
+  if (!fs_mounted) {
+    log_e("Unable to mount LittleFS, recording won't be available");
+    return;
+  }
+  file_lock = xSemaphoreCreateMutex();
+  // Core 1 runs loop(), the flash is written on core 0 below the USB host
+  const BaseType_t task_created = xTaskCreatePinnedToCore(
+    writerTask,
+    "recorder",
+    RECORDER_TASK_STACK_SIZE,
+    this,
+    RECORDER_TASK_PRIORITY,
+    &writer_task,
+    0
+  );
+  if (task_created != pdTRUE) {
+    log_e("Unable to create the recorder task, the flash will be written from loop()");
+    writer_task = NULL;
+  }
+}
+
+void MidiRecorder::loop() {
+  if (writer_task != NULL || !recorder.isRecording()) return;
+  xSemaphoreTake(file_lock, portMAX_DELAY);
+  recorder.flush();
+  xSemaphoreGive(file_lock);
+}
+
+void MidiRecorder::record(midi_usb_packet packet) {
+  recorder.record(packet, micros());
+  if (writer_task != NULL && recorder.hasFullBuffer()) xTaskNotifyGive(writer_task);
+}
+
+bool MidiRecorder::start() {
+  if (!fs_mounted) return false;
+  this->stop();
+  xSemaphoreTake(file_lock, portMAX_DELAY);
+  log_file = fopen(MIDI_FILES_MOUNT_POINT RECORDING_LOG_FILE, "wb");
+  const bool started = recorder.start(log_file, micros());
+  if (!started && log_file != NULL) fclose(log_file);
+  if (!started) log_file = NULL;
+  xSemaphoreGive(file_lock);
+  if (!started) {
+    log_e("Unable to create %s", RECORDING_LOG_FILE);
+    return false;
+  }
+  log_i("Recording started");
+  return true;
+}
+
+void MidiRecorder::stop() {
+  if (!recorder.isRecording()) return;
+  xSemaphoreTake(file_lock, portMAX_DELAY);
+  recorder.stop();
+  fclose(log_file);
+  log_file = NULL;
+  xSemaphoreGive(file_lock);
+  log_i("Recording stopped, %d events, %d dropped", recorder.getRecordedEvents(), recorder.getDroppedEvents());
+}
+
+bool MidiRecorder::isRecording() {
+  return recorder.isRecording();
+}
+
+bool MidiRecorder::exportSmf() {
+  if (!fs_mounted || recorder.isRecording()) return false;
+  FILE* log = fopen(MIDI_FILES_MOUNT_POINT RECORDING_LOG_FILE, "rb");
+  if (log == NULL) return false;
+  FILE* smf = fopen(MIDI_FILES_MOUNT_POINT RECORDING_SMF_FILE, "wb");
+  if (smf == NULL) {
+    fclose(log);
+    return false;
+  }
+  const int exported = exportEventLogToSmf(log, smf);
+  fclose(log);
+  fclose(smf);
+  log_i("%d events exported to %s", exported, RECORDING_SMF_FILE);
+  return exported >= 0;
+}
+
+/**
+ * Writes the buffers handed over by record(), each notification may stand for several full buffers.
+ */
+void MidiRecorder::writerTask(void* parameter) {
+  MidiRecorder* self = (MidiRecorder*)parameter;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    xSemaphoreTake(self->file_lock, portMAX_DELAY);
+    self->recorder.flush();
+    xSemaphoreGive(self->file_lock);
+  }
+}
+
+String MidiRecorder::getStatus() {
+  char status[96];
+  snprintf(status, sizeof(status), R"({ "recording": %s, "events": %u, "dropped": %u })",
+    recorder.isRecording() ? "true" : "false", recorder.getRecordedEvents(), recorder.getDroppedEvents());
+  return String(status);
+}
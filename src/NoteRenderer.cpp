@@ -0,0 +1,324 @@
+#include "NoteRenderer.h"
+
+#include <cstring>
+
+// Ripples cross a 175 LEDs strip in about a second
+#define RIPPLE_SPEED 60 // Pixels per second at the lowest velocity, up to 3 times faster
+#define RIPPLE_LIFE_US 700000
+#define SPARK_COUNT 4
+#define SPARK_MAX_SPEED 120
+#define SPARK_LIFE_US 300000
+// Brightness of the learning guide, keys to play now and the ones coming after
+#define GUIDE_CURRENT_SCALE 127
+#define GUIDE_UPCOMING_SCALE 31
+
+/// Functions declaration ///
+
+static uint32_t scaleColor(uint32_t color, uint8_t scale);
+static void setPixel(uint8_t* buffer, uint16_t index, uint32_t color);
+
+/// Class members definition ///
+
+NoteRenderer::NoteRenderer(uint16_t led_count, SettingsStore* settings_store, MemoryArena* arena) : compositor(led_count, arena) {
+  led_number = led_count;
+  memory = arena;
+  frame = MemoryArena::allocateBuffer(memory, 3 * led_count);
+  owns_settings = settings_store == NULL;
+  settings = owns_settings ? new SettingsStore() : settings_store;
+  compositor.setEnabled(LAYER_BACKGROUND, false);
+  compositor.setEnabled(LAYER_SCRIPT, false);
+  compositor.setEnabled(LAYER_GUIDE, false);
+  clearNoteSet(&guide_current);
+  clearNoteSet(&guide_upcoming);
+  this->clear();
+}
+
+NoteRenderer::~NoteRenderer() {
+  MemoryArena::releaseBuffer(memory, frame);
+  if (owns_settings) delete settings;
+}
+
+SettingsStore* NoteRenderer::getSettings() {
+  return settings;
+}
+
+void NoteRenderer::handleEvent(midi_event_t event, uint32_t now_us, note_source_t source) {
+  switch (event.type) {
+    case MIDI_EVENT_NOTE_ON:
+      this->noteOn(event.note, event.velocity, now_us, source);
+      break;
+    case MIDI_EVENT_NOTE_OFF:
+      this->noteOff(event.note);
+      break;
+    case MIDI_EVENT_SUSTAIN_ON:
+      this->sustainOn();
+      break;
+    case MIDI_EVENT_SUSTAIN_OFF:
+      this->sustainOff();
+      break;
+    default:
+      break;
+  }
+}
+
+void NoteRenderer::noteOn(uint8_t note, uint8_t velocity, uint32_t now_us, note_source_t source) {
+  if (note >= NOTE_COUNT) return;
+  if (velocity == 0) return this->noteOff(note);
+  const led_settings_t* current = settings->acquire();
+  const bool pressed = state.press(note, velocity, now_us, source);
+  const bool harmony_changed = harmony.noteOn(note, !pressed);
+  if (harmony_changed) this->recolorHeldNotes(current);
+  note_color[note] = scaleColor(this->getNoteColor(note, current), current->velocity_scale[velocity & 0x7f]);
+  if (current->preset.effect != EFFECT_NONE) this->spawnParticles(note, velocity, note_color[note], current->preset.effect);
+  settings->release(current);
+  dirty = true;
+}
+
+void NoteRenderer::noteOff(uint8_t note) {
+  if (!state.release(note)) return;
+  note_color[note] = 0;
+  if (harmony.noteOff(note)) {
+    const led_settings_t* current = settings->acquire();
+    this->recolorHeldNotes(current);
+    settings->release(current);
+  }
+  dirty = true;
+}
+
+uint32_t NoteRenderer::getNoteColor(uint8_t note, const led_settings_t* current) {
+  switch (current->preset.palette) {
+    case PALETTE_CHORD_QUALITY:
+      return current->chord_colors[harmony.getChord().quality];
+    case PALETTE_CHORD_ROOT: {
+      const chord_t chord = harmony.getChord();
+      return chord.quality == CHORD_QUALITY_NONE ? current->preset.color : current->pitch_class_colors[chord.root];
+    }
+    case PALETTE_KEY: {
+      const musical_key_t key = harmony.getKey();
+      if (!key.valid) return current->preset.color;
+      if (!(getScaleTemplate(key) & (1 << (note % 12)))) return current->preset.secondary_color;
+      // Relative keys share their notes, and their color
+      return current->pitch_class_colors[key.minor ? (key.tonic + 3) % 12 : key.tonic];
+    }
+    default:
+      return current->note_colors[note];
+  }
+}
+
+void NoteRenderer::recolorHeldNotes(const led_settings_t* current) {
+  const palette_mode_t palette = current->preset.palette;
+  if (palette != PALETTE_CHORD_QUALITY && palette != PALETTE_CHORD_ROOT && palette != PALETTE_KEY) return;
+  for (int note = state.nextPressed(0); note >= 0; note = state.nextPressed(note + 1)) {
+    note_color[note] = scaleColor(this->getNoteColor(note, current), current->velocity_scale[state.getVelocity(note) & 0x7f]);
+  }
+}
+
+void NoteRenderer::sustainOn() {
+  state.pedalDown();
+  dirty = true;
+}
+
+void NoteRenderer::sustainOff() {
+  state.pedalUp();
+  dirty = true;
+}
+
+void NoteRenderer::clear() {
+  memset(note_color, 0, sizeof(note_color));
+  state.clear();
+  harmony.clear();
+  particles.clear();
+  dirty = true;
+}
+
+void NoteRenderer::spawnParticles(uint8_t note, uint8_t velocity, uint32_t color, effect_mode_t effect) {
+  const int index = this->computePixelIndex(note);
+  if (index < 0 || index >= led_number) return;
+  const int32_t position = index << 16;
+  if (effect == EFFECT_RIPPLE) {
+    const int32_t speed = (RIPPLE_SPEED + RIPPLE_SPEED * 2 * velocity / 127) << 16;
+    particles.spawn(position, -speed, color, RIPPLE_LIFE_US);
+    particles.spawn(position, speed, color, RIPPLE_LIFE_US);
+  } else if (effect == EFFECT_SPARKS) {
+    for (int i = 0; i < SPARK_COUNT; i++) {
+      // Deterministic generator, replays give the same frames
+      random_state = random_state * 1103515245 + 12345;
+      const int32_t speed = (int32_t)((random_state >> 8) % (2 * SPARK_MAX_SPEED + 1)) - SPARK_MAX_SPEED;
+      particles.spawn(position, speed << 16, color, SPARK_LIFE_US / 2 + (random_state >> 20) % (SPARK_LIFE_US / 2));
+    }
+  }
+}
+
+bool NoteRenderer::animate(uint32_t now_us) {
+  if (particles.update(now_us)) dirty = true;
+  // Scripts depend on the time, they redraw every frame
+  if (effect.isLoaded() || pending_effect_length.load(std::memory_order_relaxed) >= 0) dirty = true;
+  frame_us = now_us;
+  return dirty;
+}
+
+bool NoteRenderer::render() {
+  // A snapshot can be recycled at the same address, the sequence tells a new publication
+  if (!dirty && settings->getSequence() == rendered_sequence) return false;
+  const led_settings_t* current = settings->acquire();
+  dirty = false;
+  rendered_sequence = current->sequence;
+
+  if (compositor.isEnabled(LAYER_GUIDE)) this->drawGuide(current);
+
+  uint8_t* notes = compositor.getLayer(LAYER_NOTES);
+  compositor.clearLayer(LAYER_NOTES);
+  for (int note = state.nextPressed(0); note >= 0; note = state.nextPressed(note + 1)) {
+    const int index = this->computePixelIndex(note);
+    if (index < 0 || index >= led_number) continue;
+    setPixel(notes, index, note_color[note]);
+  }
+
+  compositor.setEnabled(LAYER_PARTICLES, particles.getCount() > 0);
+  if (particles.getCount() > 0) {
+    compositor.clearLayer(LAYER_PARTICLES);
+    particles.draw(compositor.getLayer(LAYER_PARTICLES), led_number);
+  }
+
+  this->runEffect(frame_us);
+
+  // Sides are drawn over the notes, releasing the pedal uncovers them
+  const bool show_sides = current->preset.show_sustain && state.isPedalDown();
+  compositor.setEnabled(LAYER_OVERLAY, show_sides);
+  if (show_sides) {
+    uint8_t* overlay = compositor.getLayer(LAYER_OVERLAY);
+    compositor.clearLayer(LAYER_OVERLAY);
+    setPixel(overlay, 0, current->preset.color);
+    setPixel(overlay, led_number - 1, current->preset.color);
+  }
+  settings->release(current);
+
+  compositor.compose(frame);
+  return true;
+}
+
+const uint8_t* NoteRenderer::getFrame() {
+  return frame;
+}
+
+uint32_t NoteRenderer::getPixel(uint16_t index) {
+  const uint8_t* pixel = frame + 3 * index;
+  return ((uint32_t)pixel[0] << 16) | ((uint32_t)pixel[1] << 8) | pixel[2];
+}
+
+const uint32_t* NoteRenderer::getNoteColors() {
+  return note_color;
+}
+
+uint16_t NoteRenderer::getLedCount() {
+  return led_number;
+}
+
+NoteState* NoteRenderer::getNoteState() {
+  return &state;
+}
+
+HarmonyAnalyzer* NoteRenderer::getHarmony() {
+  return &harmony;
+}
+
+ParticleSystem* NoteRenderer::getParticles() {
+  return &particles;
+}
+
+Compositor* NoteRenderer::getCompositor() {
+  return &compositor;
+}
+
+void NoteRenderer::setBackground(uint32_t color) {
+  uint8_t* background = compositor.getLayer(LAYER_BACKGROUND);
+  for (uint16_t i = 0; i < led_number; i++) setPixel(background, i, color);
+  compositor.setEnabled(LAYER_BACKGROUND, color != 0);
+  dirty = true;
+}
+
+bool NoteRenderer::setEffect(const uint8_t* bytecode, size_t length) {
+  if (bytecode == NULL || length == 0) {
+    pending_effect_length.store(0, std::memory_order_release);
+    return true;
+  }
+  if (validateEffectBytecode(bytecode, length) == 0) return false;
+  memcpy(pending_effect, bytecode, length);
+  pending_effect_length.store(length, std::memory_order_release);
+  return true;
+}
+
+EffectVm* NoteRenderer::getEffect() {
+  return &effect;
+}
+
+void NoteRenderer::setGuide(const note_set_t* current, const note_set_t* upcoming) {
+  if (current != NULL) guide_current = *current;
+  else clearNoteSet(&guide_current);
+  if (upcoming != NULL) guide_upcoming = *upcoming;
+  else clearNoteSet(&guide_upcoming);
+  compositor.setEnabled(LAYER_GUIDE, countNotes(&guide_current) + countNotes(&guide_upcoming) > 0);
+  dirty = true;
+}
+
+/**
+ * Walks the two note sets, the song itself is read ahead by the LearningSession.
+ */
+void NoteRenderer::drawGuide(const led_settings_t* current) {
+  uint8_t* guide = compositor.getLayer(LAYER_GUIDE);
+  compositor.clearLayer(LAYER_GUIDE);
+  for (int note = nextNote(&guide_upcoming, 0); note >= 0; note = nextNote(&guide_upcoming, note + 1)) {
+    const int index = this->computePixelIndex(note);
+    if (index >= 0 && index < led_number) setPixel(guide, index, scaleColor(current->note_colors[note], GUIDE_UPCOMING_SCALE));
+  }
+  for (int note = nextNote(&guide_current, 0); note >= 0; note = nextNote(&guide_current, note + 1)) {
+    const int index = this->computePixelIndex(note);
+    if (index >= 0 && index < led_number) setPixel(guide, index, scaleColor(current->note_colors[note], GUIDE_CURRENT_SCALE));
+  }
+}
+
+/**
+ * Load the script uploaded since the last frame, then run the current one on the script layer.
+ * The notes layer must be drawn, per pixel scripts read it.
+ */
+void NoteRenderer::runEffect(uint32_t now_us) {
+  const int pending_length = pending_effect_length.exchange(-1, std::memory_order_acquire);
+  if (pending_length == 0) effect.unload();
+  else if (pending_length > 0) effect.load(pending_effect, pending_length);
+
+  compositor.setEnabled(LAYER_SCRIPT, effect.isLoaded());
+  if (!effect.isLoaded()) return;
+  compositor.clearLayer(LAYER_SCRIPT);
+  const effect_frame_t effect_frame = {
+    compositor.getLayer(LAYER_SCRIPT),
+    compositor.getLayer(LAYER_NOTES),
+    led_number,
+    now_us,
+    &state,
+    note_color,
+  };
+  effect.runFrame(&effect_frame);
+}
+
+int NoteRenderer::computePixelIndex(uint8_t note) {
+  return (note - 21) * 2;
+}
+
+/// Functions definition ///
+
+/**
+ * Scale each channel of a color, 255 keeps it unchanged.
+ */
+static uint32_t scaleColor(uint32_t color, uint8_t scale) {
+  const uint16_t factor = scale + 1;
+  return ((((color >> 16) & 0xff) * factor >> 8) << 16)
+    | ((((color >> 8) & 0xff) * factor >> 8) << 8)
+    | ((color & 0xff) * factor >> 8);
+}
+
+static void setPixel(uint8_t* buffer, uint16_t index, uint32_t color) {
+  uint8_t* pixel = buffer + 3 * index;
+  pixel[0] = color >> 16;
+  pixel[1] = color >> 8;
+  pixel[2] = color;
+}
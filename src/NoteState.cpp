@@ -0,0 +1,91 @@
+#include "NoteState.h"
+
+#include <cstring>
+
+NoteState::NoteState() {
+  this->clear();
+}
+
+bool NoteState::press(uint8_t note, uint8_t note_velocity, uint32_t now_us, note_source_t note_source) {
+  if (note >= NOTE_COUNT) return false;
+  velocity[note] = note_velocity;
+  onset_us[note] = now_us;
+  source[note] = note_source;
+  // A sustained note struck again is pressed, not both
+  removeNote(&sustained, note);
+  if (hasNote(&pressed, note)) return false;
+  addNote(&pressed, note);
+  pressed_count++;
+  return true;
+}
+
+bool NoteState::release(uint8_t note) {
+  if (!hasNote(&pressed, note)) return false;
+  removeNote(&pressed, note);
+  pressed_count--;
+  if (pedal_down) addNote(&sustained, note);
+  return true;
+}
+
+void NoteState::pedalDown() {
+  pedal_down = true;
+}
+
+void NoteState::pedalUp() {
+  pedal_down = false;
+  clearNoteSet(&sustained);
+}
+
+void NoteState::clear() {
+  clearNoteSet(&pressed);
+  clearNoteSet(&sustained);
+  pressed_count = 0;
+  pedal_down = false;
+  memset(velocity, 0, sizeof(velocity));
+  memset(onset_us, 0, sizeof(onset_us));
+  memset(source, 0, sizeof(source));
+}
+
+bool NoteState::isPressed(uint8_t note) {
+  return hasNote(&pressed, note);
+}
+
+bool NoteState::isSustained(uint8_t note) {
+  return hasNote(&sustained, note);
+}
+
+bool NoteState::isPedalDown() {
+  return pedal_down;
+}
+
+int NoteState::nextPressed(int note) {
+  return nextNote(&pressed, note);
+}
+
+int NoteState::nextSustained(int note) {
+  return nextNote(&sustained, note);
+}
+
+uint8_t NoteState::getPressedCount() {
+  return pressed_count;
+}
+
+const note_set_t* NoteState::getPressed() {
+  return &pressed;
+}
+
+const note_set_t* NoteState::getSustained() {
+  return &sustained;
+}
+
+uint8_t NoteState::getVelocity(uint8_t note) {
+  return note < NOTE_COUNT ? velocity[note] : 0;
+}
+
+uint32_t NoteState::getOnset(uint8_t note) {
+  return note < NOTE_COUNT ? onset_us[note] : 0;
+}
+
+note_source_t NoteState::getSource(uint8_t note) {
+  return note < NOTE_COUNT ? source[note] : NOTE_SOURCE_USB;
+}
@@ -0,0 +1,117 @@
+#include "ParticleSystem.h"
+
+/// Functions declaration ///
+
+static void addToPixel(uint8_t* pixel, uint32_t color, uint16_t scale);
+
+/// Class members definition ///
+
+ParticleSystem::ParticleSystem() {
+  this->clear();
+}
+
+bool ParticleSystem::spawn(int32_t start_position, int32_t start_velocity, uint32_t particle_color, uint32_t particle_life_us) {
+  if (frame_spawns >= PARTICLE_MAX_SPAWNS_PER_FRAME || particle_life_us == 0) {
+    dropped_count++;
+    return false;
+  }
+  frame_spawns++;
+
+  uint8_t index = count;
+  if (count < PARTICLE_CAPACITY) {
+    count++;
+  } else {
+    // Replace the particle closest to its end, it is also the dimmest one
+    uint32_t least_remaining = UINT32_MAX;
+    for (uint8_t i = 0; i < count; i++) {
+      const uint32_t remaining = life_us[i] - age_us[i];
+      if (remaining < least_remaining) {
+        least_remaining = remaining;
+        index = i;
+      }
+    }
+    reused_count++;
+  }
+  position[index] = start_position;
+  velocity[index] = start_velocity;
+  color[index] = particle_color;
+  age_us[index] = 0;
+  life_us[index] = particle_life_us;
+  return true;
+}
+
+bool ParticleSystem::update(uint32_t now_us) {
+  const uint32_t elapsed_us = updated ? now_us - last_update_us : 0;
+  last_update_us = now_us;
+  updated = true;
+  frame_spawns = 0;
+  if (count == 0) return false;
+
+  for (uint8_t i = 0; i < count;) {
+    age_us[i] += elapsed_us;
+    if (age_us[i] >= life_us[i]) {
+      this->remove(i);
+      continue;
+    }
+    position[i] += (int64_t)velocity[i] * elapsed_us / 1000000;
+    i++;
+  }
+  // Also true when the last particles just died, they have to be erased
+  return true;
+}
+
+void ParticleSystem::draw(uint8_t* frame, uint16_t led_count) {
+  for (uint8_t i = 0; i < count; i++) {
+    // Linear fade, 256 at birth
+    const uint16_t fade = 256 - (uint64_t)age_us[i] * 256 / life_us[i];
+    const int32_t pixel = position[i] >> 16;
+    // Spread over two pixels by the fractional position, so that slow particles move smoothly
+    const uint16_t fraction = (position[i] >> 8) & 0xff;
+    if (pixel >= 0 && pixel < led_count) addToPixel(frame + 3 * pixel, color[i], fade * (256 - fraction) >> 8);
+    if (pixel + 1 >= 0 && pixel + 1 < led_count) addToPixel(frame + 3 * (pixel + 1), color[i], fade * fraction >> 8);
+  }
+}
+
+void ParticleSystem::clear() {
+  count = 0;
+  frame_spawns = 0;
+  updated = false;
+}
+
+uint8_t ParticleSystem::getCount() {
+  return count;
+}
+
+uint32_t ParticleSystem::getReusedCount() {
+  return reused_count;
+}
+
+uint32_t ParticleSystem::getDroppedCount() {
+  return dropped_count;
+}
+
+/**
+ * Move the last particle in the slot, the alive ones stay packed.
+ */
+void ParticleSystem::remove(uint8_t index) {
+  count--;
+  position[index] = position[count];
+  velocity[index] = velocity[count];
+  color[index] = color[count];
+  age_us[index] = age_us[count];
+  life_us[index] = life_us[count];
+}
+
+/// Functions definition ///
+
+/**
+ * @param scale 256 adds the whole color
+ */
+static void addToPixel(uint8_t* pixel, uint32_t color, uint16_t scale) {
+  const uint16_t red = pixel[0] + (((color >> 16) & 0xff) * scale >> 8);
+  const uint16_t green = pixel[1] + (((color >> 8) & 0xff) * scale >> 8);
+  const uint16_t blue = pixel[2] + ((color & 0xff) * scale >> 8);
+  pixel[0] = red > 255 ? 255 : red;
+  pixel[1] = green > 255 ? 255 : green;
+  pixel[2] = blue > 255 ? 255 : blue;
+}
@@ -0,0 +1,262 @@
+#include "PitchDetector.h"
+
+#include <cmath>
+#include <cstring>
+#include "midi_decoder.h"
+#include "palette.h"
+
+#if __has_include("dsps_fft2r.h")
+#include "dsps_fft2r.h"
+#define USE_ESP_DSP 1
+#endif
+
+// A note has to stand this many times above the average key, the attack of a note spreads over the whole spectrum
+#define NOISE_FLOOR_RATIO 3
+// A decayed note rising this many times above the last block is a new strike of the same key
+#define RETRIGGER_RATIO 4
+
+/// Variables ///
+
+// Hann window, Q15
+static int16_t window[AUDIO_FFT_SIZE];
+#ifndef USE_ESP_DSP
+// cos and sin of 2*pi*i/N, Q15
+static int16_t twiddle_cos[AUDIO_FFT_SIZE / 2];
+static int16_t twiddle_sin[AUDIO_FFT_SIZE / 2];
+#endif
+static bool tables_ready = false;
+
+// Intervals in semitones of the partials 2 to 8 of a note
+static const uint8_t partial_intervals[] = { 12, 19, 24, 28, 31, 34, 36 };
+
+/// Functions declaration ///
+
+static void initTables();
+static void fft(int16_t* data);
+static uint32_t getBinMagnitude(int16_t re, int16_t im);
+static bool isPartial(const uint32_t* detected, uint8_t note);
+static uint8_t getVelocity(uint32_t magnitude, uint32_t threshold);
+
+/// Class members definition ///
+
+PitchDetector::PitchDetector(uint32_t sample_rate) {
+  initTables();
+  memset(history, 0, sizeof(history));
+  memset(magnitude, 0, sizeof(magnitude));
+  memset(previous_magnitude, 0, sizeof(previous_magnitude));
+  memset(notes_on, 0, sizeof(notes_on));
+  for (uint16_t bin = 0; bin < AUDIO_FFT_SIZE / 2; bin++) {
+    const double frequency = (double)bin * sample_rate / AUDIO_FFT_SIZE;
+    const long note = bin == 0 ? 0 : lround(69 + 12 * log2(frequency / 440));
+    bin_note[bin] = note >= PIANO_FIRST_NOTE && note <= PIANO_LAST_NOTE ? note : 0;
+  }
+}
+
+void PitchDetector::setMidiInCallback(midi_in_callback_t *callback) {
+  this->midiInCallback = callback;
+}
+
+void PitchDetector::setThreshold(uint32_t value) {
+  if (value > 0) threshold = value;
+}
+
+uint32_t PitchDetector::getThreshold() {
+  return threshold;
+}
+
+size_t PitchDetector::process(const int16_t* samples) {
+  memmove(history, history + AUDIO_BLOCK_SIZE, (AUDIO_FFT_SIZE - AUDIO_BLOCK_SIZE) * sizeof(int16_t));
+  memcpy(history + AUDIO_FFT_SIZE - AUDIO_BLOCK_SIZE, samples, AUDIO_BLOCK_SIZE * sizeof(int16_t));
+
+  // Microphones often have an offset, it would leak into the lowest bins
+  int32_t sum = 0;
+  for (uint16_t i = 0; i < AUDIO_FFT_SIZE; i++) sum += history[i];
+  const int32_t offset = sum / AUDIO_FFT_SIZE;
+  for (uint16_t i = 0; i < AUDIO_FFT_SIZE; i++) {
+    int32_t sample = history[i] - offset;
+    if (sample > INT16_MAX) sample = INT16_MAX;
+    if (sample < INT16_MIN) sample = INT16_MIN;
+    spectrum[2 * i] = sample * window[i] >> 15;
+    spectrum[2 * i + 1] = 0;
+  }
+  fft(spectrum);
+  return this->analyze();
+}
+
+void PitchDetector::stop() {
+  for (uint8_t word = 0; word < 4; word++) {
+    while (notes_on[word]) {
+      const uint8_t note = (word << 5) + __builtin_ctz(notes_on[word]);
+      notes_on[word] &= notes_on[word] - 1;
+      this->sendNote(note, 0);
+    }
+  }
+  memset(previous_magnitude, 0, sizeof(previous_magnitude));
+}
+
+bool PitchDetector::isNoteOn(uint8_t note) {
+  return note < 128 && (notes_on[note >> 5] & (1UL << (note & 31)));
+}
+
+uint32_t PitchDetector::getMagnitude(uint8_t note) {
+  return note < 128 ? magnitude[note] : 0;
+}
+
+/**
+ * @param velocity 0 for a note off
+ */
+size_t PitchDetector::sendNote(uint8_t note, uint8_t velocity) {
+  if (this->midiInCallback == NULL) return 0;
+  const uint8_t status = velocity > 0 ? MIDI_NOTE_ON << 4 : MIDI_NOTE_OFF << 4;
+  (*this->midiInCallback)(makeMidiPacket(status, note, velocity));
+  return 1;
+}
+
+/**
+ * Pick the notes of the spectrum and send the changes since the last block.
+ * A note on keeps going down to a quarter of the threshold, so it doesn't flicker while it decays.
+ */
+size_t PitchDetector::analyze() {
+  memset(magnitude, 0, sizeof(magnitude));
+  for (uint16_t bin = 1; bin < AUDIO_FFT_SIZE / 2; bin++) {
+    const uint8_t note = bin_note[bin];
+    if (note == 0) continue;
+    const uint32_t value = getBinMagnitude(spectrum[2 * bin], spectrum[2 * bin + 1]);
+    if (value > magnitude[note]) magnitude[note] = value;
+  }
+  uint32_t sum = 0;
+  for (uint8_t note = PIANO_FIRST_NOTE; note <= PIANO_LAST_NOTE; note++) sum += magnitude[note];
+  const uint32_t floor = NOISE_FLOOR_RATIO * sum / (PIANO_LAST_NOTE - PIANO_FIRST_NOTE + 1);
+
+  uint32_t detected[4] = { 0, 0, 0, 0 };
+  uint8_t detected_count = 0;
+  for (uint8_t note = PIANO_FIRST_NOTE; note <= PIANO_LAST_NOTE && detected_count < AUDIO_MAX_NOTES; note++) {
+    const uint32_t value = magnitude[note];
+    if (value < floor) continue;
+    if (this->isNoteOn(note)) {
+      if (value < threshold / 4) continue;
+    } else if (value < threshold || previous_magnitude[note] < threshold / 2) {
+      // A new note has to last two blocks, while the window fills up the peak can land on a neighbour
+      continue;
+    }
+    // The window leaks a strong key into its neighbours, only keep the peak
+    if (value < magnitude[note - 1] || value < magnitude[note + 1]) continue;
+    if (isPartial(detected, note)) continue;
+    detected[note >> 5] |= 1UL << (note & 31);
+    detected_count++;
+  }
+
+  size_t sent = 0;
+  for (uint8_t word = 0; word < 4; word++) {
+    uint32_t released = notes_on[word] & ~detected[word];
+    while (released) {
+      sent += this->sendNote((word << 5) + __builtin_ctz(released), 0);
+      released &= released - 1;
+    }
+    uint32_t held = detected[word];
+    while (held) {
+      const uint8_t note = (word << 5) + __builtin_ctz(held);
+      held &= held - 1;
+      const bool was_on = notes_on[word] & (1UL << (note & 31));
+      if (was_on) {
+        if (previous_magnitude[note] >= threshold / 2 || magnitude[note] < RETRIGGER_RATIO * previous_magnitude[note]) continue;
+        sent += this->sendNote(note, 0);
+      }
+      sent += this->sendNote(note, getVelocity(magnitude[note], threshold));
+    }
+    notes_on[word] = detected[word];
+  }
+  memcpy(previous_magnitude, magnitude, sizeof(magnitude));
+  return sent;
+}
+
+/// Functions definition ///
+
+static void initTables() {
+  if (tables_ready) return;
+  for (uint16_t i = 0; i < AUDIO_FFT_SIZE; i++) {
+    window[i] = lround(32767 * (0.5 - 0.5 * cos(2 * M_PI * i / AUDIO_FFT_SIZE)));
+  }
+#ifdef USE_ESP_DSP
+  dsps_fft2r_init_sc16(NULL, AUDIO_FFT_SIZE);
+#else
+  for (uint16_t i = 0; i < AUDIO_FFT_SIZE / 2; i++) {
+    twiddle_cos[i] = lround(32767 * cos(2 * M_PI * i / AUDIO_FFT_SIZE));
+    twiddle_sin[i] = lround(32767 * sin(2 * M_PI * i / AUDIO_FFT_SIZE));
+  }
+#endif
+  tables_ready = true;
+}
+
+/**
+ * In place FFT of AUDIO_FFT_SIZE interleaved complex values, output in natural order.
+ * Every stage halves the values so they can't overflow: the output is scaled by 1/N, like ESP-DSP.
+ */
+static void fft(int16_t* data) {
+#ifdef USE_ESP_DSP
+  dsps_fft2r_sc16(data, AUDIO_FFT_SIZE);
+  dsps_bit_rev_sc16_ansi(data, AUDIO_FFT_SIZE);
+#else
+  // Decimation in time: bit reversed input
+  for (uint16_t i = 1, j = 0; i < AUDIO_FFT_SIZE; i++) {
+    uint16_t bit = AUDIO_FFT_SIZE >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j |= bit;
+    if (i >= j) continue;
+    const int16_t re = data[2 * i], im = data[2 * i + 1];
+    data[2 * i] = data[2 * j];
+    data[2 * i + 1] = data[2 * j + 1];
+    data[2 * j] = re;
+    data[2 * j + 1] = im;
+  }
+  for (uint16_t half = 1; half < AUDIO_FFT_SIZE; half <<= 1) {
+    const uint16_t step = AUDIO_FFT_SIZE / (2 * half);
+    for (uint16_t start = 0; start < AUDIO_FFT_SIZE; start += 2 * half) {
+      for (uint16_t k = 0; k < half; k++) {
+        int16_t* a = data + 2 * (start + k);
+        int16_t* b = a + 2 * half;
+        const int32_t c = twiddle_cos[k * step];
+        const int32_t s = twiddle_sin[k * step];
+        // b * e^(-i*theta)
+        const int32_t re = (b[0] * c + b[1] * s) >> 15;
+        const int32_t im = (b[1] * c - b[0] * s) >> 15;
+        const int32_t a_re = a[0], a_im = a[1];
+        a[0] = (a_re + re) >> 1;
+        a[1] = (a_im + im) >> 1;
+        b[0] = (a_re - re) >> 1;
+        b[1] = (a_im - im) >> 1;
+      }
+    }
+  }
+#endif
+}
+
+/**
+ * Magnitude approximated as max + min / 2, within 12% of the exact value without a square root.
+ */
+static uint32_t getBinMagnitude(int16_t re, int16_t im) {
+  const uint32_t x = re < 0 ? -re : re;
+  const uint32_t y = im < 0 ? -im : im;
+  return x > y ? x + y / 2 : y + x / 2;
+}
+
+/**
+ * @param detected notes below the note already detected in this block
+ */
+static bool isPartial(const uint32_t* detected, uint8_t note) {
+  for (uint8_t interval : partial_intervals) {
+    if (interval > note) break;
+    const uint8_t fundamental = note - interval;
+    if (detected[fundamental >> 5] & (1UL << (fundamental & 31))) return true;
+  }
+  return false;
+}
+
+/**
+ * 12 steps of velocity per doubling of the magnitude above the threshold.
+ */
+static uint8_t getVelocity(uint32_t magnitude, uint32_t threshold) {
+  const int doublings = (31 - __builtin_clz(magnitude | 1)) - (31 - __builtin_clz(threshold | 1));
+  const int velocity = 40 + 12 * doublings;
+  return velocity < 1 ? 1 : velocity > 127 ? 127 : velocity;
+}
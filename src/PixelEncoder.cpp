@@ -0,0 +1,36 @@
+#include "PixelEncoder.h"
+
+/// Class members definition ///
+
+RuntimePixelEncoder::RuntimePixelEncoder(pixel_order_t pixel_order, pixel_mapping_t pixel_mapping) {
+  order = pixel_order;
+  mapping = pixel_mapping;
+  size = getPixelSize(order);
+  red_offset = getRedOffset(order);
+  green_offset = getGreenOffset(order);
+}
+
+void RuntimePixelEncoder::encode(const uint8_t* frame, uint16_t pixel_count, uint8_t* output, uint16_t scale) {
+  for (uint16_t i = 0; i < pixel_count; i++, frame += 3) {
+    const uint16_t position = mapping == PIXEL_MAPPING_REVERSED ? pixel_count - 1 - i : i;
+    uint8_t* pixel = output + position * size;
+    uint8_t red = frame[0] * scale >> 8;
+    uint8_t green = frame[1] * scale >> 8;
+    uint8_t blue = frame[2] * scale >> 8;
+    if (size == 4) {
+      uint8_t white = red < green ? red : green;
+      if (blue < white) white = blue;
+      red -= white;
+      green -= white;
+      blue -= white;
+      pixel[3] = white;
+    }
+    pixel[red_offset] = red;
+    pixel[green_offset] = green;
+    pixel[2] = blue;
+  }
+}
+
+pixel_order_t RuntimePixelEncoder::getOrder() {
+  return order;
+}
@@ -0,0 +1,193 @@
+#include "PixelNetworkOutput.h"
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define E131_PRIORITY 100
+#define ARTNET_OPCODE_DMX 0x5000
+#define ARTNET_PROTOCOL_VERSION 14
+
+/// Functions declaration ///
+
+static uint32_t hashBytes(const uint8_t* bytes, size_t length);
+static void writeBigEndian(uint8_t* bytes, uint32_t value, int length);
+
+/// Class members definition ///
+
+PixelNetworkOutput::PixelNetworkOutput(pixel_protocol_t protocol, uint16_t first_universe) {
+  this->protocol = protocol;
+  this->first_universe = first_universe;
+  memset(sequences, 0, sizeof(sequences));
+  memset(has_sent, 0, sizeof(has_sent));
+  this->setSourceName("Pianeon");
+}
+
+PixelNetworkOutput::~PixelNetworkOutput() {
+  this->end();
+}
+
+void PixelNetworkOutput::setSourceName(const char* name) {
+  memset(source_name, 0, sizeof(source_name));
+  strncpy(source_name, name, PIXEL_SOURCE_NAME_SIZE - 1);
+  // The component identifier only has to be stable for a given source
+  uint32_t hash = hashBytes((const uint8_t*)source_name, strlen(source_name));
+  for (int i = 0; i < 16; i += 4) {
+    hash = hash * 16777619UL + i;
+    writeBigEndian(cid + i, hash, 4);
+  }
+}
+
+bool PixelNetworkOutput::begin(uint32_t address, uint16_t port) {
+  this->end();
+  output_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (output_socket < 0) return false;
+  destination_address = address;
+  destination_port = port ? port : (protocol == PIXEL_PROTOCOL_E131 ? E131_PORT : ARTNET_PORT);
+  if (address == 0 && protocol == PIXEL_PROTOCOL_ARTNET) {
+    const int broadcast = 1;
+    setsockopt(output_socket, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+  }
+  memset(has_sent, 0, sizeof(has_sent));
+  return true;
+}
+
+void PixelNetworkOutput::end() {
+  if (output_socket >= 0) close(output_socket);
+  output_socket = -1;
+}
+
+size_t PixelNetworkOutput::send(const uint8_t* frame, uint16_t pixel_count, uint32_t now_us) {
+  if (output_socket < 0) return 0;
+  size_t sent = 0;
+  const uint16_t universe_count = this->getUniverseCount(pixel_count);
+  for (uint16_t index = 0; index < universe_count; index++) {
+    const uint16_t first_pixel = index * PIXEL_UNIVERSE_SIZE;
+    const uint16_t universe_pixels = pixel_count - first_pixel < PIXEL_UNIVERSE_SIZE ? pixel_count - first_pixel : PIXEL_UNIVERSE_SIZE;
+    const uint16_t channel_count = 3 * universe_pixels;
+    const uint8_t* data = frame + 3 * first_pixel;
+
+    const uint32_t hash = hashBytes(data, channel_count);
+    if (has_sent[index] && hash == hashes[index] && now_us - last_sent_us[index] < PIXEL_KEEP_ALIVE_US) {
+      skipped_packets++;
+      continue;
+    }
+
+    uint8_t header[PIXEL_MAX_HEADER_SIZE];
+    // Art-Net needs an even number of channels
+    static const uint8_t padding = 0;
+    const bool padded = protocol == PIXEL_PROTOCOL_ARTNET && (channel_count & 1);
+    struct iovec parts[3] = {
+      { header, this->buildHeader(index, channel_count + (padded ? 1 : 0), header) },
+      { (void*)data, channel_count },
+      { (void*)&padding, 1 },
+    };
+
+    struct sockaddr_in destination;
+    memset(&destination, 0, sizeof(destination));
+    destination.sin_family = AF_INET;
+    destination.sin_port = htons(destination_port);
+    if (destination_address != 0) {
+      destination.sin_addr.s_addr = htonl(destination_address);
+    } else if (protocol == PIXEL_PROTOCOL_E131) {
+      // One multicast group per universe: 239.255.<universe high>.<universe low>
+      const uint16_t universe = first_universe + index;
+      destination.sin_addr.s_addr = htonl(0xefff0000UL | universe);
+    } else {
+      destination.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    }
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_name = &destination;
+    message.msg_namelen = sizeof(destination);
+    message.msg_iov = parts;
+    message.msg_iovlen = padded ? 3 : 2;
+    if (sendmsg(output_socket, &message, 0) < 0) continue;
+
+    hashes[index] = hash;
+    last_sent_us[index] = now_us;
+    has_sent[index] = true;
+    sequences[index]++;
+    sent_packets++;
+    sent++;
+  }
+  return sent;
+}
+
+size_t PixelNetworkOutput::buildHeader(uint16_t universe_index, uint16_t channel_count, uint8_t* header) {
+  const uint16_t universe = first_universe + universe_index;
+  if (protocol == PIXEL_PROTOCOL_ARTNET) {
+    memcpy(header, "Art-Net", 8);
+    header[8] = ARTNET_OPCODE_DMX & 0xff; // Op code is little endian
+    header[9] = ARTNET_OPCODE_DMX >> 8;
+    writeBigEndian(header + 10, ARTNET_PROTOCOL_VERSION, 2);
+    // Sequence 0 disables reordering on the receiver, skip it
+    header[12] = (sequences[universe_index] % 255) + 1;
+    header[13] = 0; // Physical input port
+    header[14] = universe & 0xff; // Sub-net and universe
+    header[15] = (universe >> 8) & 0x7f; // Net
+    writeBigEndian(header + 16, channel_count, 2);
+    return ARTNET_HEADER_SIZE;
+  }
+
+  const uint16_t length = E131_HEADER_SIZE + channel_count;
+  memset(header, 0, E131_HEADER_SIZE);
+  // Root layer
+  writeBigEndian(header + 0, 0x0010, 2); // Preamble size
+  memcpy(header + 4, "ASC-E1.17\0\0\0", 12);
+  writeBigEndian(header + 16, 0x7000 | (length - 16), 2);
+  writeBigEndian(header + 18, 0x00000004, 4); // VECTOR_ROOT_E131_DATA
+  memcpy(header + 22, cid, 16);
+  // Framing layer
+  writeBigEndian(header + 38, 0x7000 | (length - 38), 2);
+  writeBigEndian(header + 40, 0x00000002, 4); // VECTOR_E131_DATA_PACKET
+  memcpy(header + 44, source_name, PIXEL_SOURCE_NAME_SIZE);
+  header[108] = E131_PRIORITY;
+  header[111] = sequences[universe_index];
+  writeBigEndian(header + 113, universe, 2);
+  // DMP layer
+  writeBigEndian(header + 115, 0x7000 | (length - 115), 2);
+  header[117] = 0x02; // VECTOR_DMP_SET_PROPERTY
+  header[118] = 0xa1; // Address and data type
+  writeBigEndian(header + 121, 0x0001, 2); // Address increment
+  writeBigEndian(header + 123, channel_count + 1, 2); // Property values, with the start code
+  header[125] = 0; // DMX start code
+  return E131_HEADER_SIZE;
+}
+
+uint16_t PixelNetworkOutput::getUniverseCount(uint16_t pixel_count) {
+  const uint16_t count = (pixel_count + PIXEL_UNIVERSE_SIZE - 1) / PIXEL_UNIVERSE_SIZE;
+  return count < PIXEL_MAX_UNIVERSES ? count : PIXEL_MAX_UNIVERSES;
+}
+
+uint32_t PixelNetworkOutput::getSentPackets() {
+  return sent_packets;
+}
+
+uint32_t PixelNetworkOutput::getSkippedPackets() {
+  return skipped_packets;
+}
+
+/// Functions definition ///
+
+/**
+ * FNV-1a, enough to detect a change in a universe.
+ */
+static uint32_t hashBytes(const uint8_t* bytes, size_t length) {
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 16777619UL;
+  }
+  return hash;
+}
+
+static void writeBigEndian(uint8_t* bytes, uint32_t value, int length) {
+  for (int i = length - 1; i >= 0; i--) {
+    bytes[i] = value & 0xff;
+    value >>= 8;
+  }
+}
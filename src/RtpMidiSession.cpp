@@ -0,0 +1,454 @@
+#include "RtpMidiSession.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "midi_decoder.h"
+
+#define APPLE_MIDI_SIGNATURE 0xffff
+#define APPLE_MIDI_VERSION 2
+#define RTP_HEADER_SIZE 12
+// RTP-MIDI timestamps are in 100 us units
+#define RTP_TICK_US 100
+#define FEEDBACK_PERIOD_US 1000000
+
+// Command section flags
+#define COMMAND_B 0x80
+#define COMMAND_J 0x40
+#define COMMAND_Z 0x20
+// Journal flags
+#define JOURNAL_Y 0x40
+#define JOURNAL_A 0x20
+// Channel journal chapters table of contents
+#define CHAPTER_P 0x80
+#define CHAPTER_C 0x40
+#define CHAPTER_M 0x20
+#define CHAPTER_W 0x10
+#define CHAPTER_N 0x08
+
+/// Functions declaration ///
+
+static uint32_t readBigEndian(const uint8_t* bytes, int length);
+static void writeBigEndian(uint8_t* bytes, uint32_t value, int length);
+static bool isCommand(const uint8_t* packet, const char* command);
+
+/// Class members definition ///
+
+RtpMidiSession::RtpMidiSession(const char* session_name, uint16_t session_port) : jitter_buffer(RTP_MIDI_DEFAULT_MAX_LATENCY_MS * 1000) {
+  strncpy(name, session_name, RTP_MIDI_NAME_SIZE - 1);
+  name[RTP_MIDI_NAME_SIZE - 1] = 0;
+  port = session_port;
+  // Only has to be unique among the peers of the session
+  ssrc = 0x50696e00 ^ ((uint32_t)(uintptr_t)this * 2654435761UL);
+  memset(notes_on, 0, sizeof(notes_on));
+  memset(sustain_on, 0, sizeof(sustain_on));
+}
+
+RtpMidiSession::~RtpMidiSession() {
+  this->end();
+}
+
+void RtpMidiSession::setMidiInCallback(midi_in_callback_t *callback) {
+  this->midiInCallback = callback;
+}
+
+void RtpMidiSession::setMaxLatency(uint32_t max_latency_ms) {
+  jitter_buffer.setMaxLatency(max_latency_ms * 1000);
+}
+
+bool RtpMidiSession::begin() {
+  this->end();
+  control_socket = this->openSocket(port);
+  data_socket = this->openSocket(port + 1);
+  if (control_socket < 0 || data_socket < 0) {
+    this->end();
+    return false;
+  }
+  return true;
+}
+
+void RtpMidiSession::end() {
+  this->disconnect();
+  if (control_socket >= 0) close(control_socket);
+  if (data_socket >= 0) close(data_socket);
+  control_socket = -1;
+  data_socket = -1;
+}
+
+void RtpMidiSession::loop(uint32_t now_us) {
+  clock_us += now_us - last_clock_us;
+  last_clock_us = now_us;
+  if (control_socket < 0) return;
+
+  this->receive(control_socket, false, now_us);
+  this->receive(data_socket, true, now_us);
+  jitter_buffer.pop(now_us, this->midiInCallback);
+
+  if (!connected) return;
+  if (now_us - last_packet_us > RTP_MIDI_TIMEOUT_US) {
+    this->disconnect();
+    return;
+  }
+  // Tell the sender what we received so it can trim its journal
+  if (feedback_pending && now_us - last_feedback_us > FEEDBACK_PERIOD_US) {
+    this->sendFeedback();
+    last_feedback_us = now_us;
+    feedback_pending = false;
+  }
+}
+
+bool RtpMidiSession::isConnected() {
+  return connected;
+}
+
+uint32_t RtpMidiSession::getLostPackets() {
+  return lost_packets;
+}
+
+uint32_t RtpMidiSession::getRecoveredEvents() {
+  return recovered_events;
+}
+
+MidiJitterBuffer* RtpMidiSession::getJitterBuffer() {
+  return &jitter_buffer;
+}
+
+int RtpMidiSession::openSocket(uint16_t socket_port) {
+  const int udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (udp_socket < 0) return -1;
+  const int reuse = 1;
+  setsockopt(udp_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(socket_port);
+  if (bind(udp_socket, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    close(udp_socket);
+    return -1;
+  }
+  fcntl(udp_socket, F_SETFL, fcntl(udp_socket, F_GETFL, 0) | O_NONBLOCK);
+  return udp_socket;
+}
+
+void RtpMidiSession::receive(int socket, bool is_data, uint32_t now_us) {
+  while (true) {
+    struct sockaddr_in from;
+    socklen_t from_length = sizeof(from);
+    const int length = recvfrom(socket, buffer, sizeof(buffer), 0, (struct sockaddr*)&from, &from_length);
+    if (length <= 0) return;
+    const uint32_t address = ntohl(from.sin_addr.s_addr);
+    const uint16_t from_port = ntohs(from.sin_port);
+
+    if (length >= 4 && readBigEndian(buffer, 2) == APPLE_MIDI_SIGNATURE) {
+      this->handleSessionPacket(socket, is_data, buffer, length, address, from_port, now_us);
+    } else if (is_data && connected && address == peer_address && length >= RTP_HEADER_SIZE && (buffer[0] & 0xc0) == 0x80) {
+      this->handleRtpPacket(buffer, length, now_us);
+    }
+  }
+}
+
+void RtpMidiSession::handleSessionPacket(int socket, bool is_data, const uint8_t* packet, size_t length, uint32_t address, uint16_t from_port, uint32_t now_us) {
+  if (isCommand(packet, "IN") && length >= 16) {
+    const uint32_t initiator_ssrc = readBigEndian(packet + 12, 4);
+    uint8_t reply[16 + RTP_MIDI_NAME_SIZE];
+    memcpy(reply, packet, 16);
+    writeBigEndian(reply + 4, APPLE_MIDI_VERSION, 4);
+    writeBigEndian(reply + 12, ssrc, 4);
+    size_t reply_length = 16;
+    if (connected && initiator_ssrc != peer_ssrc) {
+      // Only one peer at a time
+      reply[2] = 'N';
+      reply[3] = 'O';
+    } else {
+      reply[2] = 'O';
+      reply[3] = 'K';
+      const size_t name_length = strlen(name) + 1;
+      memcpy(reply + 16, name, name_length);
+      reply_length += name_length;
+      // The invitation on the data port opens the session
+      if (is_data) {
+        this->disconnect();
+        connected = true;
+        peer_ssrc = initiator_ssrc;
+        peer_address = address;
+        peer_data_port = from_port;
+        last_packet_us = now_us;
+      }
+    }
+    this->sendTo(socket, reply, reply_length, address, from_port);
+  } else if (isCommand(packet, "BY") && length >= 16) {
+    if (connected && readBigEndian(packet + 12, 4) == peer_ssrc) this->disconnect();
+  } else if (isCommand(packet, "CK") && length >= 36) {
+    // Clock synchronization started by the peer: answer its first message with our clock
+    if (packet[8] == 0) {
+      uint8_t reply[36];
+      memcpy(reply, packet, sizeof(reply));
+      writeBigEndian(reply + 4, ssrc, 4);
+      reply[8] = 1;
+      const uint64_t clock_100us = clock_us / RTP_TICK_US;
+      writeBigEndian(reply + 20, clock_100us >> 32, 4);
+      writeBigEndian(reply + 24, clock_100us & 0xffffffff, 4);
+      this->sendTo(socket, reply, sizeof(reply), address, from_port);
+    }
+    if (connected && address == peer_address) last_packet_us = now_us;
+  }
+}
+
+void RtpMidiSession::handleRtpPacket(const uint8_t* packet, size_t length, uint32_t now_us) {
+  if (readBigEndian(packet + 8, 4) != peer_ssrc) return;
+  const uint16_t sequence = readBigEndian(packet + 2, 2);
+  const uint32_t sender_time_us = readBigEndian(packet + 4, 4) * RTP_TICK_US;
+  last_packet_us = now_us;
+
+  bool packets_lost = false;
+  if (has_sequence) {
+    const int16_t gap = (int16_t)(sequence - (uint16_t)(last_sequence + 1));
+    // Late duplicate, its content has already been handled or recovered
+    if (gap < 0) return;
+    if (gap > 0) {
+      lost_packets += gap;
+      packets_lost = true;
+    }
+  }
+  has_sequence = true;
+  last_sequence = sequence;
+  feedback_pending = true;
+
+  // Skip the contributing sources and the header extension
+  size_t offset = RTP_HEADER_SIZE + 4 * (packet[0] & 0x0f);
+  if ((packet[0] & 0x10) && offset + 4 <= length) offset += 4 + 4 * readBigEndian(packet + offset + 2, 2);
+  if (offset >= length) return;
+
+  // MIDI command section header
+  const uint8_t flags = packet[offset];
+  size_t list_length = flags & 0x0f;
+  if (flags & COMMAND_B) {
+    if (offset + 1 >= length) return;
+    list_length = (list_length << 8) | packet[offset + 1];
+    offset += 2;
+  } else {
+    offset += 1;
+  }
+  if (offset + list_length > length) return;
+  const uint8_t* list = packet + offset;
+  jitter_buffer.receive(sender_time_us, now_us);
+
+  // The journal describes the history before this packet, apply it first
+  if (packets_lost && (flags & COMMAND_J)) {
+    this->handleJournal(list + list_length, length - offset - list_length);
+  }
+
+  size_t position = 0;
+  uint8_t running_status = 0;
+  uint32_t delta_ticks = 0;
+  bool first = true;
+  while (position < list_length) {
+    if (!first || (flags & COMMAND_Z)) {
+      // Each delta is a variable length quantity from the previous command
+      uint32_t delta = 0;
+      for (int i = 0; i < 4 && position < list_length; i++) {
+        const uint8_t byte = list[position++];
+        delta = (delta << 7) | (byte & 0x7f);
+        if (!(byte & 0x80)) break;
+      }
+      delta_ticks += delta;
+    }
+    first = false;
+    if (position >= list_length) break;
+
+    const uint8_t byte = list[position];
+    if (byte >= 0xf8) {
+      // Real time messages don't affect the running status
+      position++;
+      continue;
+    }
+    if (byte == 0xf0 || byte == 0xf7) {
+      // System exclusive, possibly segmented, ends with F7, F0 or F4
+      position++;
+      while (position < list_length && list[position] != 0xf7 && list[position] != 0xf0 && list[position] != 0xf4) position++;
+      position++;
+      running_status = 0;
+      continue;
+    }
+    if (byte >= 0xf0) {
+      position += 1 + (byte == 0xf2 ? 2 : (byte == 0xf1 || byte == 0xf3) ? 1 : 0);
+      running_status = 0;
+      continue;
+    }
+    if (byte & 0x80) {
+      running_status = byte;
+      position++;
+    } else if (running_status == 0) {
+      return;
+    }
+    const size_t data_count = (running_status & 0xe0) == 0xc0 ? 1 : 2;
+    if (position + data_count > list_length) return;
+    const uint8_t data_1 = list[position];
+    const uint8_t data_2 = data_count == 2 ? list[position + 1] : 0;
+    position += data_count;
+    // Delta times accumulate from the packet timestamp
+    this->emit(running_status, data_1, data_2, delta_ticks * RTP_TICK_US);
+  }
+}
+
+void RtpMidiSession::handleJournal(const uint8_t* journal, size_t length) {
+  if (length < 3) return;
+  const uint8_t flags = journal[0];
+  const uint8_t channel_count = (flags & 0x0f) + 1;
+  size_t offset = 3;
+  // System journal, nothing in it changes the lighting
+  if (flags & JOURNAL_Y) {
+    if (offset + 2 > length) return;
+    offset += ((journal[offset] & 0x03) << 8) | journal[offset + 1];
+  }
+  if (!(flags & JOURNAL_A)) return;
+  for (uint8_t i = 0; i < channel_count && offset < length; i++) {
+    const size_t channel_length = this->handleChannelJournal(journal + offset, length - offset);
+    if (channel_length == 0) return;
+    offset += channel_length;
+  }
+}
+
+/**
+ * Restore the notes and sustain state of a channel from its journal.
+ * @return length of the channel journal, 0 if it is malformed
+ */
+size_t RtpMidiSession::handleChannelJournal(const uint8_t* journal, size_t length) {
+  if (length < 3) return 0;
+  const uint8_t channel = (journal[0] >> 3) & 0x0f;
+  const size_t channel_length = ((journal[0] & 0x03) << 8) | journal[1];
+  const uint8_t chapters = journal[2];
+  if (channel_length < 3 || channel_length > length) return 0;
+  const uint8_t* end = journal + channel_length;
+  const uint8_t* chapter = journal + 3;
+
+  if (chapters & CHAPTER_P) chapter += 3;
+  if (chapters & CHAPTER_C) {
+    if (chapter >= end) return channel_length;
+    const size_t log_count = (chapter[0] & 0x7f) + 1;
+    const uint8_t* log = chapter + 1;
+    chapter += 1 + 2 * log_count;
+    for (size_t i = 0; i < log_count && log + 2 <= end; i++, log += 2) {
+      if ((log[0] & 0x7f) != MIDI_CC_SUSTAIN) continue;
+      // Value when A is clear, toggle count otherwise
+      const bool pressed = (log[1] & 0x80) ? (log[1] & 0x01) : (log[1] & 0x7f) >= 64;
+      if (pressed != sustain_on[channel]) {
+        this->emit((MIDI_CONTROL_CHANGE << 4) | channel, MIDI_CC_SUSTAIN, pressed ? 127 : 0);
+        recovered_events++;
+      }
+    }
+  }
+  if (chapters & CHAPTER_M) {
+    if (chapter + 2 > end) return channel_length;
+    chapter += ((chapter[0] & 0x03) << 8) | chapter[1];
+  }
+  if (chapters & CHAPTER_W) chapter += 2;
+  if (!(chapters & CHAPTER_N) || chapter + 2 > end) return channel_length;
+
+  size_t log_count = chapter[0] & 0x7f;
+  const uint8_t low = chapter[1] >> 4;
+  const uint8_t high = chapter[1] & 0x0f;
+  bool has_offbits = low <= high;
+  if (log_count == 127 && low == 15 && high == 0) {
+    log_count = 128;
+    has_offbits = false;
+  }
+  const uint8_t* log = chapter + 2;
+  for (size_t i = 0; i < log_count && log + 2 <= end; i++, log += 2) {
+    const uint8_t note = log[0] & 0x7f;
+    const uint8_t velocity = log[1] & 0x7f;
+    const bool is_on = notes_on[channel][note >> 5] & (1UL << (note & 31));
+    if (velocity > 0 && !is_on) {
+      this->emit((MIDI_NOTE_ON << 4) | channel, note, velocity);
+      recovered_events++;
+    }
+  }
+  if (!has_offbits) return channel_length;
+  // One bit per note, most significant bit first, for octets LOW to HIGH
+  for (uint8_t octet = low; octet <= high && log < end; octet++, log++) {
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      if (!(*log & (0x80 >> bit))) continue;
+      const uint8_t note = octet * 8 + bit;
+      if (notes_on[channel][note >> 5] & (1UL << (note & 31))) {
+        this->emit((MIDI_NOTE_OFF << 4) | channel, note, 0);
+        recovered_events++;
+      }
+    }
+  }
+  return channel_length;
+}
+
+void RtpMidiSession::sendFeedback() {
+  uint8_t packet[12] = { 0xff, 0xff, 'R', 'S' };
+  writeBigEndian(packet + 4, ssrc, 4);
+  writeBigEndian(packet + 8, (uint32_t)last_sequence << 16, 4);
+  this->sendTo(control_socket, packet, sizeof(packet), peer_address, peer_data_port - 1);
+}
+
+void RtpMidiSession::sendTo(int socket, const uint8_t* packet, size_t length, uint32_t address, uint16_t to_port) {
+  struct sockaddr_in destination;
+  memset(&destination, 0, sizeof(destination));
+  destination.sin_family = AF_INET;
+  destination.sin_addr.s_addr = htonl(address);
+  destination.sin_port = htons(to_port);
+  sendto(socket, packet, length, 0, (struct sockaddr*)&destination, sizeof(destination));
+}
+
+void RtpMidiSession::emit(uint8_t status, uint8_t data_1, uint8_t data_2, uint32_t delta_us) {
+  const midi_usb_packet packet = makeMidiPacket(status, data_1, data_2, RTP_MIDI_CABLE_NUMBER);
+  const midi_event_t event = decodeMidiPacket(packet);
+  const uint8_t channel = status & 0x0f;
+  const uint32_t mask = 1UL << (event.note & 31);
+  switch (event.type) {
+    case MIDI_EVENT_NOTE_ON: notes_on[channel][event.note >> 5] |= mask; break;
+    case MIDI_EVENT_NOTE_OFF: notes_on[channel][event.note >> 5] &= ~mask; break;
+    case MIDI_EVENT_SUSTAIN_ON: sustain_on[channel] = true; break;
+    case MIDI_EVENT_SUSTAIN_OFF: sustain_on[channel] = false; break;
+    default: break;
+  }
+  jitter_buffer.push(packet, delta_us);
+}
+
+void RtpMidiSession::disconnect() {
+  if (!connected) return;
+  connected = false;
+  has_sequence = false;
+  // Release what the peer left on, it won't send the note offs anymore
+  jitter_buffer.flush(this->midiInCallback);
+  jitter_buffer.reset();
+  for (uint8_t channel = 0; channel < 16; channel++) {
+    for (uint8_t note = 0; note < 128; note++) {
+      if (!(notes_on[channel][note >> 5] & (1UL << (note & 31)))) continue;
+      if (this->midiInCallback != NULL) (*this->midiInCallback)(makeMidiPacket((MIDI_NOTE_OFF << 4) | channel, note, 0, RTP_MIDI_CABLE_NUMBER));
+    }
+    if (sustain_on[channel] && this->midiInCallback != NULL) {
+      (*this->midiInCallback)(makeMidiPacket((MIDI_CONTROL_CHANGE << 4) | channel, MIDI_CC_SUSTAIN, 0, RTP_MIDI_CABLE_NUMBER));
+    }
+  }
+  memset(notes_on, 0, sizeof(notes_on));
+  memset(sustain_on, 0, sizeof(sustain_on));
+}
+
+/// Functions definition ///
+
+static uint32_t readBigEndian(const uint8_t* bytes, int length) {
+  uint32_t value = 0;
+  for (int i = 0; i < length; i++) value = (value << 8) | bytes[i];
+  return value;
+}
+
+static void writeBigEndian(uint8_t* bytes, uint32_t value, int length) {
+  for (int i = length - 1; i >= 0; i--) {
+    bytes[i] = value & 0xff;
+    value >>= 8;
+  }
+}
+
+static bool isCommand(const uint8_t* packet, const char* command) {
+  return packet[2] == command[0] && packet[3] == command[1];
+}
@@ -0,0 +1,199 @@
+#include "SettingsStore.h"
+
+#include <cmath>
+#include <cstring>
+#include "palette.h"
+
+// Softest notes keep this much of the color so that they stay visible
+#define VELOCITY_MIN_SCALE 24
+// Version 1 had no secondary color and no split key
+#define LED_PRESET_V1_SIZE 28
+// Far below any count of readers, a snapshot being written stays negative while readers come and go
+#define SNAPSHOT_WRITING (-0x10000)
+
+/// Functions declaration ///
+
+static void buildVelocityScale(velocity_curve_t curve, uint8_t* scale);
+static void buildPalette(const led_preset_t& preset, led_settings_t* settings);
+
+/// Class members definition ///
+
+SettingsStore::SettingsStore() {
+  memset(presets, 0, sizeof(presets));
+  for (int i = 0; i < SETTINGS_SNAPSHOT_COUNT; i++) readers[i].store(0);
+  current.store(NULL);
+  sequence.store(0);
+  this->publish(this->defaultPreset());
+}
+
+const led_settings_t* SettingsStore::acquire() {
+  while (true) {
+    const led_settings_t* snapshot = current.load();
+    std::atomic<int>* count = &readers[snapshot - snapshots];
+    count->fetch_add(1);
+    // Still current once counted, no writer can take it anymore
+    if (current.load() == snapshot) return snapshot;
+    count->fetch_sub(1);
+  }
+}
+
+void SettingsStore::release(const led_settings_t* snapshot) {
+  readers[snapshot - snapshots].fetch_sub(1);
+}
+
+uint32_t SettingsStore::getSequence() {
+  return sequence.load(std::memory_order_acquire);
+}
+
+led_preset_t SettingsStore::getPreset() {
+  const led_settings_t* snapshot = this->acquire();
+  const led_preset_t preset = snapshot->preset;
+  this->release(snapshot);
+  return preset;
+}
+
+void SettingsStore::publish(const led_preset_t& preset, int8_t selected) {
+  // Take a snapshot nobody reads, concurrent writers get different ones and the last store wins
+  int index = 0;
+  while (true) {
+    int expected = 0;
+    if (readers[index].compare_exchange_strong(expected, SNAPSHOT_WRITING)) {
+      // Once claimed, only this writer can make it current again. A reader may have acquired it
+      // while it still was, then it is counted: readers only return a snapshot still current after counting
+      if (&snapshots[index] != current.load() && readers[index].load() == SNAPSHOT_WRITING) break;
+      readers[index].fetch_sub(SNAPSHOT_WRITING);
+    }
+    index = (index + 1) % SETTINGS_SNAPSHOT_COUNT;
+  }
+  led_settings_t* snapshot = &snapshots[index];
+  snapshot->sequence = sequence.fetch_add(1) + 1;
+  snapshot->preset = preset;
+  buildVelocityScale(preset.velocity_curve, snapshot->velocity_scale);
+  buildPalette(preset, snapshot);
+  current.store(snapshot);
+  readers[index].fetch_sub(SNAPSHOT_WRITING);
+  if (selected >= 0) selected_preset = selected;
+}
+
+bool SettingsStore::selectPreset(uint8_t index) {
+  const led_preset_t* preset = this->getStoredPreset(index);
+  if (preset == NULL) return false;
+  this->publish(*preset, index);
+  return true;
+}
+
+bool SettingsStore::savePreset(uint8_t index, const char* name) {
+  if (index >= PRESET_COUNT) return false;
+  led_preset_t preset = this->getPreset();
+  memset(preset.name, 0, PRESET_NAME_SIZE);
+  strncpy(preset.name, name, PRESET_NAME_SIZE - 1);
+  presets[index] = preset;
+  selected_preset = index;
+  return true;
+}
+
+bool SettingsStore::setStoredPreset(uint8_t index, const led_preset_t& preset) {
+  if (index >= PRESET_COUNT) return false;
+  presets[index] = preset;
+  return true;
+}
+
+const led_preset_t* SettingsStore::getStoredPreset(uint8_t index) {
+  if (index >= PRESET_COUNT || presets[index].version == 0) return NULL;
+  return &presets[index];
+}
+
+int8_t SettingsStore::getSelectedPreset() {
+  return selected_preset;
+}
+
+led_preset_t SettingsStore::defaultPreset() {
+  led_preset_t preset;
+  memset(&preset, 0, sizeof(preset));
+  preset.version = LED_PRESET_VERSION;
+  preset.brightness = DEFAULT_BRIGHTNESS;
+  preset.show_sustain = false;
+  preset.palette = PALETTE_SINGLE_COLOR;
+  preset.velocity_curve = VELOCITY_CURVE_NONE;
+  preset.effect = EFFECT_NONE;
+  preset.mapping = KEY_MAPPING_TWO_LEDS_PER_KEY;
+  preset.split_key = DEFAULT_SPLIT_KEY;
+  preset.color = DEFAULT_LED_COLOR;
+  preset.secondary_color = DEFAULT_SECONDARY_COLOR;
+  return preset;
+}
+
+bool SettingsStore::decodePreset(const void* blob, size_t length, led_preset_t* preset) {
+  const uint8_t* bytes = (const uint8_t*)blob;
+  led_preset_t decoded;
+  if (length == LED_PRESET_V1_SIZE && bytes[0] == 1) {
+    decoded = defaultPreset();
+    memcpy(&decoded, bytes, offsetof(led_preset_t, split_key));
+    memcpy(&decoded.color, bytes + 8, sizeof(decoded.color));
+    memcpy(decoded.name, bytes + 12, PRESET_NAME_SIZE);
+    decoded.version = LED_PRESET_VERSION;
+  } else if (length == sizeof(led_preset_t)) {
+    memcpy(&decoded, blob, sizeof(decoded));
+  } else {
+    return false;
+  }
+  if (
+    decoded.version != LED_PRESET_VERSION
+    || decoded.show_sustain > 1
+    || decoded.palette >= PALETTE_COUNT
+    || decoded.velocity_curve >= VELOCITY_CURVE_COUNT
+    || decoded.effect >= EFFECT_COUNT
+    || decoded.mapping >= KEY_MAPPING_COUNT
+    || decoded.split_key > 127
+    || decoded.color > 0xffffff
+    || decoded.secondary_color > 0xffffff
+  ) {
+    return false;
+  }
+  decoded.name[PRESET_NAME_SIZE - 1] = 0;
+  *preset = decoded;
+  return true;
+}
+
+/// Functions definition ///
+
+/**
+ * Color scale applied to a note for each velocity, 255 keeps the color unchanged.
+ */
+static void buildVelocityScale(velocity_curve_t curve, uint8_t* scale) {
+  for (int velocity = 0; velocity < 128; velocity++) {
+    const float x = velocity / 127.0f;
+    float y;
+    switch (curve) {
+      case VELOCITY_CURVE_LINEAR: y = x; break;
+      case VELOCITY_CURVE_SOFT: y = sqrtf(x); break;
+      case VELOCITY_CURVE_HARD: y = x * x; break;
+      default: y = 1; break;
+    }
+    scale[velocity] = VELOCITY_MIN_SCALE + lroundf(y * (255 - VELOCITY_MIN_SCALE));
+  }
+}
+
+/**
+ * Per note color tables, so that a note on only has to load its color.
+ */
+static void buildPalette(const led_preset_t& preset, led_settings_t* settings) {
+  for (int note = 0; note < 128; note++) {
+    uint32_t color;
+    switch (preset.palette) {
+      case PALETTE_PITCH_CLASS: color = getPitchClassColor(note % 12); break;
+      // Stops on violet, red again would make both ends of the keyboard alike
+      case PALETTE_RAINBOW: color = hueToColor(getKeyboardPosition(note) * 300 / 255); break;
+      case PALETTE_GRADIENT: color = blendColors(preset.secondary_color, preset.color, getKeyboardPosition(note)); break;
+      case PALETTE_HAND_SPLIT: color = note < preset.split_key ? preset.secondary_color : preset.color; break;
+      default: color = preset.color; break;
+    }
+    settings->note_colors[note] = color;
+  }
+  for (int quality = 0; quality < CHORD_QUALITY_COUNT; quality++) {
+    settings->chord_colors[quality] = getChordQualityColor((chord_quality_t)quality, preset.color);
+  }
+  for (int pitch_class = 0; pitch_class < 12; pitch_class++) {
+    settings->pitch_class_colors[pitch_class] = getPitchClassColor(pitch_class);
+  }
+}
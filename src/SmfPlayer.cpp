@@ -0,0 +1,354 @@
+#include "SmfPlayer.h"
+
+#include <cstring>
+#include "midi_decoder.h"
+
+#define SMF_META_EVENT 0xff
+#define SMF_META_END_OF_TRACK 0x2f
+#define SMF_META_TEMPO 0x51
+#define SMF_SYSEX_EVENT 0xf0
+#define SMF_SYSEX_ESCAPE 0xf7
+
+/// Functions declaration ///
+
+static uint32_t readBigEndian(const uint8_t* bytes, int length);
+
+/// SmfFileSource ///
+
+SmfFileSource::SmfFileSource() {
+
+}
+
+SmfFileSource::~SmfFileSource() {
+  this->close();
+}
+
+bool SmfFileSource::open(const char* path) {
+  this->close();
+  file = fopen(path, "rb");
+  return file != NULL;
+}
+
+void SmfFileSource::close() {
+  if (file != NULL) fclose(file);
+  file = NULL;
+}
+
+size_t SmfFileSource::read(uint32_t offset, uint8_t* buffer, size_t length) {
+  if (file == NULL || fseek(file, offset, SEEK_SET) != 0) return 0;
+  return fread(buffer, 1, length, file);
+}
+
+/// SmfMemorySource ///
+
+SmfMemorySource::SmfMemorySource(const uint8_t* data, size_t size) {
+  this->data = data;
+  this->size = size;
+}
+
+size_t SmfMemorySource::read(uint32_t offset, uint8_t* buffer, size_t length) {
+  if (offset >= size) return 0;
+  if (length > size - offset) length = size - offset;
+  memcpy(buffer, data + offset, length);
+  return length;
+}
+
+/// SmfPlayer ///
+
+SmfPlayer::SmfPlayer() {
+  memset(notes_on, 0, sizeof(notes_on));
+}
+
+SmfPlayer::~SmfPlayer() {
+
+}
+
+bool SmfPlayer::open(SmfSource* smf_source) {
+  this->close();
+  uint8_t header[14];
+  if (smf_source->read(0, header, sizeof(header)) != sizeof(header)) return false;
+  if (memcmp(header, "MThd", 4) != 0 || readBigEndian(header + 4, 4) < 6) return false;
+  const uint16_t format = readBigEndian(header + 8, 2);
+  const uint16_t declared_tracks = readBigEndian(header + 10, 2);
+  division = (int16_t)readBigEndian(header + 12, 2);
+  if (format > 1 || division == 0) return false;
+  // SMPTE division without frames or ticks per frame, times would divide by 0
+  if (division < 0 && ((division & 0xff) == 0 || -(division >> 8) == 0)) return false;
+
+  // Walk the chunks to find where each track starts, unknown chunks are skipped
+  uint32_t offset = 8 + readBigEndian(header + 4, 4);
+  track_count = 0;
+  while (track_count < declared_tracks && track_count < SMF_MAX_TRACKS) {
+    uint8_t chunk[8];
+    if (smf_source->read(offset, chunk, sizeof(chunk)) != sizeof(chunk)) break;
+    const uint32_t length = readBigEndian(chunk + 4, 4);
+    if (memcmp(chunk, "MTrk", 4) == 0) {
+      tracks[track_count].start_offset = offset + 8;
+      tracks[track_count].end_offset = offset + 8 + length;
+      track_count++;
+    }
+    offset += 8 + length;
+  }
+  if (track_count == 0) return false;
+  // The header tells how many tracks were left out, they are reported instead of silently dropped
+  skipped_track_count = declared_tracks > track_count && track_count == SMF_MAX_TRACKS ? declared_tracks - track_count : 0;
+
+  source = smf_source;
+  this->rewind();
+  return true;
+}
+
+void SmfPlayer::close() {
+  source = NULL;
+  track_count = 0;
+  skipped_track_count = 0;
+  heap_size = 0;
+  playing = false;
+  has_pending = false;
+}
+
+void SmfPlayer::rewind() {
+  heap_size = 0;
+  tempo = SMF_DEFAULT_TEMPO;
+  tempo_tick = 0;
+  tempo_time_us = 0;
+  has_pending = false;
+  for (uint8_t i = 0; i < track_count; i++) {
+    smf_track_cursor_t* track = &tracks[i];
+    track->offset = track->start_offset;
+    track->buffer_offset = 0;
+    track->buffer_length = 0;
+    track->running_status = 0;
+    track->tick = 0;
+    if (this->readDeltaTime(track)) this->heapPush(i);
+  }
+}
+
+uint16_t SmfPlayer::getTrackCount() {
+  return track_count;
+}
+
+uint16_t SmfPlayer::getSkippedTrackCount() {
+  return skipped_track_count;
+}
+
+uint32_t SmfPlayer::getTempo() {
+  return tempo;
+}
+
+bool SmfPlayer::nextEvent(timed_midi_packet* event) {
+  while (heap_size > 0) {
+    const uint8_t index = heap[0];
+    smf_track_cursor_t* track = &tracks[index];
+    bool is_channel_event = false;
+    uint8_t data[2] = { 0, 0 };
+
+    int status = this->readByte(track);
+    if (status < 0) {
+      this->heapPop();
+      continue;
+    }
+    if (status < 0x80) {
+      // Running status, the byte read is the first data byte
+      if (track->running_status == 0) {
+        this->heapPop();
+        continue;
+      }
+      data[0] = status;
+      status = track->running_status;
+      if ((status & 0xe0) != 0xc0) {
+        const int data_2 = this->readByte(track);
+        if (data_2 < 0) { this->heapPop(); continue; }
+        data[1] = data_2;
+      }
+      is_channel_event = true;
+    } else if (status < 0xf0) {
+      track->running_status = status;
+      const int data_1 = this->readByte(track);
+      if (data_1 < 0) { this->heapPop(); continue; }
+      data[0] = data_1;
+      // Program change and channel pressure only have one data byte
+      if ((status & 0xe0) != 0xc0) {
+        const int data_2 = this->readByte(track);
+        if (data_2 < 0) { this->heapPop(); continue; }
+        data[1] = data_2;
+      }
+      is_channel_event = true;
+    } else if (status == SMF_META_EVENT) {
+      const int type = this->readByte(track);
+      uint32_t length;
+      if (type < 0 || !this->readVarLen(track, &length)) { this->heapPop(); continue; }
+      if (type == SMF_META_END_OF_TRACK) {
+        this->heapPop();
+        continue;
+      }
+      if (type == SMF_META_TEMPO && length == 3) {
+        uint32_t new_tempo = 0;
+        for (int i = 0; i < 3; i++) new_tempo = (new_tempo << 8) | (this->readByte(track) & 0xff);
+        // Tempo changes are anchored to keep later events exact, without accumulating rounding
+        tempo_time_us = this->tickToTime(track->tick);
+        tempo_tick = track->tick;
+        if (new_tempo > 0) tempo = new_tempo;
+      } else {
+        track->offset += length;
+      }
+    } else if (status == SMF_SYSEX_EVENT || status == SMF_SYSEX_ESCAPE) {
+      uint32_t length;
+      if (!this->readVarLen(track, &length)) { this->heapPop(); continue; }
+      track->offset += length;
+    } else {
+      // Invalid status in a file, the rest of the track can't be trusted
+      this->heapPop();
+      continue;
+    }
+
+    const uint32_t tick = track->tick;
+    // Prepare the next event of this track and restore the heap order
+    if (this->readDeltaTime(track)) {
+      this->heapSiftDown(0);
+    } else {
+      this->heapPop();
+    }
+
+    if (is_channel_event) {
+      event->time_us = this->tickToTime(tick);
+      event->packet = makeMidiPacket(status, data[0], data[1]);
+      return true;
+    }
+  }
+  return false;
+}
+
+void SmfPlayer::start(uint32_t song_start_us) {
+  if (source == NULL) return;
+  playing = true;
+  start_us = song_start_us;
+}
+
+void SmfPlayer::stop(midi_in_callback_t* callback) {
+  playing = false;
+  for (uint8_t note = 0; note < 128; note++) {
+    if (!(notes_on[note >> 5] & (1UL << (note & 31)))) continue;
+    if (callback != NULL) (*callback)(makeMidiPacket(MIDI_NOTE_OFF << 4, note, 0));
+  }
+  memset(notes_on, 0, sizeof(notes_on));
+}
+
+bool SmfPlayer::isPlaying() {
+  return playing;
+}
+
+size_t SmfPlayer::update(uint32_t now_us, midi_in_callback_t* callback) {
+  size_t sent = 0;
+  // Not started yet, see start()
+  if ((int32_t)(now_us - start_us) < 0) return 0;
+  const uint32_t song_time_us = now_us - start_us;
+  while (playing) {
+    if (!has_pending) {
+      if (!this->nextEvent(&pending)) {
+        playing = false;
+        break;
+      }
+      has_pending = true;
+    }
+    if (pending.time_us > song_time_us) break;
+
+    const midi_event_t event = decodeMidiPacket(pending.packet);
+    const uint32_t mask = 1UL << (event.note & 31);
+    if (event.type == MIDI_EVENT_NOTE_ON) notes_on[event.note >> 5] |= mask;
+    else if (event.type == MIDI_EVENT_NOTE_OFF) notes_on[event.note >> 5] &= ~mask;
+    if (callback != NULL) (*callback)(pending.packet);
+    has_pending = false;
+    sent++;
+  }
+  return sent;
+}
+
+int SmfPlayer::readByte(smf_track_cursor_t* track) {
+  if (track->offset >= track->end_offset) return -1;
+  if (track->offset < track->buffer_offset || track->offset >= track->buffer_offset + track->buffer_length) {
+    uint32_t length = track->end_offset - track->offset;
+    if (length > SMF_TRACK_BUFFER_SIZE) length = SMF_TRACK_BUFFER_SIZE;
+    track->buffer_offset = track->offset;
+    track->buffer_length = source->read(track->offset, track->buffer, length);
+    if (track->buffer_length == 0) return -1;
+  }
+  return track->buffer[track->offset++ - track->buffer_offset];
+}
+
+bool SmfPlayer::readVarLen(smf_track_cursor_t* track, uint32_t* value) {
+  *value = 0;
+  // Variable length quantities are at most 4 bytes long
+  for (int i = 0; i < 4; i++) {
+    const int byte = this->readByte(track);
+    if (byte < 0) return false;
+    *value = (*value << 7) | (byte & 0x7f);
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+bool SmfPlayer::readDeltaTime(smf_track_cursor_t* track) {
+  uint32_t delta;
+  if (!this->readVarLen(track, &delta)) return false;
+  track->tick += delta;
+  return true;
+}
+
+uint32_t SmfPlayer::tickToTime(uint32_t tick) {
+  const uint64_t ticks = tick - tempo_tick;
+  if (division > 0) {
+    return tempo_time_us + ticks * tempo / division;
+  }
+  // SMPTE division: frames per second in the high byte, ticks per frame in the low one
+  const uint32_t frames_per_second = -(division >> 8);
+  const uint32_t ticks_per_frame = division & 0xff;
+  return tempo_time_us + ticks * 1000000 / (frames_per_second * ticks_per_frame);
+}
+
+bool SmfPlayer::heapLess(uint8_t a, uint8_t b) {
+  // Ties are broken by track index so that type 1 conductor track events come first
+  if (tracks[a].tick != tracks[b].tick) return tracks[a].tick < tracks[b].tick;
+  return a < b;
+}
+
+void SmfPlayer::heapPush(uint8_t track) {
+  uint8_t index = heap_size++;
+  heap[index] = track;
+  while (index > 0) {
+    const uint8_t parent = (index - 1) / 2;
+    if (!this->heapLess(heap[index], heap[parent])) break;
+    const uint8_t swap = heap[parent];
+    heap[parent] = heap[index];
+    heap[index] = swap;
+    index = parent;
+  }
+}
+
+uint8_t SmfPlayer::heapPop() {
+  const uint8_t top = heap[0];
+  heap[0] = heap[--heap_size];
+  if (heap_size > 0) this->heapSiftDown(0);
+  return top;
+}
+
+void SmfPlayer::heapSiftDown(uint8_t index) {
+  while (true) {
+    const uint8_t left = 2 * index + 1;
+    const uint8_t right = left + 1;
+    uint8_t smallest = index;
+    if (left < heap_size && this->heapLess(heap[left], heap[smallest])) smallest = left;
+    if (right < heap_size && this->heapLess(heap[right], heap[smallest])) smallest = right;
+    if (smallest == index) return;
+    const uint8_t swap = heap[smallest];
+    heap[smallest] = heap[index];
+    heap[index] = swap;
+    index = smallest;
+  }
+}
+
+static uint32_t readBigEndian(const uint8_t* bytes, int length) {
+  uint32_t value = 0;
+  for (int i = 0; i < length; i++) value = (value << 8) | bytes[i];
+  return value;
+}
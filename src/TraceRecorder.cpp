@@ -0,0 +1,255 @@
+#include "TraceRecorder.h"
+
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if __has_include("esp_timer.h")
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#define USE_ESP_IDF 1
+#else
+#include <chrono>
+#endif
+
+// Formatted events are written by chunks of this size
+#define EXPORT_CHUNK_SIZE 512
+#define EXPORT_EVENT_MAX_LENGTH 160
+#define TRACE_PID 1
+
+/// Types ///
+
+typedef struct {
+  char buffer[EXPORT_CHUNK_SIZE];
+  size_t length;
+  size_t total;
+  trace_writer_t* writer;
+  void* context;
+} export_chunk_t;
+
+/// Variables ///
+
+TraceRecorder* active_trace_recorder = NULL;
+
+static const char* span_names[TRACE_SPAN_COUNT] = {
+  "loop",
+  "server",
+  "midi event",
+  "show",
+  "render",
+  "pixel output",
+  "push",
+  "strip",
+  "usb transfer",
+  "audio block",
+  "frame late",
+};
+
+// Index of the task in the trace, given by its first event
+static thread_local uint8_t current_thread = UINT8_MAX;
+
+/// Functions declaration ///
+
+static uint32_t getTimeUs();
+static uint8_t getCore();
+static void writeChunk(export_chunk_t* chunk, const char* format, ...);
+static void flushChunk(export_chunk_t* chunk);
+
+/// Class members definition ///
+
+TraceRecorder::TraceRecorder(size_t event_capacity, MemoryArena* memory) {
+  capacity = 1;
+  while (capacity * 2 <= event_capacity) capacity *= 2;
+  events = memory != NULL ? (trace_event_t*)memory->allocate(capacity * sizeof(trace_event_t)) : NULL;
+  owns_events = events == NULL;
+  if (owns_events) {
+    // Without PSRAM, a short trace still shows a stutter
+    if (memory != NULL && capacity > TRACE_FALLBACK_CAPACITY) capacity = TRACE_FALLBACK_CAPACITY;
+    events = (trace_event_t*)malloc(capacity * sizeof(trace_event_t));
+  }
+  memset(thread_names, 0, sizeof(thread_names));
+}
+
+TraceRecorder::~TraceRecorder() {
+  if (owns_events) free(events);
+}
+
+void TraceRecorder::begin(trace_span_t span) {
+  this->record(span, TRACE_PHASE_BEGIN);
+}
+
+void TraceRecorder::end(trace_span_t span) {
+  this->record(span, TRACE_PHASE_END);
+}
+
+void TraceRecorder::instant(trace_span_t span) {
+  this->record(span, TRACE_PHASE_INSTANT);
+}
+
+void TraceRecorder::setRecording(bool enabled) {
+  recording.store(enabled);
+}
+
+bool TraceRecorder::isRecording() {
+  return recording.load();
+}
+
+void TraceRecorder::clear() {
+  next_event.store(0);
+}
+
+size_t TraceRecorder::getEventCount() {
+  const uint32_t count = next_event.load();
+  return count < capacity ? count : capacity;
+}
+
+size_t TraceRecorder::getCapacity() {
+  return capacity;
+}
+
+uint32_t TraceRecorder::getOverwrittenCount() {
+  const uint32_t count = next_event.load();
+  return count > capacity ? count - capacity : 0;
+}
+
+/**
+ * Tasks become threads of a single process. An end event whose begin was overwritten is skipped,
+ * spans still open at the end of the ring are left open, Perfetto draws them up to the end of the trace.
+ */
+size_t TraceRecorder::exportChromeJson(trace_writer_t* writer, void* context) {
+  const bool was_recording = recording.exchange(false);
+  export_chunk_t chunk;
+  chunk.length = 0;
+  chunk.total = 0;
+  chunk.writer = writer;
+  chunk.context = context;
+
+  writeChunk(&chunk, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  const uint8_t threads = thread_count.load() < TRACE_MAX_THREADS ? thread_count.load() : TRACE_MAX_THREADS;
+  for (uint8_t thread = 0; thread < threads; thread++) {
+    writeChunk(&chunk, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+      TRACE_PID, thread, thread_names[thread]);
+  }
+
+  const uint32_t count = next_event.load();
+  const uint32_t first = count > capacity ? count - capacity : 0;
+  uint16_t depth[TRACE_MAX_THREADS];
+  memset(depth, 0, sizeof(depth));
+  // Times are unwrapped from 32 bits, events of two cores can be slightly out of order
+  uint32_t previous_us = first < count ? events[first & (capacity - 1)].time_us : 0;
+  int64_t time_us = previous_us;
+  bool separator = false;
+  for (uint32_t i = first; i < count; i++) {
+    const trace_event_t* event = &events[i & (capacity - 1)];
+    time_us += (int32_t)(event->time_us - previous_us);
+    previous_us = event->time_us;
+    if (event->span >= TRACE_SPAN_COUNT || event->thread >= TRACE_MAX_THREADS) continue;
+    const char* phase;
+    switch (event->phase) {
+      case TRACE_PHASE_BEGIN:
+        depth[event->thread]++;
+        phase = "B";
+        break;
+      case TRACE_PHASE_END:
+        if (depth[event->thread] == 0) continue;
+        depth[event->thread]--;
+        phase = "E";
+        break;
+      default:
+        phase = "i\",\"s\":\"t";
+        break;
+    }
+    writeChunk(&chunk, "%s{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%" PRId64 ",\"pid\":%d,\"tid\":%d,\"args\":{\"core\":%d}}",
+      separator ? ",\n" : "", span_names[event->span], phase, time_us, TRACE_PID, event->thread, event->core);
+    separator = true;
+  }
+  writeChunk(&chunk, "\n]}\n");
+  flushChunk(&chunk);
+
+  recording.store(was_recording);
+  return chunk.total;
+}
+
+const char* TraceRecorder::getSpanName(trace_span_t span) {
+  return span < TRACE_SPAN_COUNT ? span_names[span] : "unknown";
+}
+
+void TraceRecorder::record(trace_span_t span, trace_phase_t phase) {
+  if (!recording.load(std::memory_order_relaxed)) return;
+  const uint32_t index = next_event.fetch_add(1, std::memory_order_relaxed);
+  trace_event_t* event = &events[index & (capacity - 1)];
+  event->time_us = getTimeUs();
+  event->span = span;
+  event->phase = phase;
+  event->thread = this->getThread();
+  event->core = getCore();
+}
+
+/**
+ * Index of the calling task, its name is saved by its first event.
+ */
+uint8_t TraceRecorder::getThread() {
+  if (current_thread != UINT8_MAX) return current_thread;
+  const uint8_t thread = thread_count.fetch_add(1);
+  if (thread >= TRACE_MAX_THREADS) {
+    current_thread = TRACE_MAX_THREADS - 1;
+    return current_thread;
+  }
+#ifdef USE_ESP_IDF
+  snprintf(thread_names[thread], TRACE_THREAD_NAME_LENGTH, "%s", pcTaskGetName(NULL));
+#else
+  snprintf(thread_names[thread], TRACE_THREAD_NAME_LENGTH, "thread %d", thread);
+#endif
+  current_thread = thread;
+  return thread;
+}
+
+/// Functions definition ///
+
+void setTraceRecorder(TraceRecorder* recorder) {
+  active_trace_recorder = recorder;
+}
+
+TraceRecorder* getTraceRecorder() {
+  return active_trace_recorder;
+}
+
+/**
+ * The cycle counters of the two cores are not synchronized, events are stamped with the shared timer.
+ */
+static uint32_t getTimeUs() {
+#ifdef USE_ESP_IDF
+  return esp_timer_get_time();
+#else
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+#endif
+}
+
+static uint8_t getCore() {
+#ifdef USE_ESP_IDF
+  return xPortGetCoreID();
+#else
+  return 0;
+#endif
+}
+
+static void writeChunk(export_chunk_t* chunk, const char* format, ...) {
+  if (chunk->length + EXPORT_EVENT_MAX_LENGTH > EXPORT_CHUNK_SIZE) flushChunk(chunk);
+  va_list args;
+  va_start(args, format);
+  const int length = vsnprintf(chunk->buffer + chunk->length, EXPORT_CHUNK_SIZE - chunk->length, format, args);
+  va_end(args);
+  if (length > 0) chunk->length += (size_t)length < EXPORT_CHUNK_SIZE - chunk->length ? length : EXPORT_CHUNK_SIZE - chunk->length - 1;
+}
+
+static void flushChunk(export_chunk_t* chunk) {
+  if (chunk->length == 0) return;
+  (*chunk->writer)(chunk->buffer, chunk->length, chunk->context);
+  chunk->total += chunk->length;
+  chunk->length = 0;
+}
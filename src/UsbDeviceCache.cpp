@@ -0,0 +1,89 @@
+#include "UsbDeviceCache.h"
+
+#include <cstring>
+
+/// Class members definition ///
+
+UsbDeviceCache::UsbDeviceCache() {
+  this->clear();
+}
+
+const usb_device_profile_t* UsbDeviceCache::find(uint16_t vendor_id, uint16_t product_id, uint32_t serial_hash) {
+  const int index = this->indexOf(vendor_id, product_id, serial_hash);
+  if (index < 0) return NULL;
+  profiles[index].last_used = ++use_counter;
+  return &profiles[index];
+}
+
+void UsbDeviceCache::store(usb_device_profile_t profile) {
+  int index = this->indexOf(profile.vendor_id, profile.product_id, profile.serial_hash);
+  if (index < 0 && count < USB_DEVICE_CACHE_SIZE) {
+    index = count++;
+  } else if (index < 0) {
+    // Replace the device unplugged for the longest time, the counter may have wrapped
+    index = 0;
+    for (uint8_t i = 1; i < count; i++) {
+      if ((uint16_t)(use_counter - profiles[i].last_used) > (uint16_t)(use_counter - profiles[index].last_used)) index = i;
+    }
+  }
+  profile.last_used = ++use_counter;
+  profiles[index] = profile;
+}
+
+void UsbDeviceCache::remove(uint16_t vendor_id, uint16_t product_id, uint32_t serial_hash) {
+  const int index = this->indexOf(vendor_id, product_id, serial_hash);
+  if (index < 0) return;
+  profiles[index] = profiles[--count];
+}
+
+void UsbDeviceCache::clear() {
+  memset(profiles, 0, sizeof(profiles));
+  count = 0;
+  use_counter = 0;
+}
+
+uint8_t UsbDeviceCache::getCount() {
+  return count;
+}
+
+/**
+ * Version, count, then the profiles as they are in memory.
+ */
+size_t UsbDeviceCache::save(uint8_t* data, size_t size) {
+  const size_t length = 2 + count * sizeof(usb_device_profile_t);
+  if (size < length) return 0;
+  data[0] = USB_DEVICE_CACHE_VERSION;
+  data[1] = count;
+  memcpy(data + 2, profiles, count * sizeof(usb_device_profile_t));
+  return length;
+}
+
+bool UsbDeviceCache::load(const uint8_t* data, size_t length) {
+  this->clear();
+  if (length < 2 || data[0] != USB_DEVICE_CACHE_VERSION || data[1] > USB_DEVICE_CACHE_SIZE) return false;
+  if (length != 2 + data[1] * sizeof(usb_device_profile_t)) return false;
+  count = data[1];
+  memcpy(profiles, data + 2, count * sizeof(usb_device_profile_t));
+  for (uint8_t i = 0; i < count; i++) {
+    if ((int16_t)(profiles[i].last_used - use_counter) > 0) use_counter = profiles[i].last_used;
+  }
+  return true;
+}
+
+uint32_t UsbDeviceCache::hashSerial(const uint8_t* data, size_t length) {
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= data[i];
+    hash *= 16777619UL;
+  }
+  // 0 means no serial number
+  return hash ? hash : 1;
+}
+
+int UsbDeviceCache::indexOf(uint16_t vendor_id, uint16_t product_id, uint32_t serial_hash) {
+  for (uint8_t i = 0; i < count; i++) {
+    const usb_device_profile_t* profile = &profiles[i];
+    if (profile->vendor_id == vendor_id && profile->product_id == product_id && profile->serial_hash == serial_hash) return i;
+  }
+  return -1;
+}
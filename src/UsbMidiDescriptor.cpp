@@ -0,0 +1,124 @@
+#include "UsbMidiDescriptor.h"
+
+#include <cstring>
+
+#define DESCRIPTOR_TYPE_CONFIGURATION 0x02
+#define DESCRIPTOR_TYPE_INTERFACE 0x04
+#define DESCRIPTOR_TYPE_ENDPOINT 0x05
+#define DESCRIPTOR_TYPE_CS_INTERFACE 0x24
+#define DESCRIPTOR_TYPE_CS_ENDPOINT 0x25
+#define CONFIGURATION_HEADER_SIZE 9
+#define INTERFACE_DESCRIPTOR_SIZE 9
+#define ENDPOINT_DESCRIPTOR_SIZE 7
+#define USB_CLASS_AUDIO 0x01
+#define AUDIO_SUBCLASS_MIDI_STREAMING 0x03
+#define TRANSFER_TYPE_MASK 0x03
+#define TRANSFER_TYPE_BULK 0x02
+#define ENDPOINT_DIRECTION_IN 0x80
+// Class specific subtypes of the MIDI streaming interface
+#define MS_MIDI_IN_JACK 0x02
+#define MS_MIDI_OUT_JACK 0x03
+#define MS_GENERAL 0x01
+#define JACK_TYPE_EMBEDDED 0x01
+
+/// Functions definition ///
+
+usb_descriptor_status_t parseUsbMidiTopology(const uint8_t* data, size_t length, usb_midi_topology_t* topology) {
+  memset(topology, 0, sizeof(usb_midi_topology_t));
+  if (data == NULL || length < CONFIGURATION_HEADER_SIZE || data[1] != DESCRIPTOR_TYPE_CONFIGURATION) {
+    return USB_DESCRIPTOR_INVALID_HEADER;
+  }
+  size_t end = data[2] | (data[3] << 8);
+  if (end > length) end = length;
+
+  // Interface the next endpoints and jacks belong to, -1 outside of a kept MIDI interface
+  int interface_index = -1;
+  // Last endpoint kept, its class specific descriptor gives the cables
+  usb_midi_endpoint_t* endpoint = NULL;
+  for (size_t offset = 0; offset < end;) {
+    const uint8_t* descriptor = data + offset;
+    const uint8_t descriptor_length = descriptor[0];
+    // A length of 0 or 1 would never move forward
+    if (descriptor_length < 2 || offset + descriptor_length > end) return USB_DESCRIPTOR_INVALID_LENGTH;
+    offset += descriptor_length;
+    topology->descriptor_count++;
+
+    switch (descriptor[1]) {
+      case DESCRIPTOR_TYPE_INTERFACE: {
+        interface_index = -1;
+        endpoint = NULL;
+        if (descriptor_length < INTERFACE_DESCRIPTOR_SIZE) break;
+        if (descriptor[5] != USB_CLASS_AUDIO || descriptor[6] != AUDIO_SUBCLASS_MIDI_STREAMING || descriptor[7] != 0) break;
+        if (topology->interface_count >= USB_MIDI_MAX_INTERFACES) {
+          topology->dropped_count++;
+          break;
+        }
+        interface_index = topology->interface_count++;
+        topology->interfaces[interface_index].number = descriptor[2];
+        topology->interfaces[interface_index].alternate_setting = descriptor[3];
+        break;
+      }
+
+      case DESCRIPTOR_TYPE_ENDPOINT: {
+        endpoint = NULL;
+        if (interface_index < 0 || descriptor_length < ENDPOINT_DESCRIPTOR_SIZE) break;
+        if ((descriptor[3] & TRANSFER_TYPE_MASK) != TRANSFER_TYPE_BULK) break;
+        const bool in = descriptor[2] & ENDPOINT_DIRECTION_IN;
+        usb_midi_endpoint_t* endpoints = in ? topology->in_endpoints : topology->out_endpoints;
+        uint8_t* count = in ? &topology->in_endpoint_count : &topology->out_endpoint_count;
+        if (*count >= USB_MIDI_MAX_ENDPOINTS) {
+          topology->dropped_count++;
+          break;
+        }
+        endpoint = &endpoints[(*count)++];
+        endpoint->address = descriptor[2];
+        endpoint->max_packet_size = descriptor[4] | (descriptor[5] << 8);
+        endpoint->interface_index = interface_index;
+        // Devices leaving out the class specific descriptor have one cable
+        endpoint->cable_count = 1;
+        break;
+      }
+
+      case DESCRIPTOR_TYPE_CS_ENDPOINT: {
+        if (endpoint == NULL || descriptor_length < 4 || descriptor[2] != MS_GENERAL) break;
+        uint8_t cables = descriptor[3];
+        if (cables > descriptor_length - 4) cables = descriptor_length - 4;
+        if (cables > USB_MIDI_MAX_CABLES) cables = USB_MIDI_MAX_CABLES;
+        if (cables > 0) endpoint->cable_count = cables;
+        break;
+      }
+
+      case DESCRIPTOR_TYPE_CS_INTERFACE: {
+        if (interface_index < 0 || descriptor_length < 5) break;
+        if (descriptor[2] != MS_MIDI_IN_JACK && descriptor[2] != MS_MIDI_OUT_JACK) break;
+        if (topology->jack_count >= USB_MIDI_MAX_JACKS) {
+          topology->dropped_count++;
+          break;
+        }
+        usb_midi_jack_t* jack = &topology->jacks[topology->jack_count++];
+        jack->input = descriptor[2] == MS_MIDI_IN_JACK;
+        jack->embedded = descriptor[3] == JACK_TYPE_EMBEDDED;
+        jack->id = descriptor[4];
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  for (uint8_t i = 0; i < topology->in_endpoint_count; i++) {
+    if (topology->in_endpoints[i].cable_count > topology->cable_count) topology->cable_count = topology->in_endpoints[i].cable_count;
+  }
+  return topology->in_endpoint_count > 0 ? USB_DESCRIPTOR_OK : USB_DESCRIPTOR_NO_MIDI;
+}
+
+const char* getUsbDescriptorStatusName(usb_descriptor_status_t status) {
+  switch (status) {
+    case USB_DESCRIPTOR_OK: return "ok";
+    case USB_DESCRIPTOR_INVALID_HEADER: return "invalid header";
+    case USB_DESCRIPTOR_INVALID_LENGTH: return "invalid length";
+    case USB_DESCRIPTOR_NO_MIDI: return "no MIDI interface";
+    default: return "unknown";
+  }
+}
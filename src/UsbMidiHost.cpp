@@ -13,12 +13,16 @@
 #include "usb/usb_host.h"
 #include "driver/gpio.h"
 
+#include <atomic>
 #include <esp32-hal-log.h>
+#include <Preferences.h>
 #include "class_driver.h"
 
 #define HOST_LIB_TASK_PRIORITY    2
 #define CLASS_TASK_PRIORITY       3
 #define INTERRUPT_TASK_PRIORITY   3
+#define DEVICE_CACHE_NVS_NAMESPACE "usb"
+#define DEVICE_CACHE_NVS_KEY "devices"
 
 #ifdef CONFIG_USB_HOST_ENABLE_ENUM_FILTER_CALLBACK
 #define ENABLE_ENUM_FILTER_CALLBACK
@@ -48,11 +52,16 @@ static const char *TAG_USB_host = "USB host lib";
 static app_event_queue_t evt_queue;
 static QueueHandle_t app_event_queue = NULL;
 static TaskHandle_t host_lib_task_hdl, class_driver_task_hdl;
+// Packets received by the class driver task, handled by loop()
+static QueueHandle_t midi_in_queue = NULL;
+static std::atomic<uint32_t> dropped_packets{0};
 
 /// Functions declaration ///
 
 static void usbHostTask(void*);
 static void checkInterruptTask(void*);
+static void saveDeviceCache(UsbDeviceCache*);
+static void queueMidiIn(midi_usb_packet);
 
 #ifdef ENABLE_ENUM_FILTER_CALLBACK
 static bool set_config_cb(const usb_device_desc_t*, uint8_t*)
@@ -73,6 +82,24 @@ void UsbMidiHost::setMidiInCallback(midi_in_callback_t *callback) {
 }
 
 void UsbMidiHost::setup() {
+  // Known keyboards are claimed without walking their descriptors again
+  Preferences nvs;
+  if (nvs.begin(DEVICE_CACHE_NVS_NAMESPACE, true)) {
+    uint8_t data[USB_DEVICE_CACHE_DATA_SIZE];
+    const size_t length = nvs.getBytes(DEVICE_CACHE_NVS_KEY, data, sizeof(data));
+    if (length > 0 && !device_cache.load(data, length)) log_w("USB device cache from another version, ignored");
+    nvs.end();
+  }
+  log_i("%d USB devices cached", device_cache.getCount());
+  // The LEDs, the recorder and the learning session are only driven from the loop() task
+  midi_in_queue = xQueueCreate(USB_MIDI_IN_QUEUE_LENGTH, sizeof(midi_usb_packet));
+  driver_config.midi_in_callback = &queueMidiIn;
+  driver_config.device_cache = &device_cache;
+  driver_config.stats = &stats;
+  driver_config.device_cache_changed = &saveDeviceCache;
+  driver_config.midi_out = &midi_out;
+  midi_out.setReadyCallback(&classDriverMidiOutReady);
+
   // Create USB task
   ESP_LOGI(TAG_USB_host, "Creating USB task");
   app_event_queue = xQueueCreate(10, sizeof(app_event_queue_t));
@@ -98,7 +125,7 @@ void UsbMidiHost::setup() {
     classDriverTask,
     "class",
     5 * 1024,
-    (void*)this->midiInCallback,
+    &driver_config,
     CLASS_TASK_PRIORITY,
     &class_driver_task_hdl,
     0
@@ -120,8 +147,59 @@ void UsbMidiHost::setup() {
   assert(task_created == pdTRUE);
 }
 
+void UsbMidiHost::loop() {
+  if (midi_in_queue == NULL) return;
+  midi_usb_packet packet;
+  while (xQueueReceive(midi_in_queue, &packet, 0)) {
+    if (this->midiInCallback != NULL) (*this->midiInCallback)(packet);
+  }
+}
+
+uint32_t UsbMidiHost::getDroppedPackets() {
+  return dropped_packets.load(std::memory_order_relaxed);
+}
+
+usb_connection_stats_t UsbMidiHost::getStats() {
+  // Written by the class driver task, a plain copy could mix two connections
+  portENTER_CRITICAL(&connection_stats_lock);
+  const usb_connection_stats_t copy = stats;
+  portEXIT_CRITICAL(&connection_stats_lock);
+  return copy;
+}
+
+uint8_t UsbMidiHost::getCachedDeviceCount() {
+  return device_cache.getCount();
+}
+
+bool UsbMidiHost::send(midi_usb_packet packet) {
+  return midi_out.push(packet, esp_timer_get_time());
+}
+
+MidiOutQueue* UsbMidiHost::getMidiOut() {
+  return &midi_out;
+}
+
 /// Functions definition ///
 
+/**
+ * Called from the class driver task, never blocks it: a full queue drops the packet.
+ */
+static void queueMidiIn(midi_usb_packet packet) {
+  if (xQueueSend(midi_in_queue, &packet, 0) != pdTRUE) dropped_packets.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Only called when a device is seen for the first time or changed its layout, not on every connection.
+ */
+static void saveDeviceCache(UsbDeviceCache* cache) {
+  uint8_t data[USB_DEVICE_CACHE_DATA_SIZE];
+  const size_t length = cache->save(data, sizeof(data));
+  Preferences nvs;
+  if (length == 0 || !nvs.begin(DEVICE_CACHE_NVS_NAMESPACE, false)) return;
+  nvs.putBytes(DEVICE_CACHE_NVS_KEY, data, length);
+  nvs.end();
+}
+
 /**
  * Start USB Host Install and handle events
  * @param[in] arg  Not used
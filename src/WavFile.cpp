@@ -0,0 +1,98 @@
+#include "WavFile.h"
+
+#include <cstring>
+
+#define WAV_FORMAT_PCM 1
+#define WAV_MAX_CHANNELS 8
+
+/// Functions declaration ///
+
+static uint32_t readLittleEndian(const uint8_t* bytes, int length);
+
+/// Class members definition ///
+
+WavFile::WavFile() {
+
+}
+
+WavFile::~WavFile() {
+  this->close();
+}
+
+/**
+ * Walk the RIFF chunks until the data chunk, the format chunk must come before it.
+ */
+bool WavFile::open(const char* path) {
+  this->close();
+  file = fopen(path, "rb");
+  if (file == NULL) return false;
+  uint8_t header[12];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header)
+    || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+    this->close();
+    return false;
+  }
+  bool format_found = false;
+  uint8_t chunk[8];
+  while (fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)) {
+    const uint32_t size = readLittleEndian(chunk + 4, 4);
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+      uint8_t format[16];
+      if (fread(format, 1, sizeof(format), file) != sizeof(format)) break;
+      if (readLittleEndian(format, 2) != WAV_FORMAT_PCM || readLittleEndian(format + 14, 2) != 16) break;
+      channel_count = readLittleEndian(format + 2, 2);
+      sample_rate = readLittleEndian(format + 4, 4);
+      format_found = channel_count > 0 && channel_count <= WAV_MAX_CHANNELS;
+      // Chunks are padded to an even size
+      if (fseek(file, size - sizeof(format) + (size & 1), SEEK_CUR) != 0) break;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!format_found) break;
+      data_left = size;
+      return true;
+    } else if (fseek(file, size + (size & 1), SEEK_CUR) != 0) {
+      break;
+    }
+  }
+  this->close();
+  return false;
+}
+
+void WavFile::close() {
+  if (file != NULL) fclose(file);
+  file = NULL;
+  sample_rate = 0;
+  channel_count = 0;
+  data_left = 0;
+}
+
+uint32_t WavFile::getSampleRate() {
+  return sample_rate;
+}
+
+uint16_t WavFile::getChannelCount() {
+  return channel_count;
+}
+
+size_t WavFile::read(int16_t* samples, size_t count) {
+  size_t read_count = 0;
+  uint8_t frame[2 * WAV_MAX_CHANNELS];
+  const size_t frame_size = 2 * channel_count;
+  while (file != NULL && read_count < count && data_left >= frame_size) {
+    if (fread(frame, 1, frame_size, file) != frame_size) break;
+    data_left -= frame_size;
+    int32_t sum = 0;
+    for (uint16_t channel = 0; channel < channel_count; channel++) {
+      sum += (int16_t)readLittleEndian(frame + 2 * channel, 2);
+    }
+    samples[read_count++] = sum / channel_count;
+  }
+  return read_count;
+}
+
+/// Functions definition ///
+
+static uint32_t readLittleEndian(const uint8_t* bytes, int length) {
+  uint32_t value = 0;
+  for (int i = length - 1; i >= 0; i--) value = (value << 8) | bytes[i];
+  return value;
+}
@@ -1,59 +1,234 @@
 #include <Arduino.h>
+#include <ESPmDNS.h>
 
 #include "LedController.h"
 #include "ConfigServer.h"
 #include "UsbMidiHost.h"
+#include "DeviceBenchmark.h"
+#include "MidiFilePlayer.h"
+#include "MidiRecorder.h"
+#include "RtpMidiSession.h"
+#include "PixelNetworkOutput.h"
+#include "MatrixRenderer.h"
+#include "AudioInput.h"
+#include "BootTimeline.h"
+#include "TraceRecorder.h"
+#include "MemoryArena.h"
+#include "LightGuide.h"
+#include "midi_decoder.h"
 
 #define PIN_WS2812B 16
-#define LED_NUMBER 175
+#define MATRIX_WIDTH 0 // Columns of a 2D LED matrix showing a waterfall of notes, 0 for a strip along the keyboard
+#define MATRIX_HEIGHT 16
+#define MATRIX_SERPENTINE 1 // Every other row is wired in the opposite direction
+#define MATRIX_TOP_ORIGIN 0 // First LED in the top row
+#define MATRIX_MODE MATRIX_WATERFALL_RISING // MATRIX_WATERFALL_RISING or MATRIX_WATERFALL_FALLING (MIDI files only)
+#define MATRIX_ROW_PERIOD_MS 50 // Scroll speed
+#define LED_NUMBER (MATRIX_WIDTH ? MATRIX_WIDTH * MATRIX_HEIGHT : 175)
+#define LED_PIXEL_ORDER PIXEL_ORDER_GRB // PIXEL_ORDER_GRB for WS2812B, PIXEL_ORDER_GRBW for SK6812 RGBW
+#define LED_PIXEL_MAPPING PIXEL_MAPPING_FORWARD // PIXEL_MAPPING_REVERSED when the strip starts at the highest key
 #define USE_PREFERENCES 1
 #define WEBSERVER_MODE WIFI_MODE_STA // 0: inactive, WIFI_MODE_STA or WIFI_MODE_AP
+#define RTP_MIDI_NAME "Pianeon" // Session name of the network MIDI input, needs the web server WiFi
+#define PIXEL_OUTPUT_PROTOCOL PIXEL_PROTOCOL_NONE // PIXEL_PROTOCOL_NONE, PIXEL_PROTOCOL_E131 or PIXEL_PROTOCOL_ARTNET
+#define PIXEL_OUTPUT_UNIVERSE 1 // First universe of the strip, next ones are used every 170 LEDs
+#define PIXEL_OUTPUT_ADDRESS 0 // Controller IPv4 address as 0xC0A80150, 0 for multicast (E1.31) or broadcast (Art-Net)
+#define PIXEL_OUTPUT_LOCAL_STRIP 1 // 0 to only drive the remote controllers
+#define AUDIO_INPUT 0 // 1 to detect the notes of an acoustic piano with an I2S microphone
+#define AUDIO_PIN_BCK 4
+#define AUDIO_PIN_WS 5
+#define AUDIO_PIN_DATA 6
+#define AUDIO_THRESHOLD AUDIO_DEFAULT_THRESHOLD // Raise it if the room noise lights keys
+#define MIDI_THRU_SOURCES ((1 << NOTE_SOURCE_FILE) | (1 << NOTE_SOURCE_NETWORK)) // Inputs sent to the MIDI OUT of the keyboard, add NOTE_SOURCE_USB to echo it
+#define LIGHT_GUIDE_CHANNEL 0 // Channel of the key lights of the keyboard, lit in learning mode, 0 for a keyboard without them
+#define TRACE_EVENTS TRACE_DEFAULT_CAPACITY // Pipeline events kept for GET /trace.json, 0 disables the trace
+// Renderer, its layers and the matrix buffers
+#define INTERNAL_ARENA_SIZE (sizeof(NoteRenderer) + (LAYER_COUNT + 3) * 3 * LED_NUMBER + 1024)
+// File player, recording buffers and trace ring
+#define PSRAM_ARENA_SIZE (sizeof(MidiFilePlayer) + 2 * EVENT_LOG_BUFFER_SIZE + TRACE_EVENTS * sizeof(trace_event_t) + 1024)
 
 /// Functions declaration ///
 
-void midiInCallbackMain(midi_usb_packet packet);
+void midiInCallbackMain(midi_usb_packet packet, note_source_t source);
+void usbMidiInCallback(midi_usb_packet packet);
+void networkMidiInCallback(midi_usb_packet packet);
+void fileMidiInCallback(midi_usb_packet packet);
+void audioMidiInCallback(midi_usb_packet packet);
+void startNetworkServices();
+void markBootPhase(boot_phase_t phase);
+void previewMidiInCallback(midi_usb_packet packet);
 
 /// Variables ///
 
-LedController led(LED_NUMBER, PIN_WS2812B, USE_PREFERENCES);
+// Reserved first, before the heap gets fragmented
+MemoryArena internal_memory("internal", MEMORY_REGION_INTERNAL, INTERNAL_ARENA_SIZE);
+MemoryArena psram_memory("psram", MEMORY_REGION_PSRAM, PSRAM_ARENA_SIZE);
+LedController led(LED_NUMBER, PIN_WS2812B, USE_PREFERENCES, &internal_memory, LED_PIXEL_ORDER);
+// The strip is known at compile time, its frames are encoded without looking up the format per pixel
+StaticPixelEncoder<LED_NUMBER, LED_PIXEL_ORDER, LED_PIXEL_MAPPING> pixel_encoder;
 ConfigServer server(&led, WEBSERVER_MODE);
 UsbMidiHost usb_midi;
+DeviceBenchmark benchmark(&led, &psram_memory);
+MidiFilePlayer& file_player = *psram_memory.create<MidiFilePlayer>();
+// The recorder's atomics stay in internal RAM, its buffers go to PSRAM
+MidiRecorder recorder(&psram_memory);
+// Its atomics stay in internal RAM, like the recorder's
+LearningSession learning;
+LightGuide light_guide(usb_midi.getMidiOut(), LIGHT_GUIDE_CHANNEL);
+RtpMidiSession rtp_midi(RTP_MIDI_NAME);
+PixelNetworkOutput pixel_output(PIXEL_OUTPUT_PROTOCOL, PIXEL_OUTPUT_UNIVERSE);
+AudioInput audio_input;
+BootTimeline boot_timeline;
+bool network_services_started = false;
+MatrixRenderer matrix({ MATRIX_WIDTH, MATRIX_HEIGHT, MATRIX_SERPENTINE, MATRIX_TOP_ORIGIN }, &internal_memory);
 
 /// Setup ///
+/**
+ * The strip and the USB host come first: the keyboard lights up while WiFi connects in the background.
+ */
 void setup() {
   Serial.begin(115200);
-  log_d("Start setup");
+  markBootPhase(BOOT_PHASE_SETUP);
+  if (TRACE_EVENTS) setTraceRecorder(new TraceRecorder(TRACE_EVENTS, &psram_memory));
+  led.setPixelEncoder(&pixel_encoder);
   led.setup();
-  server.setup();
-  usb_midi.setMidiInCallback(&midiInCallbackMain);
+  file_player.setMidiInCallback(&fileMidiInCallback);
+  file_player.setLearningSession(&learning);
+  led.setLearningSession(&learning);
+  if (LIGHT_GUIDE_CHANNEL) light_guide.setSession(&learning);
+  if (MATRIX_WIDTH) {
+    matrix.setMode(MATRIX_MODE);
+    matrix.setRowPeriod(MATRIX_ROW_PERIOD_MS * 1000);
+    led.setMatrix(&matrix);
+    // Falling notes have to enter the matrix before they are played
+    if (MATRIX_MODE == MATRIX_WATERFALL_FALLING) file_player.setPreview(&previewMidiInCallback, matrix.getLookahead());
+  }
+  markBootPhase(BOOT_PHASE_LEDS_READY);
+  usb_midi.setMidiInCallback(&usbMidiInCallback);
   usb_midi.setup();
+  markBootPhase(BOOT_PHASE_USB_READY);
+  if (AUDIO_INPUT) {
+    audio_input.setMidiInCallback(&audioMidiInCallback);
+    audio_input.setThreshold(AUDIO_THRESHOLD);
+    audio_input.setup(AUDIO_PIN_BCK, AUDIO_PIN_WS, AUDIO_PIN_DATA);
+  }
+  file_player.setup();
+  recorder.setup();
+  server.setBenchmark(&benchmark);
+  server.setFilePlayer(&file_player);
+  server.setRecorder(&recorder);
+  server.setBootTimeline(&boot_timeline);
+  server.setTraceRecorder(getTraceRecorder());
+  server.setUsbHost(&usb_midi);
+  server.setMemoryArenas(&internal_memory, &psram_memory);
+  server.setup();
+  // Allocations from now on show up as a drift in GET /memory, marked again once WiFi is up
+  server.markSteadyState();
 }
 
 /// Loop ///
 void loop() {
+  TraceScope loop_trace(TRACE_SPAN_LOOP);
+  if (!network_services_started && server.isReady()) startNetworkServices();
+  traceBegin(TRACE_SPAN_SERVER);
   server.loop();
+  traceEnd(TRACE_SPAN_SERVER);
+  usb_midi.loop();
+  file_player.loop();
+  recorder.loop();
+  if (network_services_started) rtp_midi.loop(micros());
+  audio_input.loop();
+  light_guide.loop(micros());
+  led.loop();
   // led.blinkLoop();
 }
 
 /// Functions definition ///
 
-void midiInCallbackMain(midi_usb_packet packet) {
-  if ( // Note Off
-    packet.midi_type == MIDI_NOTE_OFF 
-    || (packet.midi_type == MIDI_NOTE_ON && packet.midi_data_2 == 0)
-  ) {
-    log_d("Note OFF: %d", packet.midi_data_1);
-    led.lightOff(packet.midi_data_1);
-  } else if (packet.midi_type == MIDI_NOTE_ON) { // Note On
-    log_d("Note ON : %d, velocity: %d", packet.midi_data_1, packet.midi_data_2);
-    led.lightOn(packet.midi_data_1, packet.midi_data_2);
-  } else if (packet.midi_type == 0x0b && packet.midi_data_1 == 0x40) { // Sustain
-    if (packet.midi_data_2 < 64) {
-      log_d("Sustain OFF");
-      led.lightOffSides();
+/**
+ * Services needing the network, started from loop() once the background task brought WiFi up.
+ */
+void startNetworkServices() {
+  network_services_started = true;
+  rtp_midi.setMidiInCallback(&networkMidiInCallback);
+  if (rtp_midi.begin()) {
+    MDNS.begin("pianeon");
+    MDNS.addService("apple-midi", "udp", RTP_MIDI_DEFAULT_PORT);
+  } else {
+    log_e("Unable to open RTP-MIDI session");
+  }
+  if (PIXEL_OUTPUT_PROTOCOL != PIXEL_PROTOCOL_NONE) {
+    if (pixel_output.begin(PIXEL_OUTPUT_ADDRESS)) {
+      led.setNetworkOutput(&pixel_output, PIXEL_OUTPUT_LOCAL_STRIP);
     } else {
-      log_d("Sustain ON");
-      led.lightOnSides();
+      log_e("Unable to open pixel network output");
     }
   }
-}
\ No newline at end of file
+  server.markSteadyState();
+}
+
+void markBootPhase(boot_phase_t phase) {
+  boot_timeline.mark(phase, micros());
+  log_i("Boot phase %s at %lu ms", BootTimeline::getPhaseName(phase), (unsigned long)boot_timeline.getTime(phase) / 1000);
+}
+
+/**
+ * Packets coming from the keyboard are recorded before being handled.
+ */
+void usbMidiInCallback(midi_usb_packet packet) {
+  recorder.record(packet);
+  midiInCallbackMain(packet, NOTE_SOURCE_USB);
+}
+
+void networkMidiInCallback(midi_usb_packet packet) {
+  midiInCallbackMain(packet, NOTE_SOURCE_NETWORK);
+}
+
+void fileMidiInCallback(midi_usb_packet packet) {
+  midiInCallbackMain(packet, NOTE_SOURCE_FILE);
+}
+
+void audioMidiInCallback(midi_usb_packet packet) {
+  midiInCallbackMain(packet, NOTE_SOURCE_AUDIO);
+}
+
+void previewMidiInCallback(midi_usb_packet packet) {
+  led.previewEvent(decodeMidiPacket(packet));
+}
+
+/**
+ * Every input ends here, the source is kept in the note state.
+ * All of them are called from loop(): the USB and audio tasks only queue their packets,
+ * so the renderer and the strip are never driven from two tasks at once.
+ */
+void midiInCallbackMain(midi_usb_packet packet, note_source_t source) {
+  // Thru goes first, the LEDs don't delay it
+  if (MIDI_THRU_SOURCES & (1 << source)) usb_midi.send(packet);
+  // The benchmark drives the strip with its own scripted events
+  if (benchmark.isRunning()) return;
+  TraceScope event_trace(TRACE_SPAN_MIDI_EVENT);
+  const midi_event_t event = decodeMidiPacket(packet);
+  // What is played is checked against the song being learned, the song itself is not
+  if (source != NOTE_SOURCE_FILE) learning.handleEvent(event);
+  switch (event.type) {
+    case MIDI_EVENT_NOTE_OFF:
+      log_d("Note OFF: %d", event.note);
+      break;
+    case MIDI_EVENT_NOTE_ON:
+      log_d("Note ON : %d, velocity: %d", event.note, event.velocity);
+      if (!boot_timeline.isReached(BOOT_PHASE_FIRST_NOTE)) markBootPhase(BOOT_PHASE_FIRST_NOTE);
+      break;
+    case MIDI_EVENT_SUSTAIN_ON:
+      log_d("Sustain ON");
+      break;
+    case MIDI_EVENT_SUSTAIN_OFF:
+      log_d("Sustain OFF");
+      break;
+    case MIDI_EVENT_PROGRAM_CHANGE:
+      log_d("Program change: %d", event.note);
+      break;
+    default:
+      return;
+  }
+  led.handleEvent(event, source);
+}
@@ -0,0 +1,84 @@
+/**
+ * Fuzz harness of the USB MIDI descriptor parser, the bytes come straight from any device plugged in.
+ * Checks that the parser stays within the input and its limits, and always ends.
+ *
+ * Not run by pio test. With libFuzzer:
+ *   clang++ -std=gnu++17 -g -O1 -fsanitize=fuzzer,address,undefined -Iinclude \
+ *     src/UsbMidiDescriptor.cpp test/fuzz_usb_descriptor/fuzz_main.cpp -o fuzz_usb_descriptor
+ *   ./fuzz_usb_descriptor -max_len=65535
+ * Without clang, build with -DFUZZ_STANDALONE and any compiler: the files given as arguments are replayed,
+ * or random mutations of a keyboard descriptor are run when there are none.
+ */
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "UsbMidiDescriptor.h"
+
+#define STANDALONE_RUNS 1000000
+
+/// Functions definition ///
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  usb_midi_topology_t topology;
+  const usb_descriptor_status_t status = parseUsbMidiTopology(data, size, &topology);
+  if (topology.interface_count > USB_MIDI_MAX_INTERFACES) abort();
+  if (topology.in_endpoint_count > USB_MIDI_MAX_ENDPOINTS || topology.out_endpoint_count > USB_MIDI_MAX_ENDPOINTS) abort();
+  if (topology.jack_count > USB_MIDI_MAX_JACKS || topology.cable_count > USB_MIDI_MAX_CABLES) abort();
+  // Each descriptor takes at least 2 bytes
+  if (topology.descriptor_count > size / 2) abort();
+  if (topology.dropped_count > topology.descriptor_count) abort();
+  if (status == USB_DESCRIPTOR_OK && topology.in_endpoint_count == 0) abort();
+  for (uint8_t i = 0; i < topology.in_endpoint_count; i++) {
+    const usb_midi_endpoint_t* endpoint = &topology.in_endpoints[i];
+    if (endpoint->interface_index >= topology.interface_count || !(endpoint->address & 0x80)) abort();
+    if (endpoint->cable_count == 0 || endpoint->cable_count > USB_MIDI_MAX_CABLES) abort();
+  }
+  for (uint8_t i = 0; i < topology.out_endpoint_count; i++) {
+    const usb_midi_endpoint_t* endpoint = &topology.out_endpoints[i];
+    if (endpoint->interface_index >= topology.interface_count || (endpoint->address & 0x80)) abort();
+  }
+  return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+static const uint8_t seed[] = {
+  0x09, 0x02, 0x2c, 0x00, 0x01, 0x01, 0x00, 0x80, 0x32,
+  0x09, 0x04, 0x02, 0x01, 0x02, 0x01, 0x03, 0x00, 0x00,
+  0x07, 0x05, 0x02, 0x02, 0x00, 0x02, 0x00,
+  0x05, 0x25, 0x01, 0x01, 0x10,
+  0x07, 0x05, 0x83, 0x02, 0x00, 0x02, 0x00,
+  0x07, 0x25, 0x01, 0x03, 0x11, 0x12, 0x13,
+};
+
+static int replayFile(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) return 1;
+  static uint8_t data[65536];
+  const size_t size = fread(data, 1, sizeof(data), file);
+  fclose(file);
+  return LLVMFuzzerTestOneInput(data, size);
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    if (replayFile(argv[i]) != 0) printf("Unable to read %s\n", argv[i]);
+  }
+  if (argc > 1) return 0;
+  srand(1);
+  uint8_t data[2 * sizeof(seed)];
+  for (int run = 0; run < STANDALONE_RUNS; run++) {
+    memcpy(data, seed, sizeof(seed));
+    const size_t size = rand() % sizeof(data);
+    for (size_t i = sizeof(seed); i < size; i++) data[i] = rand();
+    const int mutations = 1 + rand() % 8;
+    for (int i = 0; i < mutations && size > 0; i++) data[rand() % size] = rand();
+    LLVMFuzzerTestOneInput(data, size);
+  }
+  printf("%d inputs\n", STANDALONE_RUNS);
+  return 0;
+}
+
+#endif /* FUZZ_STANDALONE */
@@ -0,0 +1,370 @@
+/**
+ * Host benchmark of the MIDI to frame pipeline.
+ * Replays the synthetic workloads through the decoder, the note state and the frame composition
+ * for several strip lengths, then saves the results as JSON.
+ * Also checks that the steady state of the render path never allocates, and compares
+ * the runtime and compile time pixel encoders.
+ *
+ * Run with: pio test -e native -f test_bench_pipeline
+ * Output path can be changed with the PIANEON_BENCH_OUTPUT environment variable.
+ */
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "BenchmarkWorkloads.h"
+#include "Compositor.h"
+#include "EffectCompiler.h"
+#include "MatrixRenderer.h"
+#include "MemoryArena.h"
+#include "NoteRenderer.h"
+#include "PixelEncoder.h"
+#include "midi_decoder.h"
+
+#define DEFAULT_OUTPUT_PATH "bench_pipeline.json"
+// Each measure is repeated until it lasts at least this long
+#define MIN_MEASURE_NS 50000000LL
+// Blending all the layers of a 175 LEDs strip must stay far below this
+#define MAX_COMPOSITOR_NS 1000000
+
+/// Types ///
+
+typedef struct {
+  const char* workload;
+  uint16_t led_count;
+  size_t events;
+  double events_per_sec;
+  double ns_per_event;
+  double compose_ns;
+  double pipeline_ns_per_event;
+} bench_result_t;
+
+typedef struct {
+  const char* format;
+  uint16_t led_count;
+  double runtime_ns;
+  double static_ns;
+} encoder_result_t;
+
+/// Variables ///
+
+static const uint16_t led_counts[] = { 175, 500, 2000 };
+static timed_midi_packet workload_events[BENCH_WORKLOAD_MAX_EVENTS];
+static bench_result_t results[BENCH_WORKLOAD_COUNT * 3];
+static size_t result_count = 0;
+static double compositor_ns = 0;
+static encoder_result_t encoder_results[4];
+static size_t encoder_result_count = 0;
+// Keeps the compiler from optimizing the measured loops away
+static volatile uint32_t sink;
+// Every operator new of the program, counted while counting_allocations is set
+static size_t allocation_count = 0;
+static bool counting_allocations = false;
+
+static const char steady_state_script[] =
+  "mode note\n"
+  "  hue r6, r0\n"
+  "  px r4, r6\n";
+
+/// Functions definition ///
+
+// GCC sees the malloc behind operator new and the free behind operator delete as a mismatch
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+  if (counting_allocations) allocation_count++;
+  void* pointer = malloc(size ? size : 1);
+  if (pointer == NULL) throw std::bad_alloc();
+  return pointer;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+  free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+  operator delete(pointer);
+}
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+/**
+ * Decode the events and update the note state, without composing frames.
+ */
+static double measureUpdate(NoteRenderer* renderer, size_t event_count) {
+  int64_t elapsed = 0;
+  size_t processed = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    renderer->clear();
+    const int64_t start = nowNs();
+    for (size_t i = 0; i < event_count; i++) {
+      renderer->handleEvent(decodeMidiPacket(workload_events[i].packet));
+    }
+    elapsed += nowNs() - start;
+    processed += event_count;
+  }
+  return (double)elapsed / processed;
+}
+
+/**
+ * Time the frame composition alone, one frame per event as the firmware does.
+ */
+static double measureCompose(NoteRenderer* renderer, size_t event_count) {
+  int64_t elapsed = 0;
+  size_t frames = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    renderer->clear();
+    for (size_t i = 0; i < event_count; i++) {
+      renderer->handleEvent(decodeMidiPacket(workload_events[i].packet));
+      const int64_t start = nowNs();
+      if (renderer->render()) frames++;
+      elapsed += nowNs() - start;
+      sink = renderer->getPixel(i % renderer->getLedCount());
+    }
+  }
+  return frames ? (double)elapsed / frames : 0;
+}
+
+/**
+ * Whole pipeline: decode, state update and frame composition.
+ */
+static double measurePipeline(NoteRenderer* renderer, size_t event_count) {
+  int64_t elapsed = 0;
+  size_t processed = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    renderer->clear();
+    const int64_t start = nowNs();
+    for (size_t i = 0; i < event_count; i++) {
+      renderer->handleEvent(decodeMidiPacket(workload_events[i].packet));
+      renderer->render();
+    }
+    elapsed += nowNs() - start;
+    processed += event_count;
+    sink = renderer->getPixel(0);
+  }
+  return (double)elapsed / processed;
+}
+
+static void benchLedCount(uint16_t led_count) {
+  NoteRenderer renderer(led_count);
+  for (int workload = 0; workload < BENCH_WORKLOAD_COUNT; workload++) {
+    const size_t event_count = generateBenchWorkload((bench_workload_t)workload, workload_events, BENCH_WORKLOAD_MAX_EVENTS);
+    TEST_ASSERT_GREATER_THAN(0, event_count);
+    TEST_ASSERT_LESS_THAN(BENCH_WORKLOAD_MAX_EVENTS, event_count);
+
+    bench_result_t* result = &results[result_count++];
+    result->workload = getBenchWorkloadName((bench_workload_t)workload);
+    result->led_count = led_count;
+    result->events = event_count;
+    result->ns_per_event = measureUpdate(&renderer, event_count);
+    result->events_per_sec = 1e9 / result->ns_per_event;
+    result->compose_ns = measureCompose(&renderer, event_count);
+    result->pipeline_ns_per_event = measurePipeline(&renderer, event_count);
+
+    // Every workload releases all its notes, only the sustain sides may stay lit
+    renderer.render();
+    for (uint16_t i = 1; i < led_count - 1; i++) {
+      TEST_ASSERT_EQUAL_HEX32(0, renderer.getPixel(i));
+    }
+
+    printf("%-14s %5d leds: %10.0f events/s, %7.1f ns/event, compose %8.1f ns, pipeline %8.1f ns/event\n",
+      result->workload, led_count, result->events_per_sec, result->ns_per_event,
+      result->compose_ns, result->pipeline_ns_per_event);
+  }
+}
+
+/**
+ * Blend all the layers full, cycling through the 4 blend modes, the worst case of a frame.
+ */
+static double measureCompositor(uint16_t led_count) {
+  Compositor compositor(led_count);
+  const blend_mode_t modes[] = { BLEND_ADD, BLEND_ALPHA, BLEND_MAX, BLEND_MULTIPLY };
+  for (uint8_t i = 0; i < LAYER_COUNT; i++) {
+    uint8_t* layer = compositor.getLayer((layer_id_t)i);
+    for (uint16_t j = 0; j < 3 * led_count; j++) layer[j] = (j * 37 + i * 91) & 0xff;
+    compositor.setBlendMode((layer_id_t)i, modes[i % 4]);
+    compositor.setOpacity((layer_id_t)i, 200);
+  }
+  uint8_t* frame = new uint8_t[3 * led_count];
+  int64_t elapsed = 0;
+  size_t frames = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    const int64_t start = nowNs();
+    for (int i = 0; i < 1000; i++) compositor.compose(frame);
+    elapsed += nowNs() - start;
+    frames += 1000;
+    sink = frame[frames % (3 * led_count)];
+  }
+  delete[] frame;
+  return (double)elapsed / frames;
+}
+
+static void writeResults() {
+  const char* path = getenv("PIANEON_BENCH_OUTPUT");
+  if (path == NULL) path = DEFAULT_OUTPUT_PATH;
+  FILE* file = fopen(path, "w");
+  TEST_ASSERT_NOT_NULL(file);
+  fprintf(file, "{\n  \"benchmark\": \"pipeline\",\n  \"results\": [\n");
+  for (size_t i = 0; i < result_count; i++) {
+    const bench_result_t* result = &results[i];
+    fprintf(file,
+      "    { \"workload\": \"%s\", \"led_count\": %d, \"events\": %zu, \"events_per_sec\": %.0f, "
+      "\"ns_per_event\": %.2f, \"compose_ns\": %.2f, \"pipeline_ns_per_event\": %.2f }%s\n",
+      result->workload, result->led_count, result->events, result->events_per_sec,
+      result->ns_per_event, result->compose_ns, result->pipeline_ns_per_event,
+      i + 1 < result_count ? "," : "");
+  }
+  fprintf(file, "  ],\n  \"compositor_ns\": %.2f,\n  \"encoders\": [\n", compositor_ns);
+  for (size_t i = 0; i < encoder_result_count; i++) {
+    const encoder_result_t* result = &encoder_results[i];
+    fprintf(file, "    { \"format\": \"%s\", \"led_count\": %d, \"runtime_ns\": %.2f, \"static_ns\": %.2f }%s\n",
+      result->format, result->led_count, result->runtime_ns, result->static_ns,
+      i + 1 < encoder_result_count ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+  printf("Results saved to %s\n", path);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_bench_175_leds() {
+  benchLedCount(led_counts[0]);
+}
+
+void test_bench_500_leds() {
+  benchLedCount(led_counts[1]);
+}
+
+void test_bench_2000_leds() {
+  benchLedCount(led_counts[2]);
+}
+
+void test_bench_compositor() {
+  compositor_ns = measureCompositor(led_counts[0]);
+  printf("compositor     %5d leds: %d layers in %.1f ns\n", led_counts[0], LAYER_COUNT, compositor_ns);
+  TEST_ASSERT_LESS_THAN(MAX_COMPOSITOR_NS, compositor_ns);
+}
+
+static double measureEncoder(PixelEncoder* encoder, const uint8_t* frame, uint16_t led_count, uint8_t* output) {
+  int64_t elapsed = 0;
+  size_t frames = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    const int64_t start = nowNs();
+    for (int i = 0; i < 1000; i++) encoder->encode(frame, led_count, output, 200);
+    elapsed += nowNs() - start;
+    frames += 1000;
+    sink = output[frames % led_count];
+  }
+  return (double)elapsed / frames;
+}
+
+/**
+ * Both encoders must write the same bytes, then each one is timed on a frame of the workloads.
+ */
+template <uint16_t LedCount, pixel_order_t Order, pixel_mapping_t Mapping>
+static void benchEncoder(const char* format) {
+  StaticPixelEncoder<LedCount, Order, Mapping> static_encoder;
+  RuntimePixelEncoder runtime_encoder(Order, Mapping);
+  uint8_t* frame = new uint8_t[3 * LedCount];
+  for (uint16_t i = 0; i < 3 * LedCount; i++) frame[i] = (i * 37) & 0xff;
+  const size_t output_size = LedCount * getPixelSize(Order);
+  uint8_t* expected = new uint8_t[output_size];
+  uint8_t* output = new uint8_t[output_size];
+  runtime_encoder.encode(frame, LedCount, expected, 200);
+  static_encoder.encode(frame, LedCount, output, 200);
+  const bool same = memcmp(expected, output, output_size) == 0;
+
+  encoder_result_t* result = &encoder_results[encoder_result_count++];
+  result->format = format;
+  result->led_count = LedCount;
+  result->runtime_ns = measureEncoder(&runtime_encoder, frame, LedCount, output);
+  result->static_ns = measureEncoder(&static_encoder, frame, LedCount, output);
+  printf("encoder %-6s %5d leds: runtime %8.1f ns, static %8.1f ns\n", format, LedCount, result->runtime_ns, result->static_ns);
+  delete[] frame;
+  delete[] expected;
+  delete[] output;
+  TEST_ASSERT_TRUE_MESSAGE(same, "static and runtime encoders differ");
+}
+
+void test_bench_encoders() {
+  benchEncoder<175, PIXEL_ORDER_GRB, PIXEL_MAPPING_FORWARD>("grb");
+  benchEncoder<2000, PIXEL_ORDER_GRB, PIXEL_MAPPING_FORWARD>("grb");
+  benchEncoder<175, PIXEL_ORDER_RGB, PIXEL_MAPPING_REVERSED>("rgb");
+  benchEncoder<175, PIXEL_ORDER_GRBW, PIXEL_MAPPING_FORWARD>("grbw");
+}
+
+/**
+ * Everything is allocated by the setup, then whole workloads go through the renderer,
+ * its effect script and the matrix without a single allocation.
+ */
+void test_steady_state_allocations() {
+  const uint16_t led_count = led_counts[0];
+  MemoryArena memory("internal", MEMORY_REGION_INTERNAL, 64 * 1024);
+  NoteRenderer* renderer = memory.create<NoteRenderer>(led_count, (SettingsStore*)NULL, &memory);
+  MatrixRenderer matrix({ 25, 7, true, false }, &memory);
+  EffectCompiler compiler;
+  TEST_ASSERT_TRUE(compiler.compile(steady_state_script, sizeof(steady_state_script) - 1));
+  TEST_ASSERT_TRUE(renderer->setEffect(compiler.getBytecode(), compiler.getBytecodeLength()));
+  renderer->render();
+  TEST_ASSERT_EQUAL(0, memory.getOverflowCount());
+
+  allocation_count = 0;
+  uint32_t now_us = 0;
+  for (int workload = 0; workload < BENCH_WORKLOAD_COUNT; workload++) {
+    // Sorting the generated events allocates, only the replay is counted
+    const size_t event_count = generateBenchWorkload((bench_workload_t)workload, workload_events, BENCH_WORKLOAD_MAX_EVENTS);
+    counting_allocations = true;
+    for (size_t i = 0; i < event_count; i++) {
+      now_us += 1000;
+      renderer->handleEvent(decodeMidiPacket(workload_events[i].packet), now_us);
+      renderer->animate(now_us);
+      renderer->render();
+      matrix.update(now_us, renderer->getNoteColors());
+      matrix.render();
+    }
+    counting_allocations = false;
+  }
+  sink = renderer->getPixel(0);
+  printf("steady state   %5d leds: %zu allocations\n", led_count, allocation_count);
+  // Objects created in an arena are never destroyed
+  TEST_ASSERT_EQUAL(0, allocation_count);
+}
+
+void test_write_results() {
+  writeResults();
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_175_leds);
+  RUN_TEST(test_bench_500_leds);
+  RUN_TEST(test_bench_2000_leds);
+  RUN_TEST(test_bench_compositor);
+  RUN_TEST(test_bench_encoders);
+  RUN_TEST(test_steady_state_allocations);
+  RUN_TEST(test_write_results);
+  return UNITY_END();
+}
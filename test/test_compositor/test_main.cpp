@@ -0,0 +1,199 @@
+/**
+ * Host test of the layer blending: each mode on fixed pixels, the opacity scaling, the layers left out
+ * and the first opaque layer copied into the frame.
+ *
+ * Run with: pio test -e native -f test_compositor
+ */
+#include <unity.h>
+
+#include <cstring>
+
+#include "Compositor.h"
+
+#define PIXEL_COUNT 4
+
+/// Variables ///
+
+static Compositor* compositor = NULL;
+static uint8_t frame[3 * PIXEL_COUNT];
+
+/// Functions definition ///
+
+static void setPixel(uint8_t* pixels, int pixel, uint32_t color) {
+  pixels[3 * pixel] = color >> 16;
+  pixels[3 * pixel + 1] = color >> 8;
+  pixels[3 * pixel + 2] = color;
+}
+
+static uint32_t getPixel(int pixel) {
+  return (frame[3 * pixel] << 16) | (frame[3 * pixel + 1] << 8) | frame[3 * pixel + 2];
+}
+
+// Only the given layers take part in the composition
+static void useLayers(layer_id_t bottom, layer_id_t top) {
+  for (int layer = 0; layer < LAYER_COUNT; layer++) compositor->setEnabled((layer_id_t)layer, layer == bottom || layer == top);
+}
+
+// Bottom layer opaque, with the same color on every pixel
+static void fillBottom(layer_id_t layer, uint32_t color) {
+  for (int pixel = 0; pixel < PIXEL_COUNT; pixel++) setPixel(compositor->getLayer(layer), pixel, color);
+  compositor->setBlendMode(layer, BLEND_ALPHA);
+  compositor->setOpacity(layer, 255);
+}
+
+void setUp() {
+  compositor = new Compositor(PIXEL_COUNT);
+  // Leftovers of the previous frame, every pixel must be written
+  memset(frame, 0xa5, sizeof(frame));
+}
+
+void tearDown() {
+  delete compositor;
+}
+
+void test_add() {
+  useLayers(LAYER_BACKGROUND, LAYER_PARTICLES);
+  fillBottom(LAYER_BACKGROUND, 0xc80a00);
+  uint8_t* particles = compositor->getLayer(LAYER_PARTICLES);
+  setPixel(particles, 0, 0x646464);
+  setPixel(particles, 1, 0x37f5ff);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0xff6e64, getPixel(0));
+  // Saturated channel by channel
+  TEST_ASSERT_EQUAL_HEX32(0xffffff, getPixel(1));
+  TEST_ASSERT_EQUAL_HEX32(0xc80a00, getPixel(2));
+
+  // Half opacity: 100 * 129 >> 8 = 50
+  compositor->setOpacity(LAYER_PARTICLES, 128);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0xfa3c32, getPixel(0));
+}
+
+void test_max() {
+  useLayers(LAYER_BACKGROUND, LAYER_SCRIPT);
+  fillBottom(LAYER_BACKGROUND, 0x646464);
+  compositor->setBlendMode(LAYER_SCRIPT, BLEND_MAX);
+  setPixel(compositor->getLayer(LAYER_SCRIPT), 0, 0xc83296);
+  setPixel(compositor->getLayer(LAYER_SCRIPT), 1, 0xfa0000);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0xc86496, getPixel(0));
+  TEST_ASSERT_EQUAL_HEX32(0xfa6464, getPixel(1));
+
+  // 150 * 129 >> 8 = 75 stays under the frame, 250 * 129 >> 8 = 125 goes over it
+  compositor->setOpacity(LAYER_SCRIPT, 128);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0x7d6464, getPixel(1));
+  setPixel(compositor->getLayer(LAYER_SCRIPT), 1, 0x960000);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0x646464, getPixel(1));
+}
+
+/**
+ * A pixel with a single channel lit covers the three channels below, a black pixel leaves them.
+ */
+void test_alpha_coverage() {
+  useLayers(LAYER_BACKGROUND, LAYER_NOTES);
+  fillBottom(LAYER_BACKGROUND, 0xc86432);
+  uint8_t* notes = compositor->getLayer(LAYER_NOTES);
+  setPixel(notes, 0, 0x000002);
+  setPixel(notes, 1, 0x00ff00);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0x000002, getPixel(0));
+  TEST_ASSERT_EQUAL_HEX32(0x00ff00, getPixel(1));
+  TEST_ASSERT_EQUAL_HEX32(0xc86432, getPixel(2));
+  TEST_ASSERT_EQUAL_HEX32(0xc86432, getPixel(3));
+
+  // Half way between the frame and the layer, with opacity 127: (l - f) * 128 >> 8
+  compositor->setOpacity(LAYER_NOTES, 127);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0x64321a, getPixel(0));
+  TEST_ASSERT_EQUAL_HEX32(0x64b119, getPixel(1));
+  TEST_ASSERT_EQUAL_HEX32(0xc86432, getPixel(2));
+}
+
+void test_multiply() {
+  useLayers(LAYER_BACKGROUND, LAYER_OVERLAY);
+  fillBottom(LAYER_BACKGROUND, 0xc86432);
+  compositor->setBlendMode(LAYER_OVERLAY, BLEND_MULTIPLY);
+  uint8_t* overlay = compositor->getLayer(LAYER_OVERLAY);
+  setPixel(overlay, 0, 0xffffff);
+  setPixel(overlay, 1, 0x000000);
+  setPixel(overlay, 2, 0x80ff00);
+  setPixel(overlay, 3, 0xffffff);
+  compositor->compose(frame);
+  // White keeps the frame, black darkens it fully
+  TEST_ASSERT_EQUAL_HEX32(0xc86432, getPixel(0));
+  TEST_ASSERT_EQUAL_HEX32(0x000000, getPixel(1));
+  // 200 * (256 - 127) >> 8 = 100
+  TEST_ASSERT_EQUAL_HEX32(0x646400, getPixel(2));
+
+  // Black at opacity 127 halves the frame, white still keeps it
+  compositor->setOpacity(LAYER_OVERLAY, 127);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0xc86432, getPixel(0));
+  TEST_ASSERT_EQUAL_HEX32(0x643219, getPixel(1));
+}
+
+/**
+ * Disabled layers and layers at opacity 0 add nothing, whatever they hold.
+ */
+void test_skipped_layers() {
+  useLayers(LAYER_BACKGROUND, LAYER_NOTES);
+  fillBottom(LAYER_BACKGROUND, 0x102030);
+  setPixel(compositor->getLayer(LAYER_NOTES), 0, 0xffffff);
+  compositor->setEnabled(LAYER_NOTES, false);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0x102030, getPixel(0));
+  compositor->setEnabled(LAYER_NOTES, true);
+  compositor->setOpacity(LAYER_NOTES, 0);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0x102030, getPixel(0));
+
+  // Nothing enabled, the frame is black
+  compositor->setEnabled(LAYER_BACKGROUND, false);
+  compositor->setEnabled(LAYER_NOTES, false);
+  compositor->compose(frame);
+  for (int pixel = 0; pixel < PIXEL_COUNT; pixel++) TEST_ASSERT_EQUAL_HEX32(0, getPixel(pixel));
+}
+
+/**
+ * The first opaque layer is copied as is, over whatever the frame held, in any mode. A translucent one
+ * is blended over black, and a multiplied one over nothing leaves black.
+ */
+void test_first_layer() {
+  useLayers(LAYER_PARTICLES, LAYER_PARTICLES);
+  uint8_t* particles = compositor->getLayer(LAYER_PARTICLES);
+  setPixel(particles, 0, 0x123456);
+  setPixel(particles, 2, 0xff0080);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_MEMORY(particles, frame, sizeof(frame));
+
+  compositor->setOpacity(LAYER_PARTICLES, 127);
+  memset(frame, 0xa5, sizeof(frame));
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0x091a2b, getPixel(0));
+  TEST_ASSERT_EQUAL_HEX32(0, getPixel(1));
+  TEST_ASSERT_EQUAL_HEX32(0x7f0040, getPixel(2));
+
+  // The multiplied layer is skipped, the next one is the first
+  useLayers(LAYER_NOTES, LAYER_OVERLAY);
+  compositor->setBlendMode(LAYER_NOTES, BLEND_MULTIPLY);
+  setPixel(compositor->getLayer(LAYER_NOTES), 0, 0xffffff);
+  compositor->compose(frame);
+  for (int pixel = 0; pixel < PIXEL_COUNT; pixel++) TEST_ASSERT_EQUAL_HEX32(0, getPixel(pixel));
+  setPixel(compositor->getLayer(LAYER_OVERLAY), 1, 0x0000ff);
+  compositor->compose(frame);
+  TEST_ASSERT_EQUAL_HEX32(0, getPixel(0));
+  TEST_ASSERT_EQUAL_HEX32(0x0000ff, getPixel(1));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_add);
+  RUN_TEST(test_max);
+  RUN_TEST(test_alpha_coverage);
+  RUN_TEST(test_multiply);
+  RUN_TEST(test_skipped_layers);
+  RUN_TEST(test_first_layer);
+  return UNITY_END();
+}
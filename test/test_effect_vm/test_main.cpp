@@ -0,0 +1,276 @@
+/**
+ * Host test of the effect scripts: compiling, running through the renderer, and the guards of the sandbox.
+ * Also measures the cost of an instruction, to size the budget of a frame.
+ *
+ * Run with: pio test -e native -f test_effect_vm
+ * Set PIANEON_EFFECT_SCRIPT to the path of a script to compile it and print its cost per frame.
+ */
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "EffectCompiler.h"
+#include "EffectVm.h"
+#include "NoteRenderer.h"
+#include "palette.h"
+
+#define LED_COUNT 175
+#define MIN_MEASURE_NS 200000000LL
+
+/// Variables ///
+
+// Rainbow scrolling along the strip, one full turn of hue per strip
+static const char rainbow_script[] =
+  "mode pixel\n"
+  "; hue = (pixel * 360 / count + time / 10) % 360\n"
+  "  ldi r6, 360\n"
+  "  mul r7, r0, r6\n"
+  "  div r7, r7, r1\n"
+  "  ldi r8, 10\n"
+  "  div r8, r2, r8\n"
+  "  add r7, r7, r8\n"
+  "  hue r9, r7\n"
+  "  ldi r10, 64\n"
+  "  scale r9, r9, r10\n"
+  "  px r0, r9\n";
+
+// Halo on both sides of each pressed note, dimming for a second
+static const char halo_script[] =
+  "mode note\n"
+  "  ldi r6, 1000\n"
+  "  slt r7, r3, r6\n"
+  "  jz r7, done\n"
+  "  sub r8, r6, r3\n"
+  "  ldi r9, 255\n"
+  "  mul r8, r8, r9\n"
+  "  div r8, r8, r6\n"
+  "  scale r10, r5, r8\n"
+  "  addi r11, r4, -1\n"
+  "  px r11, r10\n"
+  "  addi r11, r4, 1\n"
+  "  px r11, r10\n"
+  "done:\n";
+
+static const char infinite_script[] =
+  "mode pixel\n"
+  "loop:\n"
+  "  addi r6, r6, 1\n"
+  "  jmp loop\n";
+
+static volatile uint32_t sink;
+
+/// Functions definition ///
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+static bool compile(EffectCompiler* compiler, const char* source) {
+  const bool compiled = compiler->compile(source, strlen(source));
+  if (!compiled) printf("line %d: %s\n", compiler->getErrorLine(), compiler->getError());
+  return compiled;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_compile_errors() {
+  EffectCompiler compiler;
+  TEST_ASSERT_FALSE(compiler.compile("mode pixel\n  foo r1, r2\n", 22));
+  TEST_ASSERT_EQUAL(2, compiler.getErrorLine());
+  TEST_ASSERT_FALSE(compiler.compile("add r1, r2, r16\n", 16));
+  TEST_ASSERT_EQUAL(1, compiler.getErrorLine());
+  TEST_ASSERT_FALSE(compiler.compile("add r1, r2\n", 11));
+  TEST_ASSERT_FALSE(compiler.compile("jmp nowhere\n", 12));
+  TEST_ASSERT_FALSE(compiler.compile("addi r1, r1, 200\n", 17));
+  TEST_ASSERT_FALSE(compiler.compile("ldi r1, 12z\n", 12));
+  TEST_ASSERT_FALSE(compiler.compile("; nothing\n", 10));
+  TEST_ASSERT_FALSE(compiler.compile("px r0, r1\nmode note\n", 20));
+  TEST_ASSERT_TRUE(compile(&compiler, rainbow_script));
+  TEST_ASSERT_EQUAL(EFFECT_HEADER_SIZE + 10 * EFFECT_INSTRUCTION_SIZE, compiler.getBytecodeLength());
+}
+
+void test_load_immediates() {
+  EffectCompiler compiler;
+  // ldi of a 32 bits value takes two instructions
+  TEST_ASSERT_TRUE(compile(&compiler, "ldi r1, 0x123456\nldi r2, -5\nldi r3, 40000\npx r0, r1\n"));
+  TEST_ASSERT_EQUAL(EFFECT_HEADER_SIZE + 6 * EFFECT_INSTRUCTION_SIZE, compiler.getBytecodeLength());
+  NoteRenderer renderer(4);
+  TEST_ASSERT_TRUE(renderer.setEffect(compiler.getBytecode(), compiler.getBytecodeLength()));
+  renderer.animate(0);
+  renderer.render();
+  for (uint16_t i = 0; i < 4; i++) TEST_ASSERT_EQUAL_HEX32(0x123456, renderer.getPixel(i));
+}
+
+void test_invalid_bytecode() {
+  EffectCompiler compiler;
+  TEST_ASSERT_TRUE(compile(&compiler, halo_script));
+  uint8_t bytecode[EFFECT_MAX_BYTECODE_SIZE];
+  const size_t length = compiler.getBytecodeLength();
+  memcpy(bytecode, compiler.getBytecode(), length);
+  EffectVm vm;
+  TEST_ASSERT_TRUE(vm.load(bytecode, length));
+  TEST_ASSERT_EQUAL(EFFECT_RUN_PER_NOTE, vm.getRunMode());
+  TEST_ASSERT_FALSE(vm.load(bytecode, length - 1));
+  TEST_ASSERT_FALSE(vm.load(bytecode, EFFECT_HEADER_SIZE));
+  bytecode[0] = 'Q';
+  TEST_ASSERT_FALSE(vm.load(bytecode, length));
+  bytecode[0] = 'P';
+  // Register out of range
+  bytecode[EFFECT_HEADER_SIZE + 1] = EFFECT_REGISTER_COUNT;
+  TEST_ASSERT_FALSE(vm.load(bytecode, length));
+  bytecode[EFFECT_HEADER_SIZE + 1] = 6;
+  // Jump past the end
+  const uint8_t jump[EFFECT_INSTRUCTION_SIZE] = { EFFECT_OP_JMP, 0, 0x01, 0x00 };
+  memcpy(bytecode + EFFECT_HEADER_SIZE, jump, sizeof(jump));
+  TEST_ASSERT_FALSE(vm.load(bytecode, length));
+  // Unknown opcode
+  bytecode[EFFECT_HEADER_SIZE] = EFFECT_OP_COUNT;
+  TEST_ASSERT_FALSE(vm.load(bytecode, length));
+  NoteRenderer renderer(LED_COUNT);
+  TEST_ASSERT_FALSE(renderer.setEffect(bytecode, length));
+}
+
+void test_rainbow_script() {
+  EffectCompiler compiler;
+  TEST_ASSERT_TRUE(compile(&compiler, rainbow_script));
+  NoteRenderer renderer(LED_COUNT);
+  TEST_ASSERT_TRUE(renderer.setEffect(compiler.getBytecode(), compiler.getBytecodeLength()));
+  TEST_ASSERT_TRUE(renderer.animate(0));
+  TEST_ASSERT_TRUE(renderer.render());
+  TEST_ASSERT_TRUE(renderer.getEffect()->isLoaded());
+  TEST_ASSERT_EQUAL(10 * LED_COUNT, renderer.getEffect()->getLastFrameCost());
+  // Pixel 0 at time 0 has the hue 0, red at a quarter of the brightness
+  TEST_ASSERT_EQUAL_HEX32(0x400000, renderer.getPixel(0));
+  for (uint16_t i = 0; i < LED_COUNT; i++) TEST_ASSERT_NOT_EQUAL(0, renderer.getPixel(i));
+  // Time moves the colors
+  const uint32_t first = renderer.getPixel(0);
+  TEST_ASSERT_TRUE(renderer.animate(1200000));
+  TEST_ASSERT_TRUE(renderer.render());
+  TEST_ASSERT_NOT_EQUAL(first, renderer.getPixel(0));
+  // Removed by the next render
+  renderer.setEffect(NULL, 0);
+  renderer.animate(1300000);
+  renderer.render();
+  TEST_ASSERT_FALSE(renderer.getEffect()->isLoaded());
+  for (uint16_t i = 0; i < LED_COUNT; i++) TEST_ASSERT_EQUAL_HEX32(0, renderer.getPixel(i));
+  TEST_ASSERT_FALSE(renderer.animate(1400000));
+}
+
+void test_halo_script() {
+  EffectCompiler compiler;
+  TEST_ASSERT_TRUE(compile(&compiler, halo_script));
+  NoteRenderer renderer(LED_COUNT);
+  TEST_ASSERT_TRUE(renderer.setEffect(compiler.getBytecode(), compiler.getBytecodeLength()));
+  renderer.noteOn(60, 127, 100000);
+  renderer.animate(100000);
+  renderer.render();
+  const int index = NoteRenderer::computePixelIndex(60);
+  const uint32_t color = renderer.getPixel(index);
+  TEST_ASSERT_NOT_EQUAL(0, color);
+  TEST_ASSERT_EQUAL_HEX32(color, renderer.getPixel(index - 1));
+  TEST_ASSERT_EQUAL_HEX32(color, renderer.getPixel(index + 1));
+  TEST_ASSERT_EQUAL_HEX32(0, renderer.getPixel(index + 2));
+  // Gone after a second
+  renderer.animate(1200000);
+  renderer.render();
+  TEST_ASSERT_EQUAL_HEX32(0, renderer.getPixel(index - 1));
+  TEST_ASSERT_EQUAL_HEX32(color, renderer.getPixel(index));
+}
+
+void test_budget_overrun() {
+  EffectCompiler compiler;
+  TEST_ASSERT_TRUE(compile(&compiler, infinite_script));
+  EffectVm vm;
+  TEST_ASSERT_TRUE(vm.load(compiler.getBytecode(), compiler.getBytecodeLength()));
+  vm.setBudget(5000);
+  uint8_t layer[3 * LED_COUNT];
+  uint8_t notes_layer[3 * LED_COUNT];
+  memset(notes_layer, 0, sizeof(notes_layer));
+  NoteState notes;
+  uint32_t note_colors[NOTE_COUNT];
+  memset(note_colors, 0, sizeof(note_colors));
+  const effect_frame_t frame = { layer, notes_layer, LED_COUNT, 0, &notes, note_colors };
+  TEST_ASSERT_FALSE(vm.runFrame(&frame));
+  TEST_ASSERT_EQUAL(5000, vm.getLastFrameCost());
+  TEST_ASSERT_FALSE(vm.runFrame(&frame));
+  TEST_ASSERT_EQUAL(2, vm.getOverrunCount());
+
+  // The renderer keeps drawing the notes
+  NoteRenderer renderer(LED_COUNT);
+  TEST_ASSERT_TRUE(renderer.setEffect(compiler.getBytecode(), compiler.getBytecodeLength()));
+  renderer.noteOn(60, 127);
+  renderer.animate(0);
+  renderer.render();
+  TEST_ASSERT_EQUAL(EFFECT_DEFAULT_BUDGET, renderer.getEffect()->getLastFrameCost());
+  TEST_ASSERT_EQUAL(1, renderer.getEffect()->getOverrunCount());
+  TEST_ASSERT_NOT_EQUAL(0, renderer.getPixel(NoteRenderer::computePixelIndex(60)));
+}
+
+void test_bench_instructions() {
+  EffectCompiler compiler;
+  TEST_ASSERT_TRUE(compile(&compiler, rainbow_script));
+  NoteRenderer renderer(LED_COUNT);
+  renderer.setEffect(compiler.getBytecode(), compiler.getBytecodeLength());
+  int64_t elapsed = 0;
+  uint64_t instructions = 0;
+  uint32_t now_us = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    const int64_t start = nowNs();
+    for (int i = 0; i < 100; i++) {
+      now_us += 8333;
+      renderer.animate(now_us);
+      renderer.render();
+      instructions += renderer.getEffect()->getLastFrameCost();
+    }
+    elapsed += nowNs() - start;
+    sink = renderer.getPixel(now_us % LED_COUNT);
+  }
+  printf("effect vm      %5d leds: %.2f ns/instruction, frame with rainbow script %.1f us\n",
+    LED_COUNT, (double)elapsed / instructions, (double)elapsed / instructions * 10 * LED_COUNT / 1000);
+}
+
+void test_effect_script_file() {
+  const char* path = getenv("PIANEON_EFFECT_SCRIPT");
+  if (path == NULL) TEST_IGNORE_MESSAGE("PIANEON_EFFECT_SCRIPT not set");
+  FILE* file = fopen(path, "rb");
+  TEST_ASSERT_NOT_NULL_MESSAGE(file, "Unable to open the script");
+  static char source[EFFECT_MAX_SOURCE_SIZE];
+  const size_t length = fread(source, 1, sizeof(source), file);
+  fclose(file);
+  EffectCompiler compiler;
+  if (!compiler.compile(source, length)) {
+    printf("%s:%d: %s\n", path, compiler.getErrorLine(), compiler.getError());
+    TEST_FAIL_MESSAGE("Compilation failed");
+  }
+  NoteRenderer renderer(LED_COUNT);
+  renderer.setEffect(compiler.getBytecode(), compiler.getBytecodeLength());
+  // A chord, so that per note scripts run too
+  renderer.noteOn(60, 100);
+  renderer.noteOn(64, 100);
+  renderer.noteOn(67, 100);
+  renderer.animate(0);
+  renderer.render();
+  EffectVm* vm = renderer.getEffect();
+  printf("%s: %zu instructions, %u run per frame, budget %s\n", path, vm->getInstructionCount(),
+    (unsigned)vm->getLastFrameCost(), vm->getOverrunCount() > 0 ? "exceeded" : "ok");
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_compile_errors);
+  RUN_TEST(test_load_immediates);
+  RUN_TEST(test_invalid_bytecode);
+  RUN_TEST(test_rainbow_script);
+  RUN_TEST(test_halo_script);
+  RUN_TEST(test_budget_overrun);
+  RUN_TEST(test_bench_instructions);
+  RUN_TEST(test_effect_script_file);
+  return UNITY_END();
+}
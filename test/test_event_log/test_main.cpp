@@ -0,0 +1,169 @@
+/**
+ * Host test of the recording path: packets recorded through the double buffer are replayed
+ * in their order and with their spacing, by EventLogReader and through the exported MIDI file.
+ *
+ * Run with: pio test -e native -f test_event_log
+ */
+#include <unity.h>
+
+#include <cstdio>
+#include <vector>
+
+#include "EventLog.h"
+#include "SmfPlayer.h"
+#include "midi_decoder.h"
+
+// Any time of the clock, the log counts from the start of the recording
+#define START_US 123456789
+// Enough records to fill both buffers a few times
+#define LONG_RECORDING_EVENTS (3 * EVENT_LOG_BUFFER_SIZE / 5)
+
+/// Variables ///
+
+static FILE* log_file = NULL;
+
+/// Functions definition ///
+
+static bool replayLog(std::vector<timed_midi_packet>* replayed) {
+  rewind(log_file);
+  EventLogReader reader;
+  if (!reader.open(log_file)) return false;
+  timed_midi_packet event;
+  while (reader.next(&event)) replayed->push_back(event);
+  return true;
+}
+
+static void assertSamePacket(midi_usb_packet expected, midi_usb_packet actual) {
+  TEST_ASSERT_EQUAL(expected.midi_type, actual.midi_type);
+  TEST_ASSERT_EQUAL(expected.midi_channel, actual.midi_channel);
+  TEST_ASSERT_EQUAL(expected.midi_data_1, actual.midi_data_1);
+  TEST_ASSERT_EQUAL(expected.midi_data_2, actual.midi_data_2);
+}
+
+void setUp() {
+  log_file = tmpfile();
+  TEST_ASSERT_NOT_NULL(log_file);
+}
+
+void tearDown() {
+  if (log_file != NULL) fclose(log_file);
+}
+
+/**
+ * Spacings from 0 to more than a second, the long ones take the 4 bytes of the delta time.
+ */
+void test_replay_order_and_spacing() {
+  const timed_midi_packet played[] = {
+    { 0, makeMidiPacket(0x90, 60, 100) },
+    { 0, makeMidiPacket(0x90, 64, 90) },
+    { 127, makeMidiPacket(0x90, 67, 80) },
+    { 128, makeMidiPacket(0xb0, 64, 127) },
+    { 20000, makeMidiPacket(0x80, 60, 0) },
+    { 1500000, makeMidiPacket(0x81, 64, 0) },
+    { 1500001, makeMidiPacket(0xc2, 5, 0) },
+    { 40000000, makeMidiPacket(0x80, 67, 0) },
+  };
+  EventLogRecorder recorder;
+  TEST_ASSERT_TRUE(recorder.start(log_file, START_US));
+  for (const timed_midi_packet& event : played) recorder.record(event.packet, START_US + event.time_us);
+  recorder.stop();
+  TEST_ASSERT_EQUAL(sizeof(played) / sizeof(played[0]), recorder.getRecordedEvents());
+
+  std::vector<timed_midi_packet> replayed;
+  TEST_ASSERT_TRUE(replayLog(&replayed));
+  TEST_ASSERT_EQUAL(sizeof(played) / sizeof(played[0]), replayed.size());
+  for (size_t i = 0; i < replayed.size(); i++) {
+    TEST_ASSERT_EQUAL(played[i].time_us, replayed[i].time_us);
+    assertSamePacket(played[i].packet, replayed[i].packet);
+  }
+}
+
+/**
+ * The buffers are handed to flush() as they fill, the records keep their order across them.
+ */
+void test_replay_across_buffers() {
+  EventLogRecorder recorder;
+  TEST_ASSERT_TRUE(recorder.start(log_file, START_US));
+  for (uint32_t i = 0; i < LONG_RECORDING_EVENTS; i++) {
+    recorder.record(makeMidiPacket(0x90, i & 0x7f, 1 + i % 127), START_US + i * 1000 + i % 7);
+    // loop() writes the full buffers from time to time
+    if (i % 100 == 99) recorder.flush();
+  }
+  recorder.stop();
+  TEST_ASSERT_EQUAL(0, recorder.getDroppedEvents());
+
+  std::vector<timed_midi_packet> replayed;
+  TEST_ASSERT_TRUE(replayLog(&replayed));
+  TEST_ASSERT_EQUAL(LONG_RECORDING_EVENTS, replayed.size());
+  for (uint32_t i = 0; i < LONG_RECORDING_EVENTS; i++) {
+    TEST_ASSERT_EQUAL(i * 1000 + i % 7, replayed[i].time_us);
+    TEST_ASSERT_EQUAL(i & 0x7f, replayed[i].packet.midi_data_1);
+  }
+}
+
+/**
+ * Without flush() both buffers fill up, the events past them are dropped and the log stays readable.
+ */
+void test_replay_after_dropped_events() {
+  EventLogRecorder recorder;
+  TEST_ASSERT_TRUE(recorder.start(log_file, START_US));
+  TEST_ASSERT_FALSE(recorder.hasFullBuffer());
+  for (uint32_t i = 0; i < LONG_RECORDING_EVENTS; i++) recorder.record(makeMidiPacket(0x90, 60, 100), START_US + i * 1000);
+  // The writer task would have been woken
+  TEST_ASSERT_TRUE(recorder.hasFullBuffer());
+  recorder.stop();
+  TEST_ASSERT_GREATER_THAN(0, recorder.getDroppedEvents());
+  TEST_ASSERT_EQUAL(LONG_RECORDING_EVENTS, recorder.getRecordedEvents() + recorder.getDroppedEvents());
+
+  std::vector<timed_midi_packet> replayed;
+  TEST_ASSERT_TRUE(replayLog(&replayed));
+  TEST_ASSERT_EQUAL(recorder.getRecordedEvents(), replayed.size());
+  for (size_t i = 0; i < replayed.size(); i++) TEST_ASSERT_EQUAL(i * 1000, replayed[i].time_us);
+}
+
+/**
+ * The exported MIDI file plays the same notes at the same times, to the ms.
+ */
+void test_replay_exported_smf() {
+  EventLogRecorder recorder;
+  TEST_ASSERT_TRUE(recorder.start(log_file, START_US));
+  for (uint32_t i = 0; i < 16; i++) {
+    recorder.record(makeMidiPacket(0x90, 48 + i, 100), START_US + i * 250000);
+    recorder.record(makeMidiPacket(0x80, 48 + i, 0), START_US + i * 250000 + 120000);
+  }
+  recorder.stop();
+
+  rewind(log_file);
+  FILE* smf_file = tmpfile();
+  TEST_ASSERT_NOT_NULL(smf_file);
+  TEST_ASSERT_EQUAL(32, exportEventLogToSmf(log_file, smf_file));
+  fflush(smf_file);
+  std::vector<uint8_t> smf_data(ftell(smf_file));
+  rewind(smf_file);
+  TEST_ASSERT_EQUAL(smf_data.size(), fread(smf_data.data(), 1, smf_data.size(), smf_file));
+  fclose(smf_file);
+
+  SmfMemorySource source(smf_data.data(), smf_data.size());
+  SmfPlayer player;
+  TEST_ASSERT_TRUE(player.open(&source));
+  timed_midi_packet event;
+  for (uint32_t i = 0; i < 16; i++) {
+    TEST_ASSERT_TRUE(player.nextEvent(&event));
+    TEST_ASSERT_EQUAL(i * 250000, event.time_us);
+    TEST_ASSERT_EQUAL(MIDI_EVENT_NOTE_ON, decodeMidiPacket(event.packet).type);
+    TEST_ASSERT_EQUAL(48 + i, event.packet.midi_data_1);
+    TEST_ASSERT_TRUE(player.nextEvent(&event));
+    TEST_ASSERT_EQUAL(i * 250000 + 120000, event.time_us);
+    TEST_ASSERT_EQUAL(MIDI_EVENT_NOTE_OFF, decodeMidiPacket(event.packet).type);
+  }
+  TEST_ASSERT_FALSE(player.nextEvent(&event));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_order_and_spacing);
+  RUN_TEST(test_replay_across_buffers);
+  RUN_TEST(test_replay_after_dropped_events);
+  RUN_TEST(test_replay_exported_smf);
+  return UNITY_END();
+}
@@ -0,0 +1,355 @@
+/**
+ * Golden frame regression test of the LED pipeline.
+ * Replays the MIDI captures of the captures directory through the decoder and the FramePipeline
+ * of LedController on a virtual clock, the way midiInCallbackMain() and loop() drive it on the device.
+ * Every frame sent to the strip is encoded like LedController::pushFrame() and hashed, the hashes must match
+ * the golden files next to the captures. The time spent per MIDI event and per loop() call
+ * must stay within the budgets below. Each capture is replayed several times and the cost of an event
+ * is the median of its replays, so a host busy with something else during one replay doesn't fail the test.
+ *
+ * Captures are event logs (.pnl) as recorded by the web page, the ones shipped are the first 4 s of the benchmark workloads.
+ * After a change meant to modify the frames, or to add a capture, write the golden files again with
+ * PIANEON_GOLDEN_UPDATE=1 and review the diff.
+ *
+ * Run with: pio test -e golden
+ * The captures directory can be changed with the PIANEON_GOLDEN_DIR environment variable,
+ * slow builds (sanitizers, valgrind) can scale the budgets with PIANEON_BUDGET_SCALE.
+ */
+#include <unity.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <vector>
+
+#include "EffectCompiler.h"
+#include "EventLog.h"
+#include "FramePipeline.h"
+#include "MatrixRenderer.h"
+#include "PixelEncoder.h"
+#include "midi_decoder.h"
+
+#define DEFAULT_CAPTURES_DIR "test/test_golden_frames/captures"
+#define LED_COUNT 175
+// loop() runs at least this often on the device, the animation frames are paced from it
+#define LOOP_PERIOD_US 1000
+// Replayed after the last event, for the fades to finish
+#define TAIL_US 2000000
+// 99% of the MIDI events must be decoded, rendered and encoded within this,
+// about 10 times what they cost on a desktop host, the device is the one running close to it
+#define EVENT_BUDGET_NS 50000
+// Same for the loop() calls, animation frames included
+#define LOOP_BUDGET_NS 100000
+// Replays of each capture timed, more for the short ones so that a percentile
+// rests on at least MIN_TIMED_SAMPLES timings
+#define TIMED_REPLAYS 5
+#define MAX_TIMED_REPLAYS 64
+#define MIN_TIMED_SAMPLES 1000
+
+/// Types ///
+
+typedef enum {
+  CONFIG_STRIP = 0,
+  CONFIG_MATRIX,
+  CONFIG_EFFECT,
+  CONFIG_RIPPLE,
+  CONFIG_SPARKS,
+} config_t;
+
+typedef struct {
+  uint32_t time_us;
+  uint32_t hash;
+} frame_hash_t;
+
+typedef struct {
+  std::vector<frame_hash_t> frames;
+  // Time spent by each event and by each loop() call, in replay order
+  std::vector<int64_t> event_ns;
+  std::vector<int64_t> loop_ns;
+} replay_t;
+
+/// Variables ///
+
+static const char* const config_names[] = { "strip", "matrix", "effect", "ripple", "sparks" };
+
+static const char effect_script[] =
+  "mode note\n"
+  "  hue r6, r0\n"
+  "  px r4, r6\n";
+
+/// Functions definition ///
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+static std::string getCapturesDir() {
+  const char* dir = getenv("PIANEON_GOLDEN_DIR");
+  return dir != NULL ? dir : DEFAULT_CAPTURES_DIR;
+}
+
+static bool isUpdating() {
+  const char* update = getenv("PIANEON_GOLDEN_UPDATE");
+  return update != NULL && strcmp(update, "0") != 0;
+}
+
+static double getBudgetScale() {
+  const char* scale = getenv("PIANEON_BUDGET_SCALE");
+  return scale != NULL && atof(scale) > 0 ? atof(scale) : 1;
+}
+
+// FNV-1a, 32 bits
+static uint32_t hashBytes(const uint8_t* bytes, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) hash = (hash ^ bytes[i]) * 16777619u;
+  return hash;
+}
+
+/**
+ * Names of the captures, without the extension, sorted.
+ */
+static std::vector<std::string> listCaptures() {
+  std::vector<std::string> names;
+  DIR* dir = opendir(getCapturesDir().c_str());
+  if (dir == NULL) return names;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    const size_t length = strlen(entry->d_name);
+    if (length > 4 && strcmp(entry->d_name + length - 4, ".pnl") == 0) names.push_back(std::string(entry->d_name, length - 4));
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+static bool readCapture(const std::string& name, std::vector<timed_midi_packet>* packets) {
+  FILE* file = fopen((getCapturesDir() + "/" + name + ".pnl").c_str(), "rb");
+  if (file == NULL) return false;
+  EventLogReader reader;
+  const bool valid = reader.open(file);
+  timed_midi_packet packet;
+  while (valid && reader.next(&packet)) packets->push_back(packet);
+  fclose(file);
+  return valid;
+}
+
+static std::string getGoldenPath(const std::string& name, config_t config) {
+  return getCapturesDir() + "/" + name + "." + config_names[config] + ".golden";
+}
+
+/**
+ * One line per frame sent to the strip: its time and its hash, so a diff shows when the frames start to differ.
+ */
+static bool readGolden(const std::string& path, std::vector<frame_hash_t>* frames) {
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == NULL) return false;
+  char line[256];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    frame_hash_t frame;
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%u %x", &frame.time_us, &frame.hash) == 2) frames->push_back(frame);
+  }
+  fclose(file);
+  return true;
+}
+
+static bool writeGolden(const std::string& path, const std::string& name, config_t config, const std::vector<frame_hash_t>& frames) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (file == NULL) return false;
+  fprintf(file, "# %s through the %s configuration: time in us and FNV-1a of each frame sent to the strip\n", name.c_str(), config_names[config]);
+  for (const frame_hash_t& frame : frames) fprintf(file, "%u %08x\n", frame.time_us, frame.hash);
+  fclose(file);
+  return true;
+}
+
+static int64_t percentile99(std::vector<int64_t> values) {
+  if (values.empty()) return 0;
+  const size_t index = values.size() * 99 / 100;
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+static size_t getTimedReplays(size_t event_count) {
+  size_t replays = event_count > 0 ? (MIN_TIMED_SAMPLES + event_count - 1) / event_count : MAX_TIMED_REPLAYS;
+  return std::min<size_t>(std::max<size_t>(replays, TIMED_REPLAYS), MAX_TIMED_REPLAYS);
+}
+
+/**
+ * Cost of each event or loop() call: the median of its timings over the replays.
+ * The replays run the same events and loops in the same order, the samples line up.
+ */
+static std::vector<int64_t> medianCosts(const std::vector<replay_t>& replays, std::vector<int64_t> replay_t::* costs) {
+  std::vector<int64_t> medians((replays[0].*costs).size());
+  std::vector<int64_t> samples(replays.size());
+  for (size_t i = 0; i < medians.size(); i++) {
+    for (size_t r = 0; r < replays.size(); r++) samples[r] = (replays[r].*costs)[i];
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    medians[i] = samples[samples.size() / 2];
+  }
+  return medians;
+}
+
+/**
+ * Encode the composed frame into the strip buffer with the brightness of the settings, then hash it.
+ */
+static void commitFrame(FramePipeline* pipeline, PixelEncoder* encoder, uint8_t* strip, uint32_t now_us, replay_t* replay) {
+  const uint16_t scale = pipeline->getRenderer()->getSettings()->getPreset().brightness + 1;
+  encoder->encode(pipeline->getFrame(), pipeline->getPixelCount(), strip, scale);
+  replay->frames.push_back({ now_us, hashBytes(strip, pipeline->getPixelCount() * getPixelSize(encoder->getOrder())) });
+}
+
+/**
+ * Run loop() every LOOP_PERIOD_US and each packet at its time, the clock only moves when told to.
+ * The render and the encoding of a frame are timed with the event or the loop that caused it.
+ */
+static void replay(const std::vector<timed_midi_packet>& packets, config_t config, replay_t* replay) {
+  SettingsStore settings;
+  // The particle configurations run both presets with their effect
+  const effect_mode_t effect = config == CONFIG_RIPPLE ? EFFECT_RIPPLE : config == CONFIG_SPARKS ? EFFECT_SPARKS : EFFECT_NONE;
+  // Program 1 selects a red preset, as saved on a configured device
+  led_preset_t preset = SettingsStore::defaultPreset();
+  preset.color = 0xff0000;
+  preset.brightness = 100;
+  preset.effect = effect;
+  settings.publish(preset);
+  settings.savePreset(1, "red");
+  preset = SettingsStore::defaultPreset();
+  preset.effect = effect;
+  settings.publish(preset);
+  NoteRenderer renderer(LED_COUNT, &settings);
+  FramePipeline pipeline(&renderer);
+  MatrixRenderer matrix({ 25, 7, true, false });
+  if (config == CONFIG_MATRIX) pipeline.setMatrix(&matrix);
+  if (config == CONFIG_EFFECT) {
+    EffectCompiler compiler;
+    TEST_ASSERT_TRUE(compiler.compile(effect_script, sizeof(effect_script) - 1));
+    TEST_ASSERT_TRUE(renderer.setEffect(compiler.getBytecode(), compiler.getBytecodeLength()));
+  }
+  RuntimePixelEncoder encoder(PIXEL_ORDER_GRB);
+  uint8_t strip[LED_COUNT * 4];
+
+  // The boot shows the first frame
+  if (pipeline.render(0)) commitFrame(&pipeline, &encoder, strip, 0, replay);
+  const uint32_t end_us = (packets.empty() ? 0 : packets.back().time_us) + TAIL_US;
+  uint32_t loop_us = 0;
+  size_t next = 0;
+  while (loop_us <= end_us) {
+    for (; next < packets.size() && packets[next].time_us <= loop_us; next++) {
+      const uint32_t now_us = packets[next].time_us;
+      const int64_t start = nowNs();
+      const bool changed = pipeline.handleEvent(decodeMidiPacket(packets[next].packet), now_us, NOTE_SOURCE_USB);
+      if (changed && pipeline.render(now_us)) commitFrame(&pipeline, &encoder, strip, now_us, replay);
+      replay->event_ns.push_back(nowNs() - start);
+    }
+    const int64_t start = nowNs();
+    if (pipeline.loop(loop_us) && pipeline.render(loop_us)) commitFrame(&pipeline, &encoder, strip, loop_us, replay);
+    replay->loop_ns.push_back(nowNs() - start);
+    loop_us += LOOP_PERIOD_US;
+  }
+}
+
+static void checkConfig(config_t config) {
+  const std::vector<std::string> captures = listCaptures();
+  TEST_ASSERT_TRUE_MESSAGE(!captures.empty(), "no capture found, see PIANEON_GOLDEN_DIR");
+  const int64_t event_budget_ns = EVENT_BUDGET_NS * getBudgetScale();
+  const int64_t loop_budget_ns = LOOP_BUDGET_NS * getBudgetScale();
+  for (const std::string& name : captures) {
+    std::vector<timed_midi_packet> packets;
+    TEST_ASSERT_TRUE_MESSAGE(readCapture(name, &packets), name.c_str());
+    // The frames of every replay are the same, the first one is checked
+    std::vector<replay_t> replays(getTimedReplays(packets.size()));
+    for (replay_t& timed : replays) replay(packets, config, &timed);
+    const replay_t& result = replays[0];
+
+    const std::string path = getGoldenPath(name, config);
+    if (isUpdating()) {
+      TEST_ASSERT_TRUE_MESSAGE(writeGolden(path, name, config, result.frames), path.c_str());
+      printf("%s written, %zu frames\n", path.c_str(), result.frames.size());
+    } else {
+      std::vector<frame_hash_t> golden;
+      TEST_ASSERT_TRUE_MESSAGE(readGolden(path, &golden), "golden file missing, run with PIANEON_GOLDEN_UPDATE=1");
+      const size_t count = std::min(golden.size(), result.frames.size());
+      for (size_t i = 0; i < count; i++) {
+        if (golden[i].time_us == result.frames[i].time_us && golden[i].hash == result.frames[i].hash) continue;
+        printf("%s %s: frame %zu differs, expected %08x at %u us, got %08x at %u us\n", name.c_str(), config_names[config],
+          i, golden[i].hash, golden[i].time_us, result.frames[i].hash, result.frames[i].time_us);
+        TEST_FAIL_MESSAGE("frame differs from the golden file");
+      }
+      TEST_ASSERT_EQUAL_MESSAGE(golden.size(), result.frames.size(), "frame count differs from the golden file");
+    }
+
+    const int64_t event_ns = percentile99(medianCosts(replays, &replay_t::event_ns));
+    const int64_t loop_ns = percentile99(medianCosts(replays, &replay_t::loop_ns));
+    printf("%-14s %-6s %5zu events %6zu frames %2zu replays, 99%% of events in %6.1f us, of loop() in %6.1f us\n",
+      name.c_str(), config_names[config], packets.size(), result.frames.size(), replays.size(), event_ns / 1000.0, loop_ns / 1000.0);
+    TEST_ASSERT_LESS_THAN_MESSAGE(event_budget_ns, event_ns, "MIDI event over budget");
+    TEST_ASSERT_LESS_THAN_MESSAGE(loop_budget_ns, loop_ns, "loop() over budget");
+  }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_strip_frames() {
+  checkConfig(CONFIG_STRIP);
+}
+
+void test_matrix_frames() {
+  checkConfig(CONFIG_MATRIX);
+}
+
+void test_effect_frames() {
+  checkConfig(CONFIG_EFFECT);
+}
+
+void test_ripple_frames() {
+  checkConfig(CONFIG_RIPPLE);
+}
+
+void test_sparks_frames() {
+  checkConfig(CONFIG_SPARKS);
+}
+
+/**
+ * The harness itself: a change of the settings changes the hashes, and the replay doesn't depend on the host.
+ */
+void test_replay_is_deterministic() {
+  std::vector<timed_midi_packet> packets;
+  for (uint8_t note = 60; note < 72; note++) {
+    packets.push_back({ (uint32_t)(note - 60) * 100000, makeMidiPacket(0x90, note, 100) });
+    packets.push_back({ (uint32_t)(note - 60) * 100000 + 50000, makeMidiPacket(0x80, note, 0) });
+  }
+  replay_t first;
+  replay_t second;
+  replay(packets, CONFIG_STRIP, &first);
+  replay(packets, CONFIG_STRIP, &second);
+  TEST_ASSERT_GREATER_THAN(24, first.frames.size());
+  TEST_ASSERT_EQUAL(first.frames.size(), second.frames.size());
+  for (size_t i = 0; i < first.frames.size(); i++) TEST_ASSERT_EQUAL_HEX32(first.frames[i].hash, second.frames[i].hash);
+
+  // Program 1 selects another preset, the frames that follow change
+  packets.insert(packets.begin(), { 0, makeMidiPacket(0xc0, 1, 0) });
+  replay_t preset;
+  replay(packets, CONFIG_STRIP, &preset);
+  bool differs = false;
+  for (size_t i = 0; i < std::min(first.frames.size(), preset.frames.size()); i++) differs |= first.frames[i].hash != preset.frames[i].hash;
+  TEST_ASSERT_TRUE(differs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_is_deterministic);
+  RUN_TEST(test_strip_frames);
+  RUN_TEST(test_matrix_frames);
+  RUN_TEST(test_effect_frames);
+  RUN_TEST(test_ripple_frames);
+  RUN_TEST(test_sparks_frames);
+  return UNITY_END();
+}
@@ -0,0 +1,181 @@
+/**
+ * Host test of the chord and key detection: the chord templates, the key of a note stream
+ * and its hysteresis, and the held notes recolored by the renderer only when the chord changes.
+ *
+ * Run with: pio test -e native -f test_harmony
+ */
+#include <unity.h>
+
+#include "HarmonyAnalyzer.h"
+#include "NoteRenderer.h"
+
+#define LED_COUNT 175
+#define MIDDLE_C 60
+
+/// Functions definition ///
+
+static uint16_t pitchClasses(const uint8_t* notes, size_t count) {
+  uint16_t pitch_classes = 0;
+  for (size_t i = 0; i < count; i++) pitch_classes |= 1 << (notes[i] % 12);
+  return pitch_classes;
+}
+
+// Play each note and release it before the next one, like a melody
+static void playMelody(HarmonyAnalyzer* harmony, const uint8_t* pitch_classes, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    harmony->noteOn(MIDDLE_C + pitch_classes[i]);
+    harmony->noteOff(MIDDLE_C + pitch_classes[i]);
+  }
+}
+
+static bool isChord(uint16_t pitch_classes, chord_quality_t quality, uint8_t root) {
+  const chord_t chord = matchChord(pitch_classes);
+  return chord.quality == quality && chord.root == root;
+}
+
+void setUp() {
+
+}
+
+void tearDown() {
+
+}
+
+void test_chord_templates() {
+  const uint8_t c_major[] = { 60, 64, 67 };
+  const uint8_t a_minor[] = { 57, 60, 64 };
+  const uint8_t b_diminished[] = { 59, 62, 65 };
+  const uint8_t d_suspended[] = { 62, 67, 69 };
+  const uint8_t c_major_7[] = { 60, 64, 67, 71 };
+  const uint8_t g_dominant_7[] = { 55, 59, 62, 65 };
+  TEST_ASSERT_TRUE(isChord(pitchClasses(c_major, 3), CHORD_QUALITY_MAJOR, 0));
+  // Inversions and octaves don't matter
+  const uint8_t c_major_inverted[] = { 76, 79, 84, 88 };
+  TEST_ASSERT_TRUE(isChord(pitchClasses(c_major_inverted, 4), CHORD_QUALITY_MAJOR, 0));
+  TEST_ASSERT_TRUE(isChord(pitchClasses(a_minor, 3), CHORD_QUALITY_MINOR, 9));
+  TEST_ASSERT_TRUE(isChord(pitchClasses(b_diminished, 3), CHORD_QUALITY_DIMINISHED, 11));
+  TEST_ASSERT_TRUE(isChord(pitchClasses(d_suspended, 3), CHORD_QUALITY_SUSPENDED, 2));
+  // C E G B holds both C major and E minor, the template covering the 4 notes wins
+  TEST_ASSERT_TRUE(isChord(pitchClasses(c_major_7, 4), CHORD_QUALITY_MAJOR_7, 0));
+  TEST_ASSERT_TRUE(isChord(pitchClasses(g_dominant_7, 4), CHORD_QUALITY_DOMINANT_7, 7));
+  // Two notes, or a cluster matching no template
+  TEST_ASSERT_TRUE(isChord(pitchClasses(c_major, 2), CHORD_QUALITY_NONE, 0));
+  TEST_ASSERT_TRUE(isChord(0x007, CHORD_QUALITY_NONE, 0));
+}
+
+/**
+ * The chord only changes, and noteOn() or noteOff() only return true, when the held pitch classes change.
+ */
+void test_chord_changes() {
+  HarmonyAnalyzer harmony;
+  TEST_ASSERT_FALSE(harmony.noteOn(60));
+  TEST_ASSERT_FALSE(harmony.noteOn(64));
+  TEST_ASSERT_TRUE(harmony.noteOn(67));
+  TEST_ASSERT_EQUAL(CHORD_QUALITY_MAJOR, harmony.getChord().quality);
+  // Same pitch class an octave up
+  TEST_ASSERT_FALSE(harmony.noteOn(72));
+  TEST_ASSERT_FALSE(harmony.noteOff(72));
+  TEST_ASSERT_EQUAL_HEX16(0x091, harmony.getPitchClasses());
+  TEST_ASSERT_TRUE(harmony.noteOn(71));
+  TEST_ASSERT_EQUAL(CHORD_QUALITY_MAJOR_7, harmony.getChord().quality);
+  TEST_ASSERT_TRUE(harmony.noteOff(71));
+  TEST_ASSERT_EQUAL(CHORD_QUALITY_MAJOR, harmony.getChord().quality);
+  // A key that was not pressed changes nothing
+  TEST_ASSERT_FALSE(harmony.noteOff(62));
+  TEST_ASSERT_TRUE(harmony.noteOff(64));
+  TEST_ASSERT_EQUAL(CHORD_QUALITY_NONE, harmony.getChord().quality);
+}
+
+void test_key_detection() {
+  HarmonyAnalyzer harmony;
+  // C major scale, tonic and dominant first
+  const uint8_t c_major[] = { 0, 4, 7, 0, 2, 4, 5, 7, 9, 11, 0, 7, 4, 0 };
+  playMelody(&harmony, c_major, KEY_MIN_NOTES - 1);
+  TEST_ASSERT_FALSE(harmony.getKey().valid);
+  playMelody(&harmony, c_major + KEY_MIN_NOTES - 1, sizeof(c_major) - KEY_MIN_NOTES + 1);
+  musical_key_t key = harmony.getKey();
+  TEST_ASSERT_TRUE(key.valid);
+  TEST_ASSERT_EQUAL(0, key.tonic);
+  TEST_ASSERT_FALSE(key.minor);
+
+  // Same notes, around A and E
+  harmony.clear();
+  const uint8_t a_minor[] = { 9, 0, 4, 9, 4, 11, 2, 9, 0, 4, 9, 4, 7, 9 };
+  playMelody(&harmony, a_minor, sizeof(a_minor));
+  key = harmony.getKey();
+  TEST_ASSERT_TRUE(key.valid);
+  TEST_ASSERT_EQUAL(9, key.tonic);
+  TEST_ASSERT_TRUE(key.minor);
+  TEST_ASSERT_EQUAL_HEX16(MAJOR_SCALE_TEMPLATE, getScaleTemplate(key));
+}
+
+/**
+ * Without F, C major and G major share every note: a single F# would be enough to flip the key.
+ */
+void test_passing_note_keeps_key() {
+  HarmonyAnalyzer harmony;
+  const uint8_t melody[] = { 0, 4, 7, 0, 2, 4, 7, 9, 11, 0, 7, 4, 0, 2, 0, 4 };
+  playMelody(&harmony, melody, sizeof(melody));
+  TEST_ASSERT_EQUAL(0, harmony.getKey().tonic);
+  TEST_ASSERT_FALSE(harmony.getKey().minor);
+
+  const uint8_t passing_note[] = { 6 };
+  playMelody(&harmony, passing_note, 1);
+  TEST_ASSERT_EQUAL(0, harmony.getKey().tonic);
+  TEST_ASSERT_FALSE(harmony.getKey().minor);
+
+  // A modulation goes through
+  const uint8_t g_major[] = { 7, 6, 7, 2, 6, 11, 7, 6 };
+  playMelody(&harmony, g_major, sizeof(g_major));
+  TEST_ASSERT_EQUAL(7, harmony.getKey().tonic);
+  TEST_ASSERT_FALSE(harmony.getKey().minor);
+}
+
+/**
+ * The renderer hands the presses and releases of NoteState to the analyzer: the held notes take the
+ * color of the chord, a key released under the pedal leaves it, a note off without note on is ignored.
+ */
+void test_renderer_chord_colors() {
+  SettingsStore settings;
+  led_preset_t preset = settings.getPreset();
+  preset.palette = PALETTE_CHORD_QUALITY;
+  preset.velocity_curve = VELOCITY_CURVE_NONE;
+  settings.publish(preset);
+  NoteRenderer renderer(LED_COUNT, &settings);
+  const led_settings_t* current = settings.acquire();
+  const uint32_t major_color = current->chord_colors[CHORD_QUALITY_MAJOR];
+  const uint32_t major_7_color = current->chord_colors[CHORD_QUALITY_MAJOR_7];
+  settings.release(current);
+  TEST_ASSERT_NOT_EQUAL(major_color, major_7_color);
+
+  renderer.noteOn(60, 100);
+  renderer.noteOn(64, 100);
+  renderer.noteOn(67, 100);
+  const uint32_t* colors = renderer.getNoteColors();
+  TEST_ASSERT_EQUAL_HEX32(major_color, colors[60]);
+  TEST_ASSERT_EQUAL_HEX32(major_color, colors[64]);
+
+  // The notes already held are recolored
+  renderer.noteOn(71, 100);
+  TEST_ASSERT_EQUAL_HEX32(major_7_color, colors[60]);
+  TEST_ASSERT_EQUAL_HEX32(major_7_color, colors[71]);
+
+  renderer.sustainOn();
+  renderer.noteOff(71);
+  TEST_ASSERT_TRUE(renderer.getNoteState()->isSustained(71));
+  TEST_ASSERT_EQUAL(CHORD_QUALITY_MAJOR, renderer.getHarmony()->getChord().quality);
+  TEST_ASSERT_EQUAL_HEX32(major_color, colors[60]);
+  renderer.noteOff(71);
+  TEST_ASSERT_EQUAL(CHORD_QUALITY_MAJOR, renderer.getHarmony()->getChord().quality);
+  TEST_ASSERT_EQUAL_HEX16(0x091, renderer.getHarmony()->getPitchClasses());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_chord_templates);
+  RUN_TEST(test_chord_changes);
+  RUN_TEST(test_key_detection);
+  RUN_TEST(test_passing_note_keeps_key);
+  RUN_TEST(test_renderer_chord_colors);
+  return UNITY_END();
+}
@@ -0,0 +1,297 @@
+/**
+ * Host test of the learning mode: steps read ahead from a MIDI file, matched against the notes played,
+ * and the guide drawn by the renderer.
+ * Also measures the cost of a played note and of a step, to check the input task and loop() stay cheap.
+ *
+ * Run with: pio test -e native -f test_learning_session
+ */
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "LearningSession.h"
+#include "NoteRenderer.h"
+#include "midi_decoder.h"
+
+#define LED_COUNT 175
+#define DIVISION 480 // Ticks per quarter note, 500 ms at the default tempo
+#define MAX_SMF_SIZE 16384
+#define MIN_MEASURE_NS 100000000LL
+
+/// Types ///
+
+typedef struct {
+  uint8_t data[MAX_SMF_SIZE];
+  size_t size;
+  size_t track_start;
+} smf_builder_t;
+
+/// Variables ///
+
+static volatile uint32_t sink;
+
+/// Functions definition ///
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+static void writeByte(smf_builder_t* smf, uint8_t value) {
+  smf->data[smf->size++] = value;
+}
+
+static void writeVarLen(smf_builder_t* smf, uint32_t value) {
+  uint8_t bytes[4];
+  int count = 0;
+  do {
+    bytes[count++] = value & 0x7f;
+    value >>= 7;
+  } while (value > 0);
+  while (count > 1) writeByte(smf, bytes[--count] | 0x80);
+  writeByte(smf, bytes[0]);
+}
+
+/**
+ * Type 0 file with a single track, closed by endSmf().
+ */
+static void beginSmf(smf_builder_t* smf) {
+  static const uint8_t header[] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, DIVISION >> 8, DIVISION & 0xff, 'M', 'T', 'r', 'k', 0, 0, 0, 0 };
+  memcpy(smf->data, header, sizeof(header));
+  smf->size = sizeof(header);
+  smf->track_start = smf->size;
+}
+
+static void writeEvent(smf_builder_t* smf, uint32_t delta, uint8_t status, uint8_t note, uint8_t velocity) {
+  writeVarLen(smf, delta);
+  writeByte(smf, status);
+  writeByte(smf, note);
+  writeByte(smf, velocity);
+}
+
+static void endSmf(smf_builder_t* smf) {
+  writeVarLen(smf, 0);
+  writeByte(smf, 0xff);
+  writeByte(smf, 0x2f);
+  writeByte(smf, 0);
+  const uint32_t length = smf->size - smf->track_start;
+  for (int i = 0; i < 4; i++) smf->data[smf->track_start - 4 + i] = length >> (24 - 8 * i);
+}
+
+/**
+ * C major chord, then D and E a quarter note apart, with a sustain pedal the session ignores.
+ */
+static void buildLesson(smf_builder_t* smf) {
+  beginSmf(smf);
+  writeEvent(smf, 0, 0x90, 60, 100);
+  writeEvent(smf, 0, 0xb0, MIDI_CC_SUSTAIN, 127);
+  // Played a few ms apart, still the same step
+  writeEvent(smf, 10, 0x90, 64, 100);
+  writeEvent(smf, 10, 0x90, 67, 100);
+  writeEvent(smf, 460, 0x80, 60, 0);
+  writeEvent(smf, 0, 0x80, 64, 0);
+  writeEvent(smf, 0, 0x80, 67, 0);
+  writeEvent(smf, 0, 0x90, 62, 100);
+  writeEvent(smf, DIVISION, 0x90, 62, 0);
+  writeEvent(smf, 0, 0x90, 64, 100);
+  writeEvent(smf, DIVISION, 0x80, 64, 0);
+  endSmf(smf);
+}
+
+// Scale of step_count notes, longer than the window
+static void buildScale(smf_builder_t* smf, int step_count) {
+  beginSmf(smf);
+  for (int i = 0; i < step_count; i++) {
+    writeEvent(smf, 0, 0x90, 48 + i % 40, 90);
+    writeEvent(smf, DIVISION / 4, 0x80, 48 + i % 40, 0);
+  }
+  endSmf(smf);
+}
+
+static midi_event_t noteOn(uint8_t note) {
+  return decodeMidiPacket(makeMidiPacket(0x90, note, 100));
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_steps() {
+  static smf_builder_t smf;
+  buildLesson(&smf);
+  SmfMemorySource source(smf.data, smf.size);
+  LearningSession session;
+  TEST_ASSERT_TRUE(session.open(&source));
+  TEST_ASSERT_EQUAL(3, session.getWindowSize());
+  TEST_ASSERT_EQUAL(3, countNotes(&session.getStep(0)->notes));
+  TEST_ASSERT_TRUE(hasNote(&session.getStep(0)->notes, 67));
+  TEST_ASSERT_EQUAL(0, session.getStep(0)->time_us);
+  TEST_ASSERT_EQUAL(500000, session.getStep(1)->time_us);
+  TEST_ASSERT_TRUE(hasNote(session.getUpcomingNotes(), 62));
+  TEST_ASSERT_FALSE(hasNote(session.getUpcomingNotes(), 64));
+  TEST_ASSERT_NULL(session.getStep(3));
+}
+
+void test_wait_mode() {
+  static smf_builder_t smf;
+  buildLesson(&smf);
+  SmfMemorySource source(smf.data, smf.size);
+  LearningSession session;
+  TEST_ASSERT_TRUE(session.open(&source, LEARNING_MODE_WAIT));
+  session.start(0);
+  const uint32_t version = session.getGuideVersion();
+
+  TEST_ASSERT_TRUE(session.handleEvent(noteOn(60)));
+  TEST_ASSERT_FALSE(session.handleEvent(noteOn(61)));
+  TEST_ASSERT_TRUE(session.handleEvent(noteOn(64)));
+  // Waits for the last note of the chord, however late
+  TEST_ASSERT_FALSE(session.update(10000000));
+  TEST_ASSERT_EQUAL(version, session.getGuideVersion());
+  TEST_ASSERT_TRUE(session.handleEvent(noteOn(67)));
+  TEST_ASSERT_TRUE(session.update(10000000));
+  TEST_ASSERT_TRUE(hasNote(session.getCurrentNotes(), 62));
+  TEST_ASSERT_EQUAL(1, countNotes(session.getCurrentNotes()));
+
+  // Notes played for the chord don't count for the next steps
+  TEST_ASSERT_FALSE(session.handleEvent(noteOn(64)));
+  TEST_ASSERT_TRUE(session.handleEvent(noteOn(62)));
+  session.update(0);
+  TEST_ASSERT_TRUE(hasNote(session.getCurrentNotes(), 64));
+  TEST_ASSERT_FALSE(session.isFinished());
+  TEST_ASSERT_TRUE(session.handleEvent(noteOn(64)));
+  session.update(0);
+  TEST_ASSERT_TRUE(session.isFinished());
+  TEST_ASSERT_EQUAL(0, countNotes(session.getCurrentNotes()));
+
+  const learning_stats_t stats = session.getStats();
+  TEST_ASSERT_EQUAL(3, stats.steps);
+  TEST_ASSERT_EQUAL(0, stats.missed_steps);
+  TEST_ASSERT_EQUAL(5, stats.correct_notes);
+  TEST_ASSERT_EQUAL(2, stats.wrong_notes);
+
+  // Nothing is matched once closed
+  session.close();
+  TEST_ASSERT_FALSE(session.isActive());
+  TEST_ASSERT_FALSE(session.handleEvent(noteOn(64)));
+}
+
+void test_follow_mode() {
+  static smf_builder_t smf;
+  buildLesson(&smf);
+  SmfMemorySource source(smf.data, smf.size);
+  LearningSession session;
+  TEST_ASSERT_TRUE(session.open(&source, LEARNING_MODE_FOLLOW));
+  session.start(1000000);
+  // Not started yet, then before the second step
+  TEST_ASSERT_FALSE(session.update(0));
+  TEST_ASSERT_FALSE(session.update(1400000));
+  // The chord was not played in time
+  TEST_ASSERT_TRUE(session.update(1600000));
+  TEST_ASSERT_TRUE(hasNote(session.getCurrentNotes(), 62));
+  // Played early, the song moves on right away
+  session.handleEvent(noteOn(62));
+  TEST_ASSERT_TRUE(session.update(1600000));
+  TEST_ASSERT_TRUE(hasNote(session.getCurrentNotes(), 64));
+  // The last step is left the look-ahead time
+  TEST_ASSERT_FALSE(session.update(2000000 + LEARNING_LOOKAHEAD_US - 1));
+  TEST_ASSERT_TRUE(session.update(2000000 + LEARNING_LOOKAHEAD_US + 1));
+  TEST_ASSERT_TRUE(session.isFinished());
+  const learning_stats_t stats = session.getStats();
+  TEST_ASSERT_EQUAL(1, stats.steps);
+  TEST_ASSERT_EQUAL(2, stats.missed_steps);
+}
+
+/**
+ * Songs longer than the window are read as the steps are played.
+ */
+void test_window_refill() {
+  static smf_builder_t smf;
+  const int step_count = 3 * LEARNING_WINDOW_STEPS + 5;
+  buildScale(&smf, step_count);
+  SmfMemorySource source(smf.data, smf.size);
+  LearningSession session;
+  TEST_ASSERT_TRUE(session.open(&source));
+  TEST_ASSERT_EQUAL(LEARNING_WINDOW_STEPS, session.getWindowSize());
+  // 8 steps every second, the next 15 are lit
+  TEST_ASSERT_EQUAL(LEARNING_WINDOW_STEPS - 1, countNotes(session.getUpcomingNotes()));
+  for (int i = 0; i < step_count; i++) {
+    TEST_ASSERT_TRUE(hasNote(session.getCurrentNotes(), 48 + i % 40));
+    session.handleEvent(noteOn(48 + i % 40));
+    session.update(0);
+    TEST_ASSERT_EQUAL(step_count - i - 1 < LEARNING_WINDOW_STEPS ? step_count - i - 1 : LEARNING_WINDOW_STEPS, session.getWindowSize());
+  }
+  TEST_ASSERT_TRUE(session.isFinished());
+  TEST_ASSERT_EQUAL(step_count, session.getStats().steps);
+}
+
+void test_guide_layer() {
+  NoteRenderer renderer(LED_COUNT);
+  note_set_t current;
+  note_set_t upcoming;
+  clearNoteSet(&current);
+  clearNoteSet(&upcoming);
+  addNote(&current, 60);
+  addNote(&upcoming, 62);
+  renderer.setGuide(&current, &upcoming);
+  TEST_ASSERT_TRUE(renderer.render());
+  const uint32_t current_pixel = renderer.getPixel(NoteRenderer::computePixelIndex(60));
+  const uint32_t upcoming_pixel = renderer.getPixel(NoteRenderer::computePixelIndex(62));
+  TEST_ASSERT_NOT_EQUAL(0, current_pixel);
+  TEST_ASSERT_NOT_EQUAL(0, upcoming_pixel);
+  TEST_ASSERT_GREATER_THAN(upcoming_pixel & 0xff, current_pixel & 0xff);
+  TEST_ASSERT_EQUAL(0, renderer.getPixel(NoteRenderer::computePixelIndex(64)));
+
+  // The pressed key covers its guide
+  renderer.noteOn(60, 127);
+  renderer.render();
+  const uint32_t pressed_pixel = renderer.getPixel(NoteRenderer::computePixelIndex(60));
+  TEST_ASSERT_GREATER_THAN(current_pixel & 0xff, pressed_pixel & 0xff);
+
+  renderer.setGuide(NULL, NULL);
+  TEST_ASSERT_FALSE(renderer.getCompositor()->isEnabled(LAYER_GUIDE));
+  renderer.render();
+  TEST_ASSERT_EQUAL(0, renderer.getPixel(NoteRenderer::computePixelIndex(62)));
+}
+
+void test_cost() {
+  static smf_builder_t smf;
+  const int step_count = 1000;
+  buildScale(&smf, step_count);
+  SmfMemorySource source(smf.data, smf.size);
+  LearningSession session;
+  TEST_ASSERT_TRUE(session.open(&source));
+
+  int64_t elapsed = 0;
+  size_t runs = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    const int64_t start = nowNs();
+    for (int i = 0; i < 1000; i++) sink = session.handleEvent(noteOn(20 + (i & 7)));
+    elapsed += nowNs() - start;
+    runs += 1000;
+  }
+  const double event_ns = (double)elapsed / runs;
+
+  // Each step is played then advanced, the window is refilled from the file
+  const int64_t start = nowNs();
+  for (int i = 0; i < step_count; i++) {
+    session.handleEvent(noteOn(48 + i % 40));
+    session.update(0);
+  }
+  const double step_ns = (double)(nowNs() - start) / step_count;
+  printf("handleEvent: %.1f ns, step: %.1f ns\n", event_ns, step_ns);
+  TEST_ASSERT_TRUE(session.isFinished());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_steps);
+  RUN_TEST(test_wait_mode);
+  RUN_TEST(test_follow_mode);
+  RUN_TEST(test_window_refill);
+  RUN_TEST(test_guide_layer);
+  RUN_TEST(test_cost);
+  return UNITY_END();
+}
@@ -0,0 +1,239 @@
+/**
+ * Host test of the MIDI output: the queue shared by the senders, its batches and stats,
+ * and the keys sent by the light guide.
+ * Also measures the cost of a push, paid by the task sending, and checks the order under concurrent senders.
+ *
+ * Run with: pio test -e native -f test_midi_out
+ */
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "MidiOutQueue.h"
+#include "LightGuide.h"
+#include "midi_decoder.h"
+
+// 16 packets of 4 bytes in a full speed bulk packet
+#define BATCH_SIZE 16
+#define PRODUCER_COUNT 4
+#define PRODUCER_PACKETS 100000
+#define MIN_MEASURE_NS 100000000LL
+
+/// Variables ///
+
+static int ready_calls = 0;
+
+/// Functions definition ///
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+static void countReady() {
+  ready_calls++;
+}
+
+static midi_usb_packet noteOn(uint8_t note) {
+  return makeMidiPacket(0x90, note, 100);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_order_and_batches() {
+  static MidiOutQueue queue;
+  // Closed until a device takes MIDI out
+  TEST_ASSERT_FALSE(queue.push(noteOn(60), 0));
+  queue.open();
+  queue.setReadyCallback(&countReady);
+  ready_calls = 0;
+  for (int i = 0; i < 40; i++) TEST_ASSERT_TRUE(queue.push(noteOn(i), 1000 + i));
+  TEST_ASSERT_EQUAL(40, ready_calls);
+  TEST_ASSERT_EQUAL(40, queue.getDepth());
+
+  midi_usb_packet packets[BATCH_SIZE];
+  int expected = 0;
+  size_t count;
+  size_t transfers = 0;
+  while ((count = queue.pop(packets, BATCH_SIZE, 2000)) > 0) {
+    for (size_t i = 0; i < count; i++) TEST_ASSERT_EQUAL(expected++, packets[i].midi_data_1);
+    transfers++;
+  }
+  TEST_ASSERT_EQUAL(40, expected);
+  TEST_ASSERT_EQUAL(3, transfers);
+
+  const midi_out_stats_t stats = queue.getStats();
+  TEST_ASSERT_EQUAL(40, stats.queued);
+  TEST_ASSERT_EQUAL(40, stats.sent);
+  TEST_ASSERT_EQUAL(3, stats.transfers);
+  TEST_ASSERT_EQUAL(0, stats.depth);
+  TEST_ASSERT_EQUAL(40, stats.max_depth);
+  TEST_ASSERT_EQUAL(1000, stats.max_latency_us);
+  TEST_ASSERT_GREATER_THAN(500, stats.average_latency_us);
+  queue.setReadyCallback(NULL);
+}
+
+void test_full_and_reconnect() {
+  static MidiOutQueue queue;
+  queue.open();
+  const uint32_t generation = queue.getGeneration();
+  for (int i = 0; i < MIDI_OUT_QUEUE_CAPACITY; i++) TEST_ASSERT_TRUE(queue.push(noteOn(i & 0x7f), 0));
+  // Never blocks, the packet is dropped
+  TEST_ASSERT_FALSE(queue.push(noteOn(1), 0));
+  TEST_ASSERT_EQUAL(1, queue.getStats().dropped);
+  midi_usb_packet packet;
+  TEST_ASSERT_EQUAL(1, queue.pop(&packet, 1, 0));
+  TEST_ASSERT_TRUE(queue.push(noteOn(2), 0));
+
+  // Unplugged: what waits is dropped, nothing more is taken
+  queue.close();
+  TEST_ASSERT_EQUAL(0, queue.getDepth());
+  TEST_ASSERT_EQUAL(1 + MIDI_OUT_QUEUE_CAPACITY, queue.getStats().dropped);
+  TEST_ASSERT_FALSE(queue.push(noteOn(3), 0));
+  TEST_ASSERT_EQUAL(0, queue.pop(&packet, 1, 0));
+  queue.open();
+  TEST_ASSERT_EQUAL(generation + 1, queue.getGeneration());
+  TEST_ASSERT_TRUE(queue.push(noteOn(4), 0));
+  TEST_ASSERT_EQUAL(1, queue.pop(&packet, 1, 0));
+  TEST_ASSERT_EQUAL(4, packet.midi_data_1);
+}
+
+/**
+ * Several tasks send while the USB task pops: nothing is lost or duplicated, each sender keeps its order.
+ */
+void test_concurrent_senders() {
+  static MidiOutQueue queue;
+  queue.open();
+  std::thread producers[PRODUCER_COUNT];
+  for (int p = 0; p < PRODUCER_COUNT; p++) {
+    producers[p] = std::thread([p]() {
+      for (uint32_t i = 0; i < PRODUCER_PACKETS;) {
+        // Sender in the cable number, sequence in the data bytes
+        midi_usb_packet packet = makeMidiPacket(0x90, (i >> 7) & 0x7f, i & 0x7f, p);
+        if (queue.push(packet, 0)) i++;
+        else std::this_thread::yield();
+      }
+    });
+  }
+  uint32_t next[PRODUCER_COUNT] = {};
+  size_t received = 0;
+  bool ordered = true;
+  midi_usb_packet packets[BATCH_SIZE];
+  while (received < PRODUCER_COUNT * PRODUCER_PACKETS) {
+    const size_t count = queue.pop(packets, BATCH_SIZE, 0);
+    for (size_t i = 0; i < count; i++) {
+      const uint8_t p = packets[i].usb_cable_number;
+      const uint32_t sequence = (packets[i].midi_data_1 << 7) | packets[i].midi_data_2;
+      if (p >= PRODUCER_COUNT || sequence != (next[p] & 0x3fff)) ordered = false;
+      else next[p]++;
+    }
+    received += count;
+    if (!ordered) break;
+  }
+  for (int p = 0; p < PRODUCER_COUNT; p++) producers[p].join();
+  TEST_ASSERT_TRUE(ordered);
+  TEST_ASSERT_EQUAL(PRODUCER_COUNT * PRODUCER_PACKETS, received);
+  TEST_ASSERT_EQUAL(0, queue.getDepth());
+  TEST_ASSERT_EQUAL(PRODUCER_COUNT * PRODUCER_PACKETS, queue.getStats().sent);
+}
+
+void test_light_guide() {
+  static MidiOutQueue queue;
+  queue.open();
+  LightGuide guide(&queue, 16, true);
+  note_set_t current;
+  note_set_t upcoming;
+  clearNoteSet(&current);
+  clearNoteSet(&upcoming);
+  addNote(&current, 60);
+  addNote(&current, 64);
+  addNote(&upcoming, 62);
+  TEST_ASSERT_EQUAL(3, guide.show(&current, &upcoming, 0));
+  midi_usb_packet packets[BATCH_SIZE];
+  TEST_ASSERT_EQUAL(3, queue.pop(packets, BATCH_SIZE, 0));
+  TEST_ASSERT_EQUAL(MIDI_NOTE_ON, packets[0].midi_type);
+  TEST_ASSERT_EQUAL(15, packets[0].midi_channel);
+  TEST_ASSERT_EQUAL(60, packets[0].midi_data_1);
+  TEST_ASSERT_EQUAL(LIGHT_GUIDE_CURRENT_VELOCITY, packets[0].midi_data_2);
+  TEST_ASSERT_EQUAL(62, packets[1].midi_data_1);
+  TEST_ASSERT_EQUAL(LIGHT_GUIDE_UPCOMING_VELOCITY, packets[1].midi_data_2);
+
+  // Nothing changed, nothing sent
+  TEST_ASSERT_EQUAL(0, guide.show(&current, &upcoming, 0));
+
+  // Next step: 60 and 64 off, 62 from upcoming to current
+  clearNoteSet(&current);
+  clearNoteSet(&upcoming);
+  addNote(&current, 62);
+  TEST_ASSERT_EQUAL(3, guide.show(&current, &upcoming, 0));
+  TEST_ASSERT_EQUAL(3, queue.pop(packets, BATCH_SIZE, 0));
+  TEST_ASSERT_EQUAL(MIDI_NOTE_OFF, packets[0].midi_type);
+  TEST_ASSERT_EQUAL(60, packets[0].midi_data_1);
+  TEST_ASSERT_EQUAL(MIDI_NOTE_ON, packets[1].midi_type);
+  TEST_ASSERT_EQUAL(62, packets[1].midi_data_1);
+  TEST_ASSERT_EQUAL(LIGHT_GUIDE_CURRENT_VELOCITY, packets[1].midi_data_2);
+  TEST_ASSERT_EQUAL(64, packets[2].midi_data_1);
+
+  TEST_ASSERT_EQUAL(1, guide.clear(0));
+  TEST_ASSERT_EQUAL(1, queue.pop(packets, BATCH_SIZE, 0));
+  TEST_ASSERT_EQUAL(MIDI_NOTE_OFF, packets[0].midi_type);
+}
+
+/**
+ * Keys the queue could not take are sent by the next loop, and all of them again after a reconnection.
+ */
+void test_light_guide_retry() {
+  static MidiOutQueue queue;
+  static const uint8_t lesson[] = {
+    'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xe0, 'M', 'T', 'r', 'k', 0, 0, 0, 12,
+    0x00, 0x90, 60, 100, 0x00, 0x90, 64, 100, 0x00, 0xff, 0x2f, 0x00,
+  };
+  SmfMemorySource source(lesson, sizeof(lesson));
+  LearningSession session;
+  TEST_ASSERT_TRUE(session.open(&source));
+  LightGuide guide(&queue, 16);
+  guide.setSession(&session);
+  // Unplugged, then plugged
+  TEST_ASSERT_EQUAL(0, guide.loop(0));
+  queue.open();
+  TEST_ASSERT_EQUAL(2, guide.loop(0));
+  TEST_ASSERT_EQUAL(0, guide.loop(0));
+  queue.close();
+  queue.open();
+  TEST_ASSERT_EQUAL(2, guide.loop(0));
+}
+
+void test_cost() {
+  static MidiOutQueue queue;
+  queue.open();
+  midi_usb_packet packets[BATCH_SIZE];
+  int64_t elapsed = 0;
+  size_t runs = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    const int64_t start = nowNs();
+    for (int i = 0; i < 1024; i++) {
+      queue.push(noteOn(i & 0x7f), i);
+      if ((i & (BATCH_SIZE - 1)) == BATCH_SIZE - 1) queue.pop(packets, BATCH_SIZE, i);
+    }
+    elapsed += nowNs() - start;
+    runs += 1024;
+  }
+  printf("push and pop: %.1f ns per packet\n", (double)elapsed / runs);
+  TEST_ASSERT_EQUAL(0, queue.getStats().dropped);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_order_and_batches);
+  RUN_TEST(test_full_and_reconnect);
+  RUN_TEST(test_concurrent_senders);
+  RUN_TEST(test_light_guide);
+  RUN_TEST(test_light_guide_retry);
+  RUN_TEST(test_cost);
+  return UNITY_END();
+}
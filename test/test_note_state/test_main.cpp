@@ -0,0 +1,118 @@
+/**
+ * Host test of the note state: the keys released under the pedal, a sustained key struck again,
+ * and the walk of the pressed notes across the words of the bitset.
+ *
+ * Run with: pio test -e native -f test_note_state
+ */
+#include <unity.h>
+
+#include "NoteState.h"
+
+/// Variables ///
+
+static NoteState* notes = NULL;
+
+/// Functions definition ///
+
+void setUp() {
+  notes = new NoteState();
+}
+
+void tearDown() {
+  delete notes;
+}
+
+void test_release_pedal_down() {
+  TEST_ASSERT_TRUE(notes->press(60, 100, 1000, NOTE_SOURCE_USB));
+  TEST_ASSERT_TRUE(notes->press(64, 90, 1000, NOTE_SOURCE_USB));
+  notes->pedalDown();
+  TEST_ASSERT_TRUE(notes->release(60));
+  TEST_ASSERT_FALSE(notes->isPressed(60));
+  TEST_ASSERT_TRUE(notes->isSustained(60));
+  TEST_ASSERT_EQUAL(1, notes->getPressedCount());
+  // A key that was not pressed is not sustained
+  TEST_ASSERT_FALSE(notes->release(62));
+  TEST_ASSERT_FALSE(notes->isSustained(62));
+  // Values of the note are kept
+  TEST_ASSERT_EQUAL(100, notes->getVelocity(60));
+
+  notes->pedalUp();
+  TEST_ASSERT_FALSE(notes->isSustained(60));
+  TEST_ASSERT_EQUAL(-1, notes->nextSustained(0));
+  TEST_ASSERT_TRUE(notes->isPressed(64));
+}
+
+void test_release_pedal_up() {
+  notes->press(60, 100, 1000, NOTE_SOURCE_USB);
+  TEST_ASSERT_TRUE(notes->release(60));
+  TEST_ASSERT_FALSE(notes->isPressed(60));
+  TEST_ASSERT_FALSE(notes->isSustained(60));
+  TEST_ASSERT_EQUAL(0, notes->getPressedCount());
+  // Released twice
+  TEST_ASSERT_FALSE(notes->release(60));
+  TEST_ASSERT_EQUAL(0, notes->getPressedCount());
+}
+
+/**
+ * A sustained key struck again is pressed only, with the values of the new press.
+ */
+void test_sustained_key_pressed_again() {
+  notes->pedalDown();
+  notes->press(60, 100, 1000, NOTE_SOURCE_USB);
+  notes->release(60);
+  TEST_ASSERT_TRUE(notes->isSustained(60));
+  TEST_ASSERT_TRUE(notes->press(60, 40, 2000, NOTE_SOURCE_NETWORK));
+  TEST_ASSERT_TRUE(notes->isPressed(60));
+  TEST_ASSERT_FALSE(notes->isSustained(60));
+  TEST_ASSERT_EQUAL(1, notes->getPressedCount());
+  TEST_ASSERT_EQUAL(40, notes->getVelocity(60));
+  TEST_ASSERT_EQUAL(2000, notes->getOnset(60));
+  TEST_ASSERT_EQUAL(NOTE_SOURCE_NETWORK, notes->getSource(60));
+
+  // Pressed again while pressed: not counted twice, the values still follow
+  TEST_ASSERT_FALSE(notes->press(60, 70, 3000, NOTE_SOURCE_USB));
+  TEST_ASSERT_EQUAL(1, notes->getPressedCount());
+  TEST_ASSERT_EQUAL(70, notes->getVelocity(60));
+  TEST_ASSERT_EQUAL(3000, notes->getOnset(60));
+  // Released again, back to sustained
+  notes->release(60);
+  TEST_ASSERT_TRUE(notes->isSustained(60));
+  TEST_ASSERT_EQUAL(0, notes->getPressedCount());
+}
+
+/**
+ * The notes at the edges of the 32 bit words, found in order, each from the note itself or the one after the previous.
+ */
+void test_next_pressed_across_words() {
+  const uint8_t pressed[] = { 0, 31, 32, 63, 64, 95, 96, 127 };
+  for (uint8_t note : pressed) notes->press(note, 100, 0, NOTE_SOURCE_USB);
+  TEST_ASSERT_EQUAL(sizeof(pressed), notes->getPressedCount());
+  int note = notes->nextPressed(0);
+  for (uint8_t expected : pressed) {
+    TEST_ASSERT_EQUAL(expected, note);
+    TEST_ASSERT_EQUAL(expected, notes->nextPressed(expected));
+    note = notes->nextPressed(note + 1);
+  }
+  TEST_ASSERT_EQUAL(-1, note);
+  TEST_ASSERT_EQUAL(-1, notes->nextPressed(NOTE_COUNT));
+  TEST_ASSERT_EQUAL(0, notes->nextPressed(-5));
+
+  // Empty words in between are skipped
+  notes->clear();
+  notes->press(5, 100, 0, NOTE_SOURCE_USB);
+  notes->press(120, 100, 0, NOTE_SOURCE_USB);
+  TEST_ASSERT_EQUAL(120, notes->nextPressed(6));
+  TEST_ASSERT_EQUAL(-1, notes->nextPressed(121));
+  // Out of range notes are refused
+  TEST_ASSERT_FALSE(notes->press(NOTE_COUNT, 100, 0, NOTE_SOURCE_USB));
+  TEST_ASSERT_EQUAL(2, notes->getPressedCount());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_release_pedal_down);
+  RUN_TEST(test_release_pedal_up);
+  RUN_TEST(test_sustained_key_pressed_again);
+  RUN_TEST(test_next_pressed_across_words);
+  return UNITY_END();
+}
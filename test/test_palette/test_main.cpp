@@ -0,0 +1,185 @@
+/**
+ * Host test of the color tables published with the settings: the note colors of each palette,
+ * the chord quality and pitch class colors, and the presets stored by the first firmware.
+ *
+ * Run with: pio test -e native -f test_palette
+ */
+#include <unity.h>
+
+#include <cstring>
+
+#include "SettingsStore.h"
+#include "palette.h"
+
+#define RED 0xff0000
+#define BLUE 0x0000ff
+
+/// Variables ///
+
+static SettingsStore* settings = NULL;
+static const led_settings_t* current = NULL;
+
+/// Functions definition ///
+
+static void publishPalette(palette_mode_t palette, uint8_t split_key = DEFAULT_SPLIT_KEY) {
+  if (current != NULL) settings->release(current);
+  led_preset_t preset = SettingsStore::defaultPreset();
+  preset.palette = palette;
+  preset.color = RED;
+  preset.secondary_color = BLUE;
+  preset.split_key = split_key;
+  settings->publish(preset);
+  current = settings->acquire();
+}
+
+void setUp() {
+  settings = new SettingsStore();
+  current = NULL;
+}
+
+void tearDown() {
+  if (current != NULL) settings->release(current);
+  delete settings;
+}
+
+void test_hue_to_color() {
+  TEST_ASSERT_EQUAL_HEX32(0xff0000, hueToColor(0));
+  TEST_ASSERT_EQUAL_HEX32(0xffff00, hueToColor(60));
+  TEST_ASSERT_EQUAL_HEX32(0x00ff00, hueToColor(120));
+  TEST_ASSERT_EQUAL_HEX32(0x00ffff, hueToColor(180));
+  TEST_ASSERT_EQUAL_HEX32(0x0000ff, hueToColor(240));
+  TEST_ASSERT_EQUAL_HEX32(0xff00ff, hueToColor(300));
+  TEST_ASSERT_EQUAL_HEX32(0xff7f00, hueToColor(30));
+  TEST_ASSERT_EQUAL_HEX32(hueToColor(10), hueToColor(370));
+}
+
+void test_single_color() {
+  publishPalette(PALETTE_SINGLE_COLOR);
+  for (int note = 0; note < 128; note++) TEST_ASSERT_EQUAL_HEX32(RED, current->note_colors[note]);
+}
+
+/**
+ * Pitch classes a fifth apart are 30 degrees apart on the color wheel, octaves have the same color.
+ */
+void test_pitch_class() {
+  publishPalette(PALETTE_PITCH_CLASS);
+  TEST_ASSERT_EQUAL_HEX32(0xff0000, current->note_colors[60]);
+  TEST_ASSERT_EQUAL_HEX32(hueToColor(30), current->note_colors[67]);
+  TEST_ASSERT_EQUAL_HEX32(hueToColor(60), current->note_colors[62]);
+  TEST_ASSERT_EQUAL_HEX32(hueToColor(210), current->note_colors[61]);
+  for (int note = 12; note < 128; note++) TEST_ASSERT_EQUAL_HEX32(current->note_colors[note - 12], current->note_colors[note]);
+  for (int pitch_class = 0; pitch_class < 12; pitch_class++) {
+    TEST_ASSERT_EQUAL_HEX32(current->note_colors[pitch_class], current->pitch_class_colors[pitch_class]);
+  }
+}
+
+/**
+ * Red on the lowest key to violet on the highest one, the notes past the keyboard take the color of its ends.
+ */
+void test_rainbow() {
+  publishPalette(PALETTE_RAINBOW);
+  TEST_ASSERT_EQUAL_HEX32(0xff0000, current->note_colors[PIANO_FIRST_NOTE]);
+  TEST_ASSERT_EQUAL_HEX32(0xff00ff, current->note_colors[PIANO_LAST_NOTE]);
+  TEST_ASSERT_EQUAL_HEX32(0xff0000, current->note_colors[0]);
+  TEST_ASSERT_EQUAL_HEX32(0xff00ff, current->note_colors[127]);
+  // Middle of the keyboard, about 150 degrees
+  TEST_ASSERT_EQUAL_HEX32(hueToColor(getKeyboardPosition(64) * 300 / 255), current->note_colors[64]);
+}
+
+void test_gradient() {
+  publishPalette(PALETTE_GRADIENT);
+  TEST_ASSERT_EQUAL_HEX32(BLUE, current->note_colors[PIANO_FIRST_NOTE]);
+  TEST_ASSERT_EQUAL_HEX32(RED, current->note_colors[PIANO_LAST_NOTE]);
+  TEST_ASSERT_EQUAL_HEX32(BLUE, current->note_colors[0]);
+  TEST_ASSERT_EQUAL_HEX32(blendColors(BLUE, RED, getKeyboardPosition(64)), current->note_colors[64]);
+  // Red rises and blue falls along the keyboard
+  for (int note = PIANO_FIRST_NOTE + 1; note <= PIANO_LAST_NOTE; note++) {
+    TEST_ASSERT_TRUE((current->note_colors[note] >> 16) >= (current->note_colors[note - 1] >> 16));
+    TEST_ASSERT_TRUE((current->note_colors[note] & 0xff) <= (current->note_colors[note - 1] & 0xff));
+  }
+  TEST_ASSERT_EQUAL_HEX32(0x80007f, blendColors(BLUE, RED, 128));
+}
+
+void test_hand_split() {
+  publishPalette(PALETTE_HAND_SPLIT);
+  TEST_ASSERT_EQUAL_HEX32(BLUE, current->note_colors[DEFAULT_SPLIT_KEY - 1]);
+  TEST_ASSERT_EQUAL_HEX32(RED, current->note_colors[DEFAULT_SPLIT_KEY]);
+  publishPalette(PALETTE_HAND_SPLIT, 48);
+  TEST_ASSERT_EQUAL_HEX32(BLUE, current->note_colors[0]);
+  TEST_ASSERT_EQUAL_HEX32(BLUE, current->note_colors[47]);
+  TEST_ASSERT_EQUAL_HEX32(RED, current->note_colors[48]);
+  TEST_ASSERT_EQUAL_HEX32(RED, current->note_colors[127]);
+}
+
+/**
+ * Every chord quality has its own color, no chord keeps the preset color.
+ */
+void test_chord_quality_colors() {
+  publishPalette(PALETTE_CHORD_QUALITY);
+  TEST_ASSERT_EQUAL_HEX32(RED, current->chord_colors[CHORD_QUALITY_NONE]);
+  TEST_ASSERT_EQUAL_HEX32(0xffc000, current->chord_colors[CHORD_QUALITY_MAJOR]);
+  TEST_ASSERT_EQUAL_HEX32(0x0040ff, current->chord_colors[CHORD_QUALITY_MINOR]);
+  for (int a = CHORD_QUALITY_NONE; a < CHORD_QUALITY_COUNT; a++) {
+    for (int b = a + 1; b < CHORD_QUALITY_COUNT; b++) TEST_ASSERT_NOT_EQUAL(current->chord_colors[a], current->chord_colors[b]);
+  }
+  // The note colors are the preset color, the renderer picks the chord ones
+  TEST_ASSERT_EQUAL_HEX32(RED, current->note_colors[60]);
+}
+
+/**
+ * Version 1 blobs are 28 bytes, without the secondary color and the split key: they get the defaults.
+ */
+void test_v1_preset_upgrade() {
+  uint8_t blob[28];
+  memset(blob, 0, sizeof(blob));
+  blob[0] = 1;
+  blob[1] = 80;
+  blob[2] = 1;
+  blob[3] = PALETTE_RAINBOW;
+  blob[4] = VELOCITY_CURVE_SOFT;
+  blob[5] = EFFECT_SPARKS;
+  blob[6] = KEY_MAPPING_TWO_LEDS_PER_KEY;
+  const uint32_t color = 0x123456;
+  memcpy(blob + 8, &color, sizeof(color));
+  strcpy((char*)blob + 12, "concert");
+
+  led_preset_t preset;
+  TEST_ASSERT_TRUE(SettingsStore::decodePreset(blob, sizeof(blob), &preset));
+  TEST_ASSERT_EQUAL(LED_PRESET_VERSION, preset.version);
+  TEST_ASSERT_EQUAL(80, preset.brightness);
+  TEST_ASSERT_EQUAL(1, preset.show_sustain);
+  TEST_ASSERT_EQUAL(PALETTE_RAINBOW, preset.palette);
+  TEST_ASSERT_EQUAL(VELOCITY_CURVE_SOFT, preset.velocity_curve);
+  TEST_ASSERT_EQUAL(EFFECT_SPARKS, preset.effect);
+  TEST_ASSERT_EQUAL_HEX32(0x123456, preset.color);
+  TEST_ASSERT_EQUAL_HEX32(DEFAULT_SECONDARY_COLOR, preset.secondary_color);
+  TEST_ASSERT_EQUAL(DEFAULT_SPLIT_KEY, preset.split_key);
+  TEST_ASSERT_EQUAL_STRING("concert", preset.name);
+
+  // The upgraded preset is stored as version 2 and reads back the same
+  led_preset_t stored;
+  TEST_ASSERT_TRUE(SettingsStore::decodePreset(&preset, sizeof(preset), &stored));
+  TEST_ASSERT_EQUAL_MEMORY(&preset, &stored, sizeof(preset));
+
+  // Values out of range are refused whatever the version
+  blob[3] = PALETTE_COUNT;
+  TEST_ASSERT_FALSE(SettingsStore::decodePreset(blob, sizeof(blob), &preset));
+  // 28 bytes are only read as version 1
+  blob[3] = PALETTE_RAINBOW;
+  blob[0] = 2;
+  TEST_ASSERT_FALSE(SettingsStore::decodePreset(blob, sizeof(blob), &preset));
+  TEST_ASSERT_FALSE(SettingsStore::decodePreset(blob, sizeof(blob) - 1, &preset));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_hue_to_color);
+  RUN_TEST(test_single_color);
+  RUN_TEST(test_pitch_class);
+  RUN_TEST(test_rainbow);
+  RUN_TEST(test_gradient);
+  RUN_TEST(test_hand_split);
+  RUN_TEST(test_chord_quality_colors);
+  RUN_TEST(test_v1_preset_upgrade);
+  return UNITY_END();
+}
@@ -0,0 +1,170 @@
+/**
+ * Host test of the particle pool: the spawn budget of a frame, the reuse of the particle closest
+ * to its end when the pool is full, the packing of the alive particles and the additive drawing.
+ *
+ * Run with: pio test -e native -f test_particle_system
+ */
+#include <unity.h>
+
+#include <cstring>
+
+#include "NoteRenderer.h"
+#include "ParticleSystem.h"
+
+#define LED_COUNT 175
+#define FRAME_US 16000
+// Velocity of the particles that stay on their pixel
+#define STILL 0
+
+/// Variables ///
+
+static uint8_t frame[3 * LED_COUNT];
+
+/// Functions definition ///
+
+static int32_t pixelPosition(int pixel) {
+  return pixel << 16;
+}
+
+static uint32_t getPixel(int pixel) {
+  return (frame[3 * pixel] << 16) | (frame[3 * pixel + 1] << 8) | frame[3 * pixel + 2];
+}
+
+static bool isBlack(const uint8_t* pixels, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (pixels[i] != 0) return false;
+  }
+  return true;
+}
+
+void setUp() {
+  memset(frame, 0, sizeof(frame));
+}
+
+void tearDown() {
+
+}
+
+/**
+ * A glissando over the 88 keys in one frame: only PARTICLE_MAX_SPAWNS_PER_FRAME particles are spawned.
+ */
+void test_spawn_budget() {
+  ParticleSystem particles;
+  particles.update(0);
+  int spawned = 0;
+  for (int key = 0; key < 88; key++) spawned += particles.spawn(pixelPosition(key), STILL, 0xffffff, 1000000);
+  TEST_ASSERT_EQUAL(PARTICLE_MAX_SPAWNS_PER_FRAME, spawned);
+  TEST_ASSERT_EQUAL(PARTICLE_MAX_SPAWNS_PER_FRAME, particles.getCount());
+  TEST_ASSERT_EQUAL(88 - PARTICLE_MAX_SPAWNS_PER_FRAME, particles.getDroppedCount());
+  TEST_ASSERT_EQUAL(0, particles.getReusedCount());
+
+  // The next frame has a new budget
+  particles.update(FRAME_US);
+  TEST_ASSERT_TRUE(particles.spawn(pixelPosition(100), STILL, 0xffffff, 1000000));
+  TEST_ASSERT_EQUAL(PARTICLE_MAX_SPAWNS_PER_FRAME + 1, particles.getCount());
+  // A particle without life is never spawned
+  TEST_ASSERT_FALSE(particles.spawn(pixelPosition(101), STILL, 0xffffff, 0));
+}
+
+/**
+ * With a full pool the particle closest to its end is replaced, whatever its age.
+ */
+void test_full_pool_reuse() {
+  ParticleSystem particles;
+  uint32_t now_us = 0;
+  particles.update(now_us);
+  for (int i = 0; i < PARTICLE_CAPACITY; i++) {
+    if (i > 0 && i % PARTICLE_MAX_SPAWNS_PER_FRAME == 0) particles.update(now_us += 1000);
+    // Particle 40 has the least life left, though not the oldest
+    const uint32_t life_us = i == 40 ? 100000 : 1000000 + i * 1000;
+    TEST_ASSERT_TRUE(particles.spawn(pixelPosition(i), STILL, 0x000010, life_us));
+  }
+  TEST_ASSERT_EQUAL(PARTICLE_CAPACITY, particles.getCount());
+  particles.update(now_us += 1000);
+  TEST_ASSERT_TRUE(particles.spawn(pixelPosition(150), STILL, 0x100000, 1000000));
+  TEST_ASSERT_EQUAL(PARTICLE_CAPACITY, particles.getCount());
+  TEST_ASSERT_EQUAL(1, particles.getReusedCount());
+
+  particles.draw(frame, LED_COUNT);
+  TEST_ASSERT_EQUAL_HEX32(0, getPixel(40));
+  TEST_ASSERT_EQUAL_HEX32(0x100000, getPixel(150));
+  TEST_ASSERT_NOT_EQUAL(0, getPixel(0));
+  TEST_ASSERT_NOT_EQUAL(0, getPixel(41));
+}
+
+/**
+ * Dead particles are replaced by the last one, the others keep being drawn until their end.
+ */
+void test_removal_keeps_alive_particles() {
+  ParticleSystem particles;
+  particles.update(0);
+  for (int i = 0; i < 10; i++) particles.spawn(pixelPosition(10 * i), STILL, 0x0000ff, i % 2 ? 200000 : 100000);
+  TEST_ASSERT_TRUE(particles.update(150000));
+  TEST_ASSERT_EQUAL(5, particles.getCount());
+  particles.draw(frame, LED_COUNT);
+  for (int i = 0; i < 10; i++) {
+    if (i % 2) TEST_ASSERT_NOT_EQUAL(0, getPixel(10 * i));
+    else TEST_ASSERT_EQUAL_HEX32(0, getPixel(10 * i));
+  }
+
+  // The update where the last ones die asks for a redraw, the next ones don't
+  TEST_ASSERT_TRUE(particles.update(250000));
+  TEST_ASSERT_EQUAL(0, particles.getCount());
+  TEST_ASSERT_FALSE(particles.update(260000));
+}
+
+void test_additive_draw() {
+  ParticleSystem particles;
+  particles.update(0);
+  // Two particles on the same pixel, green saturates
+  particles.spawn(pixelPosition(5), STILL, 0x20a000, 1000000);
+  particles.spawn(pixelPosition(5), STILL, 0x00a010, 1000000);
+  // Half way between two pixels, half of the color on each
+  particles.spawn(pixelPosition(20) + 0x8000, STILL, 0x800000, 1000000);
+  frame[3 * 5 + 2] = 0x01;
+  particles.draw(frame, LED_COUNT);
+  TEST_ASSERT_EQUAL_HEX32(0x20ff11, getPixel(5));
+  TEST_ASSERT_EQUAL_HEX32(0x400000, getPixel(20));
+  TEST_ASSERT_EQUAL_HEX32(0x400000, getPixel(21));
+
+  // Linear fade, half of the color at half of the life
+  memset(frame, 0, sizeof(frame));
+  particles.update(500000);
+  particles.draw(frame, LED_COUNT);
+  TEST_ASSERT_EQUAL_HEX32(0x10a008, getPixel(5));
+}
+
+/**
+ * Ripples leave the key and fade, once the last one is gone the particle layer adds nothing to the frame.
+ */
+void test_renderer_ripple_fades_out() {
+  SettingsStore settings;
+  led_preset_t preset = settings.getPreset();
+  preset.effect = EFFECT_RIPPLE;
+  settings.publish(preset);
+  NoteRenderer renderer(LED_COUNT, &settings);
+  renderer.animate(0);
+  renderer.noteOn(60, 127);
+  renderer.noteOff(60);
+  TEST_ASSERT_EQUAL(2, renderer.getParticles()->getCount());
+  renderer.render();
+  TEST_ASSERT_FALSE(isBlack(renderer.getFrame(), 3 * LED_COUNT));
+
+  uint32_t now_us = 0;
+  while (renderer.getParticles()->getCount() > 0 && now_us < 2000000) {
+    now_us += FRAME_US;
+    if (renderer.animate(now_us)) renderer.render();
+  }
+  TEST_ASSERT_EQUAL(0, renderer.getParticles()->getCount());
+  TEST_ASSERT_TRUE(isBlack(renderer.getFrame(), 3 * LED_COUNT));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_spawn_budget);
+  RUN_TEST(test_full_pool_reuse);
+  RUN_TEST(test_removal_keeps_alive_particles);
+  RUN_TEST(test_additive_draw);
+  RUN_TEST(test_renderer_ripple_fades_out);
+  return UNITY_END();
+}
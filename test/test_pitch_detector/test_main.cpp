@@ -0,0 +1,202 @@
+/**
+ * Host test of the audio input, from WAV files to MIDI notes.
+ * A synthetic piano chord is written to a temporary WAV file before each test, read back and fed block by block
+ * to the pitch detector, and removed after the test.
+ *
+ * Run with: pio test -e native -f test_pitch_detector
+ * Set PIANEON_WAV_INPUT to the path of a 16 bit PCM recording to also print the notes detected in it.
+ */
+#include <unity.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "PitchDetector.h"
+#include "WavFile.h"
+#include "midi_decoder.h"
+
+#define WAV_TEMPLATE "/tmp/pitch_detector_XXXXXX"
+#define CHORD_BLOCKS 16
+#define SILENCE_BLOCKS 8
+
+/// Variables ///
+
+static const uint8_t chord_notes[] = { 60, 64, 67 };
+static uint32_t notes_on[4];
+static size_t note_on_count;
+static size_t note_off_count;
+static uint32_t block_time_us;
+static bool print_events = false;
+static char wav_path[sizeof(WAV_TEMPLATE)];
+
+/// Functions definition ///
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+static void midiInCallback(midi_usb_packet packet) {
+  const midi_event_t event = decodeMidiPacket(packet);
+  if (event.type == MIDI_EVENT_NOTE_ON) {
+    notes_on[event.note >> 5] |= 1UL << (event.note & 31);
+    note_on_count++;
+  } else if (event.type == MIDI_EVENT_NOTE_OFF) {
+    notes_on[event.note >> 5] &= ~(1UL << (event.note & 31));
+    note_off_count++;
+  } else {
+    return;
+  }
+  if (print_events) printf("%8.3f s %s %d\n", block_time_us / 1e6, event.type == MIDI_EVENT_NOTE_ON ? "on " : "off", event.note);
+}
+
+static bool isOn(uint8_t note) {
+  return notes_on[note >> 5] & (1UL << (note & 31));
+}
+
+static void writeLittleEndian(FILE* file, uint32_t value, int length) {
+  for (int i = 0; i < length; i++) fputc((value >> (8 * i)) & 0xff, file);
+}
+
+/**
+ * Chord with five decaying partials per note, like a struck string, then silence.
+ */
+static void writeChordWav(int descriptor) {
+  const uint32_t sample_count = (CHORD_BLOCKS + SILENCE_BLOCKS) * AUDIO_BLOCK_SIZE;
+  FILE* file = fdopen(descriptor, "wb");
+  TEST_ASSERT_NOT_NULL(file);
+  fwrite("RIFF", 1, 4, file);
+  writeLittleEndian(file, 36 + 2 * sample_count, 4);
+  fwrite("WAVEfmt ", 1, 8, file);
+  writeLittleEndian(file, 16, 4);
+  writeLittleEndian(file, 1, 2);
+  writeLittleEndian(file, 1, 2);
+  writeLittleEndian(file, AUDIO_SAMPLE_RATE, 4);
+  writeLittleEndian(file, 2 * AUDIO_SAMPLE_RATE, 4);
+  writeLittleEndian(file, 2, 2);
+  writeLittleEndian(file, 16, 2);
+  fwrite("data", 1, 4, file);
+  writeLittleEndian(file, 2 * sample_count, 4);
+  for (uint32_t i = 0; i < sample_count; i++) {
+    double sample = 0;
+    if (i < CHORD_BLOCKS * AUDIO_BLOCK_SIZE) {
+      const double time = (double)i / AUDIO_SAMPLE_RATE;
+      for (uint8_t note : chord_notes) {
+        const double frequency = 440 * pow(2, (note - 69) / 12.0);
+        for (int partial = 1; partial <= 5; partial++) {
+          sample += 3000.0 / partial * exp(-time) * sin(2 * M_PI * frequency * partial * time);
+        }
+      }
+    }
+    writeLittleEndian(file, (uint16_t)(int16_t)lround(sample), 2);
+  }
+  fclose(file);
+}
+
+/**
+ * Feed the file block by block, the last partial block is padded with silence.
+ * Return the average processing time of a block in ns.
+ */
+static double feedWav(WavFile* wav, PitchDetector* detector) {
+  detector->setMidiInCallback(&midiInCallback);
+  int16_t block[AUDIO_BLOCK_SIZE];
+  size_t read_count;
+  size_t block_count = 0;
+  int64_t elapsed = 0;
+  block_time_us = 0;
+  while ((read_count = wav->read(block, AUDIO_BLOCK_SIZE)) > 0) {
+    for (size_t i = read_count; i < AUDIO_BLOCK_SIZE; i++) block[i] = 0;
+    const int64_t start = nowNs();
+    detector->process(block);
+    elapsed += nowNs() - start;
+    block_count++;
+    block_time_us = (uint64_t)block_count * AUDIO_BLOCK_SIZE * 1000000 / wav->getSampleRate();
+  }
+  return block_count > 0 ? (double)elapsed / block_count : 0;
+}
+
+void setUp() {
+  for (uint8_t i = 0; i < 4; i++) notes_on[i] = 0;
+  note_on_count = 0;
+  note_off_count = 0;
+  // Each test has its own file, whatever ran before
+  strcpy(wav_path, WAV_TEMPLATE);
+  const int descriptor = mkstemp(wav_path);
+  TEST_ASSERT_TRUE(descriptor >= 0);
+  writeChordWav(descriptor);
+}
+
+void tearDown() {
+  unlink(wav_path);
+}
+
+void test_wav_reader() {
+  WavFile wav;
+  TEST_ASSERT_TRUE(wav.open(wav_path));
+  TEST_ASSERT_EQUAL(AUDIO_SAMPLE_RATE, wav.getSampleRate());
+  TEST_ASSERT_EQUAL(1, wav.getChannelCount());
+  int16_t block[AUDIO_BLOCK_SIZE];
+  size_t total = 0, read_count;
+  while ((read_count = wav.read(block, AUDIO_BLOCK_SIZE)) > 0) total += read_count;
+  TEST_ASSERT_EQUAL((CHORD_BLOCKS + SILENCE_BLOCKS) * AUDIO_BLOCK_SIZE, total);
+  TEST_ASSERT_FALSE(wav.open("missing.wav"));
+}
+
+void test_chord_detection() {
+  WavFile wav;
+  TEST_ASSERT_TRUE(wav.open(wav_path));
+  PitchDetector detector(wav.getSampleRate());
+  const double block_ns = feedWav(&wav, &detector);
+  printf("%.1f us per block of %d samples\n", block_ns / 1000, AUDIO_BLOCK_SIZE);
+  // Each chord note was played once, their partials are not notes
+  TEST_ASSERT_EQUAL(3, note_on_count);
+  TEST_ASSERT_EQUAL(3, note_off_count);
+  for (uint8_t note = 0; note < 128; note++) TEST_ASSERT_FALSE(isOn(note));
+}
+
+void test_chord_held() {
+  // Stop in the middle of the chord
+  WavFile wav;
+  TEST_ASSERT_TRUE(wav.open(wav_path));
+  PitchDetector detector(wav.getSampleRate());
+  detector.setMidiInCallback(&midiInCallback);
+  int16_t block[AUDIO_BLOCK_SIZE];
+  for (int i = 0; i < CHORD_BLOCKS / 2; i++) {
+    TEST_ASSERT_EQUAL(AUDIO_BLOCK_SIZE, wav.read(block, AUDIO_BLOCK_SIZE));
+    detector.process(block);
+  }
+  for (uint8_t note : chord_notes) {
+    TEST_ASSERT_TRUE(isOn(note));
+    TEST_ASSERT_TRUE(detector.isNoteOn(note));
+  }
+  TEST_ASSERT_FALSE(isOn(72));
+  TEST_ASSERT_FALSE(isOn(79));
+  detector.stop();
+  for (uint8_t note : chord_notes) TEST_ASSERT_FALSE(isOn(note));
+}
+
+void test_wav_input() {
+  const char* path = getenv("PIANEON_WAV_INPUT");
+  if (path == NULL) TEST_IGNORE_MESSAGE("PIANEON_WAV_INPUT not set");
+  WavFile wav;
+  TEST_ASSERT_TRUE_MESSAGE(wav.open(path), "Not a 16 bit PCM WAV file");
+  PitchDetector detector(wav.getSampleRate());
+  print_events = true;
+  feedWav(&wav, &detector);
+  print_events = false;
+  printf("%zu notes detected in %s\n", note_on_count, path);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_wav_reader);
+  RUN_TEST(test_chord_detection);
+  RUN_TEST(test_chord_held);
+  RUN_TEST(test_wav_input);
+  return UNITY_END();
+}
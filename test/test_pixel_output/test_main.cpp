@@ -0,0 +1,164 @@
+/**
+ * Host test of the E1.31 and Art-Net output over a local UDP socket: the universe and sequence
+ * of the headers, the pixels carried by each universe, and the universes left out when they didn't change.
+ *
+ * Run with: pio test -e native -f test_pixel_output
+ */
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "PixelNetworkOutput.h"
+
+#define RECEIVER_PORT 15568
+#define FIRST_UNIVERSE 3
+// Two universes, the second one is not full and has an odd number of channels
+#define PIXEL_COUNT (PIXEL_UNIVERSE_SIZE + 25)
+// Time given to the loopback to deliver a datagram
+#define DELIVERY_TIMEOUT_MS 200
+
+/// Types ///
+
+typedef struct {
+  uint8_t data[E131_HEADER_SIZE + 3 * PIXEL_UNIVERSE_SIZE + 1];
+  ssize_t length;
+} datagram_t;
+
+/// Variables ///
+
+static int receiver_socket = -1;
+static uint8_t frame[3 * PIXEL_COUNT];
+
+/// Functions definition ///
+
+static uint32_t readBigEndian(const uint8_t* bytes, int length) {
+  uint32_t value = 0;
+  for (int i = 0; i < length; i++) value = (value << 8) | bytes[i];
+  return value;
+}
+
+static bool receive(datagram_t* datagram) {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DELIVERY_TIMEOUT_MS);
+  while (std::chrono::steady_clock::now() < deadline) {
+    datagram->length = recv(receiver_socket, datagram->data, sizeof(datagram->data), MSG_DONTWAIT);
+    if (datagram->length > 0) return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+static bool nothingReceived() {
+  uint8_t data[16];
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  return recv(receiver_socket, data, sizeof(data), MSG_DONTWAIT) < 0;
+}
+
+/**
+ * Check the E1.31 layers of a universe and the pixels it carries.
+ */
+static void checkE131(const datagram_t* datagram, uint16_t universe_index, uint8_t sequence) {
+  const uint16_t first_pixel = universe_index * PIXEL_UNIVERSE_SIZE;
+  const uint16_t pixels = PIXEL_COUNT - first_pixel < PIXEL_UNIVERSE_SIZE ? PIXEL_COUNT - first_pixel : PIXEL_UNIVERSE_SIZE;
+  TEST_ASSERT_EQUAL(E131_HEADER_SIZE + 3 * pixels, datagram->length);
+  TEST_ASSERT_EQUAL_MEMORY("ASC-E1.17", datagram->data + 4, 9);
+  // Each layer length covers the rest of the packet
+  TEST_ASSERT_EQUAL(datagram->length - 16, readBigEndian(datagram->data + 16, 2) & 0x0fff);
+  TEST_ASSERT_EQUAL(datagram->length - 38, readBigEndian(datagram->data + 38, 2) & 0x0fff);
+  TEST_ASSERT_EQUAL(datagram->length - 115, readBigEndian(datagram->data + 115, 2) & 0x0fff);
+  TEST_ASSERT_EQUAL_STRING("Pianeon test", (const char*)datagram->data + 44);
+  TEST_ASSERT_EQUAL(sequence, datagram->data[111]);
+  TEST_ASSERT_EQUAL(FIRST_UNIVERSE + universe_index, readBigEndian(datagram->data + 113, 2));
+  TEST_ASSERT_EQUAL(3 * pixels + 1, readBigEndian(datagram->data + 123, 2));
+  TEST_ASSERT_EQUAL(0, datagram->data[125]);
+  TEST_ASSERT_EQUAL_MEMORY(frame + 3 * first_pixel, datagram->data + E131_HEADER_SIZE, 3 * pixels);
+}
+
+void setUp() {
+  receiver_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(RECEIVER_PORT);
+  TEST_ASSERT_EQUAL(0, bind(receiver_socket, (struct sockaddr*)&address, sizeof(address)));
+  for (size_t i = 0; i < sizeof(frame); i++) frame[i] = i * 7;
+}
+
+void tearDown() {
+  close(receiver_socket);
+}
+
+void test_e131_universes() {
+  PixelNetworkOutput output(PIXEL_PROTOCOL_E131, FIRST_UNIVERSE);
+  output.setSourceName("Pianeon test");
+  TEST_ASSERT_TRUE(output.begin(INADDR_LOOPBACK, RECEIVER_PORT));
+  TEST_ASSERT_EQUAL(2, output.send(frame, PIXEL_COUNT, 0));
+  datagram_t datagram;
+  TEST_ASSERT_TRUE(receive(&datagram));
+  checkE131(&datagram, 0, 0);
+  TEST_ASSERT_TRUE(receive(&datagram));
+  checkE131(&datagram, 1, 0);
+
+  // Only the universe that changed is sent again, with the next sequence
+  frame[3 * PIXEL_UNIVERSE_SIZE + 4] ^= 0xff;
+  TEST_ASSERT_EQUAL(1, output.send(frame, PIXEL_COUNT, 1000));
+  TEST_ASSERT_TRUE(receive(&datagram));
+  checkE131(&datagram, 1, 1);
+  TEST_ASSERT_TRUE(nothingReceived());
+  TEST_ASSERT_EQUAL(3, output.getSentPackets());
+  TEST_ASSERT_EQUAL(1, output.getSkippedPackets());
+
+  // Unchanged universes are sent again after the keep alive period
+  TEST_ASSERT_EQUAL(0, output.send(frame, PIXEL_COUNT, 2000));
+  TEST_ASSERT_EQUAL(2, output.send(frame, PIXEL_COUNT, 1000 + PIXEL_KEEP_ALIVE_US));
+  TEST_ASSERT_TRUE(receive(&datagram));
+  checkE131(&datagram, 0, 1);
+  TEST_ASSERT_TRUE(receive(&datagram));
+  checkE131(&datagram, 1, 2);
+}
+
+/**
+ * Art-Net numbers its packets from 1 and pads the universes to an even number of channels.
+ */
+void test_artnet_universes() {
+  PixelNetworkOutput output(PIXEL_PROTOCOL_ARTNET, FIRST_UNIVERSE);
+  TEST_ASSERT_TRUE(output.begin(INADDR_LOOPBACK, RECEIVER_PORT));
+  TEST_ASSERT_EQUAL(2, output.send(frame, PIXEL_COUNT, 0));
+  datagram_t datagram;
+  TEST_ASSERT_TRUE(receive(&datagram));
+  TEST_ASSERT_EQUAL(ARTNET_HEADER_SIZE + 3 * PIXEL_UNIVERSE_SIZE, datagram.length);
+  TEST_ASSERT_EQUAL_MEMORY("Art-Net", datagram.data, 8);
+  TEST_ASSERT_EQUAL(0x5000, datagram.data[8] | (datagram.data[9] << 8));
+  TEST_ASSERT_EQUAL(1, datagram.data[12]);
+  TEST_ASSERT_EQUAL(FIRST_UNIVERSE, datagram.data[14]);
+  TEST_ASSERT_EQUAL(3 * PIXEL_UNIVERSE_SIZE, readBigEndian(datagram.data + 16, 2));
+  TEST_ASSERT_EQUAL_MEMORY(frame, datagram.data + ARTNET_HEADER_SIZE, 3 * PIXEL_UNIVERSE_SIZE);
+
+  const uint16_t channels = 3 * (PIXEL_COUNT - PIXEL_UNIVERSE_SIZE);
+  TEST_ASSERT_TRUE(receive(&datagram));
+  TEST_ASSERT_EQUAL(ARTNET_HEADER_SIZE + channels + 1, datagram.length);
+  TEST_ASSERT_EQUAL(FIRST_UNIVERSE + 1, datagram.data[14]);
+  TEST_ASSERT_EQUAL(channels + 1, readBigEndian(datagram.data + 16, 2));
+  TEST_ASSERT_EQUAL_MEMORY(frame + 3 * PIXEL_UNIVERSE_SIZE, datagram.data + ARTNET_HEADER_SIZE, channels);
+  TEST_ASSERT_EQUAL(0, datagram.data[ARTNET_HEADER_SIZE + channels]);
+
+  frame[0] ^= 0xff;
+  TEST_ASSERT_EQUAL(1, output.send(frame, PIXEL_COUNT, 1000));
+  TEST_ASSERT_TRUE(receive(&datagram));
+  TEST_ASSERT_EQUAL(2, datagram.data[12]);
+  TEST_ASSERT_EQUAL(FIRST_UNIVERSE, datagram.data[14]);
+  TEST_ASSERT_EQUAL_MEMORY(frame, datagram.data + ARTNET_HEADER_SIZE, 3 * PIXEL_UNIVERSE_SIZE);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_e131_universes);
+  RUN_TEST(test_artnet_universes);
+  return UNITY_END();
+}
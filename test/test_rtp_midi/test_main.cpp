@@ -0,0 +1,277 @@
+/**
+ * Host test of the RTP-MIDI session over a local UDP socket: invitation, timing of the packets
+ * and of the commands inside a packet through the jitter buffer, the state recovered from the journal
+ * after a lost packet, and the notes released when the peer leaves.
+ *
+ * Run with: pio test -e native -f test_rtp_midi
+ */
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "RtpMidiSession.h"
+#include "midi_decoder.h"
+
+#define SESSION_PORT 15004
+#define PEER_SSRC 0x12345678
+// Time given to the loopback to deliver a datagram
+#define DELIVERY_TIMEOUT_MS 200
+// Any time of the local clock, far from the sender one
+#define ARRIVAL_US 5000000
+
+/// Types ///
+
+typedef struct {
+  uint32_t time_us;
+  midi_usb_packet packet;
+} received_t;
+
+/// Variables ///
+
+static received_t received[64];
+static size_t received_count = 0;
+static uint32_t clock_us = 0;
+static int peer_socket = -1;
+static uint16_t sequence = 0;
+
+/// Functions definition ///
+
+static void receiveMidi(midi_usb_packet packet) {
+  if (received_count < sizeof(received) / sizeof(received[0])) received[received_count++] = { clock_us, packet };
+}
+
+static void sendToSession(const uint8_t* packet, size_t length, uint16_t port) {
+  struct sockaddr_in destination;
+  memset(&destination, 0, sizeof(destination));
+  destination.sin_family = AF_INET;
+  destination.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  destination.sin_port = htons(port);
+  sendto(peer_socket, packet, length, 0, (struct sockaddr*)&destination, sizeof(destination));
+}
+
+static void writeBigEndian(uint8_t* bytes, uint32_t value, int length) {
+  for (int i = length - 1; i >= 0; i--, value >>= 8) bytes[i] = value & 0xff;
+}
+
+/**
+ * AppleMIDI invitation on the data port, return true once the session answered OK.
+ */
+static bool invite(RtpMidiSession* session) {
+  uint8_t invitation[16] = { 0xff, 0xff, 'I', 'N' };
+  writeBigEndian(invitation + 4, 2, 4);
+  writeBigEndian(invitation + 12, PEER_SSRC, 4);
+  sendToSession(invitation, sizeof(invitation), SESSION_PORT + 1);
+  uint8_t reply[64];
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DELIVERY_TIMEOUT_MS);
+  while (std::chrono::steady_clock::now() < deadline) {
+    session->loop(clock_us);
+    const ssize_t length = recv(peer_socket, reply, sizeof(reply), MSG_DONTWAIT);
+    if (length >= 16) return reply[2] == 'O' && reply[3] == 'K';
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+/**
+ * RTP-MIDI packet of one command section, commands holds the delta times and the MIDI bytes.
+ * @param first_delta Z flag, the first command has a delta time
+ * @param journal recovery journal following the commands, J flag set when given
+ */
+static void sendRtp(uint32_t timestamp_100us, const uint8_t* commands, size_t length, bool first_delta = false,
+    const uint8_t* journal = NULL, size_t journal_length = 0) {
+  uint8_t packet[64] = { 0x80, 0x61 };
+  writeBigEndian(packet + 2, sequence++, 2);
+  writeBigEndian(packet + 4, timestamp_100us, 4);
+  writeBigEndian(packet + 8, PEER_SSRC, 4);
+  packet[12] = (journal != NULL ? 0x40 : 0) | (first_delta ? 0x20 : 0) | (length & 0x0f);
+  memcpy(packet + 13, commands, length);
+  if (journal != NULL) memcpy(packet + 13 + length, journal, journal_length);
+  sendToSession(packet, 13 + length + journal_length, SESSION_PORT + 1);
+}
+
+/**
+ * Let the session read what was sent, without moving its clock.
+ */
+static void deliver(RtpMidiSession* session, size_t queued) {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DELIVERY_TIMEOUT_MS);
+  while (session->getJitterBuffer()->getCount() + received_count < queued && std::chrono::steady_clock::now() < deadline) {
+    session->loop(clock_us);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+// Move the clock 100 us at a time, the events are sent at the first loop after their time
+static void advance(RtpMidiSession* session, uint32_t until_us) {
+  while ((int32_t)(until_us - clock_us) > 0) {
+    clock_us += 100;
+    session->loop(clock_us);
+  }
+}
+
+void setUp() {
+  received_count = 0;
+  clock_us = ARRIVAL_US;
+  sequence = 0;
+  peer_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+}
+
+void tearDown() {
+  close(peer_socket);
+}
+
+void test_invitation() {
+  RtpMidiSession session("Pianeon test", SESSION_PORT);
+  TEST_ASSERT_TRUE(session.begin());
+  TEST_ASSERT_FALSE(session.isConnected());
+  TEST_ASSERT_TRUE(invite(&session));
+  TEST_ASSERT_TRUE(session.isConnected());
+}
+
+/**
+ * Packets keep the spacing of their timestamps, whatever their transit time.
+ */
+void test_packet_timing() {
+  RtpMidiSession session("Pianeon test", SESSION_PORT);
+  session.setMidiInCallback(&receiveMidi);
+  TEST_ASSERT_TRUE(session.begin());
+  TEST_ASSERT_TRUE(invite(&session));
+
+  const uint8_t note_on[] = { 0x90, 60, 100 };
+  const uint8_t note_off[] = { 0x80, 60, 0 };
+  sendRtp(1000, note_on, sizeof(note_on));
+  deliver(&session, 1);
+  advance(&session, ARRIVAL_US + 1000);
+  TEST_ASSERT_EQUAL(1, received_count);
+  TEST_ASSERT_EQUAL(ARRIVAL_US, received[0].time_us);
+  TEST_ASSERT_EQUAL(RTP_MIDI_CABLE_NUMBER, received[0].packet.usb_cable_number);
+
+  // 20 ms later on both clocks
+  advance(&session, ARRIVAL_US + 20000);
+  sendRtp(1200, note_off, sizeof(note_off));
+  deliver(&session, 2);
+  advance(&session, ARRIVAL_US + 30000);
+  TEST_ASSERT_EQUAL(2, received_count);
+  TEST_ASSERT_EQUAL(MIDI_NOTE_OFF, received[1].packet.midi_type);
+  TEST_ASSERT_EQUAL(ARRIVAL_US + 20000, received[1].time_us);
+  TEST_ASSERT_EQUAL(0, session.getJitterBuffer()->getLateEvents());
+}
+
+/**
+ * The commands of a packet keep their delta times: 5 then 3 ticks of 100 us after the timestamp.
+ */
+void test_command_deltas() {
+  RtpMidiSession session("Pianeon test", SESSION_PORT);
+  session.setMidiInCallback(&receiveMidi);
+  TEST_ASSERT_TRUE(session.begin());
+  TEST_ASSERT_TRUE(invite(&session));
+  // A delta of 130 ticks takes 2 bytes
+  const uint8_t commands[] = { 0x05, 0x90, 60, 100, 0x03, 64, 100, 0x81, 0x02, 0x80, 60, 0 };
+  sendRtp(1000, commands, sizeof(commands), true);
+  deliver(&session, 3);
+  advance(&session, ARRIVAL_US + 20000);
+  TEST_ASSERT_EQUAL(3, received_count);
+  TEST_ASSERT_EQUAL(ARRIVAL_US + 500, received[0].time_us);
+  TEST_ASSERT_EQUAL(60, received[0].packet.midi_data_1);
+  TEST_ASSERT_EQUAL(ARRIVAL_US + 800, received[1].time_us);
+  TEST_ASSERT_EQUAL(64, received[1].packet.midi_data_1);
+  TEST_ASSERT_EQUAL(ARRIVAL_US + 800 + 13000, received[2].time_us);
+  TEST_ASSERT_EQUAL(MIDI_NOTE_OFF, received[2].packet.midi_type);
+}
+
+/**
+ * Packet 2 is lost: it held a note on of 67, the sustain pressed and the note off of 64.
+ * Packet 3 carries a journal of channel 3 with its chapters C and N, the state is restored before its command.
+ */
+void test_journal_recovery() {
+  RtpMidiSession session("Pianeon test", SESSION_PORT);
+  session.setMidiInCallback(&receiveMidi);
+  TEST_ASSERT_TRUE(session.begin());
+  TEST_ASSERT_TRUE(invite(&session));
+  sequence = 1;
+  const uint8_t chord[] = { 0x93, 60, 100, 0x00, 64, 100 };
+  sendRtp(0, chord, sizeof(chord));
+  deliver(&session, 2);
+  advance(&session, ARRIVAL_US + 1000);
+  TEST_ASSERT_EQUAL(2, received_count);
+
+  sequence = 3;
+  const uint8_t note_on[] = { 0x93, 72, 100 };
+  const uint8_t journal[] = {
+    // A flag, a single channel, checkpoint at packet 1
+    0x20, 0x00, 0x01,
+    // Channel 3, 13 bytes, chapters C and N
+    3 << 3, 13, 0x48,
+    // Chapter C: one log, sustain at 127
+    0x00, MIDI_CC_SUSTAIN, 127,
+    // Chapter N: two logs, off-bits of the notes 64 to 71
+    0x02, 0x88,
+    // 60 is still on and not played again, 67 was played in the lost packet
+    60, 100, 67, 0x80 | 90,
+    // 64 and 65 released, only 64 was on
+    0xc0,
+  };
+  sendRtp(200, note_on, sizeof(note_on), false, journal, sizeof(journal));
+  deliver(&session, 6);
+  advance(&session, ARRIVAL_US + 30000);
+  TEST_ASSERT_EQUAL(1, session.getLostPackets());
+  TEST_ASSERT_EQUAL(3, session.getRecoveredEvents());
+  TEST_ASSERT_EQUAL(6, received_count);
+  // Chapter C comes before chapter N
+  TEST_ASSERT_EQUAL(MIDI_CONTROL_CHANGE, received[2].packet.midi_type);
+  TEST_ASSERT_EQUAL(MIDI_CC_SUSTAIN, received[2].packet.midi_data_1);
+  TEST_ASSERT_EQUAL(127, received[2].packet.midi_data_2);
+  TEST_ASSERT_EQUAL(MIDI_NOTE_ON, received[3].packet.midi_type);
+  TEST_ASSERT_EQUAL(67, received[3].packet.midi_data_1);
+  TEST_ASSERT_EQUAL(90, received[3].packet.midi_data_2);
+  TEST_ASSERT_EQUAL(MIDI_NOTE_OFF, received[4].packet.midi_type);
+  TEST_ASSERT_EQUAL(64, received[4].packet.midi_data_1);
+  TEST_ASSERT_EQUAL(MIDI_NOTE_ON, received[5].packet.midi_type);
+  TEST_ASSERT_EQUAL(72, received[5].packet.midi_data_1);
+  for (size_t i = 2; i < received_count; i++) TEST_ASSERT_EQUAL(3, received[i].packet.midi_channel);
+
+  // The journal repeated by the next packet, nothing lost, is not applied again
+  sendRtp(300, note_on, sizeof(note_on), false, journal, sizeof(journal));
+  deliver(&session, 7);
+  advance(&session, ARRIVAL_US + 40000);
+  TEST_ASSERT_EQUAL(7, received_count);
+  TEST_ASSERT_EQUAL(3, session.getRecoveredEvents());
+}
+
+void test_notes_released_by_bye() {
+  RtpMidiSession session("Pianeon test", SESSION_PORT);
+  session.setMidiInCallback(&receiveMidi);
+  TEST_ASSERT_TRUE(session.begin());
+  TEST_ASSERT_TRUE(invite(&session));
+  const uint8_t chord[] = { 0x90, 60, 100, 0x00, 64, 100 };
+  sendRtp(0, chord, sizeof(chord));
+  deliver(&session, 2);
+  advance(&session, ARRIVAL_US + 1000);
+  TEST_ASSERT_EQUAL(2, received_count);
+
+  uint8_t bye[16] = { 0xff, 0xff, 'B', 'Y' };
+  writeBigEndian(bye + 4, 2, 4);
+  writeBigEndian(bye + 12, PEER_SSRC, 4);
+  sendToSession(bye, sizeof(bye), SESSION_PORT);
+  deliver(&session, 4);
+  TEST_ASSERT_FALSE(session.isConnected());
+  TEST_ASSERT_EQUAL(4, received_count);
+  TEST_ASSERT_EQUAL(MIDI_NOTE_OFF, received[2].packet.midi_type);
+  TEST_ASSERT_EQUAL(60, received[2].packet.midi_data_1);
+  TEST_ASSERT_EQUAL(64, received[3].packet.midi_data_1);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_invitation);
+  RUN_TEST(test_packet_timing);
+  RUN_TEST(test_command_deltas);
+  RUN_TEST(test_journal_recovery);
+  RUN_TEST(test_notes_released_by_bye);
+  return UNITY_END();
+}
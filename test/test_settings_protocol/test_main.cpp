@@ -0,0 +1,190 @@
+/**
+ * Host test of the binary settings messages: encoding and decoding, the messages refused as a whole,
+ * the fields of a newer UI skipped, and a message applied as a single publication.
+ *
+ * Run with: pio test -e native -f test_settings_protocol
+ */
+#include <unity.h>
+
+#include <cstring>
+
+#include "settings_protocol.h"
+
+/// Variables ///
+
+static uint8_t message[SETTINGS_MAX_MESSAGE_SIZE + SETTINGS_RECORD_SIZE];
+static size_t length = 0;
+
+/// Functions definition ///
+
+static void beginMessage(uint8_t version = SETTINGS_PROTOCOL_VERSION) {
+  length = 0;
+  message[length++] = version;
+}
+
+static void addRecord(uint8_t field, uint32_t value) {
+  message[length++] = field;
+  message[length++] = value >> 24;
+  message[length++] = value >> 16;
+  message[length++] = value >> 8;
+  message[length++] = value;
+}
+
+// An update already holding a field, a refused message must leave it as is
+static settings_update_t makeUntouchedUpdate() {
+  settings_update_t update = { 0, { 0 } };
+  setSettingsField(&update, SETTINGS_FIELD_BRIGHTNESS, 42);
+  return update;
+}
+
+static bool isUntouched(const settings_update_t* update) {
+  return update->fields == 1UL << SETTINGS_FIELD_BRIGHTNESS && update->values[SETTINGS_FIELD_BRIGHTNESS] == 42;
+}
+
+void setUp() {
+  length = 0;
+}
+
+void tearDown() {
+
+}
+
+void test_round_trip() {
+  settings_update_t update = { 0, { 0 } };
+  setSettingsField(&update, SETTINGS_FIELD_COLOR, 0x123456);
+  setSettingsField(&update, SETTINGS_FIELD_BRIGHTNESS, 200);
+  setSettingsField(&update, SETTINGS_FIELD_PALETTE, PALETTE_HAND_SPLIT);
+  setSettingsField(&update, SETTINGS_FIELD_SPLIT_KEY, 48);
+  setSettingsField(&update, SETTINGS_FIELD_EFFECT, EFFECT_SPARKS);
+  length = encodeSettings(&update, message);
+  TEST_ASSERT_EQUAL(1 + 5 * SETTINGS_RECORD_SIZE, length);
+  TEST_ASSERT_EQUAL(SETTINGS_PROTOCOL_VERSION, message[0]);
+  // Big endian values, records in field order
+  const uint8_t color_record[] = { SETTINGS_FIELD_COLOR, 0x00, 0x12, 0x34, 0x56 };
+  TEST_ASSERT_EQUAL_MEMORY(color_record, message + 1, sizeof(color_record));
+
+  settings_update_t decoded;
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_OK, decodeSettings(message, length, &decoded));
+  TEST_ASSERT_EQUAL_HEX32(update.fields, decoded.fields);
+  for (int field = 1; field < SETTINGS_FIELD_COUNT; field++) {
+    if (hasSettingsField(&update, (settings_field_t)field)) TEST_ASSERT_EQUAL(update.values[field], decoded.values[field]);
+  }
+
+  // A message with the version only changes nothing
+  beginMessage();
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_OK, decodeSettings(message, length, &decoded));
+  TEST_ASSERT_EQUAL(0, decoded.fields);
+}
+
+/**
+ * A bad message is refused whole: the update keeps what it held, even when the bad record comes last.
+ */
+void test_refused_messages() {
+  settings_update_t update = makeUntouchedUpdate();
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_TOO_SHORT, decodeSettings(message, 0, &update));
+  TEST_ASSERT_TRUE(isUntouched(&update));
+
+  beginMessage(SETTINGS_PROTOCOL_VERSION + 1);
+  addRecord(SETTINGS_FIELD_COLOR, 0xff0000);
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_BAD_VERSION, decodeSettings(message, length, &update));
+  TEST_ASSERT_TRUE(isUntouched(&update));
+
+  beginMessage();
+  addRecord(SETTINGS_FIELD_COLOR, 0xff0000);
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_BAD_LENGTH, decodeSettings(message, length - 1, &update));
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_BAD_LENGTH, decodeSettings(message, length + 2, &update));
+  TEST_ASSERT_TRUE(isUntouched(&update));
+
+  beginMessage();
+  for (int i = 0; i <= SETTINGS_MAX_RECORDS; i++) addRecord(SETTINGS_FIELD_COLOR, i);
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_TOO_LONG, decodeSettings(message, length, &update));
+  TEST_ASSERT_TRUE(isUntouched(&update));
+
+  const uint8_t fields[] = {
+    SETTINGS_FIELD_COLOR, SETTINGS_FIELD_SHOW_SUSTAIN, SETTINGS_FIELD_PRESET, SETTINGS_FIELD_VELOCITY_CURVE,
+    SETTINGS_FIELD_PALETTE, SETTINGS_FIELD_SECONDARY_COLOR, SETTINGS_FIELD_SPLIT_KEY, SETTINGS_FIELD_EFFECT,
+  };
+  const uint32_t out_of_range[] = { 0x1000000, 2, PRESET_COUNT, VELOCITY_CURVE_COUNT, PALETTE_COUNT, 0x1000000, 128, EFFECT_COUNT };
+  for (size_t i = 0; i < sizeof(fields); i++) {
+    beginMessage();
+    addRecord(SETTINGS_FIELD_BRIGHTNESS, 10);
+    addRecord(fields[i], out_of_range[i]);
+    TEST_ASSERT_EQUAL(SETTINGS_STATUS_BAD_VALUE, decodeSettings(message, length, &update));
+    TEST_ASSERT_TRUE(isUntouched(&update));
+    // The last valid value goes through
+    length -= SETTINGS_RECORD_SIZE;
+    addRecord(fields[i], out_of_range[i] - 1);
+    TEST_ASSERT_EQUAL(SETTINGS_STATUS_OK, decodeSettings(message, length, &update));
+    update = makeUntouchedUpdate();
+  }
+}
+
+/**
+ * Fields of a newer UI are skipped, whatever their value, and the known ones are applied.
+ */
+void test_unknown_fields_skipped() {
+  beginMessage();
+  addRecord(SETTINGS_FIELD_COUNT, 0xffffffff);
+  addRecord(SETTINGS_FIELD_COLOR, 0x00ff00);
+  addRecord(0, 0xffffffff);
+  addRecord(200, 7);
+  settings_update_t update;
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_OK, decodeSettings(message, length, &update));
+  TEST_ASSERT_EQUAL_HEX32(1UL << SETTINGS_FIELD_COLOR, update.fields);
+  TEST_ASSERT_EQUAL_HEX32(0x00ff00, update.values[SETTINGS_FIELD_COLOR]);
+}
+
+/**
+ * A message selecting a stored preset and changing some of its fields is published once, the renderer
+ * never sees the preset without the changes.
+ */
+void test_single_publication() {
+  SettingsStore settings;
+  led_preset_t stored = SettingsStore::defaultPreset();
+  stored.color = 0xff0000;
+  stored.palette = PALETTE_RAINBOW;
+  settings.publish(stored);
+  settings.savePreset(3, "stage");
+  settings.publish(SettingsStore::defaultPreset());
+  settings.savePreset(4, "default");
+  TEST_ASSERT_EQUAL(4, settings.getSelectedPreset());
+
+  beginMessage();
+  addRecord(SETTINGS_FIELD_BRIGHTNESS, 30);
+  addRecord(SETTINGS_FIELD_PRESET, 3);
+  addRecord(SETTINGS_FIELD_SECONDARY_COLOR, 0x00ff00);
+  settings_update_t update;
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_OK, decodeSettings(message, length, &update));
+  const uint32_t sequence = settings.getSequence();
+  led_preset_t preset;
+  TEST_ASSERT_EQUAL(3, applySettingsUpdate(&update, &settings, &preset));
+  TEST_ASSERT_EQUAL(sequence, settings.getSequence());
+  settings.publish(preset, 3);
+  TEST_ASSERT_EQUAL(sequence + 1, settings.getSequence());
+
+  const led_preset_t published = settings.getPreset();
+  TEST_ASSERT_EQUAL_HEX32(0xff0000, published.color);
+  TEST_ASSERT_EQUAL(PALETTE_RAINBOW, published.palette);
+  TEST_ASSERT_EQUAL(30, published.brightness);
+  TEST_ASSERT_EQUAL_HEX32(0x00ff00, published.secondary_color);
+  TEST_ASSERT_EQUAL_STRING("stage", published.name);
+  TEST_ASSERT_EQUAL(3, settings.getSelectedPreset());
+
+  // An empty slot leaves the current settings, modified by the other fields
+  beginMessage();
+  addRecord(SETTINGS_FIELD_PRESET, 5);
+  addRecord(SETTINGS_FIELD_COLOR, 0x0000ff);
+  TEST_ASSERT_EQUAL(SETTINGS_STATUS_OK, decodeSettings(message, length, &update));
+  TEST_ASSERT_EQUAL(-1, applySettingsUpdate(&update, &settings, &preset));
+  TEST_ASSERT_EQUAL_HEX32(0x0000ff, preset.color);
+  TEST_ASSERT_EQUAL(PALETTE_RAINBOW, preset.palette);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_refused_messages);
+  RUN_TEST(test_unknown_fields_skipped);
+  RUN_TEST(test_single_publication);
+  return UNITY_END();
+}
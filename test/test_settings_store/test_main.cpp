@@ -0,0 +1,145 @@
+/**
+ * Host test of the settings snapshots: readers never see a snapshot refilled under them while writers
+ * publish from other threads, a recycled snapshot is told apart by its sequence, and only the
+ * program changes of PRESET_PROGRAM_SOURCES select a preset.
+ *
+ * Run with: pio test -e native -f test_settings_store
+ */
+#include <unity.h>
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "FramePipeline.h"
+#include "SettingsStore.h"
+
+#define LED_COUNT 175
+#define READER_COUNT 3
+#define PUBLICATIONS 20000
+
+/// Functions definition ///
+
+static led_preset_t makePreset(uint32_t color) {
+  led_preset_t preset = SettingsStore::defaultPreset();
+  preset.color = color & 0xffffff;
+  return preset;
+}
+
+static midi_event_t makeProgramChange(uint8_t program) {
+  midi_event_t event;
+  memset(&event, 0, sizeof(event));
+  event.type = MIDI_EVENT_PROGRAM_CHANGE;
+  event.note = program;
+  return event;
+}
+
+void setUp() {
+
+}
+
+void tearDown() {
+
+}
+
+/**
+ * With a single color palette every note takes the color of the preset, a torn snapshot mixes two of them.
+ */
+void test_no_torn_reads() {
+  SettingsStore settings;
+  std::atomic<bool> stop{false};
+  std::atomic<uint32_t> torn{0};
+  std::atomic<uint32_t> reads{0};
+  std::thread readers[READER_COUNT];
+  for (std::thread& reader : readers) {
+    reader = std::thread([&]() {
+      while (!stop.load()) {
+        const led_settings_t* current = settings.acquire();
+        for (int note = 0; note < 128; note++) {
+          if (current->note_colors[note] == current->preset.color) continue;
+          torn++;
+          break;
+        }
+        settings.release(current);
+        reads++;
+      }
+    });
+  }
+  // Two writers, like the web server and a program change before they were both in loop()
+  std::thread writer([&]() {
+    for (uint32_t i = 0; i < PUBLICATIONS; i++) settings.publish(makePreset(i));
+  });
+  for (uint32_t i = 0; i < PUBLICATIONS; i++) settings.publish(makePreset(i * 7));
+  writer.join();
+  stop.store(true);
+  for (std::thread& reader : readers) reader.join();
+  TEST_ASSERT_GREATER_THAN(0, reads.load());
+  TEST_ASSERT_EQUAL(0, torn.load());
+  TEST_ASSERT_EQUAL(2 * PUBLICATIONS + 1, settings.getSequence());
+}
+
+/**
+ * After SETTINGS_SNAPSHOT_COUNT publications a snapshot comes back at the same address, with a new sequence.
+ */
+void test_recycled_snapshot_sequence() {
+  SettingsStore settings;
+  const led_settings_t* first = settings.acquire();
+  const uint32_t first_sequence = first->sequence;
+  settings.release(first);
+  const led_settings_t* recycled = NULL;
+  for (int i = 0; i < 2 * SETTINGS_SNAPSHOT_COUNT && recycled != first; i++) {
+    settings.publish(makePreset(i));
+    recycled = settings.acquire();
+    settings.release(recycled);
+  }
+  TEST_ASSERT_TRUE(recycled == first);
+  TEST_ASSERT_NOT_EQUAL(first_sequence, recycled->sequence);
+
+  // The renderer recomposes the frame for it
+  NoteRenderer renderer(LED_COUNT, &settings);
+  renderer.render();
+  TEST_ASSERT_FALSE(renderer.render());
+  for (int i = 0; i < SETTINGS_SNAPSHOT_COUNT; i++) settings.publish(makePreset(0x00ff00));
+  TEST_ASSERT_TRUE(renderer.render());
+  TEST_ASSERT_EQUAL_HEX32(0x00ff00, settings.getPreset().color);
+}
+
+/**
+ * A snapshot acquired is not refilled, the writers take the other ones.
+ */
+void test_acquired_snapshot_kept() {
+  SettingsStore settings;
+  settings.publish(makePreset(0xff0000));
+  const led_settings_t* held = settings.acquire();
+  for (int i = 0; i < 4 * SETTINGS_SNAPSHOT_COUNT; i++) settings.publish(makePreset(i));
+  TEST_ASSERT_EQUAL_HEX32(0xff0000, held->preset.color);
+  TEST_ASSERT_EQUAL_HEX32(0xff0000, held->note_colors[60]);
+  settings.release(held);
+}
+
+void test_program_change_sources() {
+  SettingsStore settings;
+  settings.publish(makePreset(0xff0000));
+  settings.savePreset(1, "red");
+  settings.publish(makePreset(0x0000ff));
+  settings.savePreset(2, "blue");
+  NoteRenderer renderer(LED_COUNT, &settings);
+  FramePipeline pipeline(&renderer);
+
+  // The program changes of a MIDI file choose its instruments
+  TEST_ASSERT_FALSE(pipeline.handleEvent(makeProgramChange(1), 0, NOTE_SOURCE_FILE));
+  TEST_ASSERT_EQUAL_HEX32(0x0000ff, settings.getPreset().color);
+  TEST_ASSERT_TRUE(pipeline.handleEvent(makeProgramChange(1), 0, NOTE_SOURCE_USB));
+  TEST_ASSERT_EQUAL_HEX32(0xff0000, settings.getPreset().color);
+  TEST_ASSERT_TRUE(pipeline.handleEvent(makeProgramChange(2), 0, NOTE_SOURCE_NETWORK));
+  TEST_ASSERT_EQUAL_HEX32(0x0000ff, settings.getPreset().color);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_no_torn_reads);
+  RUN_TEST(test_recycled_snapshot_sequence);
+  RUN_TEST(test_acquired_snapshot_kept);
+  RUN_TEST(test_program_change_sources);
+  return UNITY_END();
+}
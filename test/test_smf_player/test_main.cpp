@@ -0,0 +1,261 @@
+/**
+ * Host test of the Standard MIDI File parser: running status, tempo changes, the merge of the tracks
+ * of a type 1 file in time order, the tracks left out past SMF_MAX_TRACKS and SMPTE divisions.
+ *
+ * Run with: pio test -e native -f test_smf_player
+ */
+#include <unity.h>
+
+#include <cstring>
+
+#include "SmfPlayer.h"
+#include "midi_decoder.h"
+
+#define DIVISION 480 // Ticks per quarter note, 500 ms at the default tempo
+#define MAX_SMF_SIZE 1024
+
+/// Types ///
+
+typedef struct {
+  uint8_t data[MAX_SMF_SIZE];
+  size_t size;
+  size_t track_start;
+} smf_builder_t;
+
+/// Variables ///
+
+static smf_builder_t smf;
+
+/// Functions definition ///
+
+static void writeByte(uint8_t value) {
+  smf.data[smf.size++] = value;
+}
+
+static void writeBytes(const uint8_t* bytes, size_t length) {
+  memcpy(smf.data + smf.size, bytes, length);
+  smf.size += length;
+}
+
+static void writeVarLen(uint32_t value) {
+  uint8_t bytes[4];
+  int count = 0;
+  do {
+    bytes[count++] = value & 0x7f;
+    value >>= 7;
+  } while (value > 0);
+  while (count > 1) writeByte(bytes[--count] | 0x80);
+  writeByte(bytes[0]);
+}
+
+static void writeHeader(uint16_t format, uint16_t tracks) {
+  const uint8_t header[] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, (uint8_t)format, (uint8_t)(tracks >> 8), (uint8_t)tracks, DIVISION >> 8, DIVISION & 0xff };
+  smf.size = 0;
+  writeBytes(header, sizeof(header));
+}
+
+static void beginTrack() {
+  const uint8_t chunk[] = { 'M', 'T', 'r', 'k', 0, 0, 0, 0 };
+  writeBytes(chunk, sizeof(chunk));
+  smf.track_start = smf.size;
+}
+
+// The status byte of the event can be left out to use the running status
+static void writeEvent(uint32_t delta, const uint8_t* bytes, size_t length) {
+  writeVarLen(delta);
+  writeBytes(bytes, length);
+}
+
+static void writeTempo(uint32_t delta, uint32_t us_per_quarter) {
+  const uint8_t tempo[] = { 0xff, 0x51, 3, (uint8_t)(us_per_quarter >> 16), (uint8_t)(us_per_quarter >> 8), (uint8_t)us_per_quarter };
+  writeEvent(delta, tempo, sizeof(tempo));
+}
+
+static void endTrack() {
+  const uint8_t end_of_track[] = { 0xff, 0x2f, 0 };
+  writeEvent(0, end_of_track, sizeof(end_of_track));
+  const uint32_t length = smf.size - smf.track_start;
+  for (int i = 0; i < 4; i++) smf.data[smf.track_start - 1 - i] = length >> (8 * i);
+}
+
+static void assertEvent(SmfPlayer* player, uint32_t time_us, uint8_t type, uint8_t note) {
+  timed_midi_packet event;
+  TEST_ASSERT_TRUE(player->nextEvent(&event));
+  const midi_event_t decoded = decodeMidiPacket(event.packet);
+  TEST_ASSERT_EQUAL(time_us, event.time_us);
+  TEST_ASSERT_EQUAL(type, decoded.type);
+  TEST_ASSERT_EQUAL(note, decoded.note);
+}
+
+void setUp() {
+  memset(&smf, 0, sizeof(smf));
+}
+
+void tearDown() {
+
+}
+
+/**
+ * Data bytes without a status reuse the last one, a program change has a single data byte.
+ */
+void test_running_status() {
+  writeHeader(0, 1);
+  beginTrack();
+  const uint8_t note_on[] = { 0x90, 60, 100 };
+  const uint8_t running_note_on[] = { 64, 100 };
+  const uint8_t running_note_off[] = { 60, 0 };
+  const uint8_t program_change[] = { 0xc0, 5 };
+  const uint8_t running_program_change[] = { 6 };
+  const uint8_t note_off[] = { 0x80, 64, 0 };
+  writeEvent(0, note_on, sizeof(note_on));
+  writeEvent(DIVISION, running_note_on, sizeof(running_note_on));
+  writeEvent(DIVISION, running_note_off, sizeof(running_note_off));
+  writeEvent(0, program_change, sizeof(program_change));
+  writeEvent(DIVISION, running_program_change, sizeof(running_program_change));
+  writeEvent(0, note_off, sizeof(note_off));
+  endTrack();
+
+  SmfMemorySource source(smf.data, smf.size);
+  SmfPlayer player;
+  TEST_ASSERT_TRUE(player.open(&source));
+  TEST_ASSERT_EQUAL(1, player.getTrackCount());
+  assertEvent(&player, 0, MIDI_EVENT_NOTE_ON, 60);
+  assertEvent(&player, 500000, MIDI_EVENT_NOTE_ON, 64);
+  // A note on without velocity is a note off
+  assertEvent(&player, 1000000, MIDI_EVENT_NOTE_OFF, 60);
+  assertEvent(&player, 1000000, MIDI_EVENT_PROGRAM_CHANGE, 5);
+  assertEvent(&player, 1500000, MIDI_EVENT_PROGRAM_CHANGE, 6);
+  assertEvent(&player, 1500000, MIDI_EVENT_NOTE_OFF, 64);
+  timed_midi_packet event;
+  TEST_ASSERT_FALSE(player.nextEvent(&event));
+}
+
+/**
+ * Times after a tempo change are counted from the change, at the new tempo.
+ */
+void test_tempo_change() {
+  writeHeader(0, 1);
+  beginTrack();
+  const uint8_t note_on[] = { 0x90, 60, 100 };
+  const uint8_t note_off[] = { 0x80, 60, 0 };
+  writeEvent(DIVISION, note_on, sizeof(note_on));
+  // 60 bpm from the second quarter note, then 240 bpm from the fourth
+  writeTempo(0, 1000000);
+  writeEvent(DIVISION, note_off, sizeof(note_off));
+  writeTempo(DIVISION, 250000);
+  writeEvent(DIVISION, note_on, sizeof(note_on));
+  endTrack();
+
+  SmfMemorySource source(smf.data, smf.size);
+  SmfPlayer player;
+  TEST_ASSERT_TRUE(player.open(&source));
+  assertEvent(&player, 500000, MIDI_EVENT_NOTE_ON, 60);
+  assertEvent(&player, 1500000, MIDI_EVENT_NOTE_OFF, 60);
+  assertEvent(&player, 2750000, MIDI_EVENT_NOTE_ON, 60);
+  TEST_ASSERT_EQUAL(250000, player.getTempo());
+
+  // Rewinding starts again at the default tempo
+  player.rewind();
+  TEST_ASSERT_EQUAL(SMF_DEFAULT_TEMPO, player.getTempo());
+  assertEvent(&player, 500000, MIDI_EVENT_NOTE_ON, 60);
+}
+
+/**
+ * The tracks of a type 1 file are merged in time order, the conductor track first on a tie.
+ */
+void test_track_merge() {
+  writeHeader(1, 3);
+  // Conductor track, 60 bpm from the second quarter note
+  beginTrack();
+  writeTempo(DIVISION, 1000000);
+  endTrack();
+  beginTrack();
+  const uint8_t melody_on[] = { 0x90, 72, 100 };
+  const uint8_t melody_off[] = { 0x80, 72, 0 };
+  writeEvent(0, melody_on, sizeof(melody_on));
+  writeEvent(2 * DIVISION, melody_off, sizeof(melody_off));
+  endTrack();
+  beginTrack();
+  const uint8_t bass_on[] = { 0x91, 36, 100 };
+  const uint8_t bass_off[] = { 0x81, 36, 0 };
+  writeEvent(DIVISION, bass_on, sizeof(bass_on));
+  writeEvent(DIVISION / 2, bass_off, sizeof(bass_off));
+  endTrack();
+
+  SmfMemorySource source(smf.data, smf.size);
+  SmfPlayer player;
+  TEST_ASSERT_TRUE(player.open(&source));
+  TEST_ASSERT_EQUAL(3, player.getTrackCount());
+  TEST_ASSERT_EQUAL(0, player.getSkippedTrackCount());
+  assertEvent(&player, 0, MIDI_EVENT_NOTE_ON, 72);
+  // Same tick as the tempo change, played at the time of the change
+  assertEvent(&player, 500000, MIDI_EVENT_NOTE_ON, 36);
+  assertEvent(&player, 1000000, MIDI_EVENT_NOTE_OFF, 36);
+  assertEvent(&player, 1500000, MIDI_EVENT_NOTE_OFF, 72);
+  timed_midi_packet event;
+  TEST_ASSERT_FALSE(player.nextEvent(&event));
+}
+
+/**
+ * Tracks past SMF_MAX_TRACKS are not played but counted.
+ */
+void test_skipped_tracks() {
+  const uint16_t track_count = SMF_MAX_TRACKS + 2;
+  writeHeader(1, track_count);
+  for (uint16_t i = 0; i < track_count; i++) {
+    beginTrack();
+    const uint8_t note_on[] = { 0x90, (uint8_t)(40 + i), 100 };
+    writeEvent(i, note_on, sizeof(note_on));
+    endTrack();
+  }
+
+  SmfMemorySource source(smf.data, smf.size);
+  SmfPlayer player;
+  TEST_ASSERT_TRUE(player.open(&source));
+  TEST_ASSERT_EQUAL(SMF_MAX_TRACKS, player.getTrackCount());
+  TEST_ASSERT_EQUAL(2, player.getSkippedTrackCount());
+  size_t events = 0;
+  timed_midi_packet event;
+  while (player.nextEvent(&event)) events++;
+  TEST_ASSERT_EQUAL(SMF_MAX_TRACKS, events);
+
+  // Closing the file forgets them
+  player.close();
+  TEST_ASSERT_EQUAL(0, player.getSkippedTrackCount());
+}
+
+/**
+ * A SMPTE division needs frames per second and ticks per frame, without them the file is refused.
+ */
+void test_smpte_division() {
+  writeHeader(0, 1);
+  beginTrack();
+  const uint8_t note_on[] = { 0x90, 60, 100 };
+  writeEvent(50, note_on, sizeof(note_on));
+  endTrack();
+
+  // 25 frames of 40 ticks, a tick is 1 ms
+  smf.data[12] = 0xe7;
+  smf.data[13] = 40;
+  SmfMemorySource source(smf.data, smf.size);
+  SmfPlayer player;
+  TEST_ASSERT_TRUE(player.open(&source));
+  assertEvent(&player, 50000, MIDI_EVENT_NOTE_ON, 60);
+
+  const uint8_t invalid_divisions[][2] = { { 0xe7, 0x00 }, { 0xff, 0x00 }, { 0x80, 0x00 } };
+  for (const uint8_t* division : invalid_divisions) {
+    smf.data[12] = division[0];
+    smf.data[13] = division[1];
+    TEST_ASSERT_FALSE(player.open(&source));
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_running_status);
+  RUN_TEST(test_tempo_change);
+  RUN_TEST(test_track_merge);
+  RUN_TEST(test_skipped_tracks);
+  RUN_TEST(test_smpte_division);
+  return UNITY_END();
+}
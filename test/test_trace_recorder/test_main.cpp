@@ -0,0 +1,183 @@
+/**
+ * Host test of the trace export: nested spans of two threads through a ring that overflowed,
+ * exported as Chrome trace JSON with a track per thread and the begin and end events paired.
+ *
+ * Run with: pio test -e native -f test_trace_recorder
+ */
+#include <unity.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TraceRecorder.h"
+
+#define CAPACITY 64
+// Events of an iteration: loop begins, render begins and ends, loop ends
+#define ITERATION_EVENTS 4
+
+/// Types ///
+
+typedef struct {
+  std::string name;
+  std::string phase;
+  int pid;
+  int tid;
+  long long time_us;
+} exported_event_t;
+
+/// Variables ///
+
+static std::string trace;
+static int metadata_count = 0;
+static std::vector<exported_event_t> exported;
+
+/// Functions definition ///
+
+static void writeTrace(const char* data, size_t length, void* context) {
+  ((std::string*)context)->append(data, length);
+}
+
+static void recordIterations(TraceRecorder* recorder, int iterations) {
+  for (int i = 0; i < iterations; i++) {
+    recorder->begin(TRACE_SPAN_LOOP);
+    recorder->begin(TRACE_SPAN_RENDER);
+    recorder->end(TRACE_SPAN_RENDER);
+    recorder->end(TRACE_SPAN_LOOP);
+  }
+}
+
+// Text value of a field of a line, numbers included
+static std::string getField(const std::string& line, const char* key) {
+  const std::string pattern = std::string("\"") + key + "\":";
+  size_t start = line.find(pattern);
+  if (start == std::string::npos) return "";
+  start += pattern.size();
+  if (line[start] == '"') return line.substr(start + 1, line.find('"', start + 1) - start - 1);
+  return line.substr(start, line.find_first_of(",}", start) - start);
+}
+
+// One event per line, the metadata of the threads first
+static void exportTrace(TraceRecorder* recorder) {
+  trace.clear();
+  exported.clear();
+  metadata_count = 0;
+  const size_t length = recorder->exportChromeJson(&writeTrace, &trace);
+  TEST_ASSERT_EQUAL(trace.size(), length);
+  TEST_ASSERT_EQUAL(0, trace.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"));
+  TEST_ASSERT_EQUAL(trace.size() - 4, trace.rfind("\n]}\n"));
+
+  size_t start = trace.find('\n') + 1;
+  while (start < trace.size()) {
+    const size_t end = trace.find('\n', start);
+    const std::string line = trace.substr(start, end - start);
+    start = end + 1;
+    if (line.empty() || line[0] != '{') continue;
+    if (getField(line, "ph") == "M") {
+      metadata_count++;
+      continue;
+    }
+    exported_event_t event;
+    event.name = getField(line, "name");
+    event.phase = getField(line, "ph");
+    event.pid = atoi(getField(line, "pid").c_str());
+    event.tid = atoi(getField(line, "tid").c_str());
+    event.time_us = atoll(getField(line, "ts").c_str());
+    exported.push_back(event);
+  }
+}
+
+// Every end closes the last span begun on its thread, spans of the other thread in between
+static void checkPairing(int thread_count) {
+  std::vector<std::vector<std::string>> open(thread_count);
+  std::vector<long long> last_time(thread_count, 0);
+  for (const exported_event_t& event : exported) {
+    TEST_ASSERT_EQUAL(exported[0].pid, event.pid);
+    TEST_ASSERT_TRUE(event.tid >= 0 && event.tid < thread_count);
+    TEST_ASSERT_TRUE(event.time_us >= last_time[event.tid]);
+    last_time[event.tid] = event.time_us;
+    std::vector<std::string>& spans = open[event.tid];
+    if (event.phase == "B") {
+      spans.push_back(event.name);
+      continue;
+    }
+    TEST_ASSERT_EQUAL_STRING("E", event.phase.c_str());
+    TEST_ASSERT_FALSE(spans.empty());
+    TEST_ASSERT_EQUAL_STRING(spans.back().c_str(), event.name.c_str());
+    spans.pop_back();
+  }
+  for (int thread = 0; thread < thread_count; thread++) TEST_ASSERT_TRUE(open[thread].empty());
+}
+
+void setUp() {
+
+}
+
+void tearDown() {
+
+}
+
+/**
+ * The first thread records 10 iterations, this thread an end without begin, the second thread 10 iterations:
+ * 81 events in a ring of 64. The 17 oldest are overwritten, the ring starts on the render begin of the fifth
+ * iteration of the first thread: its loop end has lost its begin and is dropped from the export, like the
+ * end of this thread.
+ */
+void test_overflowed_ring_export() {
+  TraceRecorder recorder(CAPACITY);
+  std::thread first(recordIterations, &recorder, 10);
+  first.join();
+  recorder.end(TRACE_SPAN_LOOP);
+  std::thread second(recordIterations, &recorder, 10);
+  second.join();
+  TEST_ASSERT_EQUAL(81 - CAPACITY, recorder.getOverwrittenCount());
+  TEST_ASSERT_EQUAL(CAPACITY, recorder.getEventCount());
+
+  exportTrace(&recorder);
+  TEST_ASSERT_TRUE(recorder.isRecording());
+  TEST_ASSERT_EQUAL(3, metadata_count);
+  TEST_ASSERT_NOT_EQUAL(std::string::npos, trace.find("\"tid\":0,\"args\":{\"name\":\"thread 0\"}"));
+  TEST_ASSERT_EQUAL(CAPACITY - 2, exported.size());
+  int events_per_thread[3] = { 0, 0, 0 };
+  for (const exported_event_t& event : exported) events_per_thread[event.tid]++;
+  TEST_ASSERT_EQUAL(10 * ITERATION_EVENTS - 17 - 1, events_per_thread[0]);
+  TEST_ASSERT_EQUAL(0, events_per_thread[1]);
+  TEST_ASSERT_EQUAL(10 * ITERATION_EVENTS, events_per_thread[2]);
+  TEST_ASSERT_EQUAL_STRING("render", exported[0].name.c_str());
+  TEST_ASSERT_EQUAL_STRING("B", exported[0].phase.c_str());
+  checkPairing(3);
+
+  // A cleared trace only has the thread names
+  recorder.clear();
+  TEST_ASSERT_EQUAL(0, recorder.getOverwrittenCount());
+  exportTrace(&recorder);
+  TEST_ASSERT_EQUAL(0, exported.size());
+}
+
+/**
+ * Both threads record at once, the ring wraps many times: each track still pairs its spans.
+ */
+void test_concurrent_threads() {
+  TraceRecorder recorder(CAPACITY);
+  std::thread first(recordIterations, &recorder, 1000);
+  std::thread second(recordIterations, &recorder, 1000);
+  first.join();
+  second.join();
+  TEST_ASSERT_EQUAL(2 * 1000 * ITERATION_EVENTS - CAPACITY, recorder.getOverwrittenCount());
+
+  exportTrace(&recorder);
+  TEST_ASSERT_EQUAL(2, metadata_count);
+  // Only ends whose begin was overwritten are dropped, at most the two of an iteration per thread
+  TEST_ASSERT_TRUE(exported.size() >= CAPACITY - 4);
+  TEST_ASSERT_TRUE(exported.size() <= CAPACITY);
+  checkPairing(2);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_overflowed_ring_export);
+  RUN_TEST(test_concurrent_threads);
+  return UNITY_END();
+}
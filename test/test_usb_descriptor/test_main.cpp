@@ -0,0 +1,218 @@
+/**
+ * Host test of the USB MIDI descriptor parser: a keyboard, a multi cable interface, broken descriptors
+ * and the interfaces, endpoints and jacks past the limits.
+ * Also measures the worst case, a 64 KB descriptor of 2 bytes descriptors, to bound the enumeration time.
+ *
+ * Run with: pio test -e native -f test_usb_descriptor
+ * The fuzz harness is in test/fuzz_usb_descriptor.
+ */
+#include <unity.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "UsbMidiDescriptor.h"
+
+#define MIN_MEASURE_NS 100000000LL
+// Parsing the largest possible descriptor must stay far below the enumeration of a device
+#define MAX_WORST_CASE_NS 2000000
+
+/// Variables ///
+
+// Keyboard of the USB MIDI 1.0 specification, appendix B: audio control interface,
+// MIDI streaming interface with 2 jacks each way, bulk OUT then bulk IN endpoints of 9 bytes
+static const uint8_t keyboard_descriptor[] = {
+  0x09, 0x02, 0x65, 0x00, 0x02, 0x01, 0x00, 0x80, 0x32,
+  0x09, 0x04, 0x00, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00,
+  0x09, 0x24, 0x01, 0x00, 0x01, 0x09, 0x00, 0x01, 0x01,
+  0x09, 0x04, 0x01, 0x00, 0x02, 0x01, 0x03, 0x00, 0x00,
+  0x07, 0x24, 0x01, 0x00, 0x01, 0x41, 0x00,
+  0x06, 0x24, 0x02, 0x01, 0x01, 0x00,
+  0x06, 0x24, 0x02, 0x02, 0x02, 0x00,
+  0x09, 0x24, 0x03, 0x01, 0x03, 0x01, 0x02, 0x01, 0x00,
+  0x09, 0x24, 0x03, 0x02, 0x04, 0x01, 0x01, 0x01, 0x00,
+  0x09, 0x05, 0x01, 0x02, 0x40, 0x00, 0x00, 0x00, 0x00,
+  0x05, 0x25, 0x01, 0x01, 0x01,
+  0x09, 0x05, 0x81, 0x02, 0x40, 0x00, 0x00, 0x00, 0x00,
+  0x05, 0x25, 0x01, 0x01, 0x03,
+};
+
+// MIDI streaming interface alone, 7 bytes endpoints, 3 cables on the IN endpoint
+static const uint8_t multi_cable_descriptor[] = {
+  0x09, 0x02, 0x2c, 0x00, 0x01, 0x01, 0x00, 0x80, 0x32,
+  0x09, 0x04, 0x02, 0x01, 0x02, 0x01, 0x03, 0x00, 0x00,
+  0x07, 0x05, 0x02, 0x02, 0x00, 0x02, 0x00,
+  0x05, 0x25, 0x01, 0x01, 0x10,
+  0x07, 0x05, 0x83, 0x02, 0x00, 0x02, 0x00,
+  0x07, 0x25, 0x01, 0x03, 0x11, 0x12, 0x13,
+};
+
+static volatile uint32_t sink;
+
+/// Functions definition ///
+
+static int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_keyboard() {
+  usb_midi_topology_t topology;
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_OK, parseUsbMidiTopology(keyboard_descriptor, sizeof(keyboard_descriptor), &topology));
+  TEST_ASSERT_EQUAL(1, topology.interface_count);
+  TEST_ASSERT_EQUAL(1, topology.interfaces[0].number);
+  TEST_ASSERT_EQUAL(1, topology.in_endpoint_count);
+  TEST_ASSERT_EQUAL(0x81, topology.in_endpoints[0].address);
+  TEST_ASSERT_EQUAL(64, topology.in_endpoints[0].max_packet_size);
+  TEST_ASSERT_EQUAL(1, topology.out_endpoint_count);
+  TEST_ASSERT_EQUAL(0x01, topology.out_endpoints[0].address);
+  TEST_ASSERT_EQUAL(4, topology.jack_count);
+  TEST_ASSERT_TRUE(topology.jacks[0].input && topology.jacks[0].embedded);
+  TEST_ASSERT_FALSE(topology.jacks[3].input || topology.jacks[3].embedded);
+  TEST_ASSERT_EQUAL(1, topology.cable_count);
+}
+
+void test_multi_cable() {
+  usb_midi_topology_t topology;
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_OK, parseUsbMidiTopology(multi_cable_descriptor, sizeof(multi_cable_descriptor), &topology));
+  TEST_ASSERT_EQUAL(2, topology.interfaces[0].number);
+  TEST_ASSERT_EQUAL(1, topology.interfaces[0].alternate_setting);
+  TEST_ASSERT_EQUAL(512, topology.in_endpoints[0].max_packet_size);
+  TEST_ASSERT_EQUAL(3, topology.in_endpoints[0].cable_count);
+  TEST_ASSERT_EQUAL(1, topology.out_endpoints[0].cable_count);
+  TEST_ASSERT_EQUAL(3, topology.cable_count);
+}
+
+/**
+ * A descriptor of length 0 used to loop forever.
+ */
+void test_zero_length() {
+  uint8_t descriptor[sizeof(keyboard_descriptor)];
+  memcpy(descriptor, keyboard_descriptor, sizeof(descriptor));
+  descriptor[18] = 0;
+  usb_midi_topology_t topology;
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_INVALID_LENGTH, parseUsbMidiTopology(descriptor, sizeof(descriptor), &topology));
+  TEST_ASSERT_EQUAL(0, topology.in_endpoint_count);
+  descriptor[18] = 1;
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_INVALID_LENGTH, parseUsbMidiTopology(descriptor, sizeof(descriptor), &topology));
+}
+
+void test_truncated() {
+  usb_midi_topology_t topology;
+  // wTotalLength is not trusted past the buffer
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_INVALID_LENGTH, parseUsbMidiTopology(keyboard_descriptor, sizeof(keyboard_descriptor) - 3, &topology));
+  // The endpoints found before the broken descriptor are kept
+  TEST_ASSERT_EQUAL(1, topology.in_endpoint_count);
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_INVALID_HEADER, parseUsbMidiTopology(keyboard_descriptor, 4, &topology));
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_INVALID_HEADER, parseUsbMidiTopology(keyboard_descriptor + 9, 20, &topology));
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_INVALID_HEADER, parseUsbMidiTopology(NULL, 0, &topology));
+}
+
+void test_no_midi() {
+  usb_midi_topology_t topology;
+  // Configuration and audio control interface only
+  uint8_t descriptor[27];
+  memcpy(descriptor, keyboard_descriptor, sizeof(descriptor));
+  descriptor[2] = sizeof(descriptor);
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_NO_MIDI, parseUsbMidiTopology(descriptor, sizeof(descriptor), &topology));
+  // Interrupt endpoints are not MIDI streaming endpoints
+  uint8_t interrupt_descriptor[sizeof(multi_cable_descriptor)];
+  memcpy(interrupt_descriptor, multi_cable_descriptor, sizeof(interrupt_descriptor));
+  interrupt_descriptor[33] = 0x03;
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_NO_MIDI, parseUsbMidiTopology(interrupt_descriptor, sizeof(interrupt_descriptor), &topology));
+}
+
+/**
+ * 5 MIDI interfaces of 2 IN endpoints, the first one with 34 jacks: what is past the limits is counted.
+ * The endpoints of the fifth interface are not, the interface itself is.
+ */
+void test_dropped_past_limits() {
+  static uint8_t descriptor[512];
+  memcpy(descriptor, multi_cable_descriptor, 9);
+  size_t length = 9;
+  for (uint8_t interface = 0; interface < USB_MIDI_MAX_INTERFACES + 1; interface++) {
+    const uint8_t interface_descriptor[] = { 0x09, 0x04, interface, 0x00, 0x02, 0x01, 0x03, 0x00, 0x00 };
+    memcpy(descriptor + length, interface_descriptor, sizeof(interface_descriptor));
+    length += sizeof(interface_descriptor);
+    for (uint8_t jack = 0; interface == 0 && jack < USB_MIDI_MAX_JACKS + 2; jack++) {
+      const uint8_t jack_descriptor[] = { 0x06, 0x24, 0x02, 0x01, (uint8_t)(jack + 1), 0x00 };
+      memcpy(descriptor + length, jack_descriptor, sizeof(jack_descriptor));
+      length += sizeof(jack_descriptor);
+    }
+    for (uint8_t endpoint = 0; endpoint < 2; endpoint++) {
+      const uint8_t endpoint_descriptor[] = { 0x07, 0x05, (uint8_t)(0x81 + endpoint), 0x02, 0x40, 0x00, 0x00 };
+      memcpy(descriptor + length, endpoint_descriptor, sizeof(endpoint_descriptor));
+      length += sizeof(endpoint_descriptor);
+    }
+  }
+  descriptor[2] = length & 0xff;
+  descriptor[3] = length >> 8;
+
+  usb_midi_topology_t topology;
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_OK, parseUsbMidiTopology(descriptor, length, &topology));
+  TEST_ASSERT_EQUAL(USB_MIDI_MAX_INTERFACES, topology.interface_count);
+  TEST_ASSERT_EQUAL(USB_MIDI_MAX_ENDPOINTS, topology.in_endpoint_count);
+  TEST_ASSERT_EQUAL(USB_MIDI_MAX_JACKS, topology.jack_count);
+  TEST_ASSERT_EQUAL(1 + (2 * USB_MIDI_MAX_INTERFACES - USB_MIDI_MAX_ENDPOINTS) + 2, topology.dropped_count);
+
+  TEST_ASSERT_EQUAL(USB_DESCRIPTOR_OK, parseUsbMidiTopology(keyboard_descriptor, sizeof(keyboard_descriptor), &topology));
+  TEST_ASSERT_EQUAL(0, topology.dropped_count);
+}
+
+/**
+ * The most descriptors a configuration can hold: wTotalLength is 16 bits and a descriptor takes at least 2 bytes.
+ */
+void test_worst_case() {
+  static uint8_t descriptor[65535];
+  memset(descriptor, 0, sizeof(descriptor));
+  memcpy(descriptor, multi_cable_descriptor, 18);
+  descriptor[2] = 0xff;
+  descriptor[3] = 0xff;
+  for (size_t offset = 18; offset + 2 <= sizeof(descriptor); offset += 2) {
+    descriptor[offset] = 2;
+    descriptor[offset + 1] = 0x24;
+  }
+  usb_midi_topology_t topology;
+  int64_t elapsed = 0;
+  size_t runs = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    const int64_t start = nowNs();
+    parseUsbMidiTopology(descriptor, sizeof(descriptor), &topology);
+    elapsed += nowNs() - start;
+    runs++;
+    sink = topology.descriptor_count;
+  }
+  const double worst_ns = (double)elapsed / runs;
+  printf("worst case: %d descriptors in %.0f ns\n", topology.descriptor_count, worst_ns);
+  TEST_ASSERT_EQUAL(32760, topology.descriptor_count);
+  TEST_ASSERT_LESS_THAN(MAX_WORST_CASE_NS, worst_ns);
+
+  elapsed = 0;
+  runs = 0;
+  while (elapsed < MIN_MEASURE_NS) {
+    const int64_t start = nowNs();
+    for (int i = 0; i < 1000; i++) parseUsbMidiTopology(keyboard_descriptor, sizeof(keyboard_descriptor), &topology);
+    elapsed += nowNs() - start;
+    runs += 1000;
+    sink = topology.jack_count;
+  }
+  printf("keyboard: %.1f ns\n", (double)elapsed / runs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_keyboard);
+  RUN_TEST(test_multi_cable);
+  RUN_TEST(test_zero_length);
+  RUN_TEST(test_truncated);
+  RUN_TEST(test_no_midi);
+  RUN_TEST(test_dropped_past_limits);
+  RUN_TEST(test_worst_case);
+  return UNITY_END();
+}
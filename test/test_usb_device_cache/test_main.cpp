@@ -0,0 +1,143 @@
+/**
+ * Host test of the cache of USB device profiles: the blob saved in NVS loads back the same profiles,
+ * a blob of another version leaves the cache empty, and the least recently used device is forgotten first.
+ *
+ * Run with: pio test -e native -f test_usb_device_cache
+ */
+#include <unity.h>
+
+#include <cstring>
+
+#include "UsbDeviceCache.h"
+
+#define VENDOR_ID 0x0582
+
+/// Functions definition ///
+
+static usb_device_profile_t makeProfile(uint16_t product_id, uint32_t serial_hash) {
+  usb_device_profile_t profile;
+  memset(&profile, 0, sizeof(profile));
+  profile.vendor_id = VENDOR_ID;
+  profile.product_id = product_id;
+  profile.serial_hash = serial_hash;
+  profile.configuration = 1;
+  profile.interface_number = 1 + product_id % 3;
+  profile.in_endpoint = 0x81 + product_id % 4;
+  profile.in_max_packet_size = 64;
+  profile.out_endpoint = product_id % 2 ? 0x02 : 0;
+  profile.out_max_packet_size = product_id % 2 ? 64 : 0;
+  return profile;
+}
+
+static bool isCached(UsbDeviceCache* cache, uint16_t product_id) {
+  return cache->find(VENDOR_ID, product_id, 0) != NULL;
+}
+
+void setUp() {
+
+}
+
+void tearDown() {
+
+}
+
+void test_save_load_round_trip() {
+  const uint8_t serial[] = { 'A', 0, 'B', 0, '1', 0 };
+  const uint32_t serial_hash = UsbDeviceCache::hashSerial(serial, sizeof(serial));
+  TEST_ASSERT_NOT_EQUAL(0, serial_hash);
+  UsbDeviceCache cache;
+  cache.store(makeProfile(1, 0));
+  cache.store(makeProfile(2, serial_hash));
+  cache.store(makeProfile(3, 0));
+
+  uint8_t data[USB_DEVICE_CACHE_DATA_SIZE];
+  const size_t length = cache.save(data, sizeof(data));
+  TEST_ASSERT_EQUAL(2 + 3 * sizeof(usb_device_profile_t), length);
+  // Too small a buffer is left alone
+  TEST_ASSERT_EQUAL(0, cache.save(data, length - 1));
+
+  UsbDeviceCache loaded;
+  TEST_ASSERT_TRUE(loaded.load(data, length));
+  TEST_ASSERT_EQUAL(3, loaded.getCount());
+  for (uint16_t product_id = 1; product_id <= 3; product_id++) {
+    const usb_device_profile_t expected = makeProfile(product_id, product_id == 2 ? serial_hash : 0);
+    const usb_device_profile_t* profile = loaded.find(VENDOR_ID, product_id, expected.serial_hash);
+    TEST_ASSERT_NOT_NULL(profile);
+    TEST_ASSERT_EQUAL(expected.interface_number, profile->interface_number);
+    TEST_ASSERT_EQUAL_HEX8(expected.in_endpoint, profile->in_endpoint);
+    TEST_ASSERT_EQUAL(expected.in_max_packet_size, profile->in_max_packet_size);
+    TEST_ASSERT_EQUAL_HEX8(expected.out_endpoint, profile->out_endpoint);
+    TEST_ASSERT_EQUAL(expected.out_max_packet_size, profile->out_max_packet_size);
+  }
+  // The same keyboard with another serial number is another device
+  TEST_ASSERT_NULL(loaded.find(VENDOR_ID, 2, 0));
+}
+
+void test_version_mismatch() {
+  UsbDeviceCache cache;
+  cache.store(makeProfile(1, 0));
+  uint8_t data[USB_DEVICE_CACHE_DATA_SIZE];
+  const size_t length = cache.save(data, sizeof(data));
+  TEST_ASSERT_GREATER_THAN(0, length);
+
+  UsbDeviceCache loaded;
+  loaded.store(makeProfile(5, 0));
+  data[0] = USB_DEVICE_CACHE_VERSION + 1;
+  TEST_ASSERT_FALSE(loaded.load(data, length));
+  TEST_ASSERT_EQUAL(0, loaded.getCount());
+  TEST_ASSERT_FALSE(isCached(&loaded, 1));
+  TEST_ASSERT_FALSE(isCached(&loaded, 5));
+
+  // A blob cut short is refused the same way
+  data[0] = USB_DEVICE_CACHE_VERSION;
+  TEST_ASSERT_FALSE(loaded.load(data, length - 1));
+  TEST_ASSERT_EQUAL(0, loaded.getCount());
+}
+
+/**
+ * A keyboard found again is the most recent one, the next device replaces the oldest of the others.
+ */
+void test_least_recently_used_eviction() {
+  UsbDeviceCache cache;
+  for (uint16_t product_id = 1; product_id <= USB_DEVICE_CACHE_SIZE; product_id++) cache.store(makeProfile(product_id, 0));
+  TEST_ASSERT_EQUAL(USB_DEVICE_CACHE_SIZE, cache.getCount());
+  TEST_ASSERT_TRUE(isCached(&cache, 1));
+  // Storing a known device again updates it in place
+  cache.store(makeProfile(2, 0));
+  TEST_ASSERT_EQUAL(USB_DEVICE_CACHE_SIZE, cache.getCount());
+
+  cache.store(makeProfile(100, 0));
+  TEST_ASSERT_EQUAL(USB_DEVICE_CACHE_SIZE, cache.getCount());
+  TEST_ASSERT_FALSE(isCached(&cache, 3));
+  TEST_ASSERT_TRUE(isCached(&cache, 1));
+  TEST_ASSERT_TRUE(isCached(&cache, 2));
+  TEST_ASSERT_TRUE(isCached(&cache, 100));
+
+  // The order is kept through NVS
+  uint8_t data[USB_DEVICE_CACHE_DATA_SIZE];
+  UsbDeviceCache loaded;
+  TEST_ASSERT_TRUE(loaded.load(data, cache.save(data, sizeof(data))));
+  loaded.store(makeProfile(101, 0));
+  TEST_ASSERT_FALSE(isCached(&loaded, 4));
+  TEST_ASSERT_TRUE(isCached(&loaded, 5));
+  TEST_ASSERT_TRUE(isCached(&loaded, 101));
+}
+
+void test_remove() {
+  UsbDeviceCache cache;
+  for (uint16_t product_id = 1; product_id <= 3; product_id++) cache.store(makeProfile(product_id, 0));
+  cache.remove(VENDOR_ID, 1, 0);
+  TEST_ASSERT_EQUAL(2, cache.getCount());
+  TEST_ASSERT_FALSE(isCached(&cache, 1));
+  TEST_ASSERT_TRUE(isCached(&cache, 2));
+  TEST_ASSERT_TRUE(isCached(&cache, 3));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_save_load_round_trip);
+  RUN_TEST(test_version_mismatch);
+  RUN_TEST(test_least_recently_used_eviction);
+  RUN_TEST(test_remove);
+  return UNITY_END();
+}